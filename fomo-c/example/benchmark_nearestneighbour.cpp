@@ -0,0 +1,136 @@
+#include "FoMo.h"
+#include "FoMo-internal.h"
+#include <iostream>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <boost/geometry.hpp>
+#include <boost/geometry/geometries/point.hpp>
+#include <boost/geometry/geometries/box.hpp>
+#include <boost/geometry/index/rtree.hpp>
+
+// This compares the spatial indexes of the NearestNeighbour rendermethod (see FoMoObject.setspatialindex()) on random
+// points in the unit cube: the time to build the index, and the time of the queries of the nearest point in a box,
+// as done for every sample along the rays.
+// Usage: benchmark_nearestneighbour [npoints] [nqueries]
+
+namespace bg = boost::geometry;
+namespace bgi = boost::geometry::index;
+typedef bg::model::point<float, 3, bg::cs::cartesian> point;
+typedef bg::model::box<point> box;
+typedef std::pair<point, unsigned> value;
+typedef bgi::rtree< value, bgi::quadratic<16> > rtree;
+
+using namespace std;
+
+double secondssince(const chrono::steady_clock::time_point start)
+{
+	return chrono::duration<double>(chrono::steady_clock::now()-start).count();
+}
+
+int main(int argc, char* argv[])
+{
+	long npoints=(argc > 1) ? atol(argv[1]) : 1000000;
+	long nqueries=(argc > 2) ? atol(argv[2]) : 1000000;
+	// the box is as large as in the renderings: a few times the distance between the points
+	float maxdistance=3./cbrt(double(npoints));
+
+	cout << "Generating " << npoints << " random points and " << nqueries << " queries." << endl;
+	vector<float> x(npoints), y(npoints), z(npoints), qx(nqueries), qy(nqueries), qz(nqueries);
+	mt19937 generator(42);
+	uniform_real_distribution<float> uniform(0.,1.);
+	for (long i=0; i<npoints; i++)
+	{
+		x[i]=uniform(generator);
+		y[i]=uniform(generator);
+		z[i]=uniform(generator);
+	}
+	for (long i=0; i<nqueries; i++)
+	{
+		qx[i]=uniform(generator);
+		qy[i]=uniform(generator);
+		qz[i]=uniform(generator);
+	}
+
+	// the R-tree, as in the NearestNeighbour rendermethod
+	chrono::steady_clock::time_point start=chrono::steady_clock::now();
+	rtree tree;
+	{
+		vector<value> input_values(npoints);
+		for (long i=0; i<npoints; i++) input_values[i]=make_pair(point(x[i],y[i],z[i]),unsigned(i));
+		tree=rtree(input_values.begin(),input_values.end());
+	}
+	double rtreebuild=secondssince(start);
+	vector<int> rtreeresult(nqueries);
+	start=chrono::steady_clock::now();
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+	{
+		vector<value> returned_values;
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic,1024)
+#endif
+		for (long i=0; i<nqueries; i++)
+		{
+			returned_values.clear();
+			box maxdistancebox(point(qx[i]-maxdistance,qy[i]-maxdistance,qz[i]-maxdistance),point(qx[i]+maxdistance,qy[i]+maxdistance,qz[i]+maxdistance));
+			tree.query(bgi::nearest(point(qx[i],qy[i],qz[i]),1) && bgi::within(maxdistancebox),back_inserter(returned_values));
+			rtreeresult[i]=returned_values.empty() ? -1 : returned_values[0].second;
+		}
+	}
+	double rtreequery=secondssince(start);
+
+	// the kd-tree
+	start=chrono::steady_clock::now();
+	FoMo::KDTree kdtree(x,y,z);
+	double kdtreebuild=secondssince(start);
+	vector<int> kdtreeresult(nqueries);
+	start=chrono::steady_clock::now();
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,1024)
+#endif
+	for (long i=0; i<nqueries; i++) kdtreeresult[i]=kdtree.nearest(qx[i],qy[i],qz[i],maxdistance);
+	double kdtreequery=secondssince(start);
+
+	// the uniform grid
+	start=chrono::steady_clock::now();
+	FoMo::UniformGrid grid(x,y,z);
+	double gridbuild=secondssince(start);
+	vector<int> gridresult(nqueries);
+	start=chrono::steady_clock::now();
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,1024)
+#endif
+	for (long i=0; i<nqueries; i++) gridresult[i]=grid.nearest(qx[i],qy[i],qz[i],maxdistance);
+	double gridquery=secondssince(start);
+
+	// the voxel table, with at most 1GB
+	start=chrono::steady_clock::now();
+	FoMo::VoxelTable voxels(x,y,z,1e9);
+	double voxelbuild=secondssince(start);
+	vector<int> voxelresult(nqueries);
+	start=chrono::steady_clock::now();
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,1024)
+#endif
+	for (long i=0; i<nqueries; i++) voxelresult[i]=voxels.nearest(qx[i],qy[i],qz[i],maxdistance);
+	double voxelquery=secondssince(start);
+
+	long ndifferent=0, nvoxeldifferent=0;
+	for (long i=0; i<nqueries; i++)
+	{
+		if (rtreeresult[i] != kdtreeresult[i] || rtreeresult[i] != gridresult[i]) ndifferent++;
+		if (rtreeresult[i] != voxelresult[i]) nvoxeldifferent++;
+	}
+
+	cout << "index    build (s)   queries (s)   queries/s" << endl;
+	cout << "rtree    " << rtreebuild << "   " << rtreequery << "   " << nqueries/rtreequery << endl;
+	cout << "kdtree   " << kdtreebuild << "   " << kdtreequery << "   " << nqueries/kdtreequery << endl;
+	cout << "grid     " << gridbuild << "   " << gridquery << "   " << nqueries/gridquery << endl;
+	cout << "voxel    " << voxelbuild << "   " << voxelquery << "   " << nqueries/voxelquery << endl;
+	cout << "The nearest points of the exact indexes differ for " << ndifferent << " of " << nqueries << " queries." << endl;
+	cout << "The voxel table (" << voxels.readnvoxels() << " voxels) gives another point for " << nvoxeldifferent << " queries." << endl;
+	return 0;
+}
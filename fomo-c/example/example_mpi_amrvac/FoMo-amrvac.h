@@ -4,8 +4,9 @@
 #include <vector>
 
 // definitions from read_amrvac_files.cpp
+// with velocities=false, only the density and temperature are loaded (enough for imaging renderings)
 void read_amrvac_par_file(const char* amrvacpar, const int ndim, std::vector<int> &nxlone, std::vector<double> &xprobmin, std::vector<double> &xprobmax);
-FoMo::FoMoObject read_amrvac_dat_file(const char* datfile, const char* amrvacpar, std::string amrvac_version, const int gamma_eqparposition, const double n_unit, const double Teunit, const double L_unit);
+FoMo::FoMoObject read_amrvac_dat_file(const char* datfile, const char* amrvacpar, std::string amrvac_version, const int gamma_eqparposition, const double n_unit, const double Teunit, const double L_unit, const bool velocities=true);
 
 // definitions for Morton curves
 // implementations copied from http://www.forceflow.be/2013/10/07/morton-encodingdecoding-through-bit-interleaving-implementations/
@@ -235,7 +235,7 @@ std::vector<std::vector<int>> build_block_info_morton(std::vector<int> nblocks,
 	return block_info;
 }
 
-FoMo::FoMoObject fomo_from_amrvac(const int ndim,const int nleafs,const int nglev1,const int nw, std::vector<double> xprobmin, std::vector<int> nx, std::vector<double> cellsize, std::vector<std::vector<int>> block_info, std::vector<std::vector<double>> leafs, const double n_unit, const double Teunit, const double L_unit, const double gamma)
+FoMo::FoMoObject fomo_from_amrvac(const int ndim,const int nleafs,const int nglev1,const int nw, std::vector<double> xprobmin, std::vector<int> nx, std::vector<double> cellsize, std::vector<std::vector<int>> block_info, std::vector<std::vector<double>> leafs, const double n_unit, const double Teunit, const double L_unit, const double gamma, const bool velocities)
 {
 	// could take a vector of necessary variables for data into fomo (from varnames in read_amrvac_new_dat_file, or fixed in read_amrvac_old_dat_file)
 
@@ -284,6 +284,12 @@ FoMo::FoMoObject fomo_from_amrvac(const int ndim,const int nleafs,const int ngle
 			// then T = p/rho*Teunit
 			variables.push_back(p/leafs.at(i).at(0+k*nw));
 			variables.at(1)*=Teunit;
+			// the velocities are only needed for spectroscopic renderings
+			if (!velocities)
+			{
+				Object.push_back_datapoint(coordinates, variables);
+				continue;
+			}
 			// vx = m1/rho
 			variables.push_back(leafs.at(i).at(1+k*nw)/leafs.at(i).at(0+k*nw));
 			variables.at(2)*=V_unit;
@@ -302,7 +308,7 @@ FoMo::FoMoObject fomo_from_amrvac(const int ndim,const int nleafs,const int ngle
 	return Object;
 }
 
-FoMo::FoMoObject read_amrvac_old_dat_file(const char* datfile, const char* amrvacpar, string amrvac_version, const int gamma_eqparposition, const double n_unit, const double Teunit, const double L_unit)
+FoMo::FoMoObject read_amrvac_old_dat_file(const char* datfile, const char* amrvacpar, string amrvac_version, const int gamma_eqparposition, const double n_unit, const double Teunit, const double L_unit, const bool velocities)
 {
 	FoMo::FoMoObject Object;
 
@@ -403,7 +409,7 @@ FoMo::FoMoObject read_amrvac_old_dat_file(const char* datfile, const char* amrva
 		}
 
 		// Initialize the FoMo object, and load AMRVAC data into it
-		Object=fomo_from_amrvac(ndim,nleafs,nglev1,nw,xprobmin,nx,cellsize,block_info,leafs,n_unit,Teunit,L_unit,gamma);
+		Object=fomo_from_amrvac(ndim,nleafs,nglev1,nw,xprobmin,nx,cellsize,block_info,leafs,n_unit,Teunit,L_unit,gamma,velocities);
 	}
 	else
 	{
@@ -428,7 +434,7 @@ int read_dat_version(const char* datfile)
 	return version_number;
 }
 
-FoMo::FoMoObject read_amrvac_new_dat_file(const char* datfile, int version_number, const double n_unit, const double Teunit, const double L_unit)
+FoMo::FoMoObject read_amrvac_new_dat_file(const char* datfile, int version_number, const double n_unit, const double Teunit, const double L_unit, const bool velocities)
 {
 	// Initialize the FoMo object
 	FoMo::FoMoObject Object;
@@ -550,7 +556,7 @@ FoMo::FoMoObject read_amrvac_new_dat_file(const char* datfile, int version_numbe
 		std::vector<std::vector<int>> block_info=build_block_info_morton(nblocks,forest,ndim,nleafs);
 
 		// Initialize the FoMo object, and load AMRVAC data into it
-		Object=fomo_from_amrvac(ndim,nleafs,nglev1,nw,xprobmin,nx,cellsize,block_info,leafs,n_unit,Teunit,L_unit,gamma);
+		Object=fomo_from_amrvac(ndim,nleafs,nglev1,nw,xprobmin,nx,cellsize,block_info,leafs,n_unit,Teunit,L_unit,gamma,velocities);
 	}
 	else
 	{
@@ -564,7 +570,7 @@ FoMo::FoMoObject read_amrvac_new_dat_file(const char* datfile, int version_numbe
 // Added by Vaibhav Pant for AMRVAC 2 dat files (version 4)
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-FoMo::FoMoObject read_amrvac_dat_file_v4(const char* datfile, int version_number, const double n_unit, const double Teunit, const double L_unit)
+FoMo::FoMoObject read_amrvac_dat_file_v4(const char* datfile, int version_number, const double n_unit, const double Teunit, const double L_unit, const bool velocities)
 {
 	// Initialize the FoMo object
 	FoMo::FoMoObject Object;
@@ -715,7 +721,7 @@ FoMo::FoMoObject read_amrvac_dat_file_v4(const char* datfile, int version_number
 		std::vector<std::vector<int>> block_info=build_block_info_morton(nblocks,forest,ndim,nleafs);
 
 		// Initialize the FoMo object, and load AMRVAC data into it
-		Object=fomo_from_amrvac(ndim,nleafs,nglev1,nw,xprobmin,nx,cellsize,block_info,leafs,n_unit,Teunit,L_unit,gamma);
+		Object=fomo_from_amrvac(ndim,nleafs,nglev1,nw,xprobmin,nx,cellsize,block_info,leafs,n_unit,Teunit,L_unit,gamma,velocities);
 		//std::cout<<Object.at(0).at(0)<<std::endl;
 	}
 	else
@@ -730,7 +736,7 @@ FoMo::FoMoObject read_amrvac_dat_file_v4(const char* datfile, int version_number
 
 
 
-FoMo::FoMoObject read_amrvac_dat_file(const char* datfile, const char* amrvacpar, string amrvac_version, const int gamma_eqparposition, const double n_unit, const double Teunit, const double L_unit)
+FoMo::FoMoObject read_amrvac_dat_file(const char* datfile, const char* amrvacpar, string amrvac_version, const int gamma_eqparposition, const double n_unit, const double Teunit, const double L_unit, const bool velocities)
 {
 	int version_number=read_dat_version(datfile);
 
@@ -739,20 +745,20 @@ FoMo::FoMoObject read_amrvac_dat_file(const char* datfile, const char* amrvacpar
 	if(std::find(compatible_versions.begin(), compatible_versions.end(), version_number) != compatible_versions.end()) {
 		/* This is found in the compatible versions, and thus we use the new snapshot reader */
 		std::cout << "Using new datfile reader." << std::endl;
-		Object=read_amrvac_new_dat_file(datfile,version_number,n_unit,Teunit,L_unit);
+		Object=read_amrvac_new_dat_file(datfile,version_number,n_unit,Teunit,L_unit,velocities);
 	}
 	//////////// Added by vaibhav pant for DATfiles version 4///////////////////////////////////////////////////
 	if(version_number == 4) {
 		/* We use the new snapshot reader, which is similar to version 3 except few changes in the definition of Gamma */
 		std::cout << "Using new datfile reader (version 4) for AMRVAC 2.0" << std::endl;
-		Object=read_amrvac_dat_file_v4(datfile,version_number,n_unit,Teunit,L_unit);
+		Object=read_amrvac_dat_file_v4(datfile,version_number,n_unit,Teunit,L_unit,velocities);
 	}
 	////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 	else {
 		/* Not a compatible version, use the old reader */
 		std::cout << "Using old datfile reader." << std::endl;
-		Object=read_amrvac_old_dat_file(datfile,amrvacpar,amrvac_version,gamma_eqparposition,n_unit,Teunit,L_unit);
+		Object=read_amrvac_old_dat_file(datfile,amrvacpar,amrvac_version,gamma_eqparposition,n_unit,Teunit,L_unit,velocities);
 	}
 
 	return Object;
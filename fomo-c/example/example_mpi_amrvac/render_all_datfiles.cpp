@@ -48,7 +48,7 @@ bool MatchTextWithWildcards(const string &text, string wildcardPattern, bool cas
 
 int main(int argc, char* argv[])
 {
-	string amrvac_version, compstring, parstring, chiantifile, outpath;
+	string amrvac_version, compstring, parstring, chiantifile, outpath, checkpointfile;
 	int gamma_eqparposition, x_pixel, y_pixel, z_pixel, lambda_pixel;
 	double n_unit, Teunit, L_unit, lambda_width;
 	
@@ -75,6 +75,7 @@ int main(int argc, char* argv[])
 		("lambda_pixel", po::value<int>(&lambda_pixel)->default_value(50),"set lambda resolution of rendering for spectroscopic data")
 		("lambda_width", po::value<double>(&lambda_width)->default_value(200000),"set width of wavelength window (in m/s)")
 		("outpath,o", po::value<string>(&outpath)->default_value(""),"directory for output of fomo-renderings")
+		("checkpoint,k", po::value<string>(&checkpointfile)->default_value(""),"checkpoint file: completed renderings are recorded in it, and skipped when the program is run again")
 		;
 		
 	po::variables_map vm;
@@ -128,10 +129,52 @@ int main(int argc, char* argv[])
 	
 	// Initialize the FoMo object
 	FoMo::FoMoObject Object;
+	
+	// the settings of the rendering, which are also needed to check the checkpoint before reading in the file
+	auto setupobject = [&](FoMo::FoMoObject & obj, const string filename)
+	{
+		obj.setresolution(x_pixel, y_pixel, z_pixel, lambda_pixel, lambda_width);
+		obj.setchiantifile(chiantifile);
+		stringstream ss;
+		string outfile;
+		if (outpath.size() == 0)
+		{
+			outfile=filename;
+		}
+		else
+		{
+			outfile=outpath+boost::filesystem::path(filename).filename().string();
+		}
+	
+		ss << outfile << ".fomo.";
+		obj.setoutfile(ss.str());
+		obj.setwriteouttext(false);
+		obj.setwriteoutbinary();
+		obj.setwriteoutzip();
+		obj.setwriteoutdeletefiles();
+		obj.setcheckpointfile(checkpointfile);
+	};
 
 	for (int t=0; t<nframes; t++)
 	{
 		string filename=filelist[t];
+		
+		// skip the file if all its renderings are completed according to the checkpoint
+		if (checkpointfile.size() != 0)
+		{
+			FoMo::FoMoObject probe;
+			setupobject(probe, filename);
+			bool completed=true;
+			for (auto l: langles)
+				for (auto b: bangles)
+					completed = completed && probe.iscompleted(l,b);
+			if (completed)
+			{
+				cout << "Skipping file " << t+1 << " of " << nframes << ": " << filename << " is completed according to " << checkpointfile << endl << flush;
+				continue;
+			}
+		}
+		
 		cout << "Doing file " << t+1 << " of " << nframes << ": read from " << filename << endl << flush;
 		
 		Object = read_amrvac_dat_file(filename.c_str(), parstring.c_str(), amrvac_version, gamma_eqparposition, n_unit, Teunit, L_unit);
@@ -145,25 +188,7 @@ int main(int argc, char* argv[])
 		}
 		
 		// data is in structure, now start the rendering
-		Object.setresolution(x_pixel, y_pixel, z_pixel, lambda_pixel, lambda_width);
-		Object.setchiantifile(chiantifile);
-		stringstream ss;
-		string outfile;
-		if (outpath.size() == 0)
-		{
-			outfile=filename;
-		}
-		else
-		{
-			outfile=outpath+boost::filesystem::path(filename).filename().string();
-		}
-	
-		ss << outfile << ".fomo.";
-		Object.setoutfile(ss.str());
-		Object.setwriteouttext(false);
-		Object.setwriteoutbinary();
-		Object.setwriteoutzip();
-		Object.setwriteoutdeletefiles();
+		setupobject(Object, filename);
 		Object.render(langles,bangles);
 	}
 }
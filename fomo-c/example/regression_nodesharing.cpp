@@ -0,0 +1,139 @@
+#include "FoMo.h"
+#include <mpi.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cstdio>
+#include <dirent.h>
+#include <sys/stat.h>
+
+// This checks that with node sharing (see FoMoObject.setnodesharing()) every MPI rank writes the view that it renders,
+// stores it in the render cache and records it in its own checkpoint manifest, on the points of testfile.txt. Only
+// the first rank reads the data, and every rank renders another l-angle.
+// Usage: mpirun -np 2 regression_nodesharing [testfile.txt] [chiantitables directory]
+
+using namespace std;
+
+const string outfile="nodesharing_";
+const string cachedir="nodesharing_cache";
+const string manifest="nodesharing_checkpoint.txt";
+
+// the number of renderings in the cache directory
+int cachedfiles()
+{
+	int n=0;
+	DIR * dir=opendir(cachedir.c_str());
+	if (!dir) return 0;
+	while (struct dirent * entry=readdir(dir))
+	{
+		string name=entry->d_name;
+		if (name.size() > 4 && name.substr(name.size()-4) == ".dat") n++;
+	}
+	closedir(dir);
+	return n;
+}
+
+// true if the file exists and contains text
+bool filecontains(const string filename, const string text)
+{
+	ifstream in(filename);
+	if (!in.good()) return false;
+	stringstream contents;
+	contents << in.rdbuf();
+	return contents.str().find(text) != string::npos;
+}
+
+int main(int argc, char* argv[])
+{
+	MPI_Init(&argc,&argv);
+	int rank, size;
+	MPI_Comm_rank(MPI_COMM_WORLD,&rank);
+	MPI_Comm_size(MPI_COMM_WORLD,&size);
+	string datafile=(argc > 1) ? argv[1] : "testfile.txt";
+	string tabledir=(argc > 2) ? argv[2] : "../../chiantitables";
+	if (size < 2)
+	{
+		cerr << "Error: regression_nodesharing should be run with at least 2 MPI ranks." << endl;
+		MPI_Abort(MPI_COMM_WORLD,EXIT_FAILURE);
+	}
+
+	// the data of the other ranks is not used by the node sharing, and is left empty
+	FoMo::FoMoObject object;
+	if (rank == 0)
+	{
+		FoMo::tgrid grid(3);
+		FoMo::tvars vars(5);
+		ifstream in(datafile);
+		if (!in.good())
+		{
+			cerr << "Error: cannot read " << datafile << endl;
+			MPI_Abort(MPI_COMM_WORLD,EXIT_FAILURE);
+		}
+		double values[8];
+		while (in >> values[0] >> values[1] >> values[2] >> values[3] >> values[4] >> values[5] >> values[6] >> values[7])
+		{
+			for (int i=0; i<3; i++) grid[i].push_back(values[i]);
+			for (int i=0; i<5; i++) vars[i].push_back(values[3+i]);
+		}
+		object.setdata(grid,vars);
+	}
+	object.setnodesharing();
+	object.setrendermethod("NearestNeighbour");
+	object.setchiantifile(tabledir+"/goft_table_aia193_abco.dat");
+	object.setresolution(40,41,120,1,200000);
+	object.setwriteoutbinary();
+	object.setwriteouttext(false);
+	object.setoutfile(outfile);
+
+	// every rank renders its own view
+	double l=0.3+0.2*rank, b=0.3;
+	string filename=object.renderfilename(l,b);
+	filename=filename.substr(0,filename.rfind("."))+".dat";
+	stringstream rankmanifest;
+	rankmanifest << manifest << ".rank" << rank;
+	// the files of a previous run are removed, so that the view is rendered again
+	remove(filename.c_str());
+	remove(rankmanifest.str().c_str());
+	if (rank == 0)
+	{
+		mkdir(cachedir.c_str(),0755);
+		DIR * dir=opendir(cachedir.c_str());
+		while (struct dirent * entry=(dir ? readdir(dir) : NULL))
+		{
+			string name=entry->d_name;
+			if (name != "." && name != "..") remove((cachedir+"/"+name).c_str());
+		}
+		if (dir) closedir(dir);
+	}
+	MPI_Barrier(MPI_COMM_WORLD);
+	object.setrendercache(cachedir);
+	object.setcheckpointfile(manifest);
+	object.render(l,b);
+	object.setnodesharing(false);
+	MPI_Barrier(MPI_COMM_WORLD);
+
+	int nfailed=0;
+	bool written=ifstream(filename).good();
+	bool recorded=filecontains(rankmanifest.str(),filename);
+	if (!written) nfailed++;
+	if (!recorded) nfailed++;
+	cout << (written ? "OK   " : "MISS ") << "rank " << rank << " wrote " << filename << endl;
+	cout << (recorded ? "OK   " : "MISS ") << "rank " << rank << " recorded it in " << rankmanifest.str() << endl;
+	if (rank == 0)
+	{
+		int ncached=cachedfiles();
+		if (ncached != size) nfailed++;
+		cout << ((ncached == size) ? "OK   " : "MISS ") << ncached << " of " << size << " views are stored in " << cachedir << endl;
+	}
+	int totalfailed;
+	MPI_Allreduce(&nfailed,&totalfailed,1,MPI_INT,MPI_SUM,MPI_COMM_WORLD);
+	MPI_Finalize();
+	if (totalfailed > 0)
+	{
+		if (rank == 0) cerr << totalfailed << " views of the node sharing were not written, cached or recorded." << endl;
+		return EXIT_FAILURE;
+	}
+	if (rank == 0) cout << "Every rank wrote, cached and recorded its own view." << endl;
+	return 0;
+}
@@ -0,0 +1,102 @@
+#include "FoMo.h"
+#include <iostream>
+#include <fstream>
+#include <cstdlib>
+#include <cmath>
+
+// This checks the renderings with a kept index (see FoMoObject.setreuseindex()) against the renderings without it,
+// for the NearestNeighbour and Projection rendermethods, in imaging and spectroscopic mode, on the points of
+// testfile.txt. The first rendering with the kept index records the mapping of every view, and the second rendering
+// (of another snapshot on the same grid) only gathers the emission through the kept mappings: for NearestNeighbour these
+// are the run-length rays, which are compared with the rendering sample per sample.
+// The intensities must be the same, up to the rounding of the order of the additions.
+// Usage: regression_views [testfile.txt] [chiantitables directory]
+
+using namespace std;
+
+// the largest difference of the intensities, relative to the largest intensity
+double relativedifference(const FoMo::tphysvar & a, const FoMo::tphysvar & b)
+{
+	if (a.size() != b.size()) return INFINITY;
+	double maxdiff=0., maxval=0.;
+	for (size_t i=0; i<a.size(); i++)
+	{
+		maxdiff=max(maxdiff,fabs(double(a[i])-double(b[i])));
+		maxval=max(maxval,fabs(double(a[i])));
+	}
+	return (maxval > 0.) ? maxdiff/maxval : maxdiff;
+}
+
+FoMo::tphysvar renderintensity(FoMo::FoMoObject & object, const double l, const double b)
+{
+	object.render(l,b);
+	return object.readrendering().readvar(0);
+}
+
+int main(int argc, char* argv[])
+{
+	string datafile=(argc > 1) ? argv[1] : "testfile.txt";
+	string tabledir=(argc > 2) ? argv[2] : "../../chiantitables";
+
+	FoMo::tgrid grid(3);
+	FoMo::tvars vars(5);
+	ifstream in(datafile);
+	if (!in.good())
+	{
+		cerr << "Error: cannot read " << datafile << endl;
+		exit(EXIT_FAILURE);
+	}
+	double values[8];
+	while (in >> values[0] >> values[1] >> values[2] >> values[3] >> values[4] >> values[5] >> values[6] >> values[7])
+	{
+		for (int i=0; i<3; i++) grid[i].push_back(values[i]);
+		for (int i=0; i<5; i++) vars[i].push_back(values[3+i]);
+	}
+	// the second snapshot on the same grid: another density and another velocity
+	FoMo::tvars vars2=vars;
+	for (auto & n: vars2[0]) n*=1.1;
+	for (auto & vz: vars2[4]) vz+=20000.;
+
+	const vector<string> methods={"NearestNeighbour","Projection"};
+	const vector<double> lvec={0.5,1.2};
+	const double b=0.3;
+	const double tolerance=1e-5;
+	int nfailed=0;
+	for (auto method: methods)
+	for (int spectroscopic=0; spectroscopic<2; spectroscopic++)
+	{
+		FoMo::FoMoObject reference, reused;
+		reference.setreuseindex(false);
+		reused.setreuseindex(true,true);
+		for (FoMo::FoMoObject * object: {&reference, &reused})
+		{
+			object->setrendermethod(method);
+			object->setchiantifile(tabledir+(spectroscopic ? "/goft_table_fe_12_0194_abco.dat" : "/goft_table_aia193_abco.dat"));
+			object->setresolution(40,41,120,spectroscopic ? 30 : 1,200000);
+			object->setwriteouttext(false);
+		}
+		for (int snapshot=0; snapshot<2; snapshot++)
+		{
+			reference.setdata(grid,snapshot ? vars2 : vars);
+			reused.setdata(grid,snapshot ? vars2 : vars);
+			for (auto l: lvec)
+			{
+				FoMo::tphysvar expected=renderintensity(reference,l,b);
+				FoMo::tphysvar result=renderintensity(reused,l,b);
+				double difference=relativedifference(expected,result);
+				bool ok=(difference <= tolerance);
+				if (!ok) nfailed++;
+				cout << (ok ? "OK   " : "DIFF ") << method << (spectroscopic ? " spectroscopic" : " imaging")
+					<< (snapshot ? ", kept mapping" : ", recording") << ", l=" << l << ", b=" << b
+					<< ": relative difference " << difference << endl;
+			}
+		}
+	}
+	if (nfailed > 0)
+	{
+		cerr << nfailed << " renderings with the kept index differ from the renderings without it." << endl;
+		return EXIT_FAILURE;
+	}
+	cout << "All renderings with the kept index match the renderings without it." << endl;
+	return 0;
+}
@@ -68,6 +68,8 @@ int main(int argc, char* argv[])
 	
 	// Initialize the FoMo object
 	FoMo::FoMoObject Object(dim);
+	// the files are snapshots on the same grid, so the spatial index only needs to be built once
+	Object.setreuseindex();
 	
 	for (int t=0; t<nframes; t++)
 	{
@@ -60,6 +60,37 @@ endif else begin
 	abundfile=string(abundbuffer)
 endelse
 
+if (strpos(versionstring,'-sparse') ne -1) then begin
+; this is a sparse spectroscopic rendering: regular axes, and per pixel only a range of wavelength bins
+	counts=lonarr(3)
+	origin=dblarr(3)
+	step=dblarr(3)
+	readu,lun,counts
+	readu,lun,origin
+	readu,lun,step
+	nx=counts[0]
+	ny=counts[1]
+	nl=counts[2]
+	firstbin=lonarr(nx*ny)
+	bincount=lonarr(nx*ny)
+	readu,lun,firstbin
+	readu,lun,bincount
+	data=fltarr(dim+nvars,ng)
+	ind=lindgen(ng)
+	data[0,*]=origin[0]+step[0]*((ind/nl) mod nx)
+	data[1,*]=origin[1]+step[1]*(ind/nl/nx)
+	data[2,*]=origin[2]+step[2]*(ind mod nl)
+	for p=0L,nx*ny-1 do begin
+		if (bincount[p] gt 0) then begin
+			values=fltarr(bincount[p])
+			readu,lun,values
+			data[dim,p*nl+firstbin[p]:p*nl+firstbin[p]+bincount[p]-1]=values
+		endif
+	endfor
+	close,lun
+	free_lun,lun
+	return,data
+endif
 
 data=fltarr(dim+nvars,ng)
 temp=0.
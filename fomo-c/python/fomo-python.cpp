@@ -0,0 +1,278 @@
+#include "../config.h"
+#include "FoMo.h"
+#include <stdexcept>
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <pybind11/stl.h>
+#ifdef HAVEMPI
+#include <mpi.h>
+#endif
+
+// This is the Python module pyfomo, with bindings for FoMoObject, DataCube, GoftCube and RenderCube.
+// It is built with ./configure --with-python (which needs pybind11), see the Python section of the documentation.
+// Example:
+//   import numpy as np, pyfomo
+//   fomo=pyfomo.FoMoObject()
+//   fomo.setdata([x,y,z],[n,T,vx,vy,vz],["Mm","Mm","Mm","cm^-3","K","km/s","km/s","km/s"])
+//   fomo.setchiantifile("../chiantitables/goft_table_fe_12_0194small_abco.dat")
+//   fomo.setresolution(100,100,100,30,200000)
+//   rendering=fomo.render(0.,0.)
+//   peak=rendering.intensity.max(axis=2)
+
+namespace py = pybind11;
+
+// arrays of float32 are used as they are, other types are converted to float32 first
+typedef py::array_t<float, py::array::c_style | py::array::forcecast> floatarray;
+
+// This returns the memory of a list of 1D arrays, which can be read as the columns of a DataCube.
+std::vector<const float *> tocolumns(const std::vector<floatarray> & arrays, const std::string name)
+{
+	std::vector<const float *> columns;
+	for (unsigned int i=0; i<arrays.size(); i++)
+	{
+		if (arrays[i].ndim() != 1) throw std::invalid_argument("the "+name+" should be one-dimensional arrays");
+		if (arrays[i].size() != arrays[0].size()) throw std::invalid_argument("the "+name+" should have the same length");
+		columns.push_back(arrays[i].data());
+	}
+	return columns;
+}
+
+// This hands a column over to NumPy, without copying it.
+py::array_t<float> toarray(FoMo::tphysvar && column)
+{
+	FoMo::tphysvar * owned=new FoMo::tphysvar(std::move(column));
+	py::capsule release(owned,[](void * p){delete reinterpret_cast<FoMo::tphysvar*>(p);});
+	return py::array_t<float>(py::ssize_t(owned->size()),owned->data(),release);
+}
+
+py::list togrid(FoMo::tgrid && grid)
+{
+	py::list columns;
+	for (unsigned int i=0; i<grid.size(); i++) columns.append(toarray(std::move(grid[i])));
+	return columns;
+}
+
+// These let a DataCube or FoMoObject read the columns, see DataCube::setshared() and FoMoObject::setshareddata().
+void sharecolumns(FoMo::DataCube & datacube, const std::vector<const float *> & grid, const std::vector<const float *> & vars, const int ngrid, std::vector<std::string> * unit)
+{
+	if (datacube.readdim() != int(grid.size())) datacube.setdim(grid.size());
+	std::vector<const float *> columns=grid;
+	columns.insert(columns.end(),vars.begin(),vars.end());
+	datacube.setshared(columns,ngrid,unit);
+}
+
+void sharecolumns(FoMo::FoMoObject & object, const std::vector<const float *> & grid, const std::vector<const float *> & vars, const int ngrid, std::vector<std::string> * unit)
+{
+	object.setshareddata(grid,vars,ngrid,unit);
+}
+
+// This sets the data of a DataCube or FoMoObject, without copying the arrays: the DataCube reads the memory of the 
+// arrays (of float32, after conversion if needed), and only copies it before it is modified (e.g. by mortonsort()). 
+// The arrays are kept alive in the attribute _columns of self, until the data is set again. They should not be 
+// changed in place as long as they are used, set the data again instead.
+template <class T>
+void setcolumns(py::object self, const std::vector<floatarray> & grid, const std::vector<floatarray> & vars, std::vector<std::string> unit)
+{
+	std::vector<const float *> gridcolumns=tocolumns(grid,"grid columns");
+	std::vector<const float *> varcolumns=tocolumns(vars,"variables");
+	if (grid.empty()) throw std::invalid_argument("there should be at least one grid column");
+	if (!vars.empty() && grid[0].size() != vars[0].size())
+		throw std::invalid_argument("the grid and the variables should have the same length");
+	if (!unit.empty() && unit.size() != grid.size()+vars.size())
+		throw std::invalid_argument("there should be one unit for every grid column and variable");
+	sharecolumns(self.cast<T &>(),gridcolumns,varcolumns,grid[0].size(),unit.empty() ? NULL : &unit);
+	py::list arrays;
+	for (unsigned int i=0; i<grid.size(); i++) arrays.append(grid[i]);
+	for (unsigned int i=0; i<vars.size(); i++) arrays.append(vars[i]);
+	self.attr("_columns")=arrays;
+}
+
+// This returns a copy of a DataCube that owns its columns, so that it stays valid when the data it was copied from is set again.
+template <class T>
+T ownedcopy(T datacube)
+{
+	if (datacube.isshared()) datacube.decompress();
+	return datacube;
+}
+
+// This returns the intensity as a view on the memory of the RenderCube, which is kept alive by the view.
+// A regular rendering has shape (ny, nx, nlambda), or (ny, nx) for imaging.
+py::array_t<float> intensityview(py::object self)
+{
+	const FoMo::RenderCube & rendercube=self.cast<const FoMo::RenderCube &>();
+	if (rendercube.issparse()) throw std::runtime_error("the RenderCube is sparse, use densify() first");
+	if (rendercube.iscompressed()) throw std::runtime_error("the RenderCube is compressed, use decompress() first");
+	const FoMo::tphysvar & intensity=rendercube.readintensity();
+	std::vector<py::ssize_t> shape;
+	if (rendercube.isregular())
+	{
+		std::vector<int> count;
+		std::vector<double> origin, step;
+		rendercube.readaxes(count,origin,step);
+		shape={count[1],count[0]};
+		if (count.size() > 2) shape.push_back(count[2]);
+	}
+	else shape.push_back(py::ssize_t(intensity.size()));
+	return py::array_t<float>(shape,intensity.data(),self);
+}
+
+PYBIND11_MODULE(pyfomo, m)
+{
+	m.doc()="Python bindings of the FoMo library for forward modelling of optically thin coronal emission.";
+
+#ifdef HAVEMPI
+	// FoMo asks MPI for the rank of the process, so MPI is started here if the Python program has not done so
+	int initialized;
+	MPI_Initialized(&initialized);
+	if (!initialized)
+	{
+		MPI_Init(NULL,NULL);
+		py::module::import("atexit").attr("register")(py::cpp_function([]()
+		{
+			int finalized;
+			MPI_Finalized(&finalized);
+			if (!finalized) MPI_Finalize();
+		}));
+	}
+#endif
+
+	py::enum_<FoMo::FoMoObservationType>(m,"FoMoObservationType")
+		.value("Spectroscopic",FoMo::Spectroscopic)
+		.value("Imaging",FoMo::Imaging);
+
+	// the DataCube and FoMoObject keep the arrays of setdata() in an attribute, see setcolumns()
+	py::class_<FoMo::DataCube>(m,"DataCube",py::dynamic_attr())
+		.def(py::init<const int>(),py::arg("dim")=3)
+		.def("readdim",&FoMo::DataCube::readdim)
+		.def("readngrid",&FoMo::DataCube::readngrid)
+		.def("readnvars",&FoMo::DataCube::readnvars)
+		.def("readunit",&FoMo::DataCube::readunit)
+		.def("readgrid",[](const FoMo::DataCube & datacube){return togrid(datacube.readgrid());},
+			"The coordinates, as a list of arrays.")
+		.def("readvar",[](const FoMo::DataCube & datacube, const unsigned int nvar){return toarray(datacube.readvar(nvar));},py::arg("nvar"))
+		.def("setdata",&setcolumns<FoMo::DataCube>,py::arg("grid"),py::arg("vars"),py::arg("unit")=std::vector<std::string>(),
+			"Sets the coordinates and variables from lists of 1D arrays, with optionally the units of all columns.")
+		.def("mortonsort",[](FoMo::DataCube & datacube)
+			{
+				std::vector<unsigned int> permutation;
+				datacube.mortonsort(&permutation);
+				return permutation;
+			},"Sorts the data points along a Morton curve, and returns the original index of every data point.")
+		.def("compress",&FoMo::DataCube::compress)
+		.def("decompress",&FoMo::DataCube::decompress)
+		.def("iscompressed",&FoMo::DataCube::iscompressed);
+
+	py::class_<FoMo::GoftCube, FoMo::DataCube>(m,"GoftCube")
+		.def(py::init<const int>(),py::arg("dim")=3)
+		.def("readchiantifile",&FoMo::GoftCube::readchiantifile)
+		.def("readabundfile",&FoMo::GoftCube::readabundfile)
+		.def("readlambda0",&FoMo::GoftCube::readlambda0)
+		.def("writegoftcube",&FoMo::GoftCube::writegoftcube,py::arg("filename"))
+		.def("readgoftcube",&FoMo::GoftCube::readgoftcube,py::arg("filename"));
+
+	py::class_<FoMo::RenderCube, FoMo::GoftCube>(m,"RenderCube")
+		.def_property_readonly("intensity",&intensityview,
+			"The intensity as a NumPy view on the RenderCube, with shape (ny, nx, nlambda) or (ny, nx) for a regular rendering.")
+		.def("isregular",&FoMo::RenderCube::isregular)
+		.def("readaxes",[](const FoMo::RenderCube & rendercube)
+			{
+				std::vector<int> count;
+				std::vector<double> origin, step;
+				rendercube.readaxes(count,origin,step);
+				return py::make_tuple(count,origin,step);
+			},"The number of pixels, the first coordinate and the step along x, y (and lambda) of a regular or sparse rendering.")
+		.def("issparse",&FoMo::RenderCube::issparse)
+		.def("sparsify",&FoMo::RenderCube::sparsify,py::arg("threshold")=0.)
+		.def("densify",&FoMo::RenderCube::densify)
+		.def("readresolution",[](FoMo::RenderCube & rendercube)
+			{
+				int x_pixel, y_pixel, z_pixel, lambda_pixel;
+				double lambda_width;
+				rendercube.readresolution(x_pixel,y_pixel,z_pixel,lambda_pixel,lambda_width);
+				return py::make_tuple(x_pixel,y_pixel,z_pixel,lambda_pixel,lambda_width);
+			})
+		.def("readangles",[](FoMo::RenderCube & rendercube)
+			{
+				double l, b;
+				rendercube.readangles(l,b);
+				return py::make_tuple(l,b);
+			})
+		.def("readrendermethod",&FoMo::RenderCube::readrendermethod)
+		.def("readobservationtype",&FoMo::RenderCube::readobservationtype);
+
+	py::class_<FoMo::FoMoObject>(m,"FoMoObject",py::dynamic_attr())
+		.def(py::init<const int>(),py::arg("dim")=3)
+		.def("setdata",&setcolumns<FoMo::FoMoObject>,py::arg("grid"),py::arg("vars"),py::arg("unit")=std::vector<std::string>(),
+			"Sets the coordinates (x, y, z) and variables (n, T, vx, vy, vz) from lists of 1D arrays, with optionally the units of all columns.")
+		.def("mortonsort",[](FoMo::FoMoObject & object)
+			{
+				std::vector<unsigned int> permutation;
+				object.mortonsort(&permutation);
+				return permutation;
+			},"Sorts the data points along a Morton curve, and returns the original index of every data point.")
+		// the rendering does not need Python, so other Python threads can run in the meantime
+		.def("render",[](FoMo::FoMoObject & object, const double l, const double b)
+			{
+				{
+					py::gil_scoped_release release;
+					object.render(l,b);
+				}
+				return object.readrendering();
+			},py::arg("l")=0.,py::arg("b")=0.,"Renders the view with angles l and b (in radians), and returns the rendering.")
+		.def("render",[](FoMo::FoMoObject & object, const std::vector<double> & lvec, const std::vector<double> & bvec)
+			{
+				{
+					py::gil_scoped_release release;
+					object.render(lvec,bvec);
+				}
+				return object.readrendering();
+			},py::arg("lvec"),py::arg("bvec"),"Renders all combinations of the angles in lvec and bvec, and returns the last rendering.")
+		.def("readdatacube",[](FoMo::FoMoObject & object){return ownedcopy(object.readdatacube());})
+		.def("readgoftcube",[](FoMo::FoMoObject & object){return ownedcopy(object.readgoftcube());})
+		.def("readrendering",&FoMo::FoMoObject::readrendering)
+		.def("setrendermethod",&FoMo::FoMoObject::setrendermethod,py::arg("rendermethod"))
+		.def("readrendermethod",&FoMo::FoMoObject::readrendermethod)
+		.def("setchiantifile",&FoMo::FoMoObject::setchiantifile,py::arg("chiantifile"))
+		.def("readchiantifile",&FoMo::FoMoObject::readchiantifile)
+		.def("setabundfile",&FoMo::FoMoObject::setabundfile,py::arg("abundfile"))
+		.def("readabundfile",&FoMo::FoMoObject::readabundfile)
+		.def("setoutfile",&FoMo::FoMoObject::setoutfile,py::arg("outfile"))
+		.def("setresolution",&FoMo::FoMoObject::setresolution,
+			py::arg("x_pixel"),py::arg("y_pixel"),py::arg("z_pixel"),py::arg("lambda_pixel"),py::arg("lambda_width"))
+		.def("readresolution",[](FoMo::FoMoObject & object)
+			{
+				int x_pixel, y_pixel, z_pixel, lambda_pixel;
+				double lambda_width;
+				object.readresolution(x_pixel,y_pixel,z_pixel,lambda_pixel,lambda_width);
+				return py::make_tuple(x_pixel,y_pixel,z_pixel,lambda_pixel,lambda_width);
+			})
+		.def("setobservationtype",&FoMo::FoMoObject::setobservationtype)
+		.def("readobservationtype",&FoMo::FoMoObject::readobservationtype)
+		.def("setcompression",&FoMo::FoMoObject::setcompression,py::arg("compression")=true)
+		.def("readcompression",&FoMo::FoMoObject::readcompression)
+		.def("setsparsespectra",&FoMo::FoMoObject::setsparsespectra,py::arg("sparse")=true,py::arg("threshold")=0.)
+		.def("readsparsespectra",&FoMo::FoMoObject::readsparsespectra)
+		.def("setregionofinterest",&FoMo::FoMoObject::setregionofinterest,py::arg("roi")=std::vector<int>())
+		.def("readregionofinterest",&FoMo::FoMoObject::readregionofinterest)
+		.def("setreuseindex",&FoMo::FoMoObject::setreuseindex,py::arg("reuse")=true,py::arg("staticgrid")=false)
+		.def("readreuseindex",&FoMo::FoMoObject::readreuseindex)
+		.def("setslabdepth",&FoMo::FoMoObject::setslabdepth,py::arg("depth")=1.)
+		.def("readslabdepth",&FoMo::FoMoObject::readslabdepth)
+		.def("setspatialindex",&FoMo::FoMoObject::setspatialindex,py::arg("index")="rtree",py::arg("maxmemory")=1e9)
+		.def("readspatialindex",&FoMo::FoMoObject::readspatialindex)
+		.def("setlazyemission",&FoMo::FoMoObject::setlazyemission,py::arg("lazy")=true)
+		.def("readlazyemission",&FoMo::FoMoObject::readlazyemission)
+		.def("setblendedlines",&FoMo::FoMoObject::setblendedlines,py::arg("chiantifiles")=std::vector<std::string>())
+		.def("readblendedlines",&FoMo::FoMoObject::readblendedlines)
+		.def("setrendercache",&FoMo::FoMoObject::setrendercache,py::arg("cachedir")="")
+		.def("readrendercache",&FoMo::FoMoObject::readrendercache)
+		.def("setcheckpointfile",&FoMo::FoMoObject::setcheckpointfile,py::arg("manifest")="")
+		.def("readcheckpointfile",&FoMo::FoMoObject::readcheckpointfile)
+		.def("iscompleted",&FoMo::FoMoObject::iscompleted,py::arg("l"),py::arg("b"))
+		.def("writeviewmappings",&FoMo::FoMoObject::writeviewmappings,py::arg("filename"))
+		.def("readviewmappings",&FoMo::FoMoObject::readviewmappings,py::arg("filename"))
+		.def("setwriteoutbinary",&FoMo::FoMoObject::setwriteoutbinary,py::arg("binary")=true)
+		.def("setwriteouttext",&FoMo::FoMoObject::setwriteouttext,py::arg("text")=true)
+		.def("setwriteoutzip",&FoMo::FoMoObject::setwriteoutzip,py::arg("zip")=true)
+		.def("setwriteoutdeletefiles",&FoMo::FoMoObject::setwriteoutdeletefiles,py::arg("deletefiles")=true);
+}
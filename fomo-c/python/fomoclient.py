@@ -0,0 +1,55 @@
+#!/usr/bin/env python2
+# -*- coding: utf-8 -*-
+
+# Client for fomo-server, see server/fomo-server.cpp for the protocol.
+# Example:
+#   import fomoclient, readfomo
+#   client=fomoclient.FoMoClient("fomo-server.sock")
+#   client.load("snap","testfile.txt")
+#   datfile=client.render("snap","goft_table_fe_12_0194_abco.dat","/empty","NearestNeighbour",100,100,100,30,200000,0.,0.,"fomo-out")
+#   cube=readfomo.readgoftcube_dat(datfile)
+
+import socket
+
+class FoMoClient:
+    def __init__(self,socketpath="fomo-server.sock"):
+        self.sock=socket.socket(socket.AF_UNIX,socket.SOCK_STREAM)
+        self.sock.connect(socketpath)
+        self.buffer=b""
+
+    def close(self):
+        self.sock.close()
+
+    def request(self,line):
+        self.sock.sendall((line+"\n").encode())
+        while b"\n" not in self.buffer:
+            chunk=self.sock.recv(4096)
+            if not chunk:
+                raise IOError("fomo-server closed the connection")
+            self.buffer+=chunk
+        reply,self.buffer=self.buffer.split(b"\n",1)
+        reply=reply.decode()
+        if reply.startswith("ERROR"):
+            raise RuntimeError(reply)
+        return reply
+
+    def load(self,id,datafile):
+        # datafile is read by the server, with columns x, y, z, n, T, vx, vy, vz
+        return int(self.request("load "+id+" "+datafile).split()[1])
+
+    def unload(self,id):
+        self.request("unload "+id)
+
+    def list(self):
+        return self.request("list").split()[1:]
+
+    def render(self,id,chiantifile,abundfile,rendermethod,x_pixel,y_pixel,z_pixel,lambda_pixel,lambda_width,l,b,outfile,roi=None):
+        # l and b are in radians, roi is [xmin,xmax,ymin,ymax] in pixels
+        # returns the binary file of the rendering, which can be read with readfomo.readgoftcube_dat
+        line="render %s %s %s %s %d %d %d %d %r %r %r %s" % (id,chiantifile,abundfile,rendermethod,x_pixel,y_pixel,z_pixel,lambda_pixel,lambda_width,l,b,outfile)
+        if roi is not None:
+            line+=" roi %d %d %d %d" % tuple(roi)
+        return self.request(line)[3:]
+
+    def shutdown(self):
+        self.request("shutdown")
@@ -103,6 +103,28 @@ def readgoftcube_dat(filename,compress=0):
         abundsize=struct.unpack('q',int_in)[0]
         abundfile=f.read(abundsize)
     
+    if versionstring.endswith('-sparse'):
+        # sparse spectroscopic rendering: regular axes, and per pixel only a range of wavelength bins
+        counts=struct.unpack('3i',f.read(12))
+        origin=struct.unpack('3d',f.read(24))
+        step=struct.unpack('3d',f.read(24))
+        nx,ny,nl=counts
+        npix=nx*ny
+        firstbin=np.frombuffer(f.read(4*npix),dtype=np.int32)
+        bincount=np.frombuffer(f.read(4*npix),dtype=np.int32)
+        values=np.frombuffer(f.read(4*int(np.sum(bincount))),dtype=np.float32)
+        f.close()
+        data=np.zeros([ng,dim+nvars],dtype=np.float32)
+        ind=np.arange(ng)
+        data[:,0]=origin[0]+step[0]*((ind//nl)%nx)
+        data[:,1]=origin[1]+step[1]*(ind//nl//nx)
+        data[:,2]=origin[2]+step[2]*(ind%nl)
+        pos=0
+        for p in range(npix):
+            data[p*nl+firstbin[p]:p*nl+firstbin[p]+bincount[p],dim]=values[pos:pos+bincount[p]]
+            pos+=bincount[p]
+        return data,units,chiantifile
+    
     data=[]
     for i in range(ng):
         row=[]
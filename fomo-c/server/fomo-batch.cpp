@@ -0,0 +1,749 @@
+#include "FoMo.h"
+#include "FoMo-amrvac.h"
+#include "fomo-tools.h"
+#include <cstdlib>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <iomanip>
+#include <cmath>
+#include <glob.h>
+#include <getopt.h>
+
+/**
+ * @file
+ * This file contains fomo-batch, which does all the renderings described in a job file.
+ *
+ * The job file consists of sections. A [snapshot <id>] section describes how a snapshot is read in:
+ *  - file = the file to read. If it contains wildcards, every matching file is a snapshot, with id <id>:<file
+ *    without directory>
+ *  - reader = text (columns x, y, z, n, T, vx, vy, vz, as example/testfile.txt, the default) or amrvac
+ *    If all renderings of a snapshot are imaging renderings (lambda_pixel = 1), the velocities are not read in.
+ *  - for the amrvac reader: par, amrvacversion, gamma, nunit, Tunit, Lunit, as in render_all_datfiles
+ *  - reuseindex = yes, to share the spatial index and the mapping of the views between the renderings of the
+ *    snapshot (see FoMoObject.setreuseindex()), which costs memory for every view. With reuseindex = shared, the 
+ *    index is also shared between all snapshots of the section (see FoMoObject.shareindex()), and only rebuilt 
+ *    when the grid changes. With reuseindex = static, the grid of all snapshots is assumed to be the same, and is
+ *    not checked.
+ *
+ * A [render] section describes renderings, for every combination of the listed snapshots, chiantifiles,
+ * rendermethods and resolutions:
+ *  - snapshots = the ids of the snapshots (the default is all snapshots)
+ *  - chiantifile = one or more chiantifiles
+ *  - abundfile = the abundfile (the default is /empty)
+ *  - method = one or more rendermethods, or auto to let FoMo choose (the default is NearestNeighbour)
+ *  - resolution = x_pixel y_pixel z_pixel lambda_pixel lambda_width; the key can be repeated
+ *  - l, b = the viewing angles in radians
+ *  - roi = xmin xmax ymin ymax (optional)
+ *  - sparse = the threshold for sparse spectra (optional)
+ *  - cache = the directory of a render cache (optional)
+ *  - write = the output formats: binary, text and/or zip (the default is binary)
+ *  - output = the prefix of the output files, in which {snapshot}, {table} (the chiantifile without directory
+ *    and extension), {method} and {resolution} are replaced (the default is {snapshot}.{table}.{method}.{resolution}.).
+ *    Every rendering should have a different prefix.
+ *  - raster = xfirst xlast [xstep], to simulate a slit spectrograph rastering over the snapshots (optional): 
+ *    snapshot t (in the order of snapshots) only renders the column of pixels x=xfirst+t*xstep, and the raster starts 
+ *    again after xlast. With raster = x, the slit stays at column x (sit-and-stare). Instead of a rendering per 
+ *    snapshot, one file is written per view, with {snapshot} replaced by the id of the first snapshot without file 
+ *    name and "raster" appended to the prefix. It has the coordinates x, y, (lambda) and t (the index of the 
+ *    snapshot) and the intensity, with snapshot t, pixel iy along the slit and wavelength bin il at index 
+ *    (t*y_pixel+iy)*lambda_pixel+il. This cannot be combined with roi.
+ * Lines starting with # are comments.
+ *
+ * The renderings are grouped per snapshot and per chiantifile and abundfile. Every snapshot is read in once,
+ * and the emission is computed once per group. The groups are done in parallel, and a snapshot is removed from
+ * memory when all its groups are done. Since the render methods are parallelised with OpenMP themselves,
+ * OMP_NUM_THREADS should be lowered when several groups are done at the same time.
+ */
+
+using namespace std;
+
+/** @brief A snapshot in the job file. */
+struct Snapshot
+{
+	string id;
+	/** The id of the [snapshot] section. */
+	string section;
+	string file;
+	map<string, string> settings;
+	/** The data, once it is read in. */
+	unique_ptr<FoMo::FoMoObject> data;
+	bool loading=false;
+	/** The number of render groups of this snapshot. */
+	int groupsleft=0;
+	/** If false, the snapshot only has imaging renderings, and its velocities are not read in. */
+	bool spectroscopic=false;
+};
+
+/** @brief One rendering in the job file, with all its viewing angles. */
+struct RenderTask
+{
+	string method;
+	vector<double> resolution;
+	vector<double> lvec, bvec;
+	vector<int> roi;
+	bool sparse=false;
+	double sparsethreshold=0;
+	string cache;
+	string write;
+	string output;
+	/** The raster of which this rendering is a slit (-1 if it is not), and the index of the snapshot in the raster. */
+	int raster=-1;
+	int rasterstep=0;
+};
+
+/** @brief A slit raster over the snapshots of a [render] section, which is written when all its slits are rendered. */
+struct Raster
+{
+	string output;
+	string write;
+	vector<double> lvec, bvec;
+	int nsteps=0;
+	int ndone=0;
+	int y_pixel=0;
+	int lambda_pixel=0;
+	string chiantifile;
+	string abundfile;
+	double lambda0=0;
+	vector<string> unit;
+	/** For every view: the x coordinate of the slit, the y coordinates along the slit and the intensity of every snapshot. */
+	vector<vector<float> > x, y, intensity;
+	vector<float> lambda;
+};
+
+/** @brief The renderings of one snapshot with the same chiantifile and abundfile, which share their emission. */
+struct RenderGroup
+{
+	int snapshot;
+	string chiantifile;
+	string abundfile;
+	vector<RenderTask> tasks;
+	bool started=false;
+};
+
+static vector<Snapshot> snapshots;
+static vector<RenderGroup> groups;
+static mutex schedulelock;
+static condition_variable schedulecondition;
+static vector<Raster> rasters;
+static mutex rasterlock;
+/** The objects holding the shared index of the snapshot sections with reuseindex = shared or static. */
+static map<string, unique_ptr<FoMo::FoMoObject> > sharedindices;
+static set<string> outputs;
+static int nloaded=0;
+static int ngroupsleft=0;
+
+static void joberror(const string filename, const int linenumber, const string message)
+{
+	cerr << "Error in " << filename << " line " << linenumber << ": " << message << endl;
+	exit(EXIT_FAILURE);
+}
+
+static vector<string> splitwords(const string line)
+{
+	stringstream ss(line);
+	vector<string> words;
+	string word;
+	while (ss >> word) words.push_back(word);
+	return words;
+}
+
+static string replaceall(string s, const string from, const string to)
+{
+	for (size_t pos=s.find(from); pos!=string::npos; pos=s.find(from,pos+to.size())) s.replace(pos,from.size(),to);
+	return s;
+}
+
+/**
+ * @brief This converts a [render] section to render groups.
+ * @param settings The keys of the section, with all the values given for that key.
+ * @param filename The job file, for error messages.
+ * @param linenumber The line of the section, for error messages.
+ */
+static void addrendersection(map<string, vector<string> > & settings, const string filename, const int linenumber)
+{
+	const vector<string> keys={"snapshots","chiantifile","abundfile","method","resolution","l","b","roi","sparse","cache","write","output","raster"};
+	for (map<string, vector<string> >::const_iterator it=settings.begin(); it!=settings.end(); ++it)
+		if (find(keys.begin(),keys.end(),it->first) == keys.end()) joberror(filename,linenumber,"unknown key "+it->first+" in [render]");
+	// all keys except resolution take one line, whose words are collected here
+	map<string, vector<string> > words;
+	for (map<string, vector<string> >::const_iterator it=settings.begin(); it!=settings.end(); ++it)
+	{
+		if (it->first != "resolution" && it->second.size() > 1) joberror(filename,linenumber,"key "+it->first+" is given more than once");
+		if (it->first != "resolution") words[it->first]=splitwords(it->second[0]);
+	}
+
+	vector<int> snapshotindices;
+	if (words.count("snapshots"))
+	{
+		for (unsigned int i=0; i<words["snapshots"].size(); i++)
+		{
+			bool found=false;
+			// an id also selects all snapshots that were made from it with wildcards
+			for (unsigned int j=0; j<snapshots.size(); j++)
+				if (snapshots[j].id == words["snapshots"][i] || snapshots[j].id.compare(0,words["snapshots"][i].size()+1,words["snapshots"][i]+":") == 0)
+				{
+					snapshotindices.push_back(j);
+					found=true;
+				}
+			if (!found) joberror(filename,linenumber,"unknown snapshot "+words["snapshots"][i]);
+		}
+	}
+	else
+		for (unsigned int j=0; j<snapshots.size(); j++) snapshotindices.push_back(j);
+
+	if (!words.count("chiantifile") || words["chiantifile"].empty()) joberror(filename,linenumber,"no chiantifile in [render]");
+	string abundfile=words.count("abundfile") ? words["abundfile"].at(0) : "/empty";
+	vector<string> methods=words.count("method") ? words["method"] : vector<string>(1,"NearestNeighbour");
+	vector<string> available=FoMo::rendermethods();
+	for (unsigned int i=0; i<methods.size(); i++)
+		if (find(available.begin(),available.end(),methods[i]) == available.end()) joberror(filename,linenumber,"unknown rendermethod "+methods[i]);
+	if (!settings.count("resolution")) joberror(filename,linenumber,"no resolution in [render]");
+
+	RenderTask task;
+	for (unsigned int i=0; i<words["l"].size(); i++) task.lvec.push_back(atof(words["l"][i].c_str()));
+	for (unsigned int i=0; i<words["b"].size(); i++) task.bvec.push_back(atof(words["b"][i].c_str()));
+	if (task.lvec.empty() || task.bvec.empty()) joberror(filename,linenumber,"no l or b angles in [render]");
+	if (words.count("roi"))
+	{
+		if (words["roi"].size() != 4) joberror(filename,linenumber,"roi should be xmin xmax ymin ymax");
+		for (unsigned int i=0; i<4; i++) task.roi.push_back(atoi(words["roi"][i].c_str()));
+	}
+	if (words.count("sparse"))
+	{
+		task.sparse=true;
+		if (!words["sparse"].empty()) task.sparsethreshold=atof(words["sparse"][0].c_str());
+	}
+	if (words.count("cache")) task.cache=words["cache"].at(0);
+	// the columns of the slit, one per snapshot, repeated until all snapshots are done
+	vector<int> slits;
+	if (words.count("raster"))
+	{
+		if (words.count("roi")) joberror(filename,linenumber,"raster cannot be combined with roi");
+		vector<string> & raster=words["raster"];
+		if (raster.empty() || raster.size() > 3) joberror(filename,linenumber,"raster should be xfirst xlast [xstep] or x");
+		int first=atoi(raster[0].c_str());
+		int last=(raster.size() > 1) ? atoi(raster[1].c_str()) : first;
+		int step=(raster.size() > 2) ? atoi(raster[2].c_str()) : (last >= first ? 1 : -1);
+		if (first < 0 || last < 0 || step == 0 || (last-first)*step < 0) joberror(filename,linenumber,"invalid raster "+raster[0]);
+		for (int x=first; (step > 0) ? x <= last : x >= last; x+=step) slits.push_back(x);
+		// the CGAL rendermethods ignore the region of interest
+		for (unsigned int i=0; i<methods.size(); i++)
+			if (methods[i].compare(0,4,"CGAL") == 0) joberror(filename,linenumber,"raster cannot be used with rendermethod "+methods[i]);
+	}
+	task.write=words.count("write") ? settings["write"][0] : "binary";
+	string output=words.count("output") ? words["output"].at(0) : "{snapshot}.{table}.{method}.{resolution}.";
+	// the rasters of this section, per chiantifile, method and resolution
+	map<string, int> sectionrasters;
+
+	for (unsigned int s=0; s<snapshotindices.size(); s++)
+		for (unsigned int c=0; c<words["chiantifile"].size(); c++)
+		{
+			string chiantifile=words["chiantifile"][c];
+			// find the group of this snapshot and chiantifile, or make a new one
+			unsigned int g;
+			for (g=0; g<groups.size(); g++)
+				if (groups[g].snapshot == snapshotindices[s] && groups[g].chiantifile == chiantifile && groups[g].abundfile == abundfile) break;
+			if (g == groups.size())
+			{
+				RenderGroup group;
+				group.snapshot=snapshotindices[s];
+				group.chiantifile=chiantifile;
+				group.abundfile=abundfile;
+				groups.push_back(group);
+				snapshots[snapshotindices[s]].groupsleft++;
+			}
+			string table=chiantifile.substr(chiantifile.find_last_of("/")+1);
+			table=table.substr(0,table.rfind(".dat"));
+			string snapshotname=snapshots[snapshotindices[s]].id;
+			replace(snapshotname.begin(),snapshotname.end(),'/','_');
+			for (unsigned int m=0; m<methods.size(); m++)
+				for (unsigned int r=0; r<settings["resolution"].size(); r++)
+				{
+					vector<string> resolution=splitwords(settings["resolution"][r]);
+					if (resolution.size() != 5) joberror(filename,linenumber,"resolution should be x_pixel y_pixel z_pixel lambda_pixel lambda_width");
+					task.resolution.clear();
+					for (unsigned int i=0; i<5; i++) task.resolution.push_back(atof(resolution[i].c_str()));
+					task.method=methods[m];
+					string resolutionname=resolution[0]+"x"+resolution[1]+"x"+resolution[2]+"x"+resolution[3];
+					task.output=replaceall(replaceall(replaceall(output,"{snapshot}",snapshotname),"{table}",table),"{method}",methods[m]);
+					task.output=replaceall(task.output,"{resolution}",resolutionname);
+					if (!slits.empty())
+					{
+						int x=slits[s%slits.size()];
+						if (x >= task.resolution[0]) joberror(filename,linenumber,"the raster is outside of the image");
+						task.roi={x,x,0,int(task.resolution[1])-1};
+						task.rasterstep=s;
+						string rasterkey=chiantifile+"|"+methods[m]+"|"+settings["resolution"][r];
+						if (!sectionrasters.count(rasterkey))
+						{
+							// the raster is named after the first snapshot
+							string rastername=snapshots[snapshotindices[0]].id;
+							rastername=rastername.substr(0,rastername.find(':'));
+							replace(rastername.begin(),rastername.end(),'/','_');
+							Raster raster;
+							raster.output=replaceall(replaceall(replaceall(output,"{snapshot}",rastername),"{table}",table),"{method}",methods[m]);
+							raster.output=replaceall(raster.output,"{resolution}",resolutionname)+"raster";
+							raster.write=task.write;
+							raster.lvec=task.lvec;
+							raster.bvec=task.bvec;
+							raster.nsteps=snapshotindices.size();
+							if (outputs.count(raster.output)) joberror(filename,linenumber,"renderings with the same output "+raster.output+", use {resolution} or {method} in output");
+							outputs.insert(raster.output);
+							sectionrasters[rasterkey]=rasters.size();
+							rasters.push_back(raster);
+						}
+						task.raster=sectionrasters[rasterkey];
+						task.output=rasters[task.raster].output;
+						groups[g].tasks.push_back(task);
+						continue;
+					}
+					if (outputs.count(task.output)) joberror(filename,linenumber,"renderings with the same output "+task.output+", use {resolution} or {method} in output");
+					outputs.insert(task.output);
+					groups[g].tasks.push_back(task);
+				}
+		}
+}
+
+/**
+ * @brief This reads the job file.
+ * @param filename The job file.
+ */
+static void readjobfile(const string filename)
+{
+	ifstream in(filename);
+	if (!in.is_open())
+	{
+		cerr << "Error: cannot open job file " << filename << endl;
+		exit(EXIT_FAILURE);
+	}
+	string line, section;
+	map<string, vector<string> > settings;
+	int linenumber=0, sectionline=0;
+	// the sections are handled when the next section starts, and at the end of the file
+	auto endsection = [&]()
+	{
+		if (section.empty()) return;
+		vector<string> header=splitwords(section);
+		if (header[0] == "snapshot")
+		{
+			if (header.size() != 2) joberror(filename,sectionline,"a snapshot section should be [snapshot <id>]");
+			if (!settings.count("file")) joberror(filename,sectionline,"no file in snapshot "+header[1]);
+			Snapshot snapshot;
+			// a snapshot section gives one value per key
+			for (map<string, vector<string> >::const_iterator it=settings.begin(); it!=settings.end(); ++it)
+			{
+				vector<string> value=splitwords(it->second.back());
+				if (it->second.size() != 1 || value.size() != 1) joberror(filename,sectionline,"snapshot "+header[1]+": "+it->first+" should have one value");
+				snapshot.settings[it->first]=value[0];
+			}
+			if (!snapshot.settings.count("reader")) snapshot.settings["reader"]="text";
+			if (snapshot.settings["reader"] != "text" && snapshot.settings["reader"] != "amrvac") joberror(filename,sectionline,"unknown reader "+snapshot.settings["reader"]);
+			string reuse=snapshot.settings.count("reuseindex") ? snapshot.settings["reuseindex"] : "no";
+			if (reuse != "no" && reuse != "yes" && reuse != "shared" && reuse != "static") joberror(filename,sectionline,"reuseindex should be no, yes, shared or static");
+			if (reuse == "shared" || reuse == "static")
+			{
+				// an empty FoMoObject holds the index, which the snapshots use when they are read in
+				sharedindices[header[1]].reset(new FoMo::FoMoObject());
+				sharedindices[header[1]]->setreuseindex(true,reuse == "static");
+			}
+			snapshot.section=header[1];
+			string pattern=snapshot.settings["file"];
+			if (pattern.find_first_of("*?[") == string::npos)
+			{
+				snapshot.id=header[1];
+				snapshot.file=pattern;
+				snapshots.push_back(move(snapshot));
+			}
+			else
+			{
+				glob_t matches;
+				if (glob(pattern.c_str(),0,NULL,&matches) != 0) joberror(filename,sectionline,"no files match "+pattern);
+				for (size_t i=0; i<matches.gl_pathc; i++)
+				{
+					Snapshot match;
+					string file=matches.gl_pathv[i];
+					match.id=header[1]+":"+file.substr(file.find_last_of("/")+1);
+					match.file=matches.gl_pathv[i];
+					match.settings=snapshot.settings;
+					snapshots.push_back(move(match));
+				}
+				globfree(&matches);
+			}
+		}
+		else if (header[0] == "render" && header.size() == 1)
+			addrendersection(settings,filename,sectionline);
+		else
+			joberror(filename,sectionline,"unknown section ["+section+"]");
+		settings.clear();
+	};
+
+	while (getline(in,line))
+	{
+		linenumber++;
+		size_t first=line.find_first_not_of(" \t");
+		if (first == string::npos || line[first] == '#') continue;
+		line=line.substr(first);
+		if (line[0] == '[')
+		{
+			endsection();
+			size_t last=line.find(']');
+			if (last == string::npos) joberror(filename,linenumber,"missing ]");
+			section=line.substr(1,last-1);
+			sectionline=linenumber;
+			if (splitwords(section).empty()) joberror(filename,linenumber,"empty section");
+			continue;
+		}
+		size_t equal=line.find('=');
+		if (section.empty() || equal == string::npos) joberror(filename,linenumber,"expected key = value inside a section");
+		vector<string> key=splitwords(line.substr(0,equal));
+		if (key.size() != 1) joberror(filename,linenumber,"invalid key");
+		settings[key[0]].push_back(line.substr(equal+1));
+	}
+	endsection();
+}
+
+/**
+ * @brief This sorts the renderings in a group, such that renderings with the same observation type (and thus
+ * the same emission), rendermethod and resolution follow each other.
+ */
+static void sortgroups()
+{
+	for (unsigned int g=0; g<groups.size(); g++)
+		stable_sort(groups[g].tasks.begin(),groups[g].tasks.end(),[](const RenderTask & a, const RenderTask & b)
+		{
+			bool aspectroscopic=a.resolution[3]>1, bspectroscopic=b.resolution[3]>1;
+			if (aspectroscopic != bspectroscopic) return aspectroscopic < bspectroscopic;
+			if (a.method != b.method) return a.method < b.method;
+			return a.resolution < b.resolution;
+		});
+	// groups of the same snapshot follow each other, in the order in which the snapshots are given
+	stable_sort(groups.begin(),groups.end(),[](const RenderGroup & a, const RenderGroup & b) {return a.snapshot < b.snapshot;});
+}
+
+/**
+ * @brief This sets the reuse of the index of a snapshot, as given by its reuseindex.
+ * @param snapshot The snapshot.
+ * @param object The FoMoObject with the data of the snapshot.
+ */
+static void setindex(Snapshot & snapshot, FoMo::FoMoObject & object)
+{
+	if (snapshot.settings["reuseindex"] == "yes") object.setreuseindex();
+	// the holders of the shared indices are made before the threads start, and are only read here
+	if (sharedindices.count(snapshot.section)) object.shareindex(*sharedindices[snapshot.section]);
+}
+
+/**
+ * @brief This reads in a snapshot.
+ * @param snapshot The snapshot.
+ * @return The FoMoObject with the data.
+ */
+static unique_ptr<FoMo::FoMoObject> loadsnapshot(Snapshot & snapshot)
+{
+	cout << "Reading snapshot " << snapshot.id << " from " << snapshot.file << endl << flush;
+	unique_ptr<FoMo::FoMoObject> object(new FoMo::FoMoObject());
+	if (snapshot.settings["reader"] == "text")
+	{
+		if (readtextsnapshot(snapshot.file,*object,snapshot.spectroscopic) < 0)
+		{
+			cerr << "Error: cannot read snapshot " << snapshot.id << " from " << snapshot.file << endl;
+			exit(EXIT_FAILURE);
+		}
+		setindex(snapshot,*object);
+		return object;
+	}
+	map<string, string> & settings=snapshot.settings;
+	string par=settings.count("par") ? settings["par"] : "amrvac.par";
+	string version=settings.count("amrvacversion") ? settings["amrvacversion"] : "gitlab";
+	int gamma=settings.count("gamma") ? atoi(settings["gamma"].c_str()) : 0;
+	double n_unit=settings.count("nunit") ? atof(settings["nunit"].c_str()) : 1.;
+	double Teunit=settings.count("Tunit") ? atof(settings["Tunit"].c_str()) : 1.;
+	double L_unit=settings.count("Lunit") ? atof(settings["Lunit"].c_str()) : 1.;
+	*object=read_amrvac_dat_file(snapshot.file.c_str(),par.c_str(),version,gamma,n_unit,Teunit,L_unit,snapshot.spectroscopic);
+	setindex(snapshot,*object);
+	return object;
+}
+
+/**
+ * @brief This writes out the views of a raster.
+ * @param raster The raster, of which all slits are rendered.
+ */
+static void writeraster(Raster & raster)
+{
+	int nt=raster.nsteps, ny=raster.y_pixel, nl=raster.lambda_pixel;
+	bool spectroscopic=(nl > 1);
+	int ng=nt*ny*nl;
+	vector<string> unit=raster.unit;
+	// the unit of the intensity follows the units of the grid
+	unit.insert(unit.end()-1,"snapshot");
+	for (unsigned int li=0; li<raster.lvec.size(); li++)
+		for (unsigned int bi=0; bi<raster.bvec.size(); bi++)
+		{
+			int view=li*raster.bvec.size()+bi;
+			FoMo::tgrid grid(spectroscopic ? 4 : 3,FoMo::tphysvar(ng));
+			FoMo::tvars vars(1,FoMo::tphysvar(raster.intensity[view].begin(),raster.intensity[view].end()));
+			for (int t=0; t<nt; t++)
+				for (int iy=0; iy<ny; iy++)
+					for (int il=0; il<nl; il++)
+					{
+						int i=(t*ny+iy)*nl+il;
+						grid[0][i]=raster.x[view][t];
+						grid[1][i]=raster.y[view][t*ny+iy];
+						if (spectroscopic) grid[2][i]=raster.lambda[il];
+						grid.back()[i]=t;
+					}
+			FoMo::GoftCube cube;
+			cube.setdata(grid,vars,&unit);
+			cube.setchiantifile(raster.chiantifile);
+			cube.setabundfile(raster.abundfile);
+			cube.setlambda0(raster.lambda0);
+			cube.setwriteoutbinary(raster.write.find("binary") != string::npos);
+			cube.setwriteouttext(raster.write.find("text") != string::npos);
+			cube.setwriteoutzip(raster.write.find("zip") != string::npos);
+			stringstream filename;
+			filename << raster.output << "l" << setfill('0') << setw(3) << round(raster.lvec[li]/M_PI*180.);
+			filename << "b" << setfill('0') << setw(3) << round(raster.bvec[bi]/M_PI*180.) << ".txt";
+			cube.writegoftcube(filename.str());
+		}
+}
+
+/**
+ * @brief This stores the rendering of a slit in its raster, and writes out the raster when it is complete.
+ * @param task The rendering of the slit.
+ * @param view The index of the view (l-angle index times the number of b-angles plus the b-angle index).
+ * @param rendering The rendering of the slit.
+ */
+static void addslit(const RenderTask & task, const int view, FoMo::RenderCube & rendering)
+{
+	if (rendering.issparse()) rendering.densify();
+	// the slit is one column of pixels, with lambda_pixel wavelengths per pixel
+	FoMo::tgrid grid=rendering.readgrid();
+	FoMo::tphysvar intensity=rendering.readvar(0);
+	int ny=int(task.resolution[1]), nl=int(task.resolution[3]);
+	Raster * complete=NULL;
+	{
+		lock_guard<mutex> guard(rasterlock);
+		Raster & raster=rasters[task.raster];
+		if (raster.x.empty())
+		{
+			int nviews=task.lvec.size()*task.bvec.size();
+			raster.y_pixel=ny;
+			raster.lambda_pixel=nl;
+			raster.chiantifile=rendering.readchiantifile();
+			raster.abundfile=rendering.readabundfile();
+			raster.lambda0=rendering.readlambda0();
+			raster.unit=rendering.readunit();
+			raster.x.assign(nviews,vector<float>(raster.nsteps));
+			raster.y.assign(nviews,vector<float>(raster.nsteps*ny));
+			raster.intensity.assign(nviews,vector<float>(raster.nsteps*ny*nl));
+			raster.lambda.assign(nl,0);
+			if (nl > 1) for (int il=0; il<nl; il++) raster.lambda[il]=grid[2][il];
+		}
+		if (int(intensity.size()) != ny*nl)
+		{
+			cerr << "Error: the slit of raster " << raster.output << " has " << intensity.size() << " instead of " << ny*nl << " values" << endl;
+			exit(EXIT_FAILURE);
+		}
+		int t=task.rasterstep;
+		raster.x[view][t]=grid[0][0];
+		for (int iy=0; iy<ny; iy++) raster.y[view][t*ny+iy]=grid[1][iy*nl];
+		copy(intensity.begin(),intensity.end(),raster.intensity[view].begin()+t*ny*nl);
+		raster.ndone++;
+		if (raster.ndone == raster.nsteps*int(raster.x.size())) complete=&raster;
+	}
+	// all slits are in, and no other thread uses the raster anymore
+	if (complete)
+	{
+		cout << "Writing raster " << complete->output << endl << flush;
+		writeraster(*complete);
+		Raster done;
+		done.output=complete->output;
+		lock_guard<mutex> guard(rasterlock);
+		*complete=move(done);
+	}
+}
+
+/**
+ * @brief This does the renderings of a group.
+ * @param group The group.
+ * @param object The FoMoObject with the data of the snapshot.
+ */
+static void rendergroup(const RenderGroup & group, FoMo::FoMoObject & object)
+{
+	object.setchiantifile(group.chiantifile);
+	object.setabundfile(group.abundfile);
+	for (unsigned int i=0; i<group.tasks.size(); i++)
+	{
+		const RenderTask & task=group.tasks[i];
+		object.setrendermethod(task.method);
+		object.setresolution(int(task.resolution[0]),int(task.resolution[1]),int(task.resolution[2]),int(task.resolution[3]),task.resolution[4]);
+		object.setregionofinterest(task.roi);
+		object.setsparsespectra(task.sparse,task.sparsethreshold);
+		object.setrendercache(task.cache);
+		object.setwriteoutbinary(task.write.find("binary") != string::npos);
+		object.setwriteouttext(task.write.find("text") != string::npos);
+		object.setwriteoutzip(task.write.find("zip") != string::npos);
+		object.setoutfile(task.output);
+		if (task.raster < 0)
+		{
+			object.render(task.lvec,task.bvec);
+			continue;
+		}
+		// a slit of a raster is not written out, but collected in the raster
+		object.setwriteoutbinary(false);
+		object.setwriteouttext(false);
+		object.setwriteoutzip(false);
+		for (unsigned int li=0; li<task.lvec.size(); li++)
+			for (unsigned int bi=0; bi<task.bvec.size(); bi++)
+			{
+				object.render(task.lvec[li],task.bvec[bi]);
+				FoMo::RenderCube rendering=object.readrendering();
+				addslit(task,li*task.bvec.size()+bi,rendering);
+			}
+	}
+}
+
+/**
+ * @brief This is the loop of a worker thread. It does the groups of the snapshots that are in memory, and
+ * otherwise reads in the next snapshot, as long as fewer than maxloaded snapshots are in memory.
+ * @param maxloaded The maximum number of snapshots in memory.
+ */
+static void worker(const int maxloaded)
+{
+	unique_lock<mutex> guard(schedulelock);
+	while (ngroupsleft > 0)
+	{
+		// first look for a group of which the snapshot is in memory
+		int readygroup=-1;
+		for (unsigned int g=0; g<groups.size() && readygroup<0; g++)
+			if (!groups[g].started && snapshots[groups[g].snapshot].data) readygroup=g;
+		if (readygroup >= 0)
+		{
+			RenderGroup & group=groups[readygroup];
+			Snapshot & snapshot=snapshots[group.snapshot];
+			group.started=true;
+			// the last group of a snapshot takes over its data, the others work on a copy
+			bool last=true;
+			for (unsigned int g=0; g<groups.size(); g++)
+				if (groups[g].snapshot == group.snapshot && !groups[g].started) last=false;
+			unique_ptr<FoMo::FoMoObject> object;
+			if (last)
+			{
+				object=move(snapshot.data);
+				nloaded--;
+			}
+			else
+				object.reset(new FoMo::FoMoObject(*snapshot.data));
+			guard.unlock();
+			rendergroup(group,*object);
+			object.reset();
+			guard.lock();
+			ngroupsleft--;
+			schedulecondition.notify_all();
+			continue;
+		}
+		// otherwise, read in the next snapshot
+		int nextsnapshot=-1;
+		for (unsigned int s=0; s<snapshots.size() && nextsnapshot<0; s++)
+			if (snapshots[s].groupsleft > 0 && !snapshots[s].loading) nextsnapshot=s;
+		if (nextsnapshot >= 0 && nloaded < maxloaded)
+		{
+			Snapshot & snapshot=snapshots[nextsnapshot];
+			snapshot.loading=true;
+			nloaded++;
+			guard.unlock();
+			unique_ptr<FoMo::FoMoObject> object=loadsnapshot(snapshot);
+			guard.lock();
+			snapshot.data=move(object);
+			schedulecondition.notify_all();
+			continue;
+		}
+		schedulecondition.wait(guard);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned int nthreads=1;
+	int maxloaded=0;
+	bool dryrun=false;
+	bool profiling=false;
+	int option;
+	while ((option=getopt(argc,argv,"t:m:nph")) != -1)
+	{
+		switch (option)
+		{
+			case 't':
+				nthreads=max(atoi(optarg),1);
+				break;
+			case 'm':
+				maxloaded=max(atoi(optarg),1);
+				break;
+			case 'n':
+				dryrun=true;
+				break;
+			case 'p':
+				profiling=true;
+				break;
+			default:
+				cout << "Usage: " << argv[0] << " [-t threads] [-m snapshots] [-n] [-p] jobfile" << endl;
+				cout << "  -t threads   : the number of groups of renderings that are done at the same time (default 1)" << endl;
+				cout << "  -m snapshots : the maximum number of snapshots in memory (default: the number of threads)" << endl;
+				cout << "  -n           : only show the renderings that would be done" << endl;
+				cout << "  -p           : profile the stages of the renderings, and show the report at the end" << endl;
+				exit(option == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
+	}
+	if (optind != argc-1)
+	{
+		cerr << "Error: give one job file, see " << argv[0] << " -h" << endl;
+		exit(EXIT_FAILURE);
+	}
+	if (maxloaded == 0) maxloaded=nthreads;
+
+	readjobfile(argv[optind]);
+	sortgroups();
+	ngroupsleft=groups.size();
+	int nrenderings=0;
+	for (unsigned int g=0; g<groups.size(); g++)
+	{
+		nrenderings+=groups[g].tasks.size();
+		for (unsigned int i=0; i<groups[g].tasks.size(); i++)
+			if (groups[g].tasks[i].resolution[3] > 1) snapshots[groups[g].snapshot].spectroscopic=true;
+	}
+	cout << snapshots.size() << " snapshots, " << groups.size() << " emission computations, " << nrenderings << " renderings" << endl;
+
+	if (dryrun)
+	{
+		for (unsigned int g=0; g<groups.size(); g++)
+		{
+			cout << "snapshot " << snapshots[groups[g].snapshot].id << " (" << snapshots[groups[g].snapshot].file << "), ";
+			cout << "chiantifile " << groups[g].chiantifile << ", abundfile " << groups[g].abundfile << ":" << endl;
+			for (unsigned int i=0; i<groups[g].tasks.size(); i++)
+			{
+				const RenderTask & task=groups[g].tasks[i];
+				cout << "  " << task.method << " " << task.resolution[0] << "x" << task.resolution[1] << "x" << task.resolution[2];
+				cout << "x" << task.resolution[3] << ", " << task.lvec.size()*task.bvec.size() << " views";
+				if (task.raster >= 0) cout << ", slit x=" << task.roi[0] << " of snapshot " << task.rasterstep << " of the raster";
+				cout << " -> " << task.output << endl;
+			}
+		}
+		return EXIT_SUCCESS;
+	}
+
+	if (profiling) FoMo::setprofiling();
+	vector<thread> pool;
+	for (unsigned int i=0; i<nthreads; i++) pool.push_back(thread(worker,maxloaded));
+	for (unsigned int i=0; i<pool.size(); i++) pool[i].join();
+	if (profiling) cout << FoMo::profilingreport();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,141 @@
+#include "fomo-client.h"
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/**
+ * @brief This connects to a fomo-server.
+ * @param socketpath The path of the Unix socket on which the server listens.
+ */
+FoMo::FoMoClient::FoMoClient(const std::string socketpath)
+{
+	sockaddr_un address;
+	if (socketpath.size() >= sizeof(address.sun_path))
+	{
+		std::cerr << "Error: socket path " << socketpath << " is too long." << std::endl;
+		exit(EXIT_FAILURE);
+	}
+	socketfd=socket(AF_UNIX,SOCK_STREAM,0);
+	memset(&address,0,sizeof(address));
+	address.sun_family=AF_UNIX;
+	strncpy(address.sun_path,socketpath.c_str(),sizeof(address.sun_path)-1);
+	if (socketfd < 0 || connect(socketfd,(sockaddr *)&address,sizeof(address)) < 0)
+	{
+		std::cerr << "Error: cannot connect to fomo-server on " << socketpath << ": " << strerror(errno) << std::endl;
+		exit(EXIT_FAILURE);
+	}
+}
+
+FoMo::FoMoClient::~FoMoClient()
+{
+	close(socketfd);
+}
+
+/**
+ * @brief This sends a request to the server and waits for the reply.
+ * @param line The request, without the trailing newline.
+ * @return The reply of the server, without the trailing newline. If the connection was lost, "ERROR connection closed" is returned.
+ */
+std::string FoMo::FoMoClient::request(const std::string line)
+{
+	std::string message=line+"\n";
+	size_t sent=0;
+	while (sent < message.size())
+	{
+		ssize_t n=send(socketfd,message.c_str()+sent,message.size()-sent,MSG_NOSIGNAL);
+		if (n <= 0) return "ERROR connection closed";
+		sent+=n;
+	}
+	size_t end;
+	while ((end=buffer.find('\n')) == std::string::npos)
+	{
+		char chunk[4096];
+		ssize_t n=recv(socketfd,chunk,sizeof(chunk),0);
+		if (n <= 0) return "ERROR connection closed";
+		buffer.append(chunk,n);
+	}
+	std::string reply=buffer.substr(0,end);
+	buffer.erase(0,end+1);
+	return reply;
+}
+
+/**
+ * @brief This loads a snapshot into the server.
+ * @param id The name under which the server keeps the snapshot.
+ * @param datafile A text file with columns x, y, z, n, T, vx, vy, vz, as example/testfile.txt. It is read by the server,
+ * so a relative path is relative to the working directory of the server.
+ * @return True if the snapshot was loaded.
+ */
+bool FoMo::FoMoClient::load(const std::string id, const std::string datafile)
+{
+	std::string reply=request("load "+id+" "+datafile);
+	if (reply.compare(0,2,"OK")) std::cerr << reply << std::endl;
+	return !reply.compare(0,2,"OK");
+}
+
+/**
+ * @brief This removes a snapshot from the server.
+ * @param id The name of the snapshot.
+ * @return True if the snapshot was removed.
+ */
+bool FoMo::FoMoClient::unload(const std::string id)
+{
+	std::string reply=request("unload "+id);
+	if (reply.compare(0,2,"OK")) std::cerr << reply << std::endl;
+	return !reply.compare(0,2,"OK");
+}
+
+/**
+ * @brief This lists the snapshots that are kept by the server.
+ * @return The names of the snapshots.
+ */
+std::vector<std::string> FoMo::FoMoClient::list()
+{
+	std::stringstream ss(request("list"));
+	std::vector<std::string> ids;
+	std::string id;
+	ss >> id; // skip the "OK"
+	while (ss >> id) ids.push_back(id);
+	return ids;
+}
+
+/**
+ * @brief This lets the server render one view of a loaded snapshot.
+ *
+ * The arguments are the same as for FoMoObject.setchiantifile(), FoMoObject.setabundfile(), FoMoObject.setrendermethod(),
+ * FoMoObject.setresolution(), FoMoObject.render() and FoMoObject.setregionofinterest().
+ * @return The binary file with the rendering, which can be read with readgoftcube_dat. If the rendering failed, an
+ * empty string is returned.
+ */
+std::string FoMo::FoMoClient::render(const std::string id, const std::string chiantifile, const std::string abundfile, const std::string rendermethod,
+	const int x_pixel, const int y_pixel, const int z_pixel, const int lambda_pixel, const double lambda_width,
+	const double l, const double b, const std::string outfile, const std::vector<int> roi)
+{
+	std::stringstream ss;
+	ss << std::setprecision(17);
+	ss << "render " << id << " " << chiantifile << " " << abundfile << " " << rendermethod << " ";
+	ss << x_pixel << " " << y_pixel << " " << z_pixel << " " << lambda_pixel << " " << lambda_width << " ";
+	ss << l << " " << b << " " << outfile;
+	if (roi.size() == 4) ss << " roi " << roi[0] << " " << roi[1] << " " << roi[2] << " " << roi[3];
+	std::string reply=request(ss.str());
+	if (reply.compare(0,3,"OK "))
+	{
+		std::cerr << reply << std::endl;
+		return "";
+	}
+	return reply.substr(3);
+}
+
+/**
+ * @brief This asks the server to stop. The server finishes the connections that are still open.
+ */
+void FoMo::FoMoClient::shutdown()
+{
+	request("shutdown");
+}
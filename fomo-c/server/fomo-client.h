@@ -0,0 +1,42 @@
+#ifndef FOMO_CLIENT_H
+#define FOMO_CLIENT_H
+
+#include <string>
+#include <vector>
+
+/**
+ * @file
+ * This file contains the client library for fomo-server. The server keeps snapshots and their emission cubes
+ * in memory, such that a script only pays the setup cost once. See fomo-server.cpp for the protocol.
+ */
+
+namespace FoMo
+{
+	/**
+	 * @brief This class connects to a running fomo-server over its Unix socket.
+	 *
+	 * Every method sends one request and waits for its reply. The replies start with "OK" or "ERROR". The
+	 * connection is closed when the FoMoClient is destroyed.
+	 */
+	class FoMoClient
+	{
+	protected:
+		int socketfd;
+		std::string buffer;
+	public:
+		FoMoClient(const std::string socketpath = "fomo-server.sock");
+		~FoMoClient();
+		FoMoClient(const FoMoClient &) = delete;
+		FoMoClient & operator=(const FoMoClient &) = delete;
+		std::string request(const std::string line);
+		bool load(const std::string id, const std::string datafile);
+		bool unload(const std::string id);
+		std::vector<std::string> list();
+		std::string render(const std::string id, const std::string chiantifile, const std::string abundfile, const std::string rendermethod,
+			const int x_pixel, const int y_pixel, const int z_pixel, const int lambda_pixel, const double lambda_width,
+			const double l, const double b, const std::string outfile, const std::vector<int> roi = std::vector<int>());
+		void shutdown();
+	};
+}
+
+#endif
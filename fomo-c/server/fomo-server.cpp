@@ -0,0 +1,396 @@
+#include "FoMo.h"
+#include "fomo-tools.h"
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cmath>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+#include <getopt.h>
+
+/**
+ * @file
+ * This file contains fomo-server, a long-running process that keeps snapshots in memory and renders them on request.
+ *
+ * Scripts that render a few views of a snapshot spend most of their time reading in the data and computing the
+ * emission. fomo-server reads in every snapshot once, and keeps the emission (the GoftCube) for every
+ * combination of snapshot and chiantifile/abundfile that was requested before. Requests are sent over a Unix
+ * socket (see fomo-client.h, or python/fomoclient.py). The main thread reads the requests of all connections, and
+ * passes them on to a pool of threads of fixed size, so that any number of clients can stay connected. The 
+ * requests of one connection are answered in order, one after the other. Renderings of the same snapshot are done 
+ * one after the other, renderings of different snapshots are done at the same time.
+ *
+ * The protocol is line based: every request is one line of words separated by spaces, and the server answers
+ * with one line, starting with "OK" or "ERROR". File names can therefore not contain spaces. The requests are
+ *  - load <id> <file> : read in a text file with columns x, y, z, n, T, vx, vy, vz (as example/testfile.txt) as snapshot <id>
+ *  - unload <id> : remove snapshot <id> from memory
+ *  - list : answer with the ids of the snapshots in memory
+ *  - render <id> <chiantifile> <abundfile> <rendermethod> <x_pixel> <y_pixel> <z_pixel> <lambda_pixel> <lambda_width> <l> <b> <outfile> [roi <xmin> <xmax> <ymin> <ymax>] :
+ *    render snapshot <id> (see FoMoObject.render()), and answer with the name of the binary file in which the rendering is written
+ *  - shutdown : stop accepting connections, and stop after the open connections are closed
+ *
+ * The requests are checked before they are passed on to FoMo (e.g. the chiantifile and abundfile should be readable), 
+ * but FoMo stops the program on errors that are only found during the rendering (such as an imaging rendering with a 
+ * spectroscopic chiantifile, or an abundfile without the element). Then the server stops as well, and the clients 
+ * see their connection closed.
+ */
+
+using namespace std;
+
+/**
+ * @brief A snapshot kept by the server.
+ *
+ * The data is kept in a FoMoObject, and for every chiantifile and abundfile a FoMoObject is made that reads this
+ * data without copying it (see FoMoObject.sharedata()), in which the emission is kept between renderings. These 
+ * share the spatial index and the mapping of every view that was rendered before (see FoMoObject.setreuseindex()).
+ */
+struct Snapshot
+{
+	mutex lock;
+	FoMo::FoMoObject data;
+	map<string, unique_ptr<FoMo::FoMoObject> > emission;
+};
+
+static mutex snapshotslock;
+static map<string, shared_ptr<Snapshot> > snapshots;
+
+/**
+ * @brief A connection of a client, of which the main thread reads the requests.
+ */
+struct Connection
+{
+	/** The received requests that have not been passed on to the pool yet, the last one possibly incomplete. */
+	string buffer;
+	/** True while a request of this connection is handled by the pool: the next request waits until it is answered. */
+	bool busy=false;
+	/** True if the client has closed the connection. */
+	bool closed=false;
+};
+
+static mutex connectionslock;
+static map<int, Connection> connections;
+
+static mutex queuelock;
+static condition_variable queuecondition;
+// the requests waiting for a thread of the pool, with the socket to which the answer is sent
+static queue<pair<int, string> > requests;
+static atomic<bool> stopping(false);
+static int listenfd=-1;
+// a thread of the pool writes to this pipe to wake up the main thread when it has answered a request
+static int wakeup[2]={-1,-1};
+static string socketpath="fomo-server.sock";
+
+/**
+ * @brief This returns the snapshot with a given id.
+ * @param id The id of the snapshot.
+ * @return The snapshot, or an empty pointer if it is not loaded.
+ */
+static shared_ptr<Snapshot> findsnapshot(const string id)
+{
+	lock_guard<mutex> guard(snapshotslock);
+	map<string, shared_ptr<Snapshot> >::iterator it=snapshots.find(id);
+	if (it == snapshots.end()) return shared_ptr<Snapshot>();
+	return it->second;
+}
+
+/**
+ * @brief This handles a render request.
+ * @param words The words of the request, starting with "render".
+ * @return The answer to the client.
+ */
+static string render(const vector<string> & words)
+{
+	if (words.size() != 13 && words.size() != 18) return "ERROR usage: render <id> <chiantifile> <abundfile> <rendermethod> <x_pixel> <y_pixel> <z_pixel> <lambda_pixel> <lambda_width> <l> <b> <outfile> [roi <xmin> <xmax> <ymin> <ymax>]";
+	shared_ptr<Snapshot> snapshot=findsnapshot(words[1]);
+	if (!snapshot) return "ERROR snapshot "+words[1]+" is not loaded";
+	string chiantifile=words[2], abundfile=words[3], rendermethod=words[4], outfile=words[12];
+	// the library stops the program on invalid settings, so they are checked here
+	vector<string> methods=FoMo::rendermethods();
+	if (find(methods.begin(),methods.end(),rendermethod) == methods.end()) return "ERROR unknown rendermethod "+rendermethod;
+	if (!ifstream(chiantifile).good()) return "ERROR cannot read chiantifile "+chiantifile;
+	if (abundfile != "/empty" && !ifstream(abundfile).good()) return "ERROR cannot read abundfile "+abundfile;
+	int x_pixel, y_pixel, z_pixel, lambda_pixel;
+	double lambda_width, l, b;
+	stringstream ss(words[5]+" "+words[6]+" "+words[7]+" "+words[8]+" "+words[9]+" "+words[10]+" "+words[11]);
+	if (!(ss >> x_pixel >> y_pixel >> z_pixel >> lambda_pixel >> lambda_width >> l >> b) || x_pixel<1 || y_pixel<1 || z_pixel<1 || lambda_pixel<1)
+		return "ERROR invalid resolution or angles";
+	vector<int> roi;
+	if (words.size() == 18)
+	{
+		if (words[13] != "roi") return "ERROR expected roi instead of "+words[13];
+		roi.resize(4);
+		stringstream roiss(words[14]+" "+words[15]+" "+words[16]+" "+words[17]);
+		if (!(roiss >> roi[0] >> roi[1] >> roi[2] >> roi[3])) return "ERROR invalid region of interest";
+		if (max(roi[0],0) > min(roi[1],x_pixel-1) || max(roi[2],0) > min(roi[3],y_pixel-1))
+			return "ERROR the region of interest does not contain any pixel of the image";
+	}
+
+	lock_guard<mutex> guard(snapshot->lock);
+	string tablekey=chiantifile+"\n"+abundfile;
+	unique_ptr<FoMo::FoMoObject> & object=snapshot->emission[tablekey];
+	if (!object)
+	{
+		object.reset(new FoMo::FoMoObject());
+		object->sharedata(snapshot->data);
+		object->shareindex(snapshot->data);
+		object->setchiantifile(chiantifile);
+		object->setabundfile(abundfile);
+		object->setwriteoutbinary(true);
+		object->setwriteouttext(false);
+		object->setwriteoutzip(false);
+	}
+	object->setrendermethod(rendermethod);
+	object->setresolution(x_pixel,y_pixel,z_pixel,lambda_pixel,lambda_width);
+	object->setregionofinterest(roi);
+	object->setoutfile(outfile);
+	object->render(l,b);
+
+	// the binary output file of the view
+	string filename=object->renderfilename(l,b);
+	return "OK "+filename.substr(0,filename.rfind("."))+".dat";
+}
+
+/**
+ * @brief This handles one request.
+ * @param line The request.
+ * @return The answer to the client.
+ */
+static string handlerequest(const string line)
+{
+	stringstream ss(line);
+	vector<string> words;
+	string word;
+	while (ss >> word) words.push_back(word);
+	if (words.empty()) return "ERROR empty request";
+
+	if (words[0] == "load")
+	{
+		if (words.size() != 3) return "ERROR usage: load <id> <file>";
+		shared_ptr<Snapshot> snapshot(new Snapshot);
+		int npoints=readtextsnapshot(words[2],snapshot->data);
+		if (npoints < 0) return "ERROR cannot read "+words[2];
+		// the copies for every chiantifile share the spatial index and the mapping of the views
+		snapshot->data.setreuseindex();
+		lock_guard<mutex> guard(snapshotslock);
+		snapshots[words[1]]=snapshot;
+		stringstream answer;
+		answer << "OK " << npoints;
+		return answer.str();
+	}
+	if (words[0] == "unload")
+	{
+		if (words.size() != 2) return "ERROR usage: unload <id>";
+		lock_guard<mutex> guard(snapshotslock);
+		if (!snapshots.erase(words[1])) return "ERROR snapshot "+words[1]+" is not loaded";
+		return "OK";
+	}
+	if (words[0] == "list")
+	{
+		string answer="OK";
+		lock_guard<mutex> guard(snapshotslock);
+		for (map<string, shared_ptr<Snapshot> >::const_iterator it=snapshots.begin(); it!=snapshots.end(); ++it)
+			answer+=" "+it->first;
+		return answer;
+	}
+	if (words[0] == "render") return render(words);
+	if (words[0] == "shutdown")
+	{
+		stopping=true;
+		// this wakes up the poll() in the main thread
+		char c=0;
+		if (write(wakeup[1],&c,1) < 0) cerr << "Warning: cannot wake up the main thread." << endl;
+		return "OK";
+	}
+	return "ERROR unknown request "+words[0];
+}
+
+/**
+ * @brief This passes the next request of every connection that is not busy on to the pool, and closes the
+ * connections of which the client has left and all requests have been answered.
+ */
+static void dispatchrequests()
+{
+	lock_guard<mutex> guard(connectionslock);
+	map<int, Connection>::iterator it=connections.begin();
+	while (it != connections.end())
+	{
+		Connection & connection=it->second;
+		size_t end=connection.buffer.find('\n');
+		if (!connection.busy && end != string::npos)
+		{
+			connection.busy=true;
+			lock_guard<mutex> queueguard(queuelock);
+			requests.push(make_pair(it->first,connection.buffer.substr(0,end)));
+			connection.buffer.erase(0,end+1);
+			queuecondition.notify_one();
+		}
+		if (connection.closed && !connection.busy && end == string::npos)
+		{
+			close(it->first);
+			it=connections.erase(it);
+		}
+		else
+			++it;
+	}
+}
+
+/**
+ * @brief This is called when the program stops, also when FoMo calls exit() on an error during a rendering.
+ *
+ * In the latter case, the other threads are still running, and the static objects cannot be destroyed. The
+ * program is then stopped immediately.
+ */
+static void stopserver()
+{
+	unlink(socketpath.c_str());
+	if (stopping) return;
+	cerr << "fomo-server stopped on an error in FoMo." << endl << flush;
+	_exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief This is the loop of a thread in the pool: it takes requests from the queue until the server stops.
+ */
+static void worker()
+{
+	while (true)
+	{
+		pair<int, string> request;
+		{
+			unique_lock<mutex> guard(queuelock);
+			queuecondition.wait(guard,[]{return !requests.empty();});
+			request=requests.front();
+			requests.pop();
+		}
+		// a negative socket tells the thread to stop
+		if (request.first < 0) return;
+		string answer=handlerequest(request.second)+"\n";
+		// if the client has left, this fails, and the main thread closes the connection
+		send(request.first,answer.c_str(),answer.size(),MSG_NOSIGNAL);
+		{
+			lock_guard<mutex> guard(connectionslock);
+			connections[request.first].busy=false;
+		}
+		char c=0;
+		if (write(wakeup[1],&c,1) < 0) cerr << "Warning: cannot wake up the main thread." << endl;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned int nthreads=thread::hardware_concurrency();
+	if (nthreads == 0) nthreads=4;
+	int option;
+	while ((option=getopt(argc,argv,"s:t:h")) != -1)
+	{
+		switch (option)
+		{
+			case 's':
+				socketpath=optarg;
+				break;
+			case 't':
+				nthreads=max(atoi(optarg),1);
+				break;
+			default:
+				cout << "Usage: " << argv[0] << " [-s socket] [-t threads]" << endl;
+				cout << "  -s socket  : the Unix socket to listen on (default fomo-server.sock)" << endl;
+				cout << "  -t threads : the number of requests that are handled at the same time (default: number of cores)" << endl;
+				exit(option == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
+	}
+
+	sockaddr_un address;
+	if (socketpath.size() >= sizeof(address.sun_path))
+	{
+		cerr << "Error: socket path " << socketpath << " is too long." << endl;
+		exit(EXIT_FAILURE);
+	}
+	memset(&address,0,sizeof(address));
+	address.sun_family=AF_UNIX;
+	strncpy(address.sun_path,socketpath.c_str(),sizeof(address.sun_path)-1);
+	unlink(socketpath.c_str());
+	listenfd=socket(AF_UNIX,SOCK_STREAM,0);
+	if (listenfd < 0 || bind(listenfd,(sockaddr *)&address,sizeof(address)) < 0 || listen(listenfd,16) < 0 || pipe(wakeup) < 0)
+	{
+		cerr << "Error: cannot listen on " << socketpath << ": " << strerror(errno) << endl;
+		exit(EXIT_FAILURE);
+	}
+	atexit(stopserver);
+	cout << "fomo-server listening on " << socketpath << " with " << nthreads << " threads" << endl << flush;
+
+	vector<thread> pool;
+	for (unsigned int i=0; i<nthreads; i++) pool.push_back(thread(worker));
+
+	// the main thread accepts the connections and reads the requests, until it is stopped and all connections are closed
+	while (true)
+	{
+		vector<pollfd> fds;
+		fds.push_back({wakeup[0],POLLIN,0});
+		if (!stopping) fds.push_back({listenfd,POLLIN,0});
+		{
+			lock_guard<mutex> guard(connectionslock);
+			if (stopping && connections.empty()) break;
+			for (map<int, Connection>::const_iterator it=connections.begin(); it!=connections.end(); ++it)
+				if (!it->second.closed) fds.push_back({it->first,POLLIN,0});
+		}
+		if (poll(fds.data(),fds.size(),-1) < 0)
+		{
+			if (errno == EINTR) continue;
+			cerr << "Error: poll failed: " << strerror(errno) << endl;
+			break;
+		}
+		for (unsigned int i=0; i<fds.size(); i++)
+		{
+			if (!fds[i].revents) continue;
+			char chunk[4096];
+			if (fds[i].fd == wakeup[0])
+			{
+				if (read(wakeup[0],chunk,sizeof(chunk)) < 0) cerr << "Warning: cannot read the wake-up pipe." << endl;
+			}
+			else if (fds[i].fd == listenfd)
+			{
+				int fd=accept(listenfd,NULL,NULL);
+				if (fd < 0) continue;
+				lock_guard<mutex> guard(connectionslock);
+				connections[fd]=Connection();
+			}
+			else
+			{
+				ssize_t n=recv(fds[i].fd,chunk,sizeof(chunk),0);
+				lock_guard<mutex> guard(connectionslock);
+				if (n > 0)
+					connections[fds[i].fd].buffer.append(chunk,n);
+				else
+					connections[fds[i].fd].closed=true;
+			}
+		}
+		dispatchrequests();
+	}
+
+	{
+		lock_guard<mutex> guard(queuelock);
+		for (unsigned int i=0; i<nthreads; i++) requests.push(make_pair(-1,string()));
+		queuecondition.notify_all();
+	}
+	for (unsigned int i=0; i<pool.size(); i++) pool[i].join();
+	close(listenfd);
+	close(wakeup[0]);
+	close(wakeup[1]);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,46 @@
+#include "fomo-tools.h"
+#include <fstream>
+#include <vector>
+
+/**
+ * @brief This reads a snapshot from a text file.
+ * @param filename The file with columns x, y, z (Mm), n (cm^-3), T (K), vx, vy, vz (m/s).
+ * @param object The FoMoObject in which the data is stored.
+ * @param velocities If false, the velocities are skipped, which is enough for imaging renderings.
+ * @return The number of points read in, or -1 if the file could not be read.
+ */
+int readtextsnapshot(const std::string filename, FoMo::FoMoObject & object, const bool velocities)
+{
+	std::ifstream filetoread(filename);
+	if (!filetoread.is_open()) return -1;
+	std::vector<std::string> unitvec;
+	for (unsigned int i=0; i<3; i++) unitvec.push_back("Mm");
+	unitvec.push_back("cm^{-3}");
+	unitvec.push_back("K");
+	unsigned int nvars=velocities ? 5 : 2;
+	for (unsigned int i=2; i<nvars; i++) unitvec.push_back("m s^{-1}");
+
+	FoMo::tgrid grid(3);
+	FoMo::tvars vars(nvars);
+	double tmpvar;
+	int npoints=0;
+	while (filetoread >> tmpvar)
+	{
+		grid[0].push_back(tmpvar);
+		for (unsigned int i=1; i<3; i++)
+		{
+			filetoread >> tmpvar;
+			grid[i].push_back(tmpvar);
+		}
+		for (unsigned int i=0; i<5; i++)
+		{
+			filetoread >> tmpvar;
+			if (i < nvars) vars[i].push_back(tmpvar);
+		}
+		if (!filetoread) return -1;
+		npoints++;
+	}
+	if (npoints == 0) return -1;
+	object.setdata(grid,vars,&unitvec);
+	return npoints;
+}
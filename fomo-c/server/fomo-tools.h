@@ -0,0 +1,14 @@
+#ifndef FOMO_TOOLS_H
+#define FOMO_TOOLS_H
+
+#include "FoMo.h"
+#include <string>
+
+/**
+ * @file
+ * This file contains the routines that are shared between fomo-server and fomo-batch.
+ */
+
+int readtextsnapshot(const std::string filename, FoMo::FoMoObject & object, const bool velocities=true);
+
+#endif
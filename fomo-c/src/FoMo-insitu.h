@@ -0,0 +1,64 @@
+#ifndef FOMO_INSITU_H
+#define FOMO_INSITU_H
+
+/**
+ * @file
+ * This file contains the in-situ interface of FoMo, with which a running simulation renders its data without writing
+ * snapshots. It is a C interface, which can be called from Fortran through the module in fomo_insitu.f90.
+ *
+ * A typical coupling looks like this:
+ * @code
+ * fomo_insitu * insitu=fomo_insitu_create(3);
+ * fomo_insitu_setemission(insitu,"goft_table_fe_12_0194_abco.dat","/empty");
+ * fomo_insitu_setresolution(insitu,300,300,300,30,200000);
+ * fomo_insitu_addview(insitu,0.,1.5708);
+ * fomo_insitu_setoutfile(insitu,"run.");
+ * fomo_insitu_setcadence(insitu,100,0.);
+ * fomo_insitu_setthreads(insitu,4);
+ * for (step=0; ...; step++)
+ * {
+ *	// advance the solver
+ *	if (fomo_insitu_due(insitu,step,time))
+ *	{
+ *		fomo_insitu_beginstep(insitu,step,time);
+ *		for (every block) fomo_insitu_addblock(insitu,shape,lo,hi,x0,dx,n,T,vx,vy,vz);
+ *		fomo_insitu_endstep(insitu);
+ *	}
+ * }
+ * fomo_insitu_finish(insitu);
+ * @endcode
+ * fomo_insitu_endstep() returns as soon as the data of the blocks has been taken over: the rendering is done by a
+ * thread of FoMo, on the OpenMP threads set with fomo_insitu_setthreads(), while the solver continues. With MPI, all
+ * processes call these functions, and fomo_insitu_endstep() gathers the blocks of all processes on process 0,
+ * which renders the complete domain. Errors are reported on stderr and end the program, as in the rest of FoMo.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief The in-situ renderer, which is only used through the functions of this file. */
+typedef struct fomo_insitu fomo_insitu;
+
+fomo_insitu * fomo_insitu_create(const int dim);
+void fomo_insitu_setemission(fomo_insitu * insitu, const char * chiantifile, const char * abundfile);
+void fomo_insitu_setrendermethod(fomo_insitu * insitu, const char * rendermethod);
+void fomo_insitu_setresolution(fomo_insitu * insitu, const int x_pixel, const int y_pixel, const int z_pixel, const int lambda_pixel, const double lambda_width);
+void fomo_insitu_addview(fomo_insitu * insitu, const double l, const double b);
+void fomo_insitu_setoutfile(fomo_insitu * insitu, const char * outfile);
+void fomo_insitu_setunits(fomo_insitu * insitu, const double lengthunit, const double densityunit, const double temperatureunit, const double velocityunit);
+void fomo_insitu_setcadence(fomo_insitu * insitu, const int steps, const double time);
+void fomo_insitu_setthreads(fomo_insitu * insitu, const int nthreads);
+int fomo_insitu_due(fomo_insitu * insitu, const int step, const double time);
+void fomo_insitu_beginstep(fomo_insitu * insitu, const int step, const double time);
+void fomo_insitu_addblock(fomo_insitu * insitu, const int * shape, const int * lo, const int * hi, const double * x0, const double * dx,
+	const double * n, const double * T, const double * vx, const double * vy, const double * vz);
+void fomo_insitu_endstep(fomo_insitu * insitu);
+void fomo_insitu_wait(fomo_insitu * insitu);
+void fomo_insitu_finish(fomo_insitu * insitu);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,27 +1,686 @@
 #include <vector>
 #include <string>
+#include <cstdint>
+#include <algorithm>
+#include <iostream>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstring>
+#include <cmath>
+// the rank of the process, and the memory shared between the ranks of a node (see fomo-sharedmemory.cpp)
+#ifdef HAVEMPI
+#include <mpi.h>
+#endif
 
 const double Mmperarcsec=0.715; // how many Mm fit in one arcsec
 
+// binary input and output, in fomo-io.cpp
+void writegoftcube_binary(const FoMo::GoftCube & goftcube, const std::string filename);
+void writerendercube_sparse(const FoMo::RenderCube & rendercube, const std::string filename);
+bool readrendercube_binary(const std::string filename, FoMo::RenderCube & rendercube);
+
 namespace FoMo
 {
+	// Morton curve doing magicbits, as in example/example_mpi_amrvac/FoMo-amrvac.h
+	// method to seperate bits from a given integer 3 positions apart
+	inline uint64_t splitBy3(unsigned int a)
+	{
+		uint64_t x = a & 0x1fffff; // we only look at the first 21 bits
+		x = (x | x << 32) & 0x1f00000000ffff;
+		x = (x | x << 16) & 0x1f0000ff0000ff;
+		x = (x | x << 8) & 0x100f00f00f00f00f;
+		x = (x | x << 4) & 0x10c30c30c30c30c3;
+		x = (x | x << 2) & 0x1249249249249249;
+		return x;
+	}
+	
+	inline uint64_t mortonEncode_magicbits(unsigned int x, unsigned int y, unsigned int z)
+	{
+		return splitBy3(x) | splitBy3(y) << 1 | splitBy3(z) << 2;
+	}
+	
+	/**
+	 * @brief LazyEmission computes the emission of the data points of a DataCube only when they are read.
+	 * 
+	 * This replaces the emission columns (peak emission and line width) of a GoftCube computed with emissionfromdatacube(), 
+	 * with identical values. The emission is computed per block of CompressedVar::blocksize data points, the first time 
+	 * a point of the block is read, and kept for later look-ups. Blocks without any point that is sampled by a ray 
+	 * are never computed nor allocated. The look-ups are thread-safe. The DataCube should not be modified or moved 
+	 * as long as the LazyEmission is in use.
+	 */
+	class LazyEmission
+	{
+	protected:
+		const DataCube * datacube;
+		tphysvar tempgrid;
+		tphysvar rhogrid;
+		tphysvar goftvec;
+		unsigned int nt;
+		unsigned int nrho;
+		double lambda0;
+		double widthconst;
+		double emissionconst;
+		bool imaging;
+		std::string unit;
+		/** The peak emission and line width of block b, interleaved, in blocks[b], once blockdone[b] has been passed. */
+		std::vector<std::vector<float> > blocks;
+		std::unique_ptr<std::once_flag[]> blockdone;
+		/** The number of data points of which the emission has been computed. */
+		std::atomic<unsigned int> computed;
+		void computeblock(const unsigned int b);
+		void computepoint(const unsigned int i, const float rhovalue, const float Tvalue, float & peak, float & width) const;
+	public:
+		LazyEmission(const DataCube & datacube, const std::string chiantifile, const std::string abundfile, const FoMoObservationType observationtype);
+		/**
+		 * @brief This returns the emission of a data point.
+		 * @param i The index of the data point.
+		 * @param column 0 for the peak emission, 1 for the line width.
+		 * @return The value, as it would be in column dim+column of the GoftCube.
+		 */
+		inline float read(const unsigned int i, const unsigned int column)
+		{
+			unsigned int b=i/CompressedVar::blocksize;
+			std::call_once(blockdone[b],&LazyEmission::computeblock,this,b);
+			return blocks[b][2*(i-b*CompressedVar::blocksize)+column];
+		}
+		const DataCube & readdatacube() const;
+		double readlambda0() const;
+		std::string readunit() const;
+		unsigned int readncomputed() const;
+		void computeall(tphysvar & peak, tphysvar & width) const;
+	};
+	
+	/**
+	 * @brief ColumnReader gives access to one column of a DataCube, without copying it.
+	 * 
+	 * Columns 0 to dim-1 are the coordinates, columns dim to dim+nvars-1 are the variables. If the DataCube 
+	 * is compressed, the block containing the requested element is decompressed into a buffer, so that consecutive 
+	 * look-ups in the same block are cheap. A ColumnReader is not thread-safe: each thread should construct its own.
+	 * The DataCube should not be modified as long as the ColumnReader is in use. A ColumnReader can also read 
+	 * the emission columns of a LazyEmission.
+	 */
+	class ColumnReader
+	{
+	protected:
+		const float * plain;
+		const CompressedVar * compressed;
+		LazyEmission * lazy;
+		unsigned int lazycolumn;
+		unsigned int block;
+		std::vector<float> buffer;
+	public:
+		ColumnReader(const DataCube & datacube, const unsigned int column);
+		ColumnReader(LazyEmission & emission, const unsigned int column);
+		inline float operator[](const unsigned int i)
+		{
+			if (plain) return plain[i];
+			if (lazy) return lazy->read(i,lazycolumn);
+			unsigned int requestedblock=i/CompressedVar::blocksize;
+			if (requestedblock != block)
+			{
+				compressed->decompressblock(requestedblock,buffer.data());
+				block=requestedblock;
+			}
+			return buffer[i-requestedblock*CompressedVar::blocksize];
+		}
+		/**
+		 * @brief This gives access to the elements of block b, i.e. from element b*CompressedVar::blocksize on.
+		 * 
+		 * This is not available for the emission columns of a LazyEmission.
+		 * @param b The block.
+		 * @return A pointer to the first element of the block, valid until the next look-up.
+		 */
+		inline const float * readblock(const unsigned int b)
+		{
+			if (plain) return plain+size_t(b)*CompressedVar::blocksize;
+			if (b != block)
+			{
+				compressed->decompressblock(b,buffer.data());
+				block=b;
+			}
+			return buffer.data();
+		}
+	};
+
+	/**
+	 * @brief SharedVector is a std::vector that can instead read its elements from memory owned by someone else.
+	 * 
+	 * The spatial indexes are built in the std::vector. After attach(), the const accessors read the attached array 
+	 * instead (e.g. in a window shared by the MPI ranks on a node, see SharedLayout), and the std::vector is empty. 
+	 * The attached memory is not copied, and should outlive the SharedVector or be detached with detach() first.
+	 */
+	template <typename T> class SharedVector: public std::vector<T>
+	{
+	protected:
+		const T * attached=NULL;
+		size_t nattached=0;
+	public:
+		using std::vector<T>::vector;
+		SharedVector() {}
+		SharedVector(const std::vector<T> & v): std::vector<T>(v) {}
+		/**
+		 * @brief This lets the const accessors read an array in memory, and releases the std::vector.
+		 * @param data The array.
+		 * @param n The number of elements of the array.
+		 */
+		void attach(const T * data, const size_t n)
+		{
+			std::vector<T>().swap(*this);
+			attached=data;
+			nattached=n;
+		}
+		/**
+		 * @brief This copies the attached array into the std::vector, so that the attached memory can be released.
+		 */
+		void detach()
+		{
+			if (!attached) return;
+			this->assign(attached,attached+nattached);
+			attached=NULL;
+			nattached=0;
+		}
+		const T & operator[](const size_t i) const {return attached ? attached[i] : std::vector<T>::operator[](i);}
+		T & operator[](const size_t i) {return std::vector<T>::operator[](i);}
+		const T * data() const {return attached ? attached : std::vector<T>::data();}
+		T * data() {return std::vector<T>::data();}
+		size_t size() const {return attached ? nattached : std::vector<T>::size();}
+	};
+	
+	/**
+	 * @brief SharedLayout places the members of a spatial index in one block of memory.
+	 * 
+	 * The members are passed one by one to operator(), in the same order for every pass (see KDTree::layout()). The 
+	 * Size pass only adds up the bytes that are needed. The Write pass copies the members into the block. The 
+	 * Attach pass reads the other members back and attaches the SharedVector members to the block, so that the index 
+	 * is used without copying its arrays. The Detach pass copies the arrays out of the block again. Every member is 
+	 * aligned to 8 bytes. The block should be written and attached by programs that have the same binary layout.
+	 */
+	class SharedLayout
+	{
+	public:
+		enum Pass {Size, Write, Attach, Detach};
+	protected:
+		Pass pass;
+		char * memory;
+		size_t offset;
+		static size_t align(const size_t bytes) {return (bytes+7)/8*8;}
+	public:
+		SharedLayout(const Pass inpass, char * inmemory = NULL): pass(inpass), memory(inmemory), offset(0) {}
+		template <typename T> void operator()(T & member)
+		{
+			if (pass == Write) std::memcpy(memory+offset,&member,sizeof(T));
+			if (pass == Attach) std::memcpy(&member,memory+offset,sizeof(T));
+			offset+=align(sizeof(T));
+		}
+		template <typename T> void operator()(SharedVector<T> & member)
+		{
+			uint64_t n=member.size();
+			(*this)(n);
+			if (pass == Write) std::memcpy(memory+offset,member.data(),n*sizeof(T));
+			if (pass == Attach) member.attach(reinterpret_cast<const T *>(memory+offset),n);
+			if (pass == Detach) member.detach();
+			offset+=align(n*sizeof(T));
+		}
+		/**
+		 * @brief This returns the number of bytes of the members that have been passed.
+		 * @return The size of the block.
+		 */
+		size_t size() const {return offset;}
+		/**
+		 * @brief This returns the pass of the SharedLayout.
+		 * @return The pass.
+		 */
+		Pass readpass() const {return pass;}
+	};
+	
+	/**
+	 * @brief KDTree is an implicit kd-tree of 3D points, for nearest neighbour queries within a maximum distance.
+	 *
+	 * The tree is balanced: every node splits its points at the median along the widest dimension of its cell, until at most
+	 * leafsize points are left. The nodes are therefore not stored, only the split values in breadth-first order,
+	 * and the coordinates of the points (single precision, sorted by leaf). The distances to the points of a leaf
+	 * are computed in one vectorised loop. A query does not allocate memory, and can be done by many threads at once.
+	 */
+	class KDTree
+	{
+	protected:
+		/** The number of levels of split nodes. */
+		int depth;
+		/** The split value of every node, in breadth-first order. */
+		SharedVector<float> split;
+		/** The dimension along which every node is split. */
+		SharedVector<unsigned char> splitdim;
+		/** The coordinates of the points, sorted by leaf. */
+		SharedVector<float> px, py, pz;
+		/** The index of every point in the input. */
+		SharedVector<int> pointid;
+		void build(const std::vector<float> & x, const std::vector<float> & y, const std::vector<float> & z, const float * bounds, const int node, const int lo, const int hi, const int level);
+	public:
+		/** The maximum number of points in a leaf. */
+		static const int leafsize=16;
+		KDTree();
+		KDTree(const std::vector<float> & x, const std::vector<float> & y, const std::vector<float> & z);
+		int nearest(const float x, const float y, const float z, const float maxdistance) const;
+		size_t size() const;
+		/**
+		 * @brief This passes the members to a SharedLayout.
+		 * @param memory The SharedLayout.
+		 */
+		void layout(SharedLayout & memory)
+		{
+			memory(depth);
+			memory(split);
+			memory(splitdim);
+			memory(px);
+			memory(py);
+			memory(pz);
+			memory(pointid);
+		}
+	};
+
+	/**
+	 * @brief UniformGrid is a bucketed uniform grid of 3D points, for nearest neighbour queries within a maximum distance.
+	 *
+	 * The bounding box of the points is divided into cubic cells, with a side of the mean distance between the
+	 * points (taken over the dimensions in which the points are spread out). The points are stored sorted by cell. A
+	 * query searches shells of cells around the cell of the position (first that cell, then its 26 neighbours, and so on),
+	 * until no point in the remaining cells can be closer. For points with a near-uniform density, the build is linear
+	 * and a query takes constant time. A query does not allocate memory, and can be done by many threads at once.
+	 */
+	class UniformGrid
+	{
+	protected:
+		/** The lower corner of the grid. */
+		float origin[3];
+		/** The side of the cells. */
+		float cellsize;
+		/** The number of cells in every dimension. */
+		int ncells[3];
+		/** The points of cell c are cellstart[c] to cellstart[c+1]-1, with c=(k*ncells[1]+j)*ncells[0]+i. */
+		SharedVector<int> cellstart;
+		/** The coordinates of the points, sorted by cell. */
+		SharedVector<float> px, py, pz;
+		/** The index of every point in the input. */
+		SharedVector<int> pointid;
+		void searchcells(const int firstcell, const int lastcell, const float x, const float y, const float z, const float maxdistance, int & best, float & bestdistance) const;
+	public:
+		UniformGrid();
+		UniformGrid(const std::vector<float> & x, const std::vector<float> & y, const std::vector<float> & z);
+		int nearest(const float x, const float y, const float z, const float maxdistance) const;
+		size_t size() const;
+		/**
+		 * @brief This passes the members to a SharedLayout.
+		 * @param memory The SharedLayout.
+		 */
+		void layout(SharedLayout & memory)
+		{
+			memory(origin);
+			memory(cellsize);
+			memory(ncells);
+			memory(cellstart);
+			memory(px);
+			memory(py);
+			memory(pz);
+			memory(pointid);
+		}
+	};
+
+	/**
+	 * @brief VoxelTable stores the nearest point of the corners of the voxels of a fine lattice, for nearest neighbour look-ups.
+	 *
+	 * The table is a discrete Voronoi diagram of the points: every corner holds its nearest point, as computed with
+	 * the parallel jump flooding algorithm. A query then only reads the eight corners of the voxel of the position, and
+	 * takes the nearest of their points that is inside the cube around the position. The voxels are half the mean
+	 * distance between the points, or larger if the table (and the second table used while it is built) would not
+	 * fit in the given memory. The nearest point is missed if its Voronoi cell does not contain any of the corners.
+	 */
+	class VoxelTable
+	{
+	protected:
+		/** The lower corner of the lattice. */
+		float origin[3];
+		/** The side of the voxels. */
+		float voxelsize;
+		/** The number of voxels in every dimension. */
+		int nvoxels[3];
+		/** The number of corners in every dimension. */
+		int ncorners[3];
+		/** The nearest point of corner (k*ncorners[1]+j)*ncorners[0]+i, or -1 if there are no points. */
+		SharedVector<int> owner;
+		/** The coordinates of the points. */
+		SharedVector<float> px, py, pz;
+		void jumpflood(const std::vector<int> & in, std::vector<int> & out, const int step) const;
+	public:
+		VoxelTable();
+		VoxelTable(const std::vector<float> & x, const std::vector<float> & y, const std::vector<float> & z, const double maxmemory);
+		int nearest(const float x, const float y, const float z, const float maxdistance) const;
+		size_t size() const;
+		size_t readnvoxels() const;
+		/**
+		 * @brief This passes the members to a SharedLayout.
+		 * @param memory The SharedLayout.
+		 */
+		void layout(SharedLayout & memory)
+		{
+			memory(origin);
+			memory(voxelsize);
+			memory(nvoxels);
+			memory(ncorners);
+			memory(owner);
+			memory(px);
+			memory(py);
+			memory(pz);
+		}
+	};
+
+	/**
+	 * @brief ProfileScope measures a stage of the pipeline, from its construction to its destruction.
+	 * 
+	 * If profiling is switched on (see FoMo::setprofiling()), the wall time and, where the kernel allows it, the 
+	 * hardware counters of the calling thread are added to the totals of the stage and thread, which are reported by
+	 * FoMo::profilingreport(). In a parallel region, every thread should construct its own ProfileScope. If profiling 
+	 * is off, this only costs the check of a flag.
+	 */
+	class ProfileScope
+	{
+	protected:
+		const char * stage;
+		bool active;
+		double start;
+		uint64_t startcounters[4];
+	public:
+		ProfileScope(const char * stage);
+		~ProfileScope();
+	};
+
+	/**
+	 * @brief A spectral line that is blended into the spectral window of a rendering, see FoMoObject::setblendedlines().
+	 */
+	struct BlendedLine
+	{
+		/** The CHIANTI table of the line. */
+		std::string chiantifile;
+		/** The rest wavelength of the line, in Angstrom. */
+		double lambda0;
+		/** The peak emission and line width of every data point, as in the GoftCube computed by emissionfromdatacube(). */
+		tphysvar peak, fwhm;
+	};
+
+	/**
+	 * @brief RenderOptions collects the settings of a FoMoObject that are passed on to the render routines.
+	 */
+	struct RenderOptions
+	{
+		/** If true, spectroscopic renderings are stored as a sparse RenderCube. */
+		bool sparse=false;
+		/** Bins at the edges of a spectrum below this fraction of the peak of that spectrum are dropped in a sparse RenderCube. */
+		double sparsethreshold=0;
+		/** The region of interest {xmin, xmax, ymin, ymax} in pixels (inclusive), or empty for the full image. */
+		std::vector<int> roi;
+		/** The indexes kept between renderings, or empty if every rendering starts from scratch. */
+		std::shared_ptr<RenderIndex> index;
+		/** The lazily computed emission, or empty if the emission is stored in the goftcube. */
+		std::shared_ptr<LazyEmission> emission;
+		/** The thickness (in Mm) along the invariant z-axis of a 2D DataCube, for the Slab rendermethod. */
+		double depth=1.;
+		/** The spatial index of the NearestNeighbour rendermethod: "rtree", "kdtree", "grid" or "voxel". */
+		std::string spatialindex="rtree";
+		/** The maximum memory (in bytes) of the "voxel" spatial index. */
+		double indexmemory=1e9;
+		/** If true, the statistics of the rays are stored in the rendering (see RayStatistics). */
+		bool raystatistics=false;
+		/** If true, the goftcube is compressed (see FoMoObject::setcompression()), which changes the rendering slightly. */
+		bool compression=false;
+		/** If false, the renderings are only returned, and not written to the output files. If true, the calling MPI rank
+		 * writes them: FoMoObject::renderoptions() only sets it on the first rank, or on every rank with node sharing. */
+		bool write=true;
+		/** The lines that are blended into the spectral window of the chiantifile, or empty for a single line. */
+		std::shared_ptr<std::vector<BlendedLine> > blend;
+	};
+	
+	/**
+	 * @brief This gives access to a column of the goftcube that is rendered.
+	 * 
+	 * If the emission is computed lazily (options.emission is set), the goftcube only contains the grid: the emission 
+	 * columns are then read from the LazyEmission, and the velocities from its DataCube.
+	 * @param goftcube The goftcube that is rendered.
+	 * @param column The column, numbered as in the GoftCube computed by emissionfromdatacube().
+	 * @param options The render options.
+	 * @return A ColumnReader for the column.
+	 */
+	inline ColumnReader rendercolumn(const GoftCube & goftcube, const unsigned int column, const RenderOptions & options)
+	{
+		unsigned int dim=goftcube.readdim();
+		if (!options.emission || column < dim) return ColumnReader(goftcube,column);
+		if (column < dim+2) return ColumnReader(*options.emission,column-dim);
+		return ColumnReader(options.emission->readdatacube(),column);
+	}
+	
+	/**
+	 * @brief This gives access to the velocity columns of the goftcube that is rendered.
+	 * 
+	 * The velocities only shift the spectral line, so that imaging renderings (lambda_pixel == 1) do not read them. 
+	 * The velocity components that are not in the data (e.g. when only the density and temperature were loaded) are 0.
+	 * @param goftcube The goftcube that is rendered.
+	 * @param lambda_pixel The number of wavelength pixels of the rendering.
+	 * @param options The render options, possibly with a LazyEmission.
+	 * @return A ColumnReader for each of the (at most 3) velocity components in the data, none for imaging renderings.
+	 */
+	inline std::vector<ColumnReader> velocitycolumns(const GoftCube & goftcube, const int lambda_pixel, const RenderOptions & options)
+	{
+		std::vector<ColumnReader> velreader;
+		if (lambda_pixel <= 1) return velreader;
+		int nvel=(options.emission ? options.emission->readdatacube().readnvars() : goftcube.readnvars())-2;
+		for (int c=0; c<std::min(nvel,3); c++) velreader.push_back(rendercolumn(goftcube,goftcube.readdim()+2+c,options));
+		return velreader;
+	}
+
+	/**
+	 * @brief This returns the intensity of the blended lines of a data point at a wavelength of the spectral window.
+	 * 
+	 * The wavelength is relative to the rest wavelength lambda0 of the chiantifile of the rendering, as in the render 
+	 * routines. Every blended line is a Gaussian with its own peak emission and width, centred on its own rest wavelength, 
+	 * and Doppler shifted with the same line-of-sight velocity as the line of the chiantifile.
+	 * @param blend The blended lines, with the emission computed (see FoMoObject::setblendedlines()).
+	 * @param point The data point.
+	 * @param lambdaval The wavelength relative to lambda0, in Angstrom.
+	 * @param doppler The line-of-sight velocity of the data point, divided by the speed of light.
+	 * @param lambda0 The rest wavelength of the chiantifile of the rendering, in Angstrom.
+	 * @return The sum of the intensities of the blended lines.
+	 */
+	inline double blendedintensity(const std::vector<BlendedLine> & blend, const int point, const double lambdaval, const double doppler, const double lambda0)
+	{
+		double intensity=0;
+		for (unsigned int k=0; k<blend.size(); k++)
+		{
+			double peak=blend[k].peak[point];
+			if (peak) intensity+=peak*std::exp(-std::pow(lambdaval-(blend[k].lambda0-lambda0)-doppler*blend[k].lambda0,2)/std::pow(blend[k].fwhm[point],2)*4.*std::log(2.));
+		}
+		return intensity;
+	}
+
+	/**
+	 * @brief This returns the units of the emission of the goftcube that is rendered.
+	 * @param goftcube The goftcube that is rendered.
+	 * @param options The render options, possibly with a LazyEmission.
+	 * @return The units of the peak emission.
+	 */
+	inline std::string emissionunit(const GoftCube & goftcube, const RenderOptions & options)
+	{
+		if (options.emission) return options.emission->readunit();
+		return goftcube.readunit().at(goftcube.readdim());
+	}
+	
+	// the contents of the index and per-view data are specific to the render method, and defined in its source file
+	struct NearestNeighbourIndex;
+	struct NearestNeighbourView;
+	struct ProjectionView;
+	struct CGALIndex;
+	
+	/**
+	 * @brief RenderIndex keeps the data of the render routines that only depend on the grid, between renderings.
+	 * 
+	 * For a grid that does not change (e.g. a time series of a simulation without AMR), the spatial index and the
+	 * mapping of every view (which data point contributes to which pixel) only need to be computed once. They are
+	 * reused as long as the hash of the grid does not change, or always if the grid is declared static. The views
+	 * are stored with the key renderviewkey(). The members are shared between threads, and should only be
+	 * accessed while holding lock. The shared pointers that are taken out can be used without the lock.
+	 */
+	struct RenderIndex
+	{
+		std::mutex lock;
+		/** If true, the grid is assumed not to change, and is not hashed. */
+		bool staticgrid=false;
+		/** If false, only the spatial indexes are kept, and the mappings of the views are not recorded. */
+		bool keepviews=true;
+		/** True if gridhash contains the hash of the grid of the stored data. */
+		bool gridknown=false;
+		uint64_t gridhash=0;
+		std::shared_ptr<NearestNeighbourIndex> nearestneighbour;
+		std::map<std::string, std::shared_ptr<NearestNeighbourView> > nearestneighbourviews;
+		std::map<std::string, std::shared_ptr<ProjectionView> > projectionviews;
+		std::shared_ptr<CGALIndex> cgal;
+	};
+	
+	void checkrenderindex(RenderIndex & index, const DataCube & datacube);
+	std::string renderviewkey(const double l, const double b, const int x_pixel, const int y_pixel, const int z_pixel, const RenderOptions & options);
+	void writenearestneighbourviews(RenderIndex & index, const std::string filename);
+	bool readnearestneighbourviews(RenderIndex & index, const std::string filename);
+	bool buildnearestneighbourindex(RenderIndex & index, const GoftCube & goftcube, const RenderOptions & options);
+	void layoutnearestneighbourindex(RenderIndex & index, SharedLayout & memory, const RenderOptions & options);
+	
+	/**
+	 * @brief This determines the pixels of the image that need to be rendered.
+	 * 
+	 * If no region of interest is given in options, all pixels are rendered. Otherwise, the region is clipped to the image.
+	 * @param options The render options, containing the region of interest.
+	 * @param x_pixel The number of pixels of the full image in the x direction.
+	 * @param y_pixel The number of pixels of the full image in the y direction.
+	 * @param x0 The first pixel to be rendered in the x direction.
+	 * @param nx The number of pixels to be rendered in the x direction.
+	 * @param y0 The first pixel to be rendered in the y direction.
+	 * @param ny The number of pixels to be rendered in the y direction.
+	 */
+	inline void regionofinterest(const RenderOptions & options, const int x_pixel, const int y_pixel, int & x0, int & nx, int & y0, int & ny)
+	{
+		x0=0;
+		nx=x_pixel;
+		y0=0;
+		ny=y_pixel;
+		if (options.roi.size() != 4) return;
+		x0=std::max(options.roi[0],0);
+		nx=std::min(options.roi[1],x_pixel-1)-x0+1;
+		y0=std::max(options.roi[2],0);
+		ny=std::min(options.roi[3],y_pixel-1)-y0+1;
+		if (nx<1 || ny<1)
+		{
+			std::cerr << "Error: the region of interest does not contain any pixel of the image." << std::endl << std::flush;
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	/**
+	 * @brief This stores an image that is rendered on the pixels of the plane of the sky in the rendercube.
+	 *
+	 * The image is stored on its regular axes, the wavelength axis (only for spectroscopic renderings) covering the
+	 * full wavelength window. If the units of the emission contain DN (an instrument), the spatial axes are converted
+	 * to arcsec, and the intensity is rescaled to the pixel size.
+	 * @param rendercube The rendercube in which the image is stored.
+	 * @param goftcube The goftcube that is rendered.
+	 * @param options The render options, possibly with a LazyEmission.
+	 * @param minx The x-coordinate of the first pixel of the full image (in Mm).
+	 * @param maxx The x-coordinate of the last pixel of the full image (in Mm).
+	 * @param miny The y-coordinate of the first pixel of the full image (in Mm).
+	 * @param maxy The y-coordinate of the last pixel of the full image (in Mm).
+	 * @param x_pixel The number of pixels of the full image in the x direction.
+	 * @param y_pixel The number of pixels of the full image in the y direction.
+	 * @param x0 The first rendered pixel in the x direction, as given by regionofinterest().
+	 * @param nx The number of rendered pixels in the x direction.
+	 * @param y0 The first rendered pixel in the y direction.
+	 * @param ny The number of rendered pixels in the y direction.
+	 * @param lambda_pixel The number of wavelength pixels.
+	 * @param lambda_width_in_A The width of the wavelength window (in Angstrom).
+	 * @param lambda0 The central wavelength (in Angstrom).
+	 * @param pathlength The length (in Mm) with which the intensity is multiplied, 1 if it is already integrated along the line-of-sight.
+	 * @param intens The intensity, ordered with the wavelength varying fastest, then x, then y. It is converted to cm and rescaled in place.
+	 */
+	inline void setimage(RenderCube & rendercube, const GoftCube & goftcube, const RenderOptions & options,
+		const double minx, const double maxx, const double miny, const double maxy, const int x_pixel, const int y_pixel,
+		const int x0, const int nx, const int y0, const int ny, const int lambda_pixel, const double lambda_width_in_A,
+		const double lambda0, const double pathlength, tphysvar & intens)
+	{
+		// the regular axes of the image, the wavelength axis stores the full wavelength
+		// an imaging rendering has a single wavelength pixel, and no wavelength step
+		std::vector<double> step={(maxx-minx)/(x_pixel-1),(maxy-miny)/(y_pixel-1),(lambda_pixel > 1) ? lambda_width_in_A/(lambda_pixel-1) : 0.};
+		std::vector<double> origin={minx+x0*step[0],miny+y0*step[1],lambda0-lambda_width_in_A/2.};
+		// the intensity does not need to be rescaled for spectroscopic data
+		double apix = 1.;
+		// these are the default units if spectroscopic data
+		std::vector<std::string> unitvec;
+		unitvec.push_back("Mm");
+		unitvec.push_back("Mm");
+		if (lambda_pixel > 1) unitvec.push_back("\\AA{}");
+		unitvec.push_back("erg cm^{-2} s^{-1} \\AA{}^{-1}");
+		// check if the units of emissivity contain DN: then we are dealing with an instrument, and spatial units should be converted to arcsec,
+		// intensity should be rescaled to pixel size
+		std::size_t found = emissionunit(goftcube,options).find("DN");
+		if (found!=std::string::npos)
+		{
+			unitvec.at(0)="arcsec";
+			unitvec.at(1)="arcsec";
+			for (int i=0; i<2; i++)
+			{
+				origin.at(i)/=Mmperarcsec;
+				step.at(i)/=Mmperarcsec;
+			}
+			float dx=(maxx-minx)/(x_pixel-1),dy=(maxy-miny)/(y_pixel-1); // are given in Mm
+			apix = (dx/Mmperarcsec)*(dy/Mmperarcsec)*std::pow(M_PI/180./3600.,2);
+			unitvec.back()="DN s^{-1} pixel^{-1}"; // this could be improved using Boost::units, making everything automatic, including compiler checks
+		}
+
+		intens=FoMo::operator*(pathlength*1e8*apix,intens); // the coordinates in goftcube are given in Mm, convert to cm
+		std::vector<int> count={nx,ny};
+		if (lambda_pixel > 1) count.push_back(lambda_pixel);
+		rendercube.setregulardata(count,origin,step,intens,&unitvec);
+	}
+
+	uint64_t fnv1a(uint64_t hash, const void * data, const size_t size);
+	uint64_t hashdatacube(const DataCube & datacube);
+	uint64_t hashfile(const std::string filename);
+	uint64_t hashgrid(const DataCube & datacube);
+	std::string rendercachekey(const uint64_t datahash, const std::string chiantifile, const std::string abundfile, const std::string rendermethod,
+		const std::vector<int> resolution, const double lambda_width, const RenderOptions & options, const double l, const double b);
+	bool readrendercache(const std::string cachedir, const std::string key, RenderCube & rendercube);
+	void writerendercache(const std::string cachedir, const std::string key, const RenderCube & rendercube);
+	
+	std::string renderfilename(const std::string outfile, const std::string rendermethod, const double l, const double b);
+	
 	double readgoftfromchianti(const std::string chiantifile);
 	DataCube readgoftfromchianti(const std::string chiantifile, std::string & ion, double & lambda0, double & atweight);
-	GoftCube emissionfromdatacube(DataCube, std::string, std::string, const FoMoObservationType);
+	GoftCube emissionfromdatacube(const DataCube &, std::string, std::string, const FoMoObservationType);
 	
 #ifdef HAVE_CGAL_DELAUNAY_TRIANGULATION_2_H	
 	FoMo::RenderCube RenderWithCGAL(FoMo::DataCube datacube, FoMo::GoftCube goftcube, FoMoObservationType observationtype, 
 	const int x_pixel, const int y_pixel, const int z_pixel, const int lambda_pixel, const double lambda_width,
-	std::vector<double> lvec, std::vector<double> bvec, const std::string outfile);
+	std::vector<double> lvec, std::vector<double> bvec, const std::string outfile, const RenderOptions & options);
 	
 	FoMo::RenderCube RenderWithCGAL2D(FoMo::DataCube datacube, FoMo::GoftCube goftcube, FoMoObservationType observationtype, 
 	const int x_pixel, const int y_pixel, const int lambda_pixel, const double lambda_width,
-	std::vector<double> lvec, const std::string outfile);
+	std::vector<double> lvec, const std::string outfile, const RenderOptions & options);
 #endif
 	
-	FoMo::RenderCube RenderWithNearestNeighbour(FoMo::GoftCube goftcube, const int x_pixel, const int y_pixel, const int z_pixel, const int lambda_pixel, const double lambda_width,
-	std::vector<double> lvec, std::vector<double> bvec, const std::string outfile);
+	FoMo::RenderCube RenderWithNearestNeighbour(const FoMo::GoftCube & goftcube, const int x_pixel, const int y_pixel, const int z_pixel, const int lambda_pixel, const double lambda_width,
+	std::vector<double> lvec, std::vector<double> bvec, const std::string outfile, const RenderOptions & options);
+	
+	FoMo::RenderCube RenderWithProjection(const FoMo::GoftCube & goftcube, const int x_pixel, const int y_pixel, const int z_pixel, const int lambda_pixel, const double lambda_width,
+	std::vector<double> lvec, std::vector<double> bvec, const std::string outfile, const RenderOptions & options);
+	
+	FoMo::RenderCube RenderWithSlab(const FoMo::GoftCube & goftcube, const int x_pixel, const int y_pixel, const int z_pixel, const int lambda_pixel, const double lambda_width,
+	std::vector<double> lvec, std::vector<double> bvec, const std::string outfile, const RenderOptions & options);
 	
-	FoMo::RenderCube RenderWithProjection(FoMo::GoftCube goftcube, const int x_pixel, const int y_pixel, const int z_pixel, const int lambda_pixel, const double lambda_width,
-	std::vector<double> lvec, std::vector<double> bvec, const std::string outfile);
+	FoMo::RenderCube RenderWithAbel(const FoMo::GoftCube & goftcube, const int x_pixel, const int y_pixel, const int z_pixel, const int lambda_pixel, const double lambda_width,
+	std::vector<double> lvec, std::vector<double> bvec, const std::string outfile, const RenderOptions & options);
 }
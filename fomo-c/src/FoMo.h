@@ -1,6 +1,9 @@
 #include <vector>
 #include <string>
 #include <bitset>
+#include <map>
+#include <cstdint>
+#include <memory>
 #ifndef FOMO_H
 #define FOMO_H 
 /**
@@ -39,6 +42,49 @@ namespace FoMo
 	tphysvar operator*(double const &, tphysvar const &);
 	tphysvar sqrt(tphysvar const&);
 	
+	std::vector<std::string> rendermethods();
+	void setprofiling(const bool = true);
+	bool readprofiling();
+	void resetprofiling();
+	std::string profilingreport();
+	
+	/**
+	 * @brief CompressedVar stores a ::tphysvar in a lossy, compressed form.
+	 * 
+	 * The data is split in blocks of CompressedVar::blocksize elements, and each element is stored in 16 bits.
+	 * For physical variables (the default), each block is scaled with its largest absolute value and stored 
+	 * as half-precision floats, so that the relative precision is about \f$10^{-3}\f$ with respect to the
+	 * largest value in the block. For coordinates (fixedpoint=true), the elements are stored as 16-bit 
+	 * integers between the minimum and maximum of each block, so that the absolute error is at most 
+	 * (max-min)/131070 per block. The data can be decompressed per block, which is how it is accessed 
+	 * in the render routines.
+	 */
+	class CompressedVar
+	{
+	protected:
+		unsigned int n;
+		bool fixedpoint;
+		std::vector<float> blockoffset;
+		std::vector<float> blockscale;
+		std::vector<uint16_t> data;
+	public:
+		static const unsigned int blocksize=4096;
+		CompressedVar();
+		CompressedVar(tphysvar const & var, const bool fixedpoint = false);
+		unsigned int size() const;
+		unsigned int readnblocks() const;
+		void decompressblock(const unsigned int block, float * out) const;
+		tphysvar decompress() const;
+	};
+	
+	class ColumnReader;
+	struct RenderOptions;
+	struct RenderIndex;
+	class LazyEmission;
+	struct RayStatistics;
+	struct NodeSharing;
+	struct BlendedLine;
+	
 	/**
 	 * @brief The DataCube is the structure in which the model data needs to be loaded.
 	 * 
@@ -47,6 +93,7 @@ namespace FoMo
 	 */
 	class DataCube 
 	{
+		friend class ColumnReader;
 	protected:
 		/** This is the dimension of the DataCube. */
 		unsigned int dim;
@@ -57,6 +104,12 @@ namespace FoMo
 		FoMo::tgrid grid;
 		FoMo::tvars vars;
 		std::vector<std::string> unit;
+		/** This is true if the grid and variables are stored in cgrid and cvars. */
+		bool compressed;
+		std::vector<CompressedVar> cgrid;
+		std::vector<CompressedVar> cvars;
+		/** If not empty, the grid and variables are read from these columns in memory of someone else, see setshared(). */
+		std::vector<const float *> sharedcolumns;
 		void setgrid(tgrid ingrid, std::vector<std::string> * inunit = NULL);
 		void setvar(const unsigned int, const tphysvar, std::string inunit="");
 	public:
@@ -66,13 +119,21 @@ namespace FoMo
 		int readngrid() const;
 		int readnvars() const;
 		std::vector<std::string> readunit() const;
-		tgrid readgrid() const;
-		tphysvar readvar(const unsigned int) const;
+		virtual tgrid readgrid() const;
+		virtual tphysvar readvar(const unsigned int) const;
 		void setdim(const int indim);
 		void setnvars(const int innvars);
 		void setngrid(const int inngrid);
 		void setdata(tgrid& ingrid, tvars& indata, std::vector<std::string> * unitvec = NULL);
+		void swapdata(tgrid& ingrid, tvars& indata, std::vector<std::string> * unitvec = NULL);
 		void push_back(std::vector<double> coordinate, std::vector<double> variables, std::vector<std::string> * unitvec = NULL);
+		void mortonsort(std::vector<unsigned int> * permutation = NULL);
+		void compress();
+		virtual void decompress();
+		bool iscompressed() const;
+		void setshared(const std::vector<const float *> & columns, const int inngrid, std::vector<std::string> * unitvec = NULL);
+		void setshared(const DataCube & other, const bool gridonly = false);
+		bool isshared() const;
 	};
 	
 	const int noptions=4; // the number of write options for a goftcube
@@ -95,16 +156,16 @@ namespace FoMo
 		GoftCube(DataCube datacube);
 		void setchiantifile(const std::string inchianti);
 		void setabundfile(const std::string inabund);
-		std::string readchiantifile();
-		std::string readabundfile();
-		double readlambda0();
+		std::string readchiantifile() const;
+		std::string readabundfile() const;
+		double readlambda0() const;
 		void setlambda0(const double lambda0);
 		// keep the legacy ability to write Delaunay_triangulation
 //		void writegoftcube(const std::string, const Delaunay_triangulation_3 *);
 //		void readgoftcube(const std::string, Delaunay_triangulation_3*);
-		void writegoftcube(const std::string);
+		virtual void writegoftcube(const std::string, const bool = false);
 		void readgoftcube(const std::string);
-		std::bitset<noptions> getwriteoptions();
+		std::bitset<noptions> getwriteoptions() const;
 		void setwriteoptions(std::bitset<noptions> options);
 		void setwriteoutbinary(const bool = true);
 		void setwriteouttext(const bool = true);
@@ -130,6 +191,15 @@ namespace FoMo
 	 * The RenderCube class is a specialisation of the GoftCube class. It additionally contains information
 	 * on the viewing angle, the resolution used and to-be-used for the rendering. Also, the rendermethod
 	 * and observationtype is part of the RenderCube, and can be set and read with members of the class.
+	 * 
+	 * The render routines store the image on regular axes: the x, y (and \f$\lambda\f$) coordinates are given by an 
+	 * origin and a step along each axis, and only the intensity is stored for every entry (see RenderCube::isregular()). 
+	 * RenderCube::readgrid() then computes the coordinates of every entry when it is called.
+	 * 
+	 * A spectroscopic RenderCube can also be stored sparsely: for every pixel in the image plane, only the 
+	 * range of wavelength bins [firstbin, firstbin+count) containing emission is kept, packed one pixel after 
+	 * the other, on the same regular axes. Use RenderCube::issparse() to check for this, and 
+	 * RenderCube::densify() to convert it back to the regular representation.
 	 */
 	class RenderCube: public GoftCube
 	{
@@ -143,8 +213,39 @@ namespace FoMo
 		double lambda_width;
 		std::string rendermethod;
 		FoMoObservationType observationtype;
+		/** This is true if the intensity is stored in sparsefirstbin, sparsecount and sparsevalues. */
+		bool sparse;
+		/** This is true if the coordinates are given by the axes, and the intensity is stored densely in vars[0]. */
+		bool regular;
+		std::vector<int> axiscount;
+		std::vector<double> axisorigin;
+		std::vector<double> axisstep;
+		std::vector<int> sparsefirstbin;
+		std::vector<int> sparsecount;
+		tphysvar sparsevalues;
+		/** The statistics of the rays of the rendering, or empty if they were not collected. */
+		std::shared_ptr<const RayStatistics> raystatistics;
 	public:
-		RenderCube(GoftCube goftcube);
+		RenderCube(const GoftCube & goftcube);
+		void setdata(tgrid& ingrid, tvars& indata, std::vector<std::string> * unitvec = NULL);
+		void setregulardata(const std::vector<int> & count, const std::vector<double> & origin, const std::vector<double> & step, 
+			tphysvar & intensity, std::vector<std::string> * unitvec = NULL);
+		tgrid readgrid() const;
+		tphysvar readvar(const unsigned int) const;
+		void decompress();
+		bool isregular() const;
+		void readaxes(std::vector<int> & count, std::vector<double> & origin, std::vector<double> & step) const;
+		const tphysvar & readintensity() const;
+		void setsparsedata(const std::vector<int> & count, const std::vector<double> & origin, const std::vector<double> & step, 
+			std::vector<int> & firstbin, std::vector<int> & bincount, tphysvar & values, std::vector<std::string> * unitvec = NULL);
+		void sparsify(const double threshold = 0);
+		void densify();
+		bool issparse() const;
+		void readsparseaxes(std::vector<int> & count, std::vector<double> & origin, std::vector<double> & step) const;
+		const std::vector<int> & readsparsefirstbin() const;
+		const std::vector<int> & readsparsecount() const;
+		const tphysvar & readsparsevalues() const;
+		void writegoftcube(const std::string, const bool = false);
 		void setresolution(const int & x_pixel, const int & y_pixel, const int & z_pixel, const int & lambda_pixel, const double & lambda_width);
 		void readresolution(int & x_pixel, int & y_pixel, int & z_pixel, int & lambda_pixel, double & lambda_width);
 		void setangles(const double l, const double b);
@@ -153,6 +254,33 @@ namespace FoMo
 		std::string readrendermethod();
 		void setobservationtype(FoMoObservationType);
 		FoMoObservationType readobservationtype();
+		void setraystatistics(const RayStatistics & statistics);
+		bool hasraystatistics() const;
+		const RayStatistics & readraystatistics() const;
+	};
+	
+	/**
+	 * @brief RayStatistics describes how well the rays of a NearestNeighbour rendering sample the data.
+	 * 
+	 * A sample along a ray is empty if no data point is within the maximum distance from it (see the warning printed 
+	 * by the rendering). Data points that are not the nearest point of any sample do not contribute to the rendering. 
+	 * The cheapest resolution that still samples every data point has few empty samples and hits all data points.
+	 */
+	struct RayStatistics
+	{
+		/** The maps per ray, with the image coordinates x, y (in Mm) and the variables: the number of samples, the 
+		 * number of empty samples, the number of distinct data points sampled, and the fraction of empty samples. */
+		GoftCube maps;
+		/** The number of samples of all rays. */
+		long nsamples=0;
+		/** The number of empty samples of all rays. */
+		long nempty=0;
+		/** The number of data points. */
+		long npoints=0;
+		/** The number of data points that are the nearest point of at least one sample. */
+		long nhit=0;
+		/** The maximum distance (in Mm) between a sample and its nearest data point. */
+		double maxdistance=0;
 	};
 	
 	/**
@@ -188,6 +316,62 @@ namespace FoMo
 		  * In the FoMoObject.rendering, the results of FoMoObject.render are stored. 
 		*/
 		FoMo::RenderCube rendering;
+		/** If true, the goftcube is stored compressed during the rendering, the datacube is kept exact. */
+		bool compression;
+		/** If true, spectroscopic renderings are stored as a sparse RenderCube. */
+		bool sparsespectra;
+		/** Relative threshold below which the wings of a sparse spectrum are dropped. */
+		double sparsethreshold;
+		/** The directory of the render cache, or empty if no cache is used. */
+		std::string rendercache;
+		/** The hash of the datacube (see hashdatacube()) for the render cache, if datahashknown. It is reset when the data changes. */
+		uint64_t datahash;
+		bool datahashknown;
+		/** The checkpoint manifest, or empty if no checkpointing is done. */
+		std::string checkpointfile;
+		/** The entries of the checkpoint manifest, indexed by view key and output file. */
+		std::map<std::string, std::string> checkpoint;
+		/** The manifest from which the entries were read, see checkpointmanifest(). */
+		std::string checkpointread;
+		/** The region of interest {xmin, xmax, ymin, ymax} in pixels, or empty for the full image. */
+		std::vector<int> roi;
+		/** The settings with which the goftcube was computed, or empty if it needs to be recomputed. */
+		std::string emissionkey;
+		/** The spatial indexes and per-view mappings kept between renderings, or empty if they are not kept. */
+		std::shared_ptr<RenderIndex> renderindex;
+		/** The thickness of a 2D DataCube along the invariant z-axis, for the Slab rendermethod. */
+		double slabdepth;
+		/** The spatial index of the NearestNeighbour rendermethod, see setspatialindex(). */
+		std::string spatialindex;
+		/** The maximum memory of the voxel table of the NearestNeighbour rendermethod, see setspatialindex(). */
+		double indexmemory;
+		/** If true, the emission is computed lazily during the rendering, see setlazyemission(). */
+		bool lazyemission;
+		/** The lazily computed emission, or empty if the emission is stored in the goftcube. */
+		std::shared_ptr<LazyEmission> emission;
+		/** If true, the renderings collect statistics of their rays, see setraystatistics(). */
+		bool raystatistics;
+		/** If true, the rendermethod and spatial index are chosen by autotune(), see setrendermethod(). */
+		bool automethod;
+		/** The maximum relative difference of the "auto" rendermethod with the reference rendering, see setautotolerance(). */
+		double autotolerance;
+		/** The situation for which the "auto" rendermethod was last chosen, and the chosen rendermethod and spatial index. */
+		std::string autokey, autochoice, autoindex;
+		/** The MPI ranks on the node with which the goftcube and spatial index are shared, or empty, see setnodesharing(). */
+		std::shared_ptr<NodeSharing> nodesharing;
+		/** The lines that are blended into the spectral window of the chiantifile, or empty, see setblendedlines(). */
+		std::shared_ptr<std::vector<BlendedLine> > blendedlines;
+		RenderOptions renderoptions();
+		uint64_t hashdata();
+		std::string checkpointkey(const double l, const double b);
+		std::string checkpointmanifest();
+		void readcheckpoint();
+		std::vector<std::string> outputfiles(const double l, const double b);
+		void markcompleted(const double l, const double b);
+		void computeemission();
+		FoMo::RenderCube renderviews(const std::vector<double> lvec, const std::vector<double> bvec, const RenderOptions & options);
+		void autotune(const std::vector<double> lvec, const std::vector<double> bvec);
+		uint64_t sharenode();
 	public:
 		FoMoObject(const int =3);
 		~FoMoObject();
@@ -206,6 +390,41 @@ namespace FoMo
 		void setoutfile(const std::string outfile);
 		void push_back_datapoint(std::vector<double> coordinate, std::vector<double> variables, std::vector<std::string> * unitvec = NULL);
 		void setdata(tgrid& ingrid, tvars& indata, std::vector<std::string> * unitvec = NULL);
+		void swapdata(tgrid& ingrid, tvars& indata, std::vector<std::string> * unitvec = NULL);
+		void setshareddata(const std::vector<const float *> & ingrid, const std::vector<const float *> & indata, const int ngrid, std::vector<std::string> * unitvec = NULL);
+		void mortonsort(std::vector<unsigned int> * permutation = NULL);
+		void setcompression(const bool = true);
+		bool readcompression();
+		void setsparsespectra(const bool = true, const double threshold = 0);
+		bool readsparsespectra();
+		void setregionofinterest(const std::vector<int> roi = std::vector<int>());
+		std::vector<int> readregionofinterest();
+		void setreuseindex(const bool = true, const bool staticgrid = false);
+		bool readreuseindex();
+		void shareindex(FoMoObject & other);
+		void sharedata(FoMoObject & other);
+		void setslabdepth(const double depth = 1.);
+		double readslabdepth();
+		void setspatialindex(const std::string index = "rtree", const double maxmemory = 1e9);
+		std::string readspatialindex();
+		void setlazyemission(const bool = true);
+		bool readlazyemission();
+		void setraystatistics(const bool = true);
+		bool readraystatistics();
+		void setautotolerance(const double tolerance = 0.01);
+		double readautotolerance();
+		void setnodesharing(const bool = true);
+		bool readnodesharing();
+		void setblendedlines(const std::vector<std::string> chiantifiles = std::vector<std::string>());
+		std::vector<std::string> readblendedlines();
+		void writeviewmappings(const std::string filename);
+		void readviewmappings(const std::string filename);
+		void setrendercache(const std::string cachedir = "");
+		std::string readrendercache();
+		void setcheckpointfile(const std::string manifest = "");
+		std::string readcheckpointfile();
+		bool iscompleted(const double l, const double b);
+		std::string renderfilename(const double l, const double b);
 		void setobservationtype(FoMoObservationType);
 		FoMoObservationType readobservationtype();
 		void setresolution(const int & x_pixel, const int & y_pixel, const int & z_pixel, const int & lambda_pixel, const double & lambda_width);
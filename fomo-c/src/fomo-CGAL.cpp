@@ -30,6 +30,17 @@ typedef CGAL::Delaunay_triangulation_3<K> Delaunay_triangulation_3;
 const double speedoflight=GSL_CONST_MKSA_SPEED_OF_LIGHT; // speed of light
 const double pi=M_PI; //pi
 
+namespace FoMo
+{
+	/**
+	 * @brief The Delaunay triangulation of the data points, which does not depend on the view.
+	 */
+	struct CGALIndex
+	{
+		Delaunay_triangulation_3 triangulation;
+	};
+}
+
 Delaunay_triangulation_3 triangulationfromdatacube(FoMo::DataCube goftcube)
 {
 	typedef K::Point_3                                    Point;
@@ -51,6 +62,8 @@ Delaunay_triangulation_3 triangulationfromdatacube(FoMo::DataCube goftcube)
 
 	// compute the Delaunay triangulation
 	if (commrank==0) std::cout << "Doing Delaunay triangulation for interpolation onto rays... " << std::flush;
+	// the triangulation is only measured on the calling thread
+	FoMo::ProfileScope scope("index");
 	Delaunay_triangulation_3 DT;
 	// The triangulation should go quicker if it is sorted
 	// CGAL::spatial_sort(delaunaygrid.begin(),delaunaygrid.end());
@@ -110,9 +123,15 @@ FoMo::RenderCube CGALinterpolation(FoMo::GoftCube goftcube, Delaunay_triangulati
 	// Read the physical variables
 	FoMo::tphysvar peakvec=goftcube.readvar(0);//Peak intensity 
 	FoMo::tphysvar fwhmvec=goftcube.readvar(1);// line width, =1 for AIA imaging
-	FoMo::tphysvar vx=goftcube.readvar(2);  
-	FoMo::tphysvar vy=goftcube.readvar(3);
-	FoMo::tphysvar vz=goftcube.readvar(4);
+	// the velocities are only needed for spectroscopic renderings
+	bool spectroscopic=(lambda_pixel > 1);
+	FoMo::tphysvar vx, vy, vz;
+	if (spectroscopic)
+	{
+		vx=goftcube.readvar(2);
+		vy=goftcube.readvar(3);
+		vz=goftcube.readvar(4);
+	}
 	double losvelval;
 
 // No openmp possible here
@@ -128,9 +147,12 @@ FoMo::RenderCube CGALinterpolation(FoMo::GoftCube goftcube, Delaunay_triangulati
 		zacc[i]=gridpoint[0]*sin(b)*cos(l)-gridpoint[1]*sin(b)*sin(l)+gridpoint[2]*cos(b);
 		temporarygridpoint=Point(grid[0][i],grid[1][i],grid[2][i]); //position vector
 		// also create the map function_values here
-		std::vector<double> velvec = {vx[i], vy[i], vz[i]};// velocity vector
-		losvelval = inner_product(unit.begin(),unit.end(),velvec.begin(),0.0);//velocity along line of sight for position [i]/[ng]
-		losvelmap[temporarygridpoint]=Coord_type(losvelval);
+		if (spectroscopic)
+		{
+			std::vector<double> velvec = {vx[i], vy[i], vz[i]};// velocity vector
+			losvelval = inner_product(unit.begin(),unit.end(),velvec.begin(),0.0);//velocity along line of sight for position [i]/[ng]
+			losvelmap[temporarygridpoint]=Coord_type(losvelval);
+		}
 		peakmap[temporarygridpoint]=Coord_type(peakvec[i]);
 		fwhmmap[temporarygridpoint]=Coord_type(fwhmvec[i]);
 /*		peakmap.insert(make_pair(temporarygridpoint,Coord_type(peakvec[i])));
@@ -165,13 +187,10 @@ FoMo::RenderCube CGALinterpolation(FoMo::GoftCube goftcube, Delaunay_triangulati
 	bool could_lock_zone=false;
 	boost::progress_display show_progress(x_pixel*y_pixel*z_pixel);
 	
-	//initialize grids
-	FoMo::tgrid newgrid;
-	FoMo::tcoord xvec(x_pixel*y_pixel*lambda_pixel),yvec(x_pixel*y_pixel*lambda_pixel),lambdavec(x_pixel*y_pixel*lambda_pixel);
-	newgrid.push_back(xvec);
-	newgrid.push_back(yvec);
-	if (lambda_pixel > 1) newgrid.push_back(lambdavec);
+	// the image is stored on regular axes, so that only the intensity is written per pixel
 	FoMo::tphysvar intens(x_pixel*y_pixel*lambda_pixel,0);
+	// the rendering is only measured on the calling thread
+	FoMo::ProfileScope scope("render");
 	
 #ifdef _OPENMP
 #pragma omp parallel for schedule(dynamic) collapse(2) private (x,y,z,p,lt,li,lj,v,nearest,intpolpeak,intpolfwhm,intpollosvel,lambdaval,tempintens,ind,could_lock_zone,c_old,c_new)
@@ -219,7 +238,7 @@ FoMo::RenderCube CGALinterpolation(FoMo::GoftCube goftcube, Delaunay_triangulati
 			intpollosvel=tmplosvel.first;*/
 					intpolpeak=peakmap[nearest];
 					intpolfwhm=fwhmmap[nearest];
-					intpollosvel=losvelmap[nearest];
+					if (spectroscopic) intpollosvel=losvelmap[nearest];
 				}
 				else
 				{
@@ -235,9 +254,6 @@ FoMo::RenderCube CGALinterpolation(FoMo::GoftCube goftcube, Delaunay_triangulati
 
 							//tempintens=intpolpeak*exp(-pow(lambdaval-intpollosvel/speedoflight*lambda0,2)/pow(intpolfwhm,2)*4.*log(2.));
 							ind=(i*(x_pixel)+j)*lambda_pixel+il;// 
-							newgrid.at(0).at(ind)=x;
-							newgrid.at(1).at(ind)=y;
-							newgrid.at(2).at(ind)=lambdaval+lambda0; // store the full wavelength
 							// this is critical, but with tasks, the ind is unique for each task, and no collision should occur
 							intens.at(ind)+=tempintens;// loop over z and lambda [D.Y 17 Nov 2014]
 						}
@@ -247,8 +263,6 @@ FoMo::RenderCube CGALinterpolation(FoMo::GoftCube goftcube, Delaunay_triangulati
 					{
 						tempintens=intpolpeak;
 						ind=(i*x_pixel+j); 
-						newgrid[0][ind]=x;
-						newgrid[1][ind]=y;
 						intens[ind]+=tempintens; // loop over z [D.Y 17 Nov 2014]
 					}
 			// print progress
@@ -258,7 +272,10 @@ FoMo::RenderCube CGALinterpolation(FoMo::GoftCube goftcube, Delaunay_triangulati
 	if (commrank==0) std::cout << " Done! " << std::endl << std::flush;
 	
 	FoMo::RenderCube rendercube(goftcube);
-	FoMo::tvars newdata;
+	// the regular axes of the image, the wavelength axis stores the full wavelength
+	// an imaging rendering has a single wavelength pixel, and no wavelength step
+	std::vector<double> step={(maxx-minx)/(x_pixel-1),(maxy-miny)/(y_pixel-1),(lambda_pixel > 1) ? lambda_width_in_A/(lambda_pixel-1) : 0.};
+	std::vector<double> origin={minx,miny,lambda0-lambda_width_in_A/2.};
 	double pathlength=(maxz-minz)/(z_pixel-1);
 	// this does not work if only one z_pixel is given (e.g. for a 2D simulation), or the maxz and minz are equal (face-on on 2D simulation)
 	// assume that the thickness of the slab is 1Mm. 
@@ -282,17 +299,21 @@ FoMo::RenderCube CGALinterpolation(FoMo::GoftCube goftcube, Delaunay_triangulati
 	if (found!=std::string::npos)
 	{
 		unitvec.at(0)="arcsec";
-		newgrid.at(0)=FoMo::operator*(1./Mmperarcsec,newgrid.at(0));
 		unitvec.at(1)="arcsec";
-		newgrid.at(1)=FoMo::operator*(1./Mmperarcsec,newgrid.at(1));
+		for (int i=0; i<2; i++)
+		{
+			origin.at(i)/=Mmperarcsec;
+			step.at(i)/=Mmperarcsec;
+		}
 		float dx=(maxx-minx)/(x_pixel-1),dy=(maxy-miny)/(y_pixel-1); // are given in Mm
 		apix = (dx/Mmperarcsec)*(dy/Mmperarcsec)*pow(pi/180./3600.,2); 
 		unitvec.back()="DN s^{-1} pixel^{-1}"; // this could be improved using Boost::units, making everything automatic, including compiler checks
 	}
 	
 	intens=FoMo::operator*(pathlength*1e8*apix,intens); // assume that the coordinates in goftcube are given in Mm, and convert to cm
-	newdata.push_back(intens);
-	rendercube.setdata(newgrid,newdata,&unitvec);
+	std::vector<int> count={x_pixel,y_pixel};
+	if (lambda_pixel > 1) count.push_back(lambda_pixel);
+	rendercube.setregulardata(count,origin,step,intens,&unitvec);
 	rendercube.setrendermethod("CGAL");
 	rendercube.setresolution(x_pixel,y_pixel,z_pixel,lambda_pixel,lambda_width);
 	if (lambda_pixel == 1)
@@ -310,29 +331,45 @@ namespace FoMo
 {
 	FoMo::RenderCube RenderWithCGAL(FoMo::DataCube datacube, FoMo::GoftCube goftcube, FoMoObservationType observationtype, 
 	const int x_pixel, const int y_pixel, const int z_pixel, const int lambda_pixel, const double lambda_width,
-	std::vector<double> lvec, std::vector<double> bvec, std::string outfile)
+	std::vector<double> lvec, std::vector<double> bvec, std::string outfile, const FoMo::RenderOptions & options)
 	{
 		/* A good speedup would be to calculate the triangulation per ray.
 		 * It would be good to select only the points around the ray, make the triangulation of that.
 		 * The number of points would be drastically reduced, and the triangulation would be greatly sped up.
 		 */
-		Delaunay_triangulation_3 DT=triangulationfromdatacube(goftcube);
+		// the triangulation is kept between renderings if the index is reused
+		std::shared_ptr<FoMo::CGALIndex> index;
+		if (options.index)
+		{
+			FoMo::checkrenderindex(*options.index,goftcube);
+			std::lock_guard<std::mutex> guard(options.index->lock);
+			index=options.index->cgal;
+		}
+		if (index)
+		{
+			std::cout << "Reusing the Delaunay triangulation." << std::endl << std::flush;
+		}
+		else
+		{
+			index=std::make_shared<FoMo::CGALIndex>();
+			index->triangulation=triangulationfromdatacube(goftcube);
+			if (options.index)
+			{
+				std::lock_guard<std::mutex> guard(options.index->lock);
+				options.index->cgal=index;
+			}
+		}
 		FoMo::RenderCube rendercube(goftcube);
+		if (options.roi.size() != 0) std::cout << "Warning: the region of interest is not used by the CGAL routines, the full image is rendered." << std::endl << std::flush;
 		for (std::vector<double>::iterator lit=lvec.begin(); lit!=lvec.end(); ++lit)
 			for (std::vector<double>::iterator bit=bvec.begin(); bit!=bvec.end(); ++bit)
 			{
-				rendercube=CGALinterpolation(goftcube,&DT,*lit,*bit, x_pixel, y_pixel, z_pixel, lambda_pixel, lambda_width);
+				rendercube=CGALinterpolation(goftcube,&index->triangulation,*lit,*bit, x_pixel, y_pixel, z_pixel, lambda_pixel, lambda_width);
+				if (options.sparse) rendercube.sparsify(options.sparsethreshold);
 				rendercube.setangles(*lit,*bit);
-				std::stringstream ss;
 				// if outfile is "", then this should not be executed.
-				ss << outfile;
-				ss << "l";
-				ss << std::setfill('0') << std::setw(3) << std::round(*lit/pi*180.);
-				ss << "b";
-				ss << std::setfill('0') << std::setw(3) << std::round(*bit/pi*180.);
-				ss << ".txt";
-				rendercube.writegoftcube(ss.str());
-				ss.str("");
+				std::string filename=FoMo::renderfilename(outfile,"CGAL",*lit,*bit);
+				if (options.write) rendercube.writegoftcube(filename,true);
 			}
 		return rendercube;
 	}
@@ -89,8 +89,14 @@ FoMo::RenderCube CGAL2D(FoMo::GoftCube goftcube, const double l, const int x_pix
 	// Read the physical variables
 	FoMo::tphysvar peakvec=goftcube.readvar(0);//Peak intensity 
 	FoMo::tphysvar fwhmvec=goftcube.readvar(1);// line width, =1 for AIA imaging
-	FoMo::tphysvar vx=goftcube.readvar(2);  
-	FoMo::tphysvar vy=goftcube.readvar(3);
+	// the velocities are only needed for spectroscopic renderings
+	bool spectroscopic=(lambda_pixel > 1);
+	FoMo::tphysvar vx, vy;
+	if (spectroscopic)
+	{
+		vx=goftcube.readvar(2);
+		vy=goftcube.readvar(3);
+	}
 	double losvelval;
 
 // No openmp possible here
@@ -105,9 +111,12 @@ FoMo::RenderCube CGAL2D(FoMo::GoftCube goftcube, const double l, const int x_pix
 		yacc[i]=gridpoint[0]*sin(l)+gridpoint[1]*cos(l);
 		temporarygridpoint=Point(grid[0][i],grid[1][i]); //position vector
 		// also create the map function_values here
-		std::vector<double> velvec = {vx[i], vy[i]};// velocity vector
-		losvelval = inner_product(unit.begin(),unit.end(),velvec.begin(),0.0);//velocity along line of sight for position [i]/[ng]
-		losvelmap[temporarygridpoint]=Coord_type(losvelval);
+		if (spectroscopic)
+		{
+			std::vector<double> velvec = {vx[i], vy[i]};// velocity vector
+			losvelval = inner_product(unit.begin(),unit.end(),velvec.begin(),0.0);//velocity along line of sight for position [i]/[ng]
+			losvelmap[temporarygridpoint]=Coord_type(losvelval);
+		}
 		peakmap[temporarygridpoint]=Coord_type(peakvec[i]);
 		fwhmmap[temporarygridpoint]=Coord_type(fwhmvec[i]);
 /*		peakmap.insert(make_pair(temporarygridpoint,Coord_type(peakvec[i])));
@@ -180,7 +189,7 @@ FoMo::RenderCube CGAL2D(FoMo::GoftCube goftcube, const double l, const int x_pix
 			intpollosvel=tmplosvel.first;*/
 					intpolpeak=peakmap[nearest];
 					intpolfwhm=fwhmmap[nearest];
-					intpollosvel=losvelmap[nearest];
+					if (spectroscopic) intpollosvel=losvelmap[nearest];
 				}
 				else
 				{
@@ -259,22 +268,19 @@ namespace FoMo
 {
 	FoMo::RenderCube RenderWithCGAL2D(FoMo::DataCube datacube, FoMo::GoftCube goftcube, FoMoObservationType observationtype, 
 	const int x_pixel, const int y_pixel, const int lambda_pixel, const double lambda_width,
-	std::vector<double> lvec, std::string outfile)
+	std::vector<double> lvec, std::string outfile, const FoMo::RenderOptions & options)
 	{
 		assert(datacube.readdim() == 2);
 		//goftcube=FoMo::emissionfromdatacube(datacube, chiantifile, abundfile, observationtype);
 		FoMo::RenderCube rendercube(goftcube);
+		if (options.roi.size() != 0) std::cout << "Warning: the region of interest is not used by the CGAL routines, the full image is rendered." << std::endl << std::flush;
 		for (std::vector<double>::iterator lit=lvec.begin(); lit!=lvec.end(); ++lit)
 			{
 				rendercube=CGAL2D(goftcube,*lit, x_pixel, y_pixel, lambda_pixel, lambda_width);
+				if (options.sparse) rendercube.sparsify(options.sparsethreshold);
 				rendercube.setangles(*lit,pi/2.);
-				std::stringstream ss;
-				ss << outfile;
-				ss << "l";
-				ss << std::setfill('0') << std::setw(3) << std::round(*lit/pi*180.);
-				ss << ".txt";
-				rendercube.writegoftcube(ss.str());
-				ss.str("");
+				std::string filename=FoMo::renderfilename(outfile,"CGAL2D",*lit,pi/2.);
+				if (options.write) rendercube.writegoftcube(filename,true);
 			}
 		return rendercube;
 	}
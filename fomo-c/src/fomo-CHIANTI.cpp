@@ -10,6 +10,7 @@
 #include <algorithm>
 #include <cassert>
 #include <cstring>
+#include <atomic>
 
 // Physical constants
 const double alphaconst=1.0645; // alpha=\sqrt{2\pi}/2/\sqrt{2ln2}
@@ -60,8 +61,42 @@ double abundfromchianti(std::istream & in, const std::string & ion)
 	return value;
 }
 
+double goftpoint(const float logT, const float logrho, const FoMo::tphysvar & tempgrid, const FoMo::tphysvar & rhogrid, const FoMo::tphysvar & goftvec, 
+	const unsigned int nt, const unsigned int nrho)
+{
+	// the G(T) of a single data point, with the table sorted by a slowly varying density and quickly varying temperature
+	int floortemp, ceiltemp, rhoindex,goftindex;
+	double res, x1, x2, y1, y2;
+
+	// find index of logT in tempgrid[0:nt-1]
+	// find index of logrho in rhogrid[0:nrho-1]
+	// tempindex=round((logT-tempgrid.at(0))/(tempgrid.at(1)-tempgrid.at(0)));
+	floortemp=floor((logT-tempgrid.at(0))/(tempgrid.at(1)-tempgrid.at(0)));
+	ceiltemp=floortemp+1;
+	rhoindex=round((logrho-rhogrid.at(0))/(rhogrid.at(nt)-rhogrid.at(0)));
+	
+	// if these indices are outside the domain, then the G(T) is 0
+	if (floortemp<0 || rhoindex<0 || ceiltemp>nt-1 || rhoindex>nrho-1)
+	{
+		res=0;
+	}
+	else
+	{
+		goftindex=rhoindex*nt+ceiltemp;
+	// we do a linear interpolation
+	// Patrick does a linear interpolation in temperature, and a nearest neighbour in density
+		x1=tempgrid.at(ceiltemp);
+		y1=goftvec.at(goftindex);
+		x2=tempgrid.at(floortemp);
+		y2=goftvec.at(goftindex-1);
+		res=(logT-x1)*(y2-y1)/(x2-x1)+y1;
+	}
+	return res;
+}
+
 FoMo::tphysvar goft(const FoMo::tphysvar logT, const FoMo::tphysvar logrho, const FoMo::DataCube gofttab)
 {
+	FoMo::ProfileScope scope("goft");
 	// uses the log(T), because the G(T) is also stored using those values.
 
 	FoMo::tgrid grid=gofttab.readgrid();
@@ -80,39 +115,12 @@ FoMo::tphysvar goft(const FoMo::tphysvar logT, const FoMo::tphysvar logrho, cons
 	g.resize(ng);
 	std::cout << "Doing G(T) interpolation... " << std::flush;
 
-	int floortemp, ceiltemp, rhoindex,goftindex;
-	double res, x1, x2, y1, y2;
-
 #ifdef _OPENMP
-#pragma omp parallel for schedule(dynamic) private(floortemp,ceiltemp,rhoindex,goftindex,res,x1,x2,y1,y2) shared(g)
+#pragma omp parallel for schedule(dynamic) shared(g)
 #endif
 	for (int i=0; i<ng; i++)
 	{
-		// find index of logT[i] in tempgrid[0:nt-1]
-		// find index of logrho[i] in rhogrid[0:nrho-1]
-		// tempindex=round((logT.at(i)-tempgrid.at(0))/(tempgrid.at(1)-tempgrid.at(0)));
-		floortemp=floor((logT.at(i)-tempgrid.at(0))/(tempgrid.at(1)-tempgrid.at(0)));
-		ceiltemp=floortemp+1;
-		rhoindex=round((logrho.at(i)-rhogrid.at(0))/(rhogrid.at(nt)-rhogrid.at(0)));
-		
-		// if these indices are outside the domain, then the G(T) is 0
-		if (floortemp<0 || rhoindex<0 || ceiltemp>nt-1 || rhoindex>nrho-1)
-		{
-			res=0;
-		}
-		else
-		{
-			goftindex=rhoindex*nt+ceiltemp;
-		// we do a linear interpolation
-		// Patrick does a linear interpolation in temperature, and a nearest neighbour in density
-			x1=tempgrid.at(ceiltemp);
-			y1=goftvec.at(goftindex);
-			x2=tempgrid.at(floortemp);
-			y2=goftvec.at(goftindex-1);
-			res=(logT.at(i)-x1)*(y2-y1)/(x2-x1)+y1;
-		}
-		
-		g.at(i)=res;
+		g.at(i)=goftpoint(logT.at(i),logrho.at(i),tempgrid,rhogrid,goftvec,nt,nrho);
 	}
 	std::cout << " Done!" << std::endl << std::flush;
 
@@ -224,41 +232,17 @@ FoMo::tphysvar linefwhm(const FoMo::tphysvar T, const double lambda0, const doub
  	return w;
 }
 
-FoMo::GoftCube FoMo::emissionfromdatacube(FoMo::DataCube datacube, std::string chiantifile, std::string abundfile, const FoMoObservationType observationtype)
+double emissionnormalisation(const std::string ion, const double lambda0, const std::string abundfile, const FoMo::FoMoObservationType observationtype)
 {
-// construct the G(T) using CHIANTI tables
-	int nvars=datacube.readnvars(); // G(T), width, vx, vy, vz
-	// take the last 3 from datacube
-	//std::cout << nvars << datacube.vars[0][0] << std::flush;
-	
-	FoMo::GoftCube emission;
-	
-	FoMo::tphysvar logrho = FoMo::log10(datacube.readvar(0));
-	FoMo::tphysvar T = datacube.readvar(1);
-	FoMo::tphysvar logT = FoMo::log10(T);
-	
-	std::string ion="";// better to be aia for AIA tables this will be checked for correct table [DY]
-	double lambda0=.0;
-	double atweight=1;
-	FoMo::DataCube gofttab=readgoftfromchianti(chiantifile,ion,lambda0,atweight);
-
-
-// fit the G(T) function to the data points
-	FoMo::tphysvar fittedgoft=goft(logT,logrho,gofttab);
-// calculate the line width at each data point
-	FoMo::tphysvar fittedwidth=linefwhm(T,lambda0,atweight);
-
-// calculate the maximum of the emission profile at each grid point
 // The emission in the CHIANTItables is calculated with the sun_coronal_2012_schmelz.abund file
 // There are 2 cases:
 // 	- we are doing spectroscopic calculations: the fittedemission should normalised with the alphaconst, and if a different abundance is used, we should renormalise to the new abundance
 // 	- we are doing intensity calculations (for e.g. AIA): the tables are already in the correct units, and the fittedemission needs to only be multiplied with 1. 
 	double normaliseconst=1.;
 	double abundratio=1.;
-	if (observationtype == Spectroscopic) // for spectroscopic study
+	if (observationtype == FoMo::Spectroscopic) // for spectroscopic study
 	{
 		std::cout << "This code is configured to do spectroscopic modelling." << std::endl;        
-		// FoMo::tphysvar fittedwidth=linefwhm(T,lambda0,atweight);
 		normaliseconst=1./alphaconst;
 		if (abundfile != std::string("/empty"))
 		{
@@ -271,15 +255,46 @@ FoMo::GoftCube FoMo::emissionfromdatacube(FoMo::DataCube datacube, std::string c
 			abundratio=abundnew/abundold;
 		}
 	}
-        if (observationtype == Imaging) // for imaging study 
+        if (observationtype == FoMo::Imaging) // for imaging study 
         {
-        
         	if (atoi(ion.c_str())!=int(lambda0+0.5)) 
 	        {// check if it is AIA GOFT table
 	                std::cerr << "GOFT table is not correct!" << std::endl; 
 	                exit(EXIT_FAILURE);
 		} 
- 
+        }
+	return normaliseconst*abundratio;
+}
+
+FoMo::GoftCube FoMo::emissionfromdatacube(const FoMo::DataCube & datacube, std::string chiantifile, std::string abundfile, const FoMoObservationType observationtype)
+{
+	FoMo::ProfileScope scope("emission");
+// construct the G(T) using CHIANTI tables
+	int nvars=datacube.readnvars(); // G(T), width, vx, vy, vz
+	// take the last 3 from datacube
+	//std::cout << nvars << datacube.vars[0][0] << std::flush;
+	
+	FoMo::GoftCube emission;
+	
+	FoMo::tphysvar logrho = FoMo::log10(datacube.readvar(0));
+	FoMo::tphysvar T = datacube.readvar(1);
+	FoMo::tphysvar logT = FoMo::log10(T);
+	
+	std::string ion="";// better to be aia for AIA tables this will be checked for correct table [DY]
+	double lambda0=.0;
+	double atweight=1;
+	FoMo::DataCube gofttab=readgoftfromchianti(chiantifile,ion,lambda0,atweight);
+
+
+// fit the G(T) function to the data points
+	FoMo::tphysvar fittedgoft=goft(logT,logrho,gofttab);
+// calculate the line width at each data point
+	FoMo::tphysvar fittedwidth=linefwhm(T,lambda0,atweight);
+
+// calculate the maximum of the emission profile at each grid point, with the normalisation of emissionnormalisation()
+	double normalisation=emissionnormalisation(ion,lambda0,abundfile,observationtype);
+        if (observationtype == Imaging) // for imaging study 
+        {
 	  	for (int i=0; i<fittedwidth.size(); i++)
 			fittedwidth.at(i)=1.;
         }
@@ -288,7 +303,7 @@ FoMo::GoftCube FoMo::emissionfromdatacube(FoMo::DataCube datacube, std::string c
 // for integration *[cm] [D.Y 12 Nov 2014]
 // AIA modelling: Temperature response function K(ne,Te)[cm^5 DN S^-1]*ne[cm^-3]=emis [DN cm^-1 s^-1]; 
 // for integration *[cm] [D.Y 12 Nov 20
-	FoMo::tphysvar fittedemission=FoMo::operator *(normaliseconst*abundratio,FoMo::operator *(FoMo::pow(10.,FoMo::operator *(2.,logrho)),fittedgoft));
+	FoMo::tphysvar fittedemission=FoMo::operator *(normalisation,FoMo::operator *(FoMo::pow(10.,FoMo::operator *(2.,logrho)),fittedgoft));
 	fittedemission=FoMo::operator /(fittedemission,fittedwidth);
 
 // load the emission and width into the emission-cube variable
@@ -305,8 +320,8 @@ FoMo::GoftCube FoMo::emissionfromdatacube(FoMo::DataCube datacube, std::string c
 	}
 	unitvec.push_back(gofttab.readunit().at(2)); // leave out density and temperature, but keep units of emissivity
 	unitvec.push_back("\\AA{}"); // units for FWHM of spectral line
-	// copy velocity vectors
-	for (int i=2; i<nvars; i++)
+	// copy velocity vectors, which are only used for spectroscopic renderings
+	if (observationtype != Imaging) for (int i=2; i<nvars; i++)
 	{
 			FoMo::tphysvar velcomp=datacube.readvar(i);
 			exporteddata.push_back(velcomp);
@@ -320,3 +335,147 @@ FoMo::GoftCube FoMo::emissionfromdatacube(FoMo::DataCube datacube, std::string c
 	return emission;
 };
 
+/**
+ * @brief This sets up the lazy computation of the emission of a DataCube.
+ * 
+ * The CHIANTI table and abundances are read in, but no emission is computed yet.
+ * @param datacube The DataCube with the density and temperature as first two variables, as for emissionfromdatacube().
+ * @param chiantifile The CHIANTI table with the G(T).
+ * @param abundfile The abundance file, or "/empty" for the abundances of the CHIANTI table.
+ * @param observationtype The observationtype, which determines the normalisation and line width.
+ */
+FoMo::LazyEmission::LazyEmission(const FoMo::DataCube & datacube, const std::string chiantifile, const std::string abundfile, const FoMo::FoMoObservationType observationtype):
+	datacube(&datacube), computed(0)
+{
+	std::string ion="";
+	double atweight=1;
+	lambda0=.0;
+	FoMo::DataCube gofttab=readgoftfromchianti(chiantifile,ion,lambda0,atweight);
+	FoMo::tgrid grid=gofttab.readgrid();
+	tempgrid=grid.at(0);
+	rhogrid=grid.at(1);
+	goftvec=gofttab.readvar(0);
+	nrho=std::count(tempgrid.begin(),tempgrid.end(),tempgrid.at(0));
+	nt=std::count(rhogrid.begin(),rhogrid.end(),rhogrid.at(0));
+	assert(tempgrid.size()==nt*nrho);
+	unit=gofttab.readunit().at(2);
+	
+	emissionconst=emissionnormalisation(ion,lambda0,abundfile,observationtype);
+	imaging=(observationtype == Imaging);
+	widthconst=2*std::sqrt(2*std::log(2))*std::sqrt(boltzmannconstant/massproton/atweight)*lambda0/speedoflight;
+	
+	unsigned int nblocks=(datacube.readngrid()+CompressedVar::blocksize-1)/CompressedVar::blocksize;
+	blocks.resize(nblocks);
+	blockdone.reset(new std::once_flag[nblocks]);
+}
+
+/**
+ * @brief This computes the emission of one data point.
+ * 
+ * The computation is done in the same steps and precision as in emissionfromdatacube(), such that the values are identical.
+ * @param i The index of the data point, for the warnings.
+ * @param rhovalue The density of the data point.
+ * @param Tvalue The temperature of the data point.
+ * @param peak The peak emission of the data point.
+ * @param width The line width of the data point.
+ */
+void FoMo::LazyEmission::computepoint(const unsigned int i, const float rhovalue, const float Tvalue, float & peak, float & width) const
+{
+	// log10 as in FoMo::log10(FoMo::tphysvar)
+	float logrho=0, logT=0;
+	if (rhovalue <= 0) std::cerr << "Warning: some densities were <= 0 at position " << i << std::endl;
+	else logrho=std::log10(rhovalue);
+	if (Tvalue <= 0) std::cerr << "Warning: some densities were <= 0 at position " << i << std::endl;
+	else logT=std::log10(Tvalue);
+	
+	float fittedgoft=goftpoint(logT,logrho,tempgrid,rhogrid,goftvec,nt,nrho);
+	width=imaging ? 1. : float(widthconst*std::sqrt(Tvalue));
+	float rhosquared=std::pow(10.,float(2.*logrho));
+	float fittedemission=emissionconst*(rhosquared*fittedgoft);
+	peak=fittedemission/width;
+}
+
+/**
+ * @brief This computes the emission of one block of data points.
+ * 
+ * The computation is done in the same steps and precision as in emissionfromdatacube(), such that the values are identical.
+ * @param b The block, containing data points b*CompressedVar::blocksize up to (b+1)*CompressedVar::blocksize-1.
+ */
+void FoMo::LazyEmission::computeblock(const unsigned int b)
+{
+	FoMo::ProfileScope scope("lazyemission");
+	unsigned int start=b*CompressedVar::blocksize;
+	unsigned int end=std::min(unsigned(datacube->readngrid()),start+CompressedVar::blocksize);
+	unsigned int dim=datacube->readdim();
+	FoMo::ColumnReader rho(*datacube,dim);
+	FoMo::ColumnReader T(*datacube,dim+1);
+	std::vector<float> & values=blocks[b];
+	values.resize(2*(end-start));
+	for (unsigned int i=start; i<end; i++) computepoint(i,rho[i],T[i],values[2*(i-start)],values[2*(i-start)+1]);
+	computed+=end-start;
+}
+
+/**
+ * @brief This computes the emission of all data points at once, without keeping it.
+ * 
+ * This is used for the lines that are blended into the spectral window (see FoMoObject::setblendedlines()), of 
+ * which only the peak emission and the line width are needed. The values are identical to the columns of the 
+ * GoftCube computed by emissionfromdatacube().
+ * @param peak The peak emission of every data point.
+ * @param width The line width of every data point.
+ */
+void FoMo::LazyEmission::computeall(FoMo::tphysvar & peak, FoMo::tphysvar & width) const
+{
+	FoMo::ProfileScope scope("emission");
+	int ng=datacube->readngrid();
+	unsigned int dim=datacube->readdim();
+	peak.resize(ng);
+	width.resize(ng);
+	int nblocks=blocks.size();
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for (int b=0; b<nblocks; b++)
+	{
+		FoMo::ColumnReader rho(*datacube,dim);
+		FoMo::ColumnReader T(*datacube,dim+1);
+		int end=std::min(ng,(b+1)*int(CompressedVar::blocksize));
+		for (int i=b*CompressedVar::blocksize; i<end; i++) computepoint(i,rho[i],T[i],peak[i],width[i]);
+	}
+}
+
+/**
+ * @brief This returns the DataCube of which the emission is computed.
+ * @return The DataCube.
+ */
+const FoMo::DataCube & FoMo::LazyEmission::readdatacube() const
+{
+	return *datacube;
+}
+
+/**
+ * @brief This returns the rest wavelength of the CHIANTI table.
+ * @return The rest wavelength lambda0, in Angstrom.
+ */
+double FoMo::LazyEmission::readlambda0() const
+{
+	return lambda0;
+}
+
+/**
+ * @brief This returns the units of the peak emission, as stored in the CHIANTI table.
+ * @return The units.
+ */
+std::string FoMo::LazyEmission::readunit() const
+{
+	return unit;
+}
+
+/**
+ * @brief This returns the number of data points of which the emission has been computed so far.
+ * @return The number of data points, which is a multiple of CompressedVar::blocksize (except for the last block).
+ */
+unsigned int FoMo::LazyEmission::readncomputed() const
+{
+	return computed;
+}
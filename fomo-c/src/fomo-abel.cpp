@@ -0,0 +1,276 @@
+#include "../config.h"
+#include "FoMo.h"
+#include "FoMo-internal.h"
+#include <sstream>
+#include <iomanip>
+#include <cstdlib>
+#include <gsl/gsl_const_mksa.h>
+#include <boost/progress.hpp>
+#include <cmath>
+#include <algorithm>
+
+const double speedoflight=GSL_CONST_MKSA_SPEED_OF_LIGHT; // speed of light
+const double pi=M_PI; //pi
+
+/**
+ * @brief The emission of an axisymmetric model on its (r,z) lattice, averaged over phi for (r,phi,z) data.
+ */
+struct AbelModel
+{
+	/** The radii and axial positions of the lattice, sorted. */
+	FoMo::tcoord rvec, zvec;
+	/** The peak emission, line width and radial and azimuthal velocity at (rvec[i],zvec[k]), at i*zvec.size()+k. */
+	std::vector<double> peak, fwhm, vr, vphi;
+	/** The edges of the radial shells around every radius: shell i spans redge[i] to redge[i+1]. */
+	std::vector<double> redge;
+};
+
+/**
+ * @brief One element of the Abel-projection matrix: the part of a ray in one radial shell, on one side of the axis.
+ */
+struct AbelElement
+{
+	/** The radial shell. */
+	int shell;
+	/** The length of the ray in the shell, on one side of its closest approach to the axis. */
+	double length;
+	/** The mean of s/r and p/r over this part of the ray, with s the distance along the ray and p the impact parameter. */
+	double radialfraction, azimuthalfraction;
+};
+
+/**
+ * @brief This collects the emission of a goftcube in cylindrical coordinates on its (r,z) lattice.
+ * @param goftcube The goftcube, with coordinates (r,z) or (r,phi,z) and variables peak, fwhm, vr, vphi (and vz).
+ * @param options The render options, possibly with lazily computed emission.
+ * @param spectroscopic If false, the velocities are not needed, and are left 0.
+ * @return The model, with the values of the data points with the same (r,z) averaged over phi.
+ */
+AbelModel abelmodel(const FoMo::GoftCube & goftcube, const FoMo::RenderOptions & options, const bool spectroscopic)
+{
+	int ng=goftcube.readngrid();
+	int dim=goftcube.readdim();
+	int zcolumn=dim-1;
+	AbelModel model;
+	FoMo::ColumnReader rreader(goftcube,0), zreader(goftcube,zcolumn);
+	for (int i=0; i<ng; i++)
+	{
+		model.rvec.push_back(rreader[i]);
+		model.zvec.push_back(zreader[i]);
+	}
+	std::sort(model.rvec.begin(),model.rvec.end());
+	model.rvec.erase(std::unique(model.rvec.begin(),model.rvec.end()),model.rvec.end());
+	std::sort(model.zvec.begin(),model.zvec.end());
+	model.zvec.erase(std::unique(model.zvec.begin(),model.zvec.end()),model.zvec.end());
+	size_t nr=model.rvec.size(), nz=model.zvec.size(), nphi=1;
+	if (dim == 3)
+	{
+		FoMo::ColumnReader phireader(goftcube,1);
+		FoMo::tcoord phivec(ng);
+		for (int i=0; i<ng; i++) phivec[i]=phireader[i];
+		std::sort(phivec.begin(),phivec.end());
+		nphi=std::unique(phivec.begin(),phivec.end())-phivec.begin();
+	}
+	if (nr*nz*nphi != size_t(ng) || model.rvec.front() < 0 || nr < 2)
+	{
+		std::cerr << "Error: the Abel rendermethod needs data on a lattice in (r,z) or (r,phi,z), with r >= 0 and at least 2 radii." << std::endl;
+		exit(EXIT_FAILURE);
+	}
+
+	// the radial shells are bounded by the midpoints between the radii
+	model.redge.resize(nr+1);
+	model.redge[0]=std::max(0.,model.rvec[0]-(model.rvec[1]-model.rvec[0])/2.);
+	for (size_t i=1; i<nr; i++) model.redge[i]=(model.rvec[i-1]+model.rvec[i])/2.;
+	model.redge[nr]=model.rvec[nr-1]+(model.rvec[nr-1]-model.rvec[nr-2])/2.;
+
+	// average the values over phi
+	int nvel=spectroscopic ? (options.emission ? options.emission->readdatacube().readnvars() : goftcube.readnvars())-2 : 0;
+	FoMo::ColumnReader peakvec=FoMo::rendercolumn(goftcube,dim,options);
+	FoMo::ColumnReader fwhmvec=FoMo::rendercolumn(goftcube,dim+1,options);
+	model.peak.assign(nr*nz,0);
+	model.fwhm.assign(nr*nz,0);
+	model.vr.assign(nr*nz,0);
+	model.vphi.assign(nr*nz,0);
+	for (int n=0; n<ng; n++)
+	{
+		size_t i=std::lower_bound(model.rvec.begin(),model.rvec.end(),rreader[n])-model.rvec.begin();
+		size_t k=std::lower_bound(model.zvec.begin(),model.zvec.end(),zreader[n])-model.zvec.begin();
+		model.peak[i*nz+k]+=peakvec[n]/nphi;
+		model.fwhm[i*nz+k]+=fwhmvec[n]/nphi;
+	}
+	if (nvel >= 2)
+	{
+		FoMo::ColumnReader vrvec=FoMo::rendercolumn(goftcube,dim+2,options);
+		FoMo::ColumnReader vphivec=FoMo::rendercolumn(goftcube,dim+3,options);
+		for (int n=0; n<ng; n++)
+		{
+			size_t i=std::lower_bound(model.rvec.begin(),model.rvec.end(),rreader[n])-model.rvec.begin();
+			size_t k=std::lower_bound(model.zvec.begin(),model.zvec.end(),zreader[n])-model.zvec.begin();
+			model.vr[i*nz+k]+=vrvec[n]/nphi;
+			model.vphi[i*nz+k]+=vphivec[n]/nphi;
+		}
+	}
+	return model;
+}
+
+/**
+ * @brief This computes the row of the Abel-projection matrix for a ray with impact parameter p.
+ *
+ * The ray is split into the parts inside every radial shell, on both sides of its closest approach to the axis.
+ * The lengths and the mean of s/r and p/r are integrated exactly.
+ * @param model The model, of which the radial shells are used.
+ * @param p The impact parameter of the ray.
+ * @return The elements of the row, for one side of the axis: the other side has the same length and opposite s/r.
+ */
+std::vector<AbelElement> abelrow(const AbelModel & model, const double p)
+{
+	std::vector<AbelElement> row;
+	double absp=std::abs(p);
+	for (size_t i=0; i+1<model.redge.size(); i++)
+	{
+		if (model.redge[i+1] <= absp) continue;
+		double s1=std::sqrt(std::max(0.,model.redge[i]*model.redge[i]-p*p));
+		double s2=std::sqrt(model.redge[i+1]*model.redge[i+1]-p*p);
+		AbelElement element;
+		element.shell=i;
+		element.length=s2-s1;
+		if (element.length <= 0) continue;
+		// integral of s/r ds is r, integral of p/r ds is p*asinh(s/p)
+		element.radialfraction=(std::max(model.redge[i+1],absp)-std::max(model.redge[i],absp))/element.length;
+		element.azimuthalfraction= absp > 0 ? p*(std::asinh(s2/absp)-std::asinh(s1/absp))/element.length : 0;
+		row.push_back(element);
+	}
+	return row;
+}
+
+FoMo::RenderCube abelprojection(const FoMo::GoftCube & goftcube, const AbelModel & model, const int x_pixel, const int y_pixel, const int z_pixel, const int lambda_pixel, const double lambda_width, const FoMo::RenderOptions & options)
+{
+	int commrank;
+#ifdef HAVEMPI
+	MPI_Comm_rank(MPI_COMM_WORLD,&commrank);
+#else
+	commrank = 0;
+#endif
+	// The axis of symmetry is the z-axis. For a line-of-sight perpendicular to it (b=pi/2), the image x-axis is -z,
+	// and the image y-axis is the impact parameter p, as for the other rendermethods. The image does not depend on l.
+	double rmax=model.redge.back();
+	double minx=-model.zvec.back(), maxx=-model.zvec.front(), miny=-rmax, maxy=rmax;
+	int nz=model.zvec.size();
+
+	std::string chiantifile=goftcube.readchiantifile();
+	double lambda0=goftcube.readlambda0();// lambda0=AIA bandpass for AIA imaging
+	double lambda_width_in_A=lambda_width*lambda0/speedoflight;
+
+	// only the pixels in the region of interest are rendered
+	int x0, nx, y0, ny;
+	FoMo::regionofinterest(options,x_pixel,y_pixel,x0,nx,y0,ny);
+	// the image is stored on regular axes, so that only the intensity is written per pixel
+	FoMo::tphysvar intens(nx*ny*lambda_pixel,0);
+
+	if (commrank==0) std::cout << "Building frame: " << std::flush;
+	boost::progress_display show_progress(ny);
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+	{
+	FoMo::ProfileScope scope("render");
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+	for (int i=y0; i<y0+ny; i++)
+	{
+		double y = double(i)/(y_pixel-1)*(maxy-miny)+miny;
+		// the row of the Abel-projection matrix for this impact parameter
+		std::vector<AbelElement> row=abelrow(model,y);
+		FoMo::tphysvar rayspectrum(lambda_pixel);
+		for (int j=x0; j<x0+nx; j++)
+		{
+			double x = double(j)/(x_pixel-1)*(maxx-minx)+minx;
+			std::fill(rayspectrum.begin(),rayspectrum.end(),0);
+			// the nearest axial position of the model
+			int k=std::lower_bound(model.zvec.begin(),model.zvec.end(),-x)-model.zvec.begin();
+			if (k == nz || (k > 0 && -x-model.zvec[k-1] < model.zvec[k]+x)) k--;
+			for (unsigned int e=0; e<row.size(); e++)
+			{
+				int m=row[e].shell*nz+k;
+				double intpolpeak=model.peak[m]*row[e].length;
+				if (lambda_pixel>1)// spectroscopic study
+				{
+					// the velocity along the line-of-sight is vr*s/r-vphi*p/r, with s/r of opposite sign on the other side of the axis
+					double radialvel=model.vr[m]*row[e].radialfraction;
+					double azimuthalvel=-model.vphi[m]*row[e].azimuthalfraction;
+					for (int il=0; il<lambda_pixel; il++)
+					{
+						// lambda the relative wavelength around lambda0, with a width of lambda_width
+						double lambdaval=double(il)/(lambda_pixel-1)*lambda_width_in_A-lambda_width_in_A/2.;
+						for (int side=-1; side<=1; side+=2)
+						{
+							double intpollosvel=side*radialvel+azimuthalvel;
+							rayspectrum[il]+=intpolpeak ? intpolpeak*exp(-pow(lambdaval-intpollosvel/speedoflight*lambda0,2)/pow(model.fwhm[m],2)*4.*log(2.)) : 0;
+						}
+					}
+				}
+				if (lambda_pixel==1) // AIA imaging study
+				{
+					rayspectrum[0]+=2*intpolpeak;
+				}
+			}
+			// every pixel is written by one thread only
+			std::copy(rayspectrum.begin(),rayspectrum.end(),intens.begin()+((i-y0)*nx+j-x0)*lambda_pixel);
+		}
+		++show_progress;
+	}
+	}
+	if (commrank==0) std::cout << " Done! " << std::endl << std::flush;
+
+	FoMo::RenderCube rendercube(goftcube);
+	// the path lengths of the rays are already in the intensity, in Mm
+	FoMo::setimage(rendercube,goftcube,options,minx,maxx,miny,maxy,x_pixel,y_pixel,x0,nx,y0,ny,lambda_pixel,lambda_width_in_A,lambda0,1.,intens);
+	if (options.sparse && (lambda_pixel > 1)) rendercube.sparsify(options.sparsethreshold);
+	rendercube.setrendermethod("Abel");
+	rendercube.setresolution(nx,ny,z_pixel,lambda_pixel,lambda_width);
+	if (lambda_pixel == 1)
+	{
+		rendercube.setobservationtype(FoMo::Imaging);
+	}
+	else
+	{
+		rendercube.setobservationtype(FoMo::Spectroscopic);
+	}
+	return rendercube;
+}
+
+namespace FoMo
+{
+	FoMo::RenderCube RenderWithAbel(const FoMo::GoftCube & goftcube, const int x_pixel, const int y_pixel, const int z_pixel, const int lambda_pixel, const double lambda_width,
+	std::vector<double> lvec, std::vector<double> bvec, std::string outfile, const FoMo::RenderOptions & options)
+	{
+		if (goftcube.readdim() != 2 && goftcube.readdim() != 3)
+		{
+			std::cerr << "Error: the Abel rendermethod needs a DataCube in (r,z) or (r,phi,z) coordinates." << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		for (std::vector<double>::iterator bit=bvec.begin(); bit!=bvec.end(); ++bit)
+			if (std::abs(cos(*bit)) > 1e-6)
+			{
+				std::cerr << "Error: the Abel rendermethod only renders views perpendicular to the axis of symmetry (b=pi/2)." << std::endl;
+				exit(EXIT_FAILURE);
+			}
+		FoMo::RenderCube rendercube(goftcube);
+		AbelModel model;
+		{
+			FoMo::ProfileScope scope("index");
+			model=abelmodel(goftcube,options,lambda_pixel > 1);
+		}
+		std::cout << "Axisymmetric model with " << model.rvec.size() << " radii and " << model.zvec.size() << " axial positions." << std::endl << std::flush;
+		for (std::vector<double>::iterator lit=lvec.begin(); lit!=lvec.end(); ++lit)
+			for (std::vector<double>::iterator bit=bvec.begin(); bit!=bvec.end(); ++bit)
+			{
+				rendercube=abelprojection(goftcube,model, x_pixel, y_pixel, z_pixel, lambda_pixel, lambda_width, options);
+				rendercube.setangles(*lit,*bit);
+				// if outfile is "", then this should not be executed.
+				std::string filename=FoMo::renderfilename(outfile,"Abel",*lit,*bit);
+				if (options.write) rendercube.writegoftcube(filename,true);
+			}
+		return rendercube;
+	}
+}
@@ -0,0 +1,209 @@
+#include "../config.h"
+#include "FoMo.h"
+#include "FoMo-internal.h"
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <set>
+#include <unistd.h>
+
+// A rendermethod and spatial index that the "auto" rendermethod can choose.
+struct AutoCandidate
+{
+	std::string method;
+	std::string index;
+	// a rough estimate of the memory of the spatial index per data point, in bytes
+	double bytesperpoint;
+	// the estimated time for all views, and the relative difference with the reference on the sample
+	double estimate;
+	double difference;
+};
+
+// This counts the distinct values of a coordinate of the DataCube, and the distinct spacings between them. The
+// spacings are compared on a logarithmic scale, so that every level of an AMR grid is counted once.
+static void coordinatestatistics(const FoMo::DataCube & datacube, const unsigned int column, long & ndistinct, int & nspacings)
+{
+	FoMo::ColumnReader reader(datacube,column);
+	std::vector<float> values(datacube.readngrid());
+	for (unsigned int i=0; i<values.size(); i++) values[i]=reader[i];
+	std::sort(values.begin(),values.end());
+	values.erase(std::unique(values.begin(),values.end()),values.end());
+	ndistinct=values.size();
+	float smallest=INFINITY;
+	for (unsigned int i=1; i<values.size(); i++) smallest=std::min(smallest,values[i]-values[i-1]);
+	std::set<long> spacings;
+	for (unsigned int i=1; i<values.size(); i++) spacings.insert(std::lround(4*std::log2((values[i]-values[i-1])/smallest)));
+	nspacings=spacings.size();
+}
+
+// This renders a sample of the rays of one view with a candidate, without writing it out, and measures the time.
+static FoMo::RenderCube rendersample(const FoMo::GoftCube & goftcube, const AutoCandidate & candidate, const int x_pixel, const int y_pixel,
+	const int z_pixel, const int lambda_pixel, const double lambda_width, const double l, const double b, const FoMo::RenderOptions & options, double & seconds)
+{
+	FoMo::RenderOptions sampleoptions=options;
+	sampleoptions.spatialindex=candidate.index;
+	std::chrono::steady_clock::time_point start=std::chrono::steady_clock::now();
+	FoMo::RenderCube rendercube(goftcube);
+	if (candidate.method == "Projection")
+		rendercube=FoMo::RenderWithProjection(goftcube,x_pixel,y_pixel,z_pixel,lambda_pixel,lambda_width,{l},{b},"",sampleoptions);
+	else
+		rendercube=FoMo::RenderWithNearestNeighbour(goftcube,x_pixel,y_pixel,z_pixel,lambda_pixel,lambda_width,{l},{b},"",sampleoptions);
+	seconds=std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+	return rendercube;
+}
+
+/**
+ * @brief This chooses the rendermethod and spatial index for the "auto" rendermethod.
+ *
+ * A 2D DataCube is rendered with the Slab rendermethod. For a 3D DataCube, the candidates are the NearestNeighbour
+ * rendermethod with the "rtree", "kdtree" and "grid" spatial indexes (and "voxel" if the index is reused, see
+ * setreuseindex()), and the Projection rendermethod if the grid is a regular lattice, since it assumes that all
+ * data points have the same volume. Indexes that do not fit in the available memory are left out. The CGAL
+ * rendermethods are not considered, since they cannot render a sample of the rays.
+ *
+ * Every candidate renders a band of 1/16 of the rows (at least 8) in the middle of the image (or of the region of
+ * interest) for the first view, and a single pixel for the fixed cost of a view, with a spatial index that is built 
+ * once, for the first sample. The time of the full rendering of all views is extrapolated from these times, and the
+ * candidate with the lowest estimate is chosen among the candidates that differ less than setautotolerance() from the
+ * NearestNeighbour rendering with the "rtree" index. The decision is printed, and kept as long as the grid, the 
+ * resolution, the chiantifile, the region of interest, the number of views, the tolerance and the spatial index set
+ * with setspatialindex() stay the same, so that a series of snapshots on the same grid is only sampled once.
+ * @param lvec The l-angles of the views that will be rendered.
+ * @param bvec The b-angles of the views that will be rendered.
+ */
+void FoMo::FoMoObject::autotune(const std::vector<double> lvec, const std::vector<double> bvec)
+{
+	int x_pixel, y_pixel, z_pixel, lambda_pixel;
+	double lambda_width;
+	this->rendering.readresolution(x_pixel,y_pixel,z_pixel,lambda_pixel,lambda_width);
+	int dim=datacube.readdim();
+	long ng=datacube.readngrid();
+	long nviews=lvec.size()*bvec.size();
+
+	std::stringstream key;
+	key << FoMo::hashgrid(datacube) << "|" << x_pixel << "|" << y_pixel << "|" << z_pixel << "|" << lambda_pixel << "|" << lambda_width;
+	key << "|" << rendering.readchiantifile() << "|" << rendering.readabundfile() << "|" << nviews << "|" << (renderindex ? 1 : 0);
+	key << "|" << autotolerance << "|" << spatialindex << "|" << indexmemory;
+	for (unsigned int i=0; i<roi.size(); i++) key << "|" << roi[i];
+	if (key.str() == autokey)
+	{
+		rendering.setrendermethod(autochoice);
+		return;
+	}
+
+	autoindex=spatialindex;
+	if (dim == 2 || nviews == 0)
+	{
+		autochoice=(dim == 2) ? "Slab" : "NearestNeighbour";
+		std::cout << "Autotuning: using the " << autochoice << " rendermethod for the " << dim << "D DataCube." << std::endl << std::flush;
+		rendering.setrendermethod(autochoice);
+		autokey=key.str();
+		return;
+	}
+
+	// inspect the grid
+	long ndistinct[3];
+	int nspacings[3];
+	for (int d=0; d<3; d++) coordinatestatistics(datacube,d,ndistinct[d],nspacings[d]);
+	bool lattice=(double(ndistinct[0])*ndistinct[1]*ndistinct[2] == ng);
+	int maxspacings=std::max(nspacings[0],std::max(nspacings[1],nspacings[2]));
+	long pages=sysconf(_SC_AVPHYS_PAGES), pagesize=sysconf(_SC_PAGESIZE);
+	double available=(pages > 0 && pagesize > 0) ? double(pages)*pagesize : INFINITY;
+
+	std::vector<AutoCandidate> candidates;
+	candidates.push_back({"NearestNeighbour","rtree",40,0,0});
+	candidates.push_back({"NearestNeighbour","kdtree",20,0,0});
+	candidates.push_back({"NearestNeighbour","grid",24,0,0});
+	// the voxel table only pays off if it is kept for several views
+	if (renderindex) candidates.push_back({"NearestNeighbour","voxel",12+indexmemory/ng,0,0});
+	if (lattice) candidates.push_back({"Projection","",12,0,0});
+	std::vector<std::string> skipped;
+	for (unsigned int c=1; c<candidates.size(); c++)
+		if (candidates[c].bytesperpoint*ng > available)
+		{
+			skipped.push_back(candidates[c].method+" "+candidates[c].index);
+			candidates.erase(candidates.begin()+c);
+			c--;
+		}
+
+	// all candidates can use the lazy emission
+	rendering.setrendermethod("NearestNeighbour");
+	this->computeemission();
+	FoMo::RenderOptions options=this->renderoptions();
+	options.index.reset();
+	options.emission=emission;
+	options.sparse=false;
+	options.raystatistics=false;
+	options.write=false;
+
+	// the band of rows in the middle of the region of interest, and a single pixel in its middle
+	int x0, nx, y0, ny;
+	FoMo::regionofinterest(options,x_pixel,y_pixel,x0,nx,y0,ny);
+	int rows=std::min(std::max(ny/16,8),ny);
+	int first=y0+(ny-rows)/2;
+	double l=lvec.front(), b=bvec.front();
+	std::vector<int> band={x0,x0+nx-1,first,first+rows-1}, pixel={x0+nx/2,x0+nx/2,first+rows/2,first+rows/2};
+
+	// Every candidate keeps its spatial index in a RenderIndex of its own, so that it is built once, by the first
+	// sample. The time of the build is the difference between the first and the second sample of a single pixel.
+	// With the lazy emission, the band of the reference is timed a second time, once the emission of the band is known.
+	FoMo::tphysvar reference;
+	double referencesum=0;
+	for (unsigned int c=0; c<candidates.size(); c++)
+	{
+		double buildseconds, pixelseconds, bandseconds;
+		options.index=std::make_shared<FoMo::RenderIndex>();
+		options.index->keepviews=false;
+		options.roi=pixel;
+		rendersample(goftcube,candidates[c],x_pixel,y_pixel,z_pixel,lambda_pixel,lambda_width,l,b,options,buildseconds);
+		rendersample(goftcube,candidates[c],x_pixel,y_pixel,z_pixel,lambda_pixel,lambda_width,l,b,options,pixelseconds);
+		buildseconds=std::max(buildseconds-pixelseconds,0.);
+		options.roi=band;
+		FoMo::tphysvar intensity=rendersample(goftcube,candidates[c],x_pixel,y_pixel,z_pixel,lambda_pixel,lambda_width,l,b,options,bandseconds).readintensity();
+		if (c == 0)
+		{
+			if (options.emission) rendersample(goftcube,candidates[c],x_pixel,y_pixel,z_pixel,lambda_pixel,lambda_width,l,b,options,bandseconds);
+			reference=intensity;
+			for (unsigned int i=0; i<reference.size(); i++) referencesum+=std::fabs(reference[i]);
+		}
+		double differencesum=0;
+		for (unsigned int i=0; i<std::min(intensity.size(),reference.size()); i++) differencesum+=std::fabs(intensity[i]-reference[i]);
+		if (intensity.size() != reference.size()) differencesum=INFINITY;
+		candidates[c].difference=(referencesum > 0) ? differencesum/referencesum : (differencesum > 0 ? INFINITY : 0);
+		// the time of a view is a fixed part (the rotation of the grid), measured with a single pixel, and a part 
+		// proportional to the number of rows; the index is built for every view, or once if it is kept
+		double viewseconds=pixelseconds+std::max(bandseconds-pixelseconds,0.)*ny/rows;
+		candidates[c].estimate=renderindex ? buildseconds+nviews*viewseconds : nviews*(buildseconds+viewseconds);
+	}
+	options.index.reset();
+
+	unsigned int best=0;
+	for (unsigned int c=1; c<candidates.size(); c++)
+		if (candidates[c].difference <= autotolerance && candidates[c].estimate < candidates[best].estimate) best=c;
+	autochoice=candidates[best].method;
+	if (!candidates[best].index.empty()) autoindex=candidates[best].index;
+	autokey=key.str();
+	rendering.setrendermethod(autochoice);
+
+	std::cout << "Autotuning: " << ng << " data points, ";
+	if (lattice) std::cout << "a regular lattice of " << ndistinct[0] << "x" << ndistinct[1] << "x" << ndistinct[2] << " points";
+	else std::cout << "not a regular lattice (up to " << maxspacings << " different spacings along an axis)";
+	std::cout << ", " << available/1e9 << "GB of memory available." << std::endl;
+	for (unsigned int i=0; i<skipped.size(); i++) std::cout << "  " << skipped[i] << ": skipped, since it does not fit in memory" << std::endl;
+#ifdef HAVE_CGAL_DELAUNAY_TRIANGULATION_2_H
+	std::cout << "  CGAL: skipped, since it cannot render a sample of the rays" << std::endl;
+#endif
+	if (!lattice) std::cout << "  Projection: skipped, since the data points do not have equal volumes" << std::endl;
+	std::cout << "Autotuning: rendered rows " << first << "-" << first+rows-1 << " of the view l=" << l << ", b=" << b << ":" << std::endl;
+	for (unsigned int c=0; c<candidates.size(); c++)
+	{
+		std::cout << "  " << candidates[c].method << " " << candidates[c].index << ": estimated " << candidates[c].estimate << "s for " << nviews << " views, ";
+		if (c == 0) std::cout << "reference" << std::endl;
+		else std::cout << "relative difference " << candidates[c].difference << (candidates[c].difference > autotolerance ? " (too large)" : "") << std::endl;
+	}
+	std::cout << "Autotuning: using the " << autochoice << " rendermethod";
+	if (autochoice == "NearestNeighbour") std::cout << " with the " << autoindex << " spatial index";
+	std::cout << "." << std::endl << std::flush;
+}
@@ -0,0 +1,250 @@
+#include "../config.h"
+#include "FoMo.h"
+#include "FoMo-internal.h"
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <cstdio>
+#include <unistd.h>
+#include <thread>
+
+// escape double quotes from the shell, as in fomo-io.cpp
+#define XSTR(x) #x
+#define STR(x) XSTR(x)
+#define FOMO_VER STR(FOMOVERSION)
+
+const uint64_t fnvoffset=14695981039346656037ULL;
+const uint64_t fnvprime=1099511628211ULL;
+
+/**
+ * @brief This adds a block of memory to a 64-bit FNV-1a hash.
+ * @param hash The hash so far. It should be initialised with fnvoffset.
+ * @param data The start of the memory block.
+ * @param size The size of the memory block in bytes.
+ * @return The updated hash.
+ */
+uint64_t FoMo::fnv1a(uint64_t hash, const void * data, const size_t size)
+{
+	const unsigned char * bytes=static_cast<const unsigned char *>(data);
+	for (size_t i=0; i<size; i++)
+	{
+		hash^=bytes[i];
+		hash*=fnvprime;
+	}
+	return hash;
+}
+
+/**
+ * @brief This computes a hash of the contents of a DataCube.
+ *
+ * The hash includes the dimension, number of grid points and variables, the units and all the coordinates and
+ * variables. A compressed DataCube is hashed block by block after decompression, with the same result. The hash
+ * of the data of a FoMoObject is kept by FoMoObject::hashdata().
+ * @param datacube The DataCube to be hashed.
+ * @return The 64-bit FNV-1a hash.
+ */
+uint64_t FoMo::hashdatacube(const FoMo::DataCube & datacube)
+{
+	uint64_t hash=fnvoffset;
+	int header[3]={datacube.readdim(),datacube.readngrid(),datacube.readnvars()};
+	hash=fnv1a(hash,header,sizeof(header));
+	std::vector<std::string> unitvec=datacube.readunit();
+	for (unsigned int i=0; i<unitvec.size(); i++) hash=fnv1a(hash,unitvec[i].c_str(),unitvec[i].size()+1);
+	for (int i=0; i<header[0]+header[2]; i++)
+	{
+		FoMo::ColumnReader column(datacube,i);
+		for (int j=0; j<header[1]; j+=FoMo::CompressedVar::blocksize)
+		{
+			int n=std::min(header[1]-j,int(FoMo::CompressedVar::blocksize));
+			hash=fnv1a(hash,column.readblock(j/FoMo::CompressedVar::blocksize),n*sizeof(float));
+		}
+	}
+	return hash;
+}
+
+/**
+ * @brief This computes a hash of the grid of a DataCube.
+ * 
+ * Only the dimension, the number of grid points and the coordinates are hashed, so that the hash does not change
+ * if only the variables change (e.g. between the snapshots of a simulation on a fixed grid).
+ * @param datacube The DataCube of which the grid is hashed.
+ * @return The 64-bit FNV-1a hash.
+ */
+uint64_t FoMo::hashgrid(const FoMo::DataCube & datacube)
+{
+	uint64_t hash=fnvoffset;
+	int header[2]={datacube.readdim(),datacube.readngrid()};
+	hash=fnv1a(hash,header,sizeof(header));
+	for (int i=0; i<header[0]; i++)
+	{
+		FoMo::ColumnReader column(datacube,i);
+		for (int j=0; j<header[1]; j+=FoMo::CompressedVar::blocksize)
+		{
+			int n=std::min(header[1]-j,int(FoMo::CompressedVar::blocksize));
+			hash=fnv1a(hash,column.readblock(j/FoMo::CompressedVar::blocksize),n*sizeof(float));
+		}
+	}
+	return hash;
+}
+
+/**
+ * @brief This returns the hash of the datacube of the FoMoObject, see hashdatacube().
+ *
+ * The hash is only computed the first time after the data has been changed (with setdata(), swapdata(),
+ * push_back_datapoint(), mortonsort() or sharedata()), so that renderings that hit the render cache do not
+ * read the whole datacube.
+ * @return The 64-bit FNV-1a hash.
+ */
+uint64_t FoMo::FoMoObject::hashdata()
+{
+	if (!datahashknown)
+	{
+		datahash=FoMo::hashdatacube(datacube);
+		datahashknown=true;
+	}
+	return datahash;
+}
+
+/**
+ * @brief This checks whether a RenderIndex still belongs to the grid of a DataCube.
+ * 
+ * If the grid has changed, the contents of the index are removed, so that they are computed again by the render 
+ * routines. If the grid is declared static, the grid is not checked.
+ * @param index The RenderIndex.
+ * @param datacube The DataCube (usually the goftcube) that is about to be rendered.
+ */
+void FoMo::checkrenderindex(FoMo::RenderIndex & index, const FoMo::DataCube & datacube)
+{
+	std::lock_guard<std::mutex> guard(index.lock);
+	if (index.staticgrid) return;
+	uint64_t hash=hashgrid(datacube);
+	if (index.gridknown && hash == index.gridhash) return;
+	if (index.gridknown) std::cout << "The grid has changed: the spatial index is built again." << std::endl << std::flush;
+	index.nearestneighbour.reset();
+	index.nearestneighbourviews.clear();
+	index.projectionviews.clear();
+	index.cgal.reset();
+	index.gridhash=hash;
+	index.gridknown=true;
+}
+
+/**
+ * @brief This computes the key of a view in a RenderIndex.
+ * @param l The l-angle of the view.
+ * @param b The b-angle of the view.
+ * @param x_pixel The number of pixels in the x direction.
+ * @param y_pixel The number of pixels in the y direction.
+ * @param z_pixel The number of pixels along the line of sight.
+ * @param options The render options, of which the region of interest is part of the key.
+ * @return The key, which is different for every view that has a different mapping of data points to pixels.
+ */
+std::string FoMo::renderviewkey(const double l, const double b, const int x_pixel, const int y_pixel, const int z_pixel, const FoMo::RenderOptions & options)
+{
+	std::stringstream ss;
+	ss << std::hexfloat << l << "|" << b << "|" << x_pixel << "|" << y_pixel << "|" << z_pixel << "|roi:";
+	for (unsigned int i=0; i<options.roi.size(); i++) ss << options.roi[i] << ",";
+	return ss.str();
+}
+
+/**
+ * @brief This computes a hash of the contents of a file.
+ *
+ * If the file cannot be read (such as the default abundfile "/empty"), the filename itself is hashed.
+ * @param filename The file to be hashed.
+ * @return The 64-bit FNV-1a hash.
+ */
+uint64_t FoMo::hashfile(const std::string filename)
+{
+	uint64_t hash=fnvoffset;
+	std::ifstream in(filename,std::ios::binary);
+	if (!in.is_open()) return fnv1a(hash,filename.c_str(),filename.size());
+	std::vector<char> buffer(1<<16);
+	while (in)
+	{
+		in.read(buffer.data(),buffer.size());
+		hash=fnv1a(hash,buffer.data(),in.gcount());
+	}
+	return hash;
+}
+
+/**
+ * @brief This computes the key of a rendering in the render cache.
+ *
+ * The key combines the FoMo version, the hash of the DataCube, the hashes of the chiantifile and abundfile (and of
+ * the blended lines, if any), the rendermethod, the resolution, the render options and the viewing angles. It is 
+ * used as the filename of the rendering in the cache directory.
+ * @param datahash The hash of the DataCube, see hashdatacube().
+ * @param chiantifile The chiantifile of the rendering.
+ * @param abundfile The abundfile of the rendering.
+ * @param rendermethod The rendermethod.
+ * @param resolution The resolution x_pixel, y_pixel, z_pixel and lambda_pixel.
+ * @param lambda_width The width of the spectral window.
+ * @param options The options passed to the render routine.
+ * @param l The l-angle of the view.
+ * @param b The b-angle of the view.
+ * @return The key as a string of 16 hexadecimal digits.
+ */
+std::string FoMo::rendercachekey(const uint64_t datahash, const std::string chiantifile, const std::string abundfile, const std::string rendermethod,
+	const std::vector<int> resolution, const double lambda_width, const FoMo::RenderOptions & options, const double l, const double b)
+{
+	std::stringstream ss;
+	ss << std::hexfloat;
+	ss << "FoMo-" << FOMO_VER << "|data:" << datahash << "|chianti:" << hashfile(chiantifile) << "|abund:" << hashfile(abundfile);
+	ss << "|method:" << rendermethod << "|resolution:";
+	for (unsigned int i=0; i<resolution.size(); i++) ss << resolution[i] << ",";
+	ss << lambda_width << "|sparse:" << options.sparse << "," << options.sparsethreshold << "|roi:";
+	for (unsigned int i=0; i<options.roi.size(); i++) ss << options.roi[i] << ",";
+	ss << "|compression:" << options.compression << "|raystatistics:" << options.raystatistics;
+	if (options.blend)
+	{
+		ss << "|blend:";
+		for (unsigned int i=0; i<options.blend->size(); i++) ss << hashfile(options.blend->at(i).chiantifile) << ",";
+	}
+	if (rendermethod == "Slab") ss << "|depth:" << options.depth;
+	if (rendermethod == "NearestNeighbour" && options.spatialindex != "rtree") ss << "|index:" << options.spatialindex;
+	if (rendermethod == "NearestNeighbour" && options.spatialindex == "voxel") ss << "," << options.indexmemory;
+	ss << "|l:" << l << "|b:" << b;
+	std::string description=ss.str();
+	std::stringstream key;
+	key << std::hex << std::setfill('0') << std::setw(16) << fnv1a(fnvoffset,description.c_str(),description.size());
+	return key.str();
+}
+
+/**
+ * @brief This reads a rendering from the render cache.
+ * @param cachedir The cache directory.
+ * @param key The key of the rendering, see rendercachekey().
+ * @param rendercube The RenderCube in which the cached rendering is stored.
+ * @return True if the rendering was found in the cache.
+ */
+bool FoMo::readrendercache(const std::string cachedir, const std::string key, FoMo::RenderCube & rendercube)
+{
+	return readrendercube_binary(cachedir+"/"+key+".dat",rendercube);
+}
+
+/**
+ * @brief This stores a rendering in the render cache.
+ *
+ * The rendering is written to a temporary file first, which is then renamed. In this way, other processes (or
+ * threads) using the same cache directory never read an incomplete file. The rendering is stored by the calling MPI
+ * rank: render() only calls this on the ranks that write their views (see RenderOptions.write).
+ * @param cachedir The cache directory.
+ * @param key The key of the rendering, see rendercachekey().
+ * @param rendercube The rendering to be stored.
+ */
+void FoMo::writerendercache(const std::string cachedir, const std::string key, const FoMo::RenderCube & rendercube)
+{
+	std::string filename=cachedir+"/"+key+".dat";
+	std::stringstream tmpfile;
+	tmpfile << filename << ".tmp" << getpid() << "." << std::this_thread::get_id();
+	if (rendercube.issparse())
+		writerendercube_sparse(rendercube,tmpfile.str());
+	else
+		writegoftcube_binary(rendercube,tmpfile.str());
+	if (std::rename(tmpfile.str().c_str(),filename.c_str()))
+	{
+		std::cerr << "Warning: unable to store the rendering in the render cache " << cachedir << std::endl << std::flush;
+		std::remove(tmpfile.str().c_str());
+	}
+}
@@ -0,0 +1,245 @@
+#include "../config.h"
+#include "FoMo.h"
+#include "FoMo-internal.h"
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <cstdio>
+#include <unistd.h>
+#include <fcntl.h>
+
+/**
+ * @brief This sets the checkpoint manifest.
+ *
+ * If a checkpoint manifest is set, render() records every view that it has written out, together with the
+ * checksums of the output files. Views that are already recorded, and of which all output files still have the
+ * recorded checksum, are skipped by render(). In this way, a long campaign of renderings can be resumed after it was
+ * interrupted: views that were not completed, or of which the output files were only partially written, are
+ * rendered again. If the last view is skipped, FoMoObject.rendering is read back from its binary output file, 
+ * if that was kept (i.e. not zipped and deleted), otherwise the rendering keeps its previous contents. 
+ * The entries depend on the outfile, the viewing angles, the requested rendermethod, the resolution, the chiantifile and 
+ * abundfile, but not on the datacube, so the outfile should be different for every snapshot.
+ * Every completed view is appended to the manifest. An existing manifest is compacted when it is read in, i.e. 
+ * rewritten atomically with only the last entry of every output file. It should not be shared between processes 
+ * that run at the same time. With MPI, only the first rank writes the manifest, unless the data is shared between
+ * the ranks of a node (see setnodesharing()): every rank then renders its own views, and records them in its own
+ * manifest, which is the given filename followed by ".rank" and the rank in MPI_COMM_WORLD.
+ * @param manifest The filename of the checkpoint manifest. An existing manifest is read in. If empty (the default),
+ * no checkpointing is done.
+ */
+void FoMo::FoMoObject::setcheckpointfile(const std::string manifest)
+{
+	checkpointfile=manifest;
+	this->readcheckpoint();
+}
+
+/**
+ * @brief This returns the manifest to which this rank records its views.
+ * @return The checkpoint manifest, followed by ".rank" and the rank in MPI_COMM_WORLD if the data is shared between
+ * the ranks of a node (see setcheckpointfile()).
+ */
+std::string FoMo::FoMoObject::checkpointmanifest()
+{
+	if (checkpointfile.empty() || !nodesharing) return checkpointfile;
+	int commrank;
+#ifdef HAVEMPI
+	MPI_Comm_rank(MPI_COMM_WORLD,&commrank);
+#else
+	commrank = 0;
+#endif
+	std::stringstream manifest;
+	manifest << checkpointfile << ".rank" << commrank;
+	return manifest.str();
+}
+
+/**
+ * @brief This reads in the checkpoint manifest of this rank, see checkpointmanifest().
+ *
+ * The entries of the manifest are stored in FoMoObject.checkpoint. The manifest is compacted if it contains 
+ * entries that were replaced by later ones, invalid lines, or an incomplete last line.
+ */
+void FoMo::FoMoObject::readcheckpoint()
+{
+	checkpoint.clear();
+	checkpointread=checkpointmanifest();
+	if (checkpointread.empty()) return;
+	std::ifstream in(checkpointread);
+	if (!in.good()) return;
+	std::string line;
+	unsigned int nlines=0;
+	bool truncated=false;
+	while (std::getline(in,line))
+	{
+		// a last line without newline was only partially appended (see markcompleted())
+		if (in.eof())
+		{
+			truncated=true;
+			break;
+		}
+		if (line.empty() || line[0]=='#') continue;
+		nlines++;
+		// the line consists of key, l, b, checksum and filename, separated by tabs
+		std::stringstream ss(line);
+		std::string key, l, b, checksum, filename;
+		if (std::getline(ss,key,'\t') && std::getline(ss,l,'\t') && std::getline(ss,b,'\t') && std::getline(ss,checksum,'\t') && std::getline(ss,filename))
+			checkpoint[key+"\t"+filename]=line;
+		else
+			std::cerr << "Warning: ignoring invalid line in checkpoint " << checkpointread << ": " << line << std::endl << std::flush;
+	}
+	in.close();
+	// the later entries of an output file replace the earlier ones, which are only removed here
+	if (nlines == checkpoint.size() && !truncated) return;
+	std::stringstream tmpfile;
+	tmpfile << checkpointread << ".tmp" << getpid();
+	std::ofstream out(tmpfile.str());
+	if (!out.is_open())
+	{
+		std::cerr << "Warning: unable to compact checkpoint " << checkpointread << std::endl << std::flush;
+		return;
+	}
+	out << "# FoMo checkpoint: key, l, b, checksum, output file" << std::endl;
+	for (std::map<std::string, std::string>::const_iterator it=checkpoint.begin(); it!=checkpoint.end(); ++it)
+		out << it->second << std::endl;
+	out.close();
+	if (!out || std::rename(tmpfile.str().c_str(),checkpointread.c_str()))
+	{
+		std::cerr << "Warning: unable to compact checkpoint " << checkpointread << std::endl << std::flush;
+		std::remove(tmpfile.str().c_str());
+	}
+}
+
+/**
+ * @brief This returns the checkpoint manifest.
+ * @return The filename set with setcheckpointfile(), or an empty string if no checkpointing is done.
+ */
+std::string FoMo::FoMoObject::readcheckpointfile()
+{
+	return checkpointfile;
+}
+
+/**
+ * @brief This computes the key of a view in the checkpoint manifest.
+ * 
+ * Only the settings that determine the output files are used: the rendermethod as it was requested (i.e. "auto" 
+ * rather than the rendermethod chosen by autotune()), but not e.g. the spatial index or the ray statistics.
+ * @param l The l-angle of the view.
+ * @param b The b-angle of the view.
+ * @return The key, which depends on the angles and the settings of the rendering, but not on the datacube.
+ */
+std::string FoMo::FoMoObject::checkpointkey(const double l, const double b)
+{
+	int x_pixel, y_pixel, z_pixel, lambda_pixel;
+	double lambda_width;
+	this->rendering.readresolution(x_pixel,y_pixel,z_pixel,lambda_pixel,lambda_width);
+	std::vector<int> resolution={x_pixel,y_pixel,z_pixel,lambda_pixel};
+	FoMo::RenderOptions options;
+	options.sparse=sparsespectra;
+	options.sparsethreshold=sparsethreshold;
+	options.roi=roi;
+	options.depth=slabdepth;
+	options.blend=blendedlines;
+	return FoMo::rendercachekey(0,rendering.readchiantifile(),rendering.readabundfile(),this->readrendermethod(),
+		resolution,lambda_width,options,l,b);
+}
+
+/**
+ * @brief This returns the files that render() writes out for a view.
+ *
+ * The files follow from renderfilename() and the write options (see GoftCube::setwriteoptions()).
+ * @param l The l-angle of the view.
+ * @param b The b-angle of the view.
+ * @return The list of output files.
+ */
+std::vector<std::string> FoMo::FoMoObject::outputfiles(const double l, const double b)
+{
+	std::vector<std::string> files;
+	std::string filename=renderfilename(l,b);
+	std::string root=filename.substr(0,filename.rfind("."));
+	std::bitset<FoMo::noptions> woptions=this->goftcube.getwriteoptions();
+	const std::vector<std::string> extensions={".dat", ".txt"};
+	for (unsigned int i=0; i<extensions.size(); i++)
+	{
+		if (!woptions[i]) continue;
+		if (woptions[2]) files.push_back(root+extensions[i]+".gz");
+		if (!(woptions[2] && woptions[3])) files.push_back(root+extensions[i]);
+	}
+	return files;
+}
+
+/**
+ * @brief This checks whether a view has been completed according to the checkpoint manifest.
+ *
+ * A view is completed if all its output files are recorded in the manifest (with the current settings of the
+ * rendering), and the checksums of the files on disk match the recorded checksums.
+ * @param l The l-angle of the view.
+ * @param b The b-angle of the view.
+ * @return True if the view does not need to be rendered again. If no checkpoint manifest is set, false is returned.
+ */
+bool FoMo::FoMoObject::iscompleted(const double l, const double b)
+{
+	if (checkpointfile.empty()) return false;
+	// the node sharing may have been switched on or off after setcheckpointfile()
+	if (checkpointread != checkpointmanifest()) this->readcheckpoint();
+	std::string key=checkpointkey(l,b);
+	std::vector<std::string> files=outputfiles(l,b);
+	if (files.empty()) return false;
+	for (unsigned int i=0; i<files.size(); i++)
+	{
+		std::map<std::string, std::string>::const_iterator entry=checkpoint.find(key+"\t"+files[i]);
+		if (entry == checkpoint.end()) return false;
+		std::ifstream test(files[i]);
+		if (!test.good()) return false;
+		std::stringstream checksum;
+		checksum << std::hex << std::setfill('0') << std::setw(16) << FoMo::hashfile(files[i]);
+		// the checksum is the fourth field in the line
+		std::stringstream ss(entry->second);
+		std::string field;
+		for (int j=0; j<4; j++) std::getline(ss,field,'\t');
+		if (field != checksum.str())
+		{
+			std::cout << "Checksum of " << files[i] << " does not match the checkpoint: it will be rendered again." << std::endl << std::flush;
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief This records a view in the checkpoint manifest, after it has been written out.
+ *
+ * The checksums of the output files are computed, and a line for every file is appended to the manifest, which is
+ * then flushed to disk. An interrupted append leaves at most an incomplete last line, which is dropped when the
+ * manifest is read in again. It is called by render() on the ranks that write their views (see RenderOptions.write),
+ * and appends to the manifest of the rank (see checkpointmanifest()).
+ * @param l The l-angle of the view.
+ * @param b The b-angle of the view.
+ */
+void FoMo::FoMoObject::markcompleted(const double l, const double b)
+{
+	if (checkpointread != checkpointmanifest()) this->readcheckpoint();
+	std::string key=checkpointkey(l,b);
+	std::vector<std::string> files=outputfiles(l,b);
+	std::stringstream lines;
+	for (unsigned int i=0; i<files.size(); i++)
+	{
+		std::stringstream line;
+		line << key << "\t" << l << "\t" << b << "\t";
+		line << std::hex << std::setfill('0') << std::setw(16) << FoMo::hashfile(files[i]) << "\t" << files[i];
+		checkpoint[key+"\t"+files[i]]=line.str();
+		lines << line.str() << std::endl;
+	}
+
+	int fd=open(checkpointread.c_str(),O_WRONLY | O_APPEND | O_CREAT,0644);
+	if (fd < 0)
+	{
+		std::cerr << "Warning: unable to write checkpoint " << checkpointread << std::endl << std::flush;
+		return;
+	}
+	std::string text=lines.str();
+	// a new manifest starts with the header
+	if (lseek(fd,0,SEEK_END) == 0) text="# FoMo checkpoint: key, l, b, checksum, output file\n"+text;
+	if (write(fd,text.c_str(),text.size()) != ssize_t(text.size()) || fsync(fd) != 0)
+		std::cerr << "Warning: unable to write checkpoint " << checkpointread << std::endl << std::flush;
+	close(fd);
+}
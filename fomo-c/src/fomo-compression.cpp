@@ -0,0 +1,319 @@
+#include "../config.h"
+#include "FoMo.h"
+#include "FoMo-internal.h"
+#include <cmath>
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+#include <iostream>
+#include <climits>
+
+// conversion between single and half precision floats (IEEE 754 binary16), with rounding to nearest
+static uint16_t floattohalf(const float f)
+{
+	uint32_t x;
+	std::memcpy(&x,&f,sizeof(x));
+	uint16_t sign=(x >> 16) & 0x8000;
+	int exponent=((x >> 23) & 0xff) - 127 + 15;
+	uint32_t mantissa=x & 0x7fffff;
+	if (exponent >= 31) return sign | 0x7c00; // overflow (or NaN): this does not occur for scaled data
+	if (exponent <= 0)
+	{
+		// subnormal half, or flush to zero
+		if (exponent < -10) return sign;
+		mantissa |= 0x800000;
+		int shift=14-exponent;
+		uint16_t half=mantissa >> shift;
+		if ((mantissa >> (shift-1)) & 1) half++;
+		return sign | half;
+	}
+	uint16_t half=sign | (exponent << 10) | (mantissa >> 13);
+	// round to nearest, the carry ends up in the exponent if needed
+	if (mantissa & 0x1000) half++;
+	return half;
+}
+
+static float halftofloat(const uint16_t h)
+{
+	uint32_t sign=uint32_t(h & 0x8000) << 16;
+	int exponent=(h >> 10) & 0x1f;
+	uint32_t mantissa=h & 0x3ff;
+	uint32_t x;
+	if (exponent == 0)
+	{
+		if (mantissa == 0) x=sign;
+		else
+		{
+			// normalise the subnormal half
+			exponent=1;
+			while (!(mantissa & 0x400))
+			{
+				mantissa <<= 1;
+				exponent--;
+			}
+			mantissa &= 0x3ff;
+			x=sign | uint32_t(exponent-15+127) << 23 | mantissa << 13;
+		}
+	}
+	else if (exponent == 31) x=sign | 0x7f800000 | mantissa << 13;
+	else x=sign | uint32_t(exponent-15+127) << 23 | mantissa << 13;
+	float f;
+	std::memcpy(&f,&x,sizeof(f));
+	return f;
+}
+
+/**
+ * @brief The default constructor for an empty CompressedVar.
+ */
+FoMo::CompressedVar::CompressedVar():
+	n(0), fixedpoint(false)
+{
+}
+
+/**
+ * @brief This constructs the CompressedVar from a ::tphysvar.
+ * @param var The variable to be compressed.
+ * @param fixed If true, the elements are stored as fixed point numbers between the minimum and maximum of each block (use this for 
+ * coordinates). Otherwise, they are stored as half precision floats, scaled with the maximum absolute value of each block (use this
+ * for physical variables, which may span orders of magnitude).
+ */
+FoMo::CompressedVar::CompressedVar(FoMo::tphysvar const & var, const bool fixed):
+	n(var.size()), fixedpoint(fixed)
+{
+	unsigned int nblocks=this->readnblocks();
+	blockoffset.resize(nblocks);
+	blockscale.resize(nblocks);
+	data.resize(n);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int b=0; b<int(nblocks); b++)
+	{
+		unsigned int start=b*blocksize;
+		unsigned int end=std::min(n,start+blocksize);
+		if (fixedpoint)
+		{
+			auto bounds=std::minmax_element(var.begin()+start,var.begin()+end);
+			blockoffset[b]=*bounds.first;
+			blockscale[b]=(*bounds.second-*bounds.first)/65535.;
+			for (unsigned int i=start; i<end; i++)
+				data[i]= blockscale[b]>0 ? std::min(65535.,std::round((double(var[i])-blockoffset[b])/blockscale[b])) : 0;
+		}
+		else
+		{
+			float maxabs=0;
+			for (unsigned int i=start; i<end; i++) maxabs=std::max(maxabs,std::abs(var[i]));
+			blockoffset[b]=0;
+			blockscale[b]=maxabs;
+			for (unsigned int i=start; i<end; i++)
+				data[i]= maxabs>0 ? floattohalf(var[i]/maxabs) : 0;
+		}
+	}
+}
+
+/**
+ * @brief This returns the number of elements in the CompressedVar.
+ * @return The number of elements.
+ */
+unsigned int FoMo::CompressedVar::size() const
+{
+	return n;
+}
+
+/**
+ * @brief This returns the number of blocks in the CompressedVar.
+ * @return The number of blocks of length CompressedVar::blocksize (the last block may be shorter).
+ */
+unsigned int FoMo::CompressedVar::readnblocks() const
+{
+	return (n+blocksize-1)/blocksize;
+}
+
+/**
+ * @brief This decompresses one block of the CompressedVar.
+ * @param block The index of the block that needs to be decompressed.
+ * @param out The decompressed values are written here. It should have room for CompressedVar::blocksize floats.
+ */
+void FoMo::CompressedVar::decompressblock(const unsigned int block, float * out) const
+{
+	assert(block < this->readnblocks());
+	unsigned int start=block*blocksize;
+	unsigned int end=std::min(n,start+blocksize);
+	const float offset=blockoffset[block];
+	const float scale=blockscale[block];
+	if (fixedpoint)
+		for (unsigned int i=start; i<end; i++) out[i-start]=offset+data[i]*scale;
+	else
+		for (unsigned int i=start; i<end; i++) out[i-start]=halftofloat(data[i])*scale;
+}
+
+/**
+ * @brief This decompresses the full CompressedVar.
+ * @return The decompressed variable.
+ */
+FoMo::tphysvar FoMo::CompressedVar::decompress() const
+{
+	FoMo::tphysvar out(this->readnblocks()*blocksize);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int b=0; b<int(this->readnblocks()); b++)
+		this->decompressblock(b,&out[b*blocksize]);
+	out.resize(n);
+	return out;
+}
+
+/**
+ * @brief This compresses the grid and variables of the DataCube.
+ * 
+ * The coordinates are stored as 16-bit fixed point numbers, and the variables as block-wise scaled half precision floats 
+ * (see CompressedVar). This reduces the memory needed by the DataCube by a factor of 2. The compression is lossy, and works best 
+ * if neighbouring data points are stored close to each other (e.g. after mortonsort()).\n
+ * readgrid() and readvar() keep working on a compressed DataCube, but return decompressed copies. The render routines
+ * decompress the data on the fly, block by block.
+ */
+void FoMo::DataCube::compress()
+{
+	// shared columns are not compressed, they do not use memory of this process
+	if (compressed || !sharedcolumns.empty()) return;
+	cgrid.clear();
+	cvars.clear();
+	for (unsigned int i=0; i<dim; i++)
+	{
+		cgrid.push_back(CompressedVar(grid[i],true));
+		tcoord().swap(grid[i]); // release the memory
+	}
+	for (unsigned int i=0; i<nvars; i++)
+	{
+		cvars.push_back(CompressedVar(vars[i]));
+		tphysvar().swap(vars[i]);
+	}
+	compressed=true;
+}
+
+/**
+ * @brief This restores the uncompressed grid and variables of a compressed DataCube.
+ * 
+ * The values are not identical to the values before compress() was called, because the compression is lossy.
+ * The columns of a shared DataCube (see setshared()) are copied, so that the DataCube can be modified.
+ */
+void FoMo::DataCube::decompress()
+{
+	if (!sharedcolumns.empty())
+	{
+		for (unsigned int i=0; i<dim; i++) grid[i].assign(sharedcolumns[i],sharedcolumns[i]+ng);
+		for (unsigned int i=0; i<nvars; i++) vars[i].assign(sharedcolumns[dim+i],sharedcolumns[dim+i]+ng);
+		sharedcolumns.clear();
+	}
+	if (!compressed) return;
+	for (unsigned int i=0; i<dim; i++) grid[i]=cgrid[i].decompress();
+	for (unsigned int i=0; i<nvars; i++) vars[i]=cvars[i].decompress();
+	cgrid.clear();
+	cvars.clear();
+	compressed=false;
+}
+
+/**
+ * @brief This returns whether the DataCube is compressed.
+ * @return True if compress() has been called (and the data has not been decompressed since).
+ */
+bool FoMo::DataCube::iscompressed() const
+{
+	return compressed;
+}
+
+/**
+ * @brief This lets the DataCube read its grid and variables from columns in memory of someone else.
+ * 
+ * This is used to share the goftcube between the MPI ranks on a node (see FoMoObject::setnodesharing()). The 
+ * columns are not copied: they should stay valid as long as the DataCube uses them. The DataCube keeps its 
+ * dimension, and releases its own grid and variables. The render routines read the columns directly, readgrid() 
+ * and readvar() return copies, and the columns are copied before the DataCube is modified.
+ * @param columns The readdim() coordinates followed by the variables, each with inngrid values.
+ * @param inngrid The number of grid points.
+ * @param unitvec If not NULL, the units of the coordinates and variables.
+ */
+void FoMo::DataCube::setshared(const std::vector<const float *> & columns, const int inngrid, std::vector<std::string> * unitvec)
+{
+	if (columns.size() < dim || (unitvec && unitvec->size() != columns.size()))
+	{
+		std::cerr << "Error: the number of shared columns does not match the DataCube." << std::endl << std::flush;
+		exit(EXIT_FAILURE);
+	}
+	compressed=false;
+	cgrid.clear();
+	cvars.clear();
+	nvars=columns.size()-dim;
+	ng=inngrid;
+	tgrid(dim).swap(grid);
+	tvars(nvars).swap(vars);
+	unit.resize(dim+nvars);
+	if (unitvec) unit=*unitvec;
+	sharedcolumns=columns;
+}
+
+/**
+ * @brief This lets the DataCube read the grid and variables of another DataCube, without copying them.
+ * 
+ * This is the same as setshared() with the columns of other. The other DataCube should not be compressed, and 
+ * should not be modified or destroyed as long as this DataCube uses its columns.
+ * @param other The DataCube of which the grid and variables are read.
+ * @param gridonly If true, only the grid of other is read, and this DataCube has no variables.
+ */
+void FoMo::DataCube::setshared(const FoMo::DataCube & other, const bool gridonly)
+{
+	if (other.compressed)
+	{
+		std::cerr << "Error: the columns of a compressed DataCube cannot be shared." << std::endl << std::flush;
+		exit(EXIT_FAILURE);
+	}
+	std::vector<const float *> columns=other.sharedcolumns;
+	if (columns.empty())
+	{
+		for (unsigned int i=0; i<other.dim; i++) columns.push_back(other.grid[i].data());
+		for (unsigned int i=0; i<other.nvars; i++) columns.push_back(other.vars[i].data());
+	}
+	std::vector<std::string> unitvec=other.unit;
+	unitvec.resize(other.dim+other.nvars);
+	if (gridonly)
+	{
+		columns.resize(other.dim);
+		unitvec.resize(other.dim);
+	}
+	dim=other.dim;
+	setshared(columns,other.ng,&unitvec);
+}
+
+/**
+ * @brief This returns whether the DataCube reads its data from shared columns.
+ * @return True if setshared() has been called (and the DataCube has not been modified since).
+ */
+bool FoMo::DataCube::isshared() const
+{
+	return !sharedcolumns.empty();
+}
+
+FoMo::ColumnReader::ColumnReader(const FoMo::DataCube & datacube, const unsigned int column):
+	plain(NULL), compressed(NULL), lazy(NULL), lazycolumn(0), block(UINT_MAX)
+{
+	assert(column < datacube.dim+datacube.nvars);
+	if (datacube.compressed)
+	{
+		compressed= column < datacube.dim ? &datacube.cgrid[column] : &datacube.cvars[column-datacube.dim];
+		buffer.resize(CompressedVar::blocksize);
+	}
+	else if (!datacube.sharedcolumns.empty())
+	{
+		plain=datacube.sharedcolumns[column];
+	}
+	else
+	{
+		plain= column < datacube.dim ? datacube.grid[column].data() : datacube.vars[column-datacube.dim].data();
+	}
+}
+
+FoMo::ColumnReader::ColumnReader(FoMo::LazyEmission & emission, const unsigned int column):
+	plain(NULL), compressed(NULL), lazy(&emission), lazycolumn(column), block(UINT_MAX)
+{
+	assert(column < 2);
+}
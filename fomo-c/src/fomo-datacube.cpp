@@ -2,6 +2,7 @@
 #include "FoMo.h"
 #include "FoMo-internal.h"
 #include <cassert>
+#include <algorithm>
 
 /**
  * @brief The default constructor for a DataCube.
@@ -17,6 +18,7 @@ FoMo::DataCube::DataCube(const int indim)
 	ng=0;
 	nvars=0;
 	unit.resize(indim+nvars);
+	compressed=false;
 }
 
 /**
@@ -73,6 +75,7 @@ std::vector<std::string> FoMo::DataCube::readunit() const
 void FoMo::DataCube::setdim(const int indim)
 {
 	assert(dim > 0);
+	this->decompress();
 	dim=indim;
 	grid.resize(indim);
 	unit.resize(indim+nvars);
@@ -88,6 +91,7 @@ void FoMo::DataCube::setdim(const int indim)
 void FoMo::DataCube::setnvars(const int innvars)
 {
 	assert(innvars >= 0);
+	this->decompress();
 	nvars=innvars;
 	vars.resize(innvars);
 	unit.resize(dim+nvars);
@@ -103,6 +107,7 @@ void FoMo::DataCube::setnvars(const int innvars)
 void FoMo::DataCube::setngrid(const int inngrid)
 {
 	assert(inngrid >= 0);
+	this->decompress();
 	ng=inngrid;
 	for (unsigned int i=0; i<dim; i++)
 	{
@@ -126,6 +131,8 @@ void FoMo::DataCube::setgrid(FoMo::tgrid ingrid, std::vector<std::string> * inun
 {
 	//perform checks
 	assert(ingrid.size() != 0); // The dimension is 0. This shouldn't work.
+	// a compressed DataCube is decompressed first, because the variables are kept if only the grid is set
+	this->decompress();
 	// store the old units of vars
 	std::vector<std::string> oldunits(unit.begin()+dim,unit.end());
 	
@@ -152,10 +159,24 @@ void FoMo::DataCube::setgrid(FoMo::tgrid ingrid, std::vector<std::string> * inun
 
 /**
  * @brief This function allows reading of the grid.
+ * 
+ * If the DataCube is compressed or shared, a decompressed copy of the grid is returned.
  * @return The grid is returned as a tgrid.
  */
 FoMo::tgrid FoMo::DataCube::readgrid() const
 {
+	if (!sharedcolumns.empty())
+	{
+		FoMo::tgrid outgrid;
+		for (unsigned int i=0; i<dim; i++) outgrid.push_back(tcoord(sharedcolumns[i],sharedcolumns[i]+ng));
+		return outgrid;
+	}
+	if (compressed)
+	{
+		FoMo::tgrid outgrid;
+		for (unsigned int i=0; i<dim; i++) outgrid.push_back(cgrid[i].decompress());
+		return outgrid;
+	}
 	return grid;
 };
 
@@ -174,18 +195,23 @@ FoMo::tgrid FoMo::DataCube::readgrid() const
 void FoMo::DataCube::setvar(const unsigned int nvar, const FoMo::tphysvar var, std::string inunit)
 {
 	assert(nvar < vars.size());
+	this->decompress();
 	vars.at(nvar)=var;
 	unit.at(dim+nvar)=inunit;
 }
 
 /**
  * @brief This reads a specific variable in the DataCube.
+ * 
+ * If the DataCube is compressed, the variable is decompressed.
  * @param nvar The variable that should be read. It should be between 0 and nvars-1.
  * @return The physical variable is returned as a vector.
  */
 FoMo::tphysvar FoMo::DataCube::readvar(const unsigned int nvar) const
 {
 	assert(nvar < nvars);
+	if (compressed) return cvars.at(nvar).decompress();
+	if (!sharedcolumns.empty()) return FoMo::tphysvar(sharedcolumns[dim+nvar],sharedcolumns[dim+nvar]+ng);
 	FoMo::tphysvar var=vars.at(nvar);
 	return var;
 }
@@ -224,6 +250,7 @@ void FoMo::DataCube::push_back(std::vector<double> coordinate, std::vector<doubl
 	{
 		assert(coordinate.size() == dim);
 		assert(variables.size() == nvars);
+		this->decompress();
 
 		// tgrid grid=this->readgrid();
 		for (unsigned int i=0; i<dim; i++)
@@ -276,4 +303,99 @@ void FoMo::DataCube::setdata(tgrid& ingrid, tvars& indata, std::vector<std::stri
 		assert(unitvec->size() == dim+nvars);
 		unit=*unitvec;
 	}
-}
\ No newline at end of file
+}
+
+/**
+ * @brief This sets the data of the DataCube by swapping the columns of the arguments in, without copying them.
+ * 
+ * This is setdata() for large data that is not needed anymore by the caller: the memory of the columns is taken
+ * over, so that the data is never stored twice. The previous data of the DataCube is not decompressed or copied
+ * from the memory of other DataCubes (see setshared()), and ingrid and indata contain whatever the DataCube
+ * stored before.
+ * @param ingrid The grid to be imported in DataCube.
+ * @param indata The data to be imported in DataCube.
+ * @param unitvec If not NULL, the units of the grid and the variables.
+ */
+void FoMo::DataCube::swapdata(tgrid& ingrid, tvars& indata, std::vector<std::string> * unitvec)
+{
+	assert(ingrid.size() != 0);
+	for (unsigned int i=1; i<ingrid.size(); i++) assert(ingrid[i].size() == ingrid[0].size());
+	for (unsigned int i=0; i<indata.size(); i++) assert(indata[i].size() == ingrid[0].size());
+	sharedcolumns.clear();
+	cgrid.clear();
+	cvars.clear();
+	compressed=false;
+	dim=ingrid.size();
+	ng=ingrid[0].size();
+	nvars=indata.size();
+	grid.swap(ingrid);
+	vars.swap(indata);
+	unit.resize(dim+nvars);
+	if (unitvec) 
+	{
+		assert(unitvec->size() == dim+nvars);
+		unit=*unitvec;
+	}
+}
+
+/**
+ * @brief This reorders the data points of the DataCube along a Morton (Z-order) curve.
+ * 
+ * The coordinates are mapped onto a lattice of \f$2^{21}\f$ points in each direction of the bounding box 
+ * of the grid, and the data points are sorted by the interleaved bits of their lattice indices (the same 
+ * Morton code that is used for ordering the AMRVAC blocks in example/example_mpi_amrvac). The grid and all 
+ * variables are permuted consistently. Points that are close in space then end up close in memory, which
+ * speeds up the building of the spatial indices and the look-ups of the variables in the rendering.\n
+ * For 2D DataCubes, the third Morton index is set to 0. Only the first 3 coordinates are used for the ordering. A compressed 
+ * DataCube is decompressed first.
+ * @param permutation If not NULL, the permutation is stored in this vector: element i contains the original 
+ * index of the data point that is now stored at position i. It can be used to map results back to the original order.
+ */
+void FoMo::DataCube::mortonsort(std::vector<unsigned int> * permutation)
+{
+	this->decompress();
+	unsigned int sortdim=std::min(dim,3u);
+	// compute the bounding box of the grid, to map the coordinates onto 21 bits
+	std::vector<double> mincoord(sortdim), scale(sortdim);
+	for (unsigned int i=0; i<sortdim && ng>0; i++)
+	{
+		auto bounds=std::minmax_element(grid[i].begin(),grid[i].end());
+		mincoord[i]=*bounds.first;
+		scale[i]=0.;
+		if (*bounds.second > *bounds.first) scale[i]=2097151./(double(*bounds.second)-double(*bounds.first));
+	}
+	
+	std::vector<std::pair<uint64_t,unsigned int>> keys(ng);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int j=0; j<int(ng); j++)
+	{
+		unsigned int index[3]={0,0,0};
+		for (unsigned int i=0; i<sortdim; i++)
+			index[i]=std::min(2097151.,(grid[i][j]-mincoord[i])*scale[i]);
+		keys[j]=std::make_pair(mortonEncode_magicbits(index[0],index[1],index[2]),j);
+	}
+	// the original index is the second element of the pair: equal keys keep their original order
+	std::sort(keys.begin(),keys.end());
+	
+	// permute the coordinates and variables, one column at a time to limit the memory overhead
+	FoMo::tcoord tempcolumn(ng);
+	for (unsigned int i=0; i<dim; i++)
+	{
+		for (unsigned int j=0; j<ng; j++) tempcolumn[j]=grid[i][keys[j].second];
+		grid[i].swap(tempcolumn);
+	}
+	for (unsigned int i=0; i<nvars; i++)
+	{
+		assert(vars[i].size() == ng);
+		for (unsigned int j=0; j<ng; j++) tempcolumn[j]=vars[i][keys[j].second];
+		vars[i].swap(tempcolumn);
+	}
+	
+	if (permutation)
+	{
+		permutation->resize(ng);
+		for (unsigned int j=0; j<ng; j++) permutation->at(j)=keys[j].second;
+	}
+}
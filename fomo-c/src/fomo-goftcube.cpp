@@ -55,7 +55,7 @@ FoMo::GoftCube::GoftCube(FoMo::DataCube incube)
  * returned. In this case, the built-in sun_coronal_2012_schmelz.abund is being used.
  * @return It returns the path and filename to the abundance file.
  */
-std::string FoMo::GoftCube::readabundfile()
+std::string FoMo::GoftCube::readabundfile() const
 {
 	return abundfile;
 }
@@ -67,7 +67,7 @@ std::string FoMo::GoftCube::readabundfile()
  * "../chiantitables/goft_table_fe_12_0194_abco.dat" will be returned.
  * @return The path to the chiantifile being used.
  */
-std::string FoMo::GoftCube::readchiantifile()
+std::string FoMo::GoftCube::readchiantifile() const
 {
 	return chiantifile;
 }
@@ -107,7 +107,7 @@ void FoMo::GoftCube::setlambda0(const double lambda)
  * If the wavelength has not been set, the default value of 193.509 is returned.
  * @return The return value is the wavelength in \f$\AA{}\f$.
  */
-double FoMo::GoftCube::readlambda0()
+double FoMo::GoftCube::readlambda0() const
 {
 	return lambda0;
 }
@@ -0,0 +1,438 @@
+#include "../config.h"
+#include "FoMo.h"
+#include "FoMo-insitu.h"
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <cstdlib>
+#include <cmath>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <climits>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifdef HAVEMPI
+#include <mpi.h>
+#endif
+
+// The data of one step and the settings with which it is rendered.
+struct InsituStep
+{
+	int step;
+	double time;
+	FoMo::tgrid grid;
+	FoMo::tvars vars;
+	std::string chiantifile, abundfile, rendermethod, outfile;
+	int x_pixel, y_pixel, z_pixel, lambda_pixel;
+	double lambda_width;
+	std::vector<double> lvec, bvec;
+	int nthreads;
+};
+
+struct fomo_insitu
+{
+	int dim;
+	std::string chiantifile, abundfile="/empty", rendermethod="NearestNeighbour", outfile="fomo-insitu.";
+	int x_pixel=100, y_pixel=100, z_pixel=100, lambda_pixel=1;
+	double lambda_width=0;
+	/** The views, as pairs of lvec[i] and bvec[i]. */
+	std::vector<double> lvec, bvec;
+	double units[4]={1.,1.,1.,1.};
+	int cadencesteps=1;
+	double cadencetime=0, nexttime=-INFINITY;
+	int nthreads=0;
+	/** The step of which the blocks are being added, or empty. */
+	std::unique_ptr<InsituStep> collecting;
+	/** The lock protects the members below, and changed is notified when they change. */
+	std::mutex lock;
+	std::condition_variable changed;
+	std::deque<std::unique_ptr<InsituStep> > queue;
+	bool busy=false, stopping=false;
+	std::thread worker;
+	/** The FoMoObject of the worker, which keeps the spatial index while the grid does not change. */
+	FoMo::FoMoObject object;
+#ifdef HAVEMPI
+	/** The communicator with which the blocks of all processes are gathered on process 0. */
+	MPI_Comm comm;
+#endif
+	fomo_insitu(const int indim): dim(indim), object(indim) {}
+};
+
+// This renders a step on the worker thread.
+static void renderstep(FoMo::FoMoObject & object, InsituStep & step)
+{
+#ifdef _OPENMP
+	if (step.nthreads > 0) omp_set_num_threads(step.nthreads);
+#endif
+	std::cout << "In-situ rendering of step " << step.step << " (time " << step.time << ", " << step.grid[0].size() << " data points)." << std::endl << std::flush;
+	// the data is swapped into the FoMoObject, and the data of the previous step is released
+	object.swapdata(step.grid,step.vars);
+	FoMo::tgrid().swap(step.grid);
+	FoMo::tvars().swap(step.vars);
+	object.setchiantifile(step.chiantifile);
+	object.setabundfile(step.abundfile);
+	object.setrendermethod(step.rendermethod);
+	object.setresolution(step.x_pixel,step.y_pixel,step.z_pixel,step.lambda_pixel,step.lambda_width);
+	std::stringstream ss;
+	ss << step.outfile << "t" << std::setfill('0') << std::setw(6) << step.step;
+	object.setoutfile(ss.str());
+	for (unsigned int i=0; i<step.lvec.size(); i++) object.render(step.lvec[i],step.bvec[i]);
+}
+
+// The worker thread renders the queued steps one by one, until fomo_insitu_finish() is called.
+static void insituworker(fomo_insitu * insitu)
+{
+	while (true)
+	{
+		std::unique_ptr<InsituStep> step;
+		{
+			std::unique_lock<std::mutex> guard(insitu->lock);
+			while (insitu->queue.empty() && !insitu->stopping) insitu->changed.wait(guard);
+			if (insitu->queue.empty()) return;
+			step=std::move(insitu->queue.front());
+			insitu->queue.pop_front();
+			insitu->busy=true;
+		}
+		insitu->changed.notify_all();
+		renderstep(insitu->object,*step);
+		{
+			std::lock_guard<std::mutex> guard(insitu->lock);
+			insitu->busy=false;
+		}
+		insitu->changed.notify_all();
+	}
+}
+
+static void insituerror(const std::string message)
+{
+	std::cerr << "Error: " << message << std::endl << std::flush;
+	exit(EXIT_FAILURE);
+}
+
+#ifdef HAVEMPI
+// This gathers the data points of all processes on process 0, column by column, and releases them on the other processes.
+static void gatherstep(fomo_insitu * insitu, InsituStep & step)
+{
+	int commrank, commsize;
+	MPI_Comm_rank(insitu->comm,&commrank);
+	MPI_Comm_size(insitu->comm,&commsize);
+	int count=step.grid[0].size();
+	std::vector<int> counts(commsize), offsets(commsize);
+	MPI_Gather(&count,1,MPI_INT,&counts[0],1,MPI_INT,0,insitu->comm);
+	long total=0;
+	for (int r=0; r<commsize; r++)
+	{
+		offsets[r]=total;
+		total+=counts[r];
+	}
+	if (commrank == 0 && total > INT_MAX) insituerror("the step has more data points than MPI can gather.");
+	std::vector<std::vector<float> *> columns;
+	for (unsigned int d=0; d<step.grid.size(); d++) columns.push_back(&step.grid[d]);
+	for (unsigned int i=0; i<step.vars.size(); i++) columns.push_back(&step.vars[i]);
+	for (unsigned int c=0; c<columns.size(); c++)
+	{
+		std::vector<float> gathered(commrank == 0 ? total : 0);
+		MPI_Gatherv(columns[c]->data(),count,MPI_FLOAT,gathered.data(),&counts[0],&offsets[0],MPI_FLOAT,0,insitu->comm);
+		columns[c]->swap(gathered);
+	}
+}
+#endif
+
+/**
+ * @brief This creates an in-situ renderer.
+ *
+ * The spatial index is kept between the steps (see FoMo::FoMoObject::setreuseindex()), so that it is only rebuilt
+ * when the grid changes. With MPI, this should be called by all processes, after MPI_Init_thread() with 
+ * MPI_THREAD_MULTIPLE, since process 0 renders on a thread of FoMo while the solver continues.
+ * @param dim The dimension of the simulation, 2 or 3.
+ * @return The in-situ renderer, which should be ended with fomo_insitu_finish().
+ */
+fomo_insitu * fomo_insitu_create(const int dim)
+{
+	if (dim != 2 && dim != 3) insituerror("the in-situ renderer needs a 2D or 3D simulation.");
+	fomo_insitu * insitu=new fomo_insitu(dim);
+	insitu->object.setreuseindex();
+#ifdef HAVEMPI
+	MPI_Comm_dup(MPI_COMM_WORLD,&insitu->comm);
+	int commrank, provided;
+	MPI_Comm_rank(insitu->comm,&commrank);
+	MPI_Query_thread(&provided);
+	if (commrank == 0 && provided < MPI_THREAD_MULTIPLE) 
+		std::cout << "Warning: MPI was not initialised with MPI_THREAD_MULTIPLE, but FoMo renders on a thread of its own." << std::endl << std::flush;
+#endif
+	return insitu;
+}
+
+/**
+ * @brief This sets the emission that is rendered, see FoMo::FoMoObject::setchiantifile().
+ * @param insitu The in-situ renderer.
+ * @param chiantifile The chiantifile.
+ * @param abundfile The abundfile, or "/empty" for the default abundances.
+ */
+void fomo_insitu_setemission(fomo_insitu * insitu, const char * chiantifile, const char * abundfile)
+{
+	insitu->chiantifile=chiantifile;
+	insitu->abundfile=abundfile;
+}
+
+/**
+ * @brief This sets the rendermethod, see FoMo::FoMoObject::setrendermethod(). The default is NearestNeighbour.
+ * @param insitu The in-situ renderer.
+ * @param rendermethod The rendermethod.
+ */
+void fomo_insitu_setrendermethod(fomo_insitu * insitu, const char * rendermethod)
+{
+	insitu->rendermethod=rendermethod;
+}
+
+/**
+ * @brief This sets the resolution of the renderings, see FoMo::FoMoObject::setresolution().
+ * @param insitu The in-situ renderer.
+ * @param x_pixel The number of pixels in the x-direction.
+ * @param y_pixel The number of pixels in the y-direction.
+ * @param z_pixel The number of samples along the line-of-sight.
+ * @param lambda_pixel The number of wavelength bins, 1 for imaging.
+ * @param lambda_width The width of the spectral window, in m/s.
+ */
+void fomo_insitu_setresolution(fomo_insitu * insitu, const int x_pixel, const int y_pixel, const int z_pixel, const int lambda_pixel, const double lambda_width)
+{
+	insitu->x_pixel=x_pixel;
+	insitu->y_pixel=y_pixel;
+	insitu->z_pixel=z_pixel;
+	insitu->lambda_pixel=lambda_pixel;
+	insitu->lambda_width=lambda_width;
+}
+
+/**
+ * @brief This adds a view that is rendered at every rendered step.
+ * @param insitu The in-situ renderer.
+ * @param l The l-angle of the view, in radians.
+ * @param b The b-angle of the view, in radians.
+ */
+void fomo_insitu_addview(fomo_insitu * insitu, const double l, const double b)
+{
+	insitu->lvec.push_back(l);
+	insitu->bvec.push_back(b);
+}
+
+/**
+ * @brief This sets the prefix of the output files.
+ *
+ * The renderings of step s are written as outfile+"t"+s (with 6 digits), appended with "l"+l+"b"+b as in
+ * FoMo::FoMoObject::render(). The default is "fomo-insitu.".
+ * @param insitu The in-situ renderer.
+ * @param outfile The prefix of the output files.
+ */
+void fomo_insitu_setoutfile(fomo_insitu * insitu, const char * outfile)
+{
+	insitu->outfile=outfile;
+}
+
+/**
+ * @brief This sets the factors with which the data of the blocks is multiplied, so that the normalised variables of
+ * the simulation can be passed without converting them first.
+ *
+ * After the multiplication, the coordinates should be in Mm, the number density in cm^-3, the temperature in K and the
+ * velocities in the units of FoMo::FoMoObject::setdata(). All factors are 1 by default.
+ * @param insitu The in-situ renderer.
+ * @param lengthunit The factor of the coordinates.
+ * @param densityunit The factor of the density.
+ * @param temperatureunit The factor of the temperature.
+ * @param velocityunit The factor of the velocities.
+ */
+void fomo_insitu_setunits(fomo_insitu * insitu, const double lengthunit, const double densityunit, const double temperatureunit, const double velocityunit)
+{
+	insitu->units[0]=lengthunit;
+	insitu->units[1]=densityunit;
+	insitu->units[2]=temperatureunit;
+	insitu->units[3]=velocityunit;
+}
+
+/**
+ * @brief This sets how often a step is rendered, see fomo_insitu_due().
+ * @param insitu The in-situ renderer.
+ * @param steps Every steps-th step is rendered, or none if 0. The default is 1.
+ * @param time A step is rendered whenever the time passes a multiple of this interval, or never if 0 (the default).
+ */
+void fomo_insitu_setcadence(fomo_insitu * insitu, const int steps, const double time)
+{
+	insitu->cadencesteps=steps;
+	insitu->cadencetime=time;
+}
+
+/**
+ * @brief This sets the number of OpenMP threads of the renderings, which should be the cores that the solver leaves free.
+ * @param insitu The in-situ renderer.
+ * @param nthreads The number of threads, or 0 (the default) for the OpenMP default.
+ */
+void fomo_insitu_setthreads(fomo_insitu * insitu, const int nthreads)
+{
+	insitu->nthreads=nthreads;
+}
+
+/**
+ * @brief This returns whether a step should be rendered, according to fomo_insitu_setcadence().
+ *
+ * The solver should only pass its blocks for the steps that are due, since passing the blocks copies their data. With
+ * MPI, all processes should pass the same step and time, so that they render the same steps.
+ * @param insitu The in-situ renderer.
+ * @param step The number of the step.
+ * @param time The time of the step.
+ * @return 1 if the step should be rendered, 0 otherwise.
+ */
+int fomo_insitu_due(fomo_insitu * insitu, const int step, const double time)
+{
+	if (insitu->cadencesteps > 0 && step%insitu->cadencesteps == 0) return 1;
+	if (insitu->cadencetime > 0 && time >= insitu->nexttime) return 1;
+	return 0;
+}
+
+/**
+ * @brief This starts a step that is rendered, of which the blocks are then passed with fomo_insitu_addblock().
+ * @param insitu The in-situ renderer.
+ * @param step The number of the step, which is used in the names of the output files.
+ * @param time The time of the step.
+ */
+void fomo_insitu_beginstep(fomo_insitu * insitu, const int step, const double time)
+{
+	if (insitu->collecting) insituerror("fomo_insitu_beginstep() is called before the previous step was ended with fomo_insitu_endstep().");
+	insitu->collecting.reset(new InsituStep);
+	insitu->collecting->step=step;
+	insitu->collecting->time=time;
+	insitu->collecting->grid.resize(insitu->dim);
+	insitu->collecting->vars.resize(insitu->lambda_pixel > 1 ? 5 : 2);
+	if (insitu->cadencetime > 0) insitu->nexttime=(std::floor(time/insitu->cadencetime)+1)*insitu->cadencetime;
+}
+
+/**
+ * @brief This passes a block of cell-centred data of the simulation.
+ *
+ * The arrays are stored with the first index running fastest, as in Fortran. Only the cells from lo to hi (the
+ * interior of the block, without ghost cells) are taken. Their data is copied (and converted to single precision), 
+ * so that the solver can continue as soon as fomo_insitu_endstep() returns. This copy is handed over to the 
+ * rendering without copying it again. For imaging renderings (lambda_pixel=1), the velocities are not used.
+ * @param insitu The in-situ renderer.
+ * @param shape The size of the arrays in every dimension.
+ * @param lo The first cell that is taken in every dimension, counting from 0.
+ * @param hi The last cell that is taken in every dimension, counting from 0.
+ * @param x0 The coordinates of the centre of the first cell of the arrays (index 0).
+ * @param dx The size of the cells in every dimension.
+ * @param n The number density.
+ * @param T The temperature.
+ * @param vx The velocity in the x-direction, or NULL if it is 0.
+ * @param vy The velocity in the y-direction, or NULL if it is 0.
+ * @param vz The velocity in the z-direction, or NULL if it is 0.
+ */
+void fomo_insitu_addblock(fomo_insitu * insitu, const int * shape, const int * lo, const int * hi, const double * x0, const double * dx,
+	const double * n, const double * T, const double * vx, const double * vy, const double * vz)
+{
+	InsituStep * step=insitu->collecting.get();
+	if (!step) insituerror("fomo_insitu_addblock() is called outside of fomo_insitu_beginstep() and fomo_insitu_endstep().");
+	int first[3]={lo[0],lo[1],0}, last[3]={hi[0],hi[1],0}, size[3]={shape[0],shape[1],1};
+	if (insitu->dim == 3)
+	{
+		first[2]=lo[2];
+		last[2]=hi[2];
+		size[2]=shape[2];
+	}
+	for (int d=0; d<3; d++)
+		if (first[d] < 0 || last[d] >= size[d] || first[d] > last[d]) insituerror("the cells of a block passed to fomo_insitu_addblock() are outside of its arrays.");
+	const double * velocities[3]={vx,vy,vz};
+	bool spectroscopic=(step->vars.size() == 5);
+	for (int k=first[2]; k<=last[2]; k++)
+		for (int j=first[1]; j<=last[1]; j++)
+			for (int i=first[0]; i<=last[0]; i++)
+			{
+				int cell[3]={i,j,k};
+				long index=(long(k)*size[1]+j)*size[0]+i;
+				for (int d=0; d<insitu->dim; d++) step->grid[d].push_back((x0[d]+cell[d]*dx[d])*insitu->units[0]);
+				step->vars[0].push_back(n[index]*insitu->units[1]);
+				step->vars[1].push_back(T[index]*insitu->units[2]);
+				if (spectroscopic)
+					for (int d=0; d<3; d++) step->vars[2+d].push_back(velocities[d] ? velocities[d][index]*insitu->units[3] : 0.);
+			}
+}
+
+/**
+ * @brief This ends a step, and hands it over to the rendering thread.
+ *
+ * The rendering is done while the solver continues. If the previous step is still being rendered and another step
+ * is already waiting, this waits until that step is started, so that at most two steps are kept in memory. With MPI,
+ * this should be called by all processes: the blocks of all processes are gathered on process 0, which renders 
+ * the complete domain and writes the renderings. The other processes continue as soon as their blocks are sent.
+ * @param insitu The in-situ renderer.
+ */
+void fomo_insitu_endstep(fomo_insitu * insitu)
+{
+	if (!insitu->collecting) insituerror("fomo_insitu_endstep() is called without fomo_insitu_beginstep().");
+	if (insitu->chiantifile.empty()) insituerror("no chiantifile is set with fomo_insitu_setemission().");
+	if (insitu->lvec.empty()) insituerror("no views are added with fomo_insitu_addview().");
+	std::unique_ptr<InsituStep> step=std::move(insitu->collecting);
+#ifdef HAVEMPI
+	gatherstep(insitu,*step);
+	int commrank;
+	MPI_Comm_rank(insitu->comm,&commrank);
+	if (commrank != 0) return;
+#endif
+	if (step->grid[0].empty())
+	{
+		std::cout << "Warning: step " << step->step << " has no data points, and is not rendered." << std::endl << std::flush;
+		return;
+	}
+	step->chiantifile=insitu->chiantifile;
+	step->abundfile=insitu->abundfile;
+	step->rendermethod=insitu->rendermethod;
+	step->outfile=insitu->outfile;
+	step->x_pixel=insitu->x_pixel;
+	step->y_pixel=insitu->y_pixel;
+	step->z_pixel=insitu->z_pixel;
+	step->lambda_pixel=insitu->lambda_pixel;
+	step->lambda_width=insitu->lambda_width;
+	step->lvec=insitu->lvec;
+	step->bvec=insitu->bvec;
+	step->nthreads=insitu->nthreads;
+	// the velocities are only kept if the step was started with a spectroscopic resolution
+	if (step->lambda_pixel > 1 && step->vars.size() != 5) insituerror("the resolution was changed to spectroscopic during a step.");
+	if (!insitu->worker.joinable()) insitu->worker=std::thread(insituworker,insitu);
+	std::unique_lock<std::mutex> guard(insitu->lock);
+	while (!insitu->queue.empty()) insitu->changed.wait(guard);
+	insitu->queue.push_back(std::move(step));
+	guard.unlock();
+	insitu->changed.notify_all();
+}
+
+/**
+ * @brief This waits until all steps that were ended have been rendered.
+ * @param insitu The in-situ renderer.
+ */
+void fomo_insitu_wait(fomo_insitu * insitu)
+{
+	std::unique_lock<std::mutex> guard(insitu->lock);
+	while (!insitu->queue.empty() || insitu->busy) insitu->changed.wait(guard);
+}
+
+/**
+ * @brief This waits until all steps have been rendered, and releases the in-situ renderer.
+ *
+ * With MPI, this should be called by all processes.
+ * @param insitu The in-situ renderer, which cannot be used anymore afterwards.
+ */
+void fomo_insitu_finish(fomo_insitu * insitu)
+{
+	if (insitu->collecting) std::cout << "Warning: step " << insitu->collecting->step << " was not ended, and is not rendered." << std::endl << std::flush;
+	fomo_insitu_wait(insitu);
+	{
+		std::lock_guard<std::mutex> guard(insitu->lock);
+		insitu->stopping=true;
+	}
+	insitu->changed.notify_all();
+	if (insitu->worker.joinable()) insitu->worker.join();
+#ifdef HAVEMPI
+	MPI_Comm_free(&insitu->comm);
+#endif
+	delete insitu;
+}
@@ -1,3 +1,4 @@
+#include "../config.h"
 #include "FoMo.h"
 #include "FoMo-internal.h"
 #include <fstream>
@@ -23,59 +24,89 @@
  * Normally, one would use it to post-process the forward modelling results (when using with a RenderCube), but it is also very useful for debugging purposes when using it with a GoftCube before the rendering.
  * @param filename This parameter specifies which filename the data needs to be written to.
  */
-void writegoftcube_txt(FoMo::GoftCube goftcube, const std::string filename)
+void writegoftcube_txt(const FoMo::GoftCube & goftcube, const std::string filename)
 {
         // write out goftcube to file "filename"
-        int commrank;
         std::string space=" ";
-#ifdef HAVEMPI
-        MPI_Comm_rank(MPI_COMM_WORLD,&commrank);
-#else
-        commrank = 0;
-#endif
-        if (commrank==0)
+        std::ofstream out(filename,std::ios::ate);
+        if (out.is_open())
         {
-                std::ofstream out(filename,std::ios::ate);
-                if (out.is_open())
+                int nvars = goftcube.readnvars();
+                int dim = goftcube.readdim();
+                int ng = goftcube.readngrid();
+					out << "FoMo-" << FOMO_VER << std::endl;
+                out << dim << std::endl;
+                out << ng << std::endl;
+                out << nvars << std::endl;
+					std::vector<std::string> unitvec=goftcube.readunit();
+					for (int u=0; u<dim+nvars; u++)
+					{
+						out << unitvec.at(u) << "\t";
+					}
+					out << std::endl;
+                out << goftcube.readchiantifile() << std::endl;
+                out << goftcube.readabundfile() << std::endl;
+					FoMo::tgrid grid=goftcube.readgrid();
+					FoMo::tvars vars;
+					for (int i=0; i<nvars; i++)
+					{
+						vars.push_back(goftcube.readvar(i));
+					}
+					out << std::setprecision(8);
+                for (int j=0; j<ng; j++)
                 {
-                        int nvars = goftcube.readnvars();
-                        int dim = goftcube.readdim();
-                        int ng = goftcube.readngrid();
-						out << "FoMo-" << FOMO_VER << std::endl;
-                        out << dim << std::endl;
-                        out << ng << std::endl;
-                        out << nvars << std::endl;
-						std::vector<std::string> unitvec=goftcube.readunit();
-						for (int u=0; u<dim+nvars; u++)
-						{
-							out << unitvec.at(u) << "\t";
-						}
-						out << std::endl;
-                        out << goftcube.readchiantifile() << std::endl;
-                        out << goftcube.readabundfile() << std::endl;
-						FoMo::tgrid grid=goftcube.readgrid();
-						FoMo::tvars vars;
-						for (int i=0; i<nvars; i++)
-						{
-							vars.push_back(goftcube.readvar(i));
-						}
-						out << std::setprecision(8);
-                        for (int j=0; j<ng; j++)
+                        for (int i=0; i<dim; i++)
+                        {
+                                out << grid[i][j] << space;
+                        }
+                        for (int i=0; i<nvars; i++)
                         {
-                                for (int i=0; i<dim; i++)
-                                {
-                                        out << grid[i][j] << space;
-                                }
-                                for (int i=0; i<nvars; i++)
-                                {
-                                        out << vars[i][j] << space;
-                                }
-                                out << std::endl;
+                                out << vars[i][j] << space;
                         }
+                        out << std::endl;
                 }
-                else std::cerr << "Unable to write to " << filename << std::endl;
-                out.close();
         }
+        else std::cerr << "Unable to write to " << filename << std::endl;
+        out.close();
+}
+
+/**
+ * @brief This writes the header of a binary file.
+ * 
+ * The header consists of the version string (terminated by the marker #), the dimension, number of grid points, 
+ * number of variables, the units, the chiantifile and the abundfile. 
+ * @param out The stream to which the header is written.
+ * @param goftcube The GoftCube of which the header is written.
+ * @param format This is appended to the version string, to mark a different layout of the data following the header.
+ */
+void writeheader_binary(std::ofstream & out, const FoMo::GoftCube & goftcube, const std::string format)
+{
+	std::string versionstring("FoMo-");
+	versionstring.append(FOMO_VER).append(format).append("#"); // this allows us to read the file into python, up to the marker string #
+	// the longest possible string is 27 digits (e.g. FoMo-v3.3-79-gbeba0fc-dirty), 
+	// but could grow longer if 3.3 changes to e.g. 3.10 or there are more than 99 commits since the last tag
+	// in any case, it will be shorter than 40 digits
+	out.write(versionstring.c_str(),versionstring.size());
+	int nvars = goftcube.readnvars();
+	int dim = goftcube.readdim();
+	int ng = goftcube.readngrid();
+	out.write(reinterpret_cast<const char*>(&dim),sizeof(dim));
+	out.write(reinterpret_cast<const char*>(&ng),sizeof(ng));
+	out.write(reinterpret_cast<const char*>(&nvars),sizeof(nvars));
+	// units
+	std::vector<std::string> unitvec=goftcube.readunit();
+	for (int i=0; i<dim+nvars; i++)
+	{
+		size_t unitsize=unitvec.at(i).size();
+		out.write(reinterpret_cast<const char*>(&unitsize),sizeof(unitsize));
+		out.write(unitvec.at(i).c_str(),unitsize);
+	}
+	size_t chiantisize=goftcube.readchiantifile().size();
+	size_t abundsize=goftcube.readabundfile().size();
+	out.write(reinterpret_cast<const char*>(&chiantisize),sizeof(chiantisize));
+	out.write(goftcube.readchiantifile().c_str(),chiantisize);
+	out.write(reinterpret_cast<const char*>(&abundsize),sizeof(abundsize));
+	out.write(goftcube.readabundfile().c_str(),abundsize);
 }
 
 /**
@@ -86,67 +117,149 @@ void writegoftcube_txt(FoMo::GoftCube goftcube, const std::string filename)
  * Normally, one would use it to post-process the forward modelling results (when using with a RenderCube), but it is also very useful for debugging purposes when using it with a GoftCube before the rendering.
  * @param filename This parameter specifies which filename the data needs to be written to.
  */
-void writegoftcube_binary(FoMo::GoftCube goftcube, const std::string filename)
+void writegoftcube_binary(const FoMo::GoftCube & goftcube, const std::string filename)
 {
 	// write out goftcube to file "filename"
-	int commrank;
-	std::string space=" ";
-	size_t chiantisize=goftcube.readchiantifile().size();
-	size_t abundsize=goftcube.readabundfile().size();
-	
-#ifdef HAVEMPI
-        MPI_Comm_rank(MPI_COMM_WORLD,&commrank);
-#else
-	commrank = 0;
-#endif
-	if (commrank==0)
+	std::ofstream out(filename,std::ios::binary|std::ios::ate);
+	if (out.is_open())
 	{
-		std::ofstream out(filename,std::ios::binary|std::ios::ate);
-		if (out.is_open())
+		writeheader_binary(out,goftcube,"");
+		int nvars = goftcube.readnvars();
+		int dim = goftcube.readdim();
+		int ng = goftcube.readngrid();
+		
+		FoMo::tgrid grid=goftcube.readgrid();
+		FoMo::tvars vars;
+		for (int i=0; i<nvars; i++)
 		{
-			std::string versionstring("FoMo-");
-			versionstring.append(FOMO_VER).append("#"); // this allows us to read the file into python, up to the marker string #
-			// the longest possible string is 27 digits (e.g. FoMo-v3.3-79-gbeba0fc-dirty), 
-			// but could grow longer if 3.3 changes to e.g. 3.10 or there are more than 99 commits since the last tag
-			// in any case, it will be shorter than 40 digits
-			out.write(versionstring.c_str(),versionstring.size());
-			int nvars = goftcube.readnvars();
-			int dim = goftcube.readdim();
-			int ng = goftcube.readngrid();
-			out.write(reinterpret_cast<const char*>(&dim),sizeof(dim));
-			out.write(reinterpret_cast<const char*>(&ng),sizeof(ng));
-			out.write(reinterpret_cast<const char*>(&nvars),sizeof(nvars));
-			// units
-			std::vector<std::string> unitvec=goftcube.readunit();
-			for (unsigned int i=0; i<dim+nvars; i++)
-			{
-				size_t unitsize=unitvec.at(i).size();
-				out.write(reinterpret_cast<const char*>(&unitsize),sizeof(unitsize));
-				out.write(unitvec.at(i).c_str(),unitsize);
-			}
-			out.write(reinterpret_cast<const char*>(&chiantisize),sizeof(chiantisize));
-			out.write(goftcube.readchiantifile().c_str(),chiantisize);
-			out.write(reinterpret_cast<const char*>(&abundsize),sizeof(abundsize));
-			out.write(goftcube.readabundfile().c_str(),abundsize);
-			
-			FoMo::tgrid grid=goftcube.readgrid();
-			FoMo::tvars vars;
-			for (int i=0; i<nvars; i++)
-			{
-				vars.push_back(goftcube.readvar(i));
-			}
-			for (int i=0; i<dim; i++)
-			{ 
-				out.write(reinterpret_cast<const char*>(grid[i].data()),ng*sizeof(grid[i][0]));
-			}
-			for (int i=0; i<nvars; i++)
-			{
-				out.write(reinterpret_cast<const char*>(vars[i].data()),ng*sizeof(vars[i][0]));
-			}
+			vars.push_back(goftcube.readvar(i));
+		}
+		for (int i=0; i<dim; i++)
+		{ 
+			out.write(reinterpret_cast<const char*>(grid[i].data()),ng*sizeof(grid[i][0]));
+		}
+		for (int i=0; i<nvars; i++)
+		{
+			out.write(reinterpret_cast<const char*>(vars[i].data()),ng*sizeof(vars[i][0]));
 		}
-		else std::cerr << "Unable to write to " << filename << std::endl;
-		out.close();
 	}
+	else std::cerr << "Unable to write to " << filename << std::endl;
+	out.close();
+}
+
+/**
+ * @brief This writes out a sparse RenderCube in binary format.
+ * 
+ * The header is the same as for writegoftcube_binary(), with "-sparse" appended to the version string. It is followed by
+ * the number of pixels along x, y and \f$\lambda\f$ (3 ints), the origin and step of these axes (3+3 doubles), 
+ * the first stored wavelength bin and the number of stored bins for each pixel (2 times x_pixel*y_pixel ints) and 
+ * the packed intensities (floats). The readers in the idl/ and python/ directories expand this to the usual dense data.
+ * @param rendercube The sparse RenderCube to be written.
+ * @param filename This parameter specifies which filename the data needs to be written to.
+ */
+void writerendercube_sparse(const FoMo::RenderCube & rendercube, const std::string filename)
+{
+	std::ofstream out(filename,std::ios::binary|std::ios::ate);
+	if (out.is_open())
+	{
+		writeheader_binary(out,rendercube,"-sparse");
+		std::vector<int> count;
+		std::vector<double> origin, step;
+		rendercube.readsparseaxes(count,origin,step);
+		out.write(reinterpret_cast<const char*>(count.data()),count.size()*sizeof(count[0]));
+		out.write(reinterpret_cast<const char*>(origin.data()),origin.size()*sizeof(origin[0]));
+		out.write(reinterpret_cast<const char*>(step.data()),step.size()*sizeof(step[0]));
+		const std::vector<int> & firstbin=rendercube.readsparsefirstbin();
+		const std::vector<int> & bincount=rendercube.readsparsecount();
+		const FoMo::tphysvar & values=rendercube.readsparsevalues();
+		out.write(reinterpret_cast<const char*>(firstbin.data()),firstbin.size()*sizeof(firstbin[0]));
+		out.write(reinterpret_cast<const char*>(bincount.data()),bincount.size()*sizeof(bincount[0]));
+		out.write(reinterpret_cast<const char*>(values.data()),values.size()*sizeof(values[0]));
+	}
+	else std::cerr << "Unable to write to " << filename << std::endl;
+	out.close();
+}
+
+/**
+ * @brief This reads a RenderCube from a binary file.
+ * 
+ * The file should have been written by writegoftcube_binary() or writerendercube_sparse(), i.e. it is the binary 
+ * output of GoftCube::writegoftcube() or RenderCube::writegoftcube(). The grid, variables, units, chiantifile and 
+ * abundfile are set in rendercube, a sparse file results in a sparse RenderCube. Other members of the RenderCube 
+ * (such as the resolution and angles) are not stored in the file and are left unchanged.
+ * @param filename The binary file to be read.
+ * @param rendercube The RenderCube in which the contents of the file are stored.
+ * @return False if the file could not be opened, or is not a complete binary FoMo file.
+ */
+bool readrendercube_binary(const std::string filename, FoMo::RenderCube & rendercube)
+{
+	std::ifstream in(filename,std::ios::binary);
+	if (!in.is_open()) return false;
+	const size_t maxsize_version=40;
+	std::string versionstring;
+	char c=0;
+	while (in.get(c) && c!='#' && versionstring.size()<maxsize_version) versionstring+=c;
+	// the version is a tag such as v3.3, or only a commit hash if the source has no tags
+	if (c!='#' || versionstring.compare(0,5,"FoMo-")) return false;
+	bool sparse=(versionstring.size() > 7) && (versionstring.compare(versionstring.size()-7,7,"-sparse") == 0);
+	
+	int dim, ng, nvars;
+	in.read(reinterpret_cast<char*>(&dim),sizeof(dim));
+	in.read(reinterpret_cast<char*>(&ng),sizeof(ng));
+	in.read(reinterpret_cast<char*>(&nvars),sizeof(nvars));
+	if (!in || dim<=0 || ng<0 || nvars<0) return false;
+	std::vector<std::string> unitvec(dim+nvars);
+	for (int i=0; i<dim+nvars; i++)
+	{
+		size_t unitsize;
+		in.read(reinterpret_cast<char*>(&unitsize),sizeof(unitsize));
+		if (!in) return false;
+		unitvec.at(i).resize(unitsize);
+		in.read(&unitvec.at(i)[0],unitsize);
+	}
+	std::string chiantifile, abundfile;
+	size_t stringsize;
+	in.read(reinterpret_cast<char*>(&stringsize),sizeof(stringsize));
+	if (!in) return false;
+	chiantifile.resize(stringsize);
+	in.read(&chiantifile[0],stringsize);
+	in.read(reinterpret_cast<char*>(&stringsize),sizeof(stringsize));
+	if (!in) return false;
+	abundfile.resize(stringsize);
+	in.read(&abundfile[0],stringsize);
+	if (!in) return false;
+	
+	if (sparse)
+	{
+		std::vector<int> count(3);
+		std::vector<double> origin(3), step(3);
+		in.read(reinterpret_cast<char*>(count.data()),count.size()*sizeof(count[0]));
+		in.read(reinterpret_cast<char*>(origin.data()),origin.size()*sizeof(origin[0]));
+		in.read(reinterpret_cast<char*>(step.data()),step.size()*sizeof(step[0]));
+		if (!in || count[0]<0 || count[1]<0 || count[2]<0) return false;
+		std::vector<int> firstbin(count[0]*count[1]), bincount(count[0]*count[1]);
+		in.read(reinterpret_cast<char*>(firstbin.data()),firstbin.size()*sizeof(firstbin[0]));
+		in.read(reinterpret_cast<char*>(bincount.data()),bincount.size()*sizeof(bincount[0]));
+		if (!in) return false;
+		size_t nvalues=0;
+		for (unsigned int i=0; i<bincount.size(); i++) nvalues+=bincount[i];
+		FoMo::tphysvar values(nvalues);
+		in.read(reinterpret_cast<char*>(values.data()),nvalues*sizeof(values[0]));
+		if (!in) return false;
+		rendercube.setsparsedata(count,origin,step,firstbin,bincount,values,&unitvec);
+	}
+	else
+	{
+		FoMo::tgrid grid(dim,FoMo::tcoord(ng));
+		FoMo::tvars vars(nvars,FoMo::tphysvar(ng));
+		for (int i=0; i<dim; i++) in.read(reinterpret_cast<char*>(grid[i].data()),ng*sizeof(grid[i][0]));
+		for (int i=0; i<nvars; i++) in.read(reinterpret_cast<char*>(vars[i].data()),ng*sizeof(vars[i][0]));
+		if (!in) return false;
+		rendercube.setdata(grid,vars,&unitvec);
+	}
+	rendercube.setchiantifile(chiantifile);
+	rendercube.setabundfile(abundfile);
+	return true;
 }
 
 const std::vector<std::string> extensions={".dat", ".txt"};
@@ -169,13 +282,62 @@ void zipfile(std::bitset<FoMo::noptions> woptions, std::string root)
 	}
 }
 
+/**
+ * @brief This strips the extension from a filename.
+ * @param filename The filename, possibly with an extension.
+ * @return The filename without extension.
+ */
+std::string rootfilename(const std::string filename)
+{
+	// find root of filename
+	size_t pos = filename.rfind(".");
+	std::string root;
+    if ((pos == std::string::npos) ||   //No extension.
+		(pos == 0)) //. is at the front. Not an extension.
+		{
+			root=filename;
+		}
+	else
+	{
+		root=filename.substr(0, pos);
+	}
+	return root;
+}
+
+/**
+ * @brief This zips the output files written with root, and deletes the unzipped files, as requested by woptions.
+ * @param woptions The write options of the GoftCube.
+ * @param root The filename of the output, without extension.
+ */
+void zipoutput(std::bitset<FoMo::noptions> woptions, std::string root)
+{
+	// if zip requested: writeoptions[2] is true
+	if (woptions[2] & (woptions[0] | woptions[1]))
+	// zip filename
+	{
+		zipfile(woptions, root);
+		// if delete files requested, remove uncompressed files
+		if (woptions[3])
+		{
+			// delete files 
+			for (unsigned int i=0; i<woptions.size()-2; i++)
+			{
+				std::string tmpfile=root+extensions[i];
+				if (woptions[i]) remove(tmpfile.c_str());
+			}
+		}
+	}
+	else if (woptions[2])
+		std::cerr << "Zipping of output only possible if output set with goftcube.setwriteouttext or goftcube.setwriteoutbinary." << std::endl << std::flush;
+}
+
 /**
  * @brief This member returns the current writeoptions
  * 
  * The current writeoptions are returned as a std::bitset<FoMo::noptions>.
  * @return The current writeoptions.
  */
-std::bitset<FoMo::noptions> FoMo::GoftCube::getwriteoptions()
+std::bitset<FoMo::noptions> FoMo::GoftCube::getwriteoptions() const
 {
 	return writeoptions;
 }
@@ -243,47 +405,64 @@ void FoMo::GoftCube::setwriteoutdeletefiles(const bool deletefiles)
  * This member function writes out the contents of the GoftCube to the hard disk, in the filename given by the argument (with the extension appropriately changed to .txt, .dat or .zip). 
  * The file can then be read into IDL with the commands provide under the idl/ directory, here in particular readgoftcube.pro.
  * Normally, one would use it to post-process the forward modelling results (when using with a RenderCube), but it is also very useful for debugging purposes when using it with a GoftCube before the rendering.
+ * With MPI, only the first rank of MPI_COMM_WORLD writes, unless anyrank is set.
  * @param filename This parameter specifies which filename the data needs to be written to.
+ * @param anyrank If true, the GoftCube is written by the calling MPI rank, whichever it is. The render routines set it
+ * for the views that every rank renders itself (see FoMoObject::setnodesharing()).
  */
-void FoMo::GoftCube::writegoftcube(const std::string filename)
+void FoMo::GoftCube::writegoftcube(const std::string filename, const bool anyrank)
 {
-	// find root of filename
-	// append correct extension
-	size_t pos = filename.rfind(".");
-	std::string root;
-    if ((pos == std::string::npos) ||   //No extension.
-		(pos == 0)) //. is at the front. Not an extension.
-		{
-			root=filename;
-		}
-	else
-	{
-		root=filename.substr(0, pos);
-	}
+	int commrank;
+#ifdef HAVEMPI
+	MPI_Comm_rank(MPI_COMM_WORLD,&commrank);
+#else
+	commrank = 0;
+#endif
+	if (!anyrank && commrank!=0) return;
+	FoMo::ProfileScope scope("write");
+	std::string root=rootfilename(filename);
 	// if binary requested: writeoptions[0] is true
 	if (writeoptions[0])
 		writegoftcube_binary(*this,root+extensions[0]);
 	// if text requested: writeoptions[1] is true
 	if (writeoptions[1])
 		writegoftcube_txt(*this,root+extensions[1]);
-	// if zip requested: writeoptions[2] is true
-	if (writeoptions[2] & (writeoptions[0] | writeoptions[1]))
-	// zip filename
+	zipoutput(writeoptions, root);
+}
+
+/**
+ * @brief This writes out the contents of the RenderCube.
+ * 
+ * This does the same as GoftCube::writegoftcube(), unless the RenderCube is sparse. In that case, the binary output
+ * is written in the sparse format (see RenderCube::issparse()), and the text output is written from a dense copy.
+ * @param filename This parameter specifies which filename the data needs to be written to.
+ * @param anyrank If true, the RenderCube is written by the calling MPI rank, otherwise only by the first rank.
+ */
+void FoMo::RenderCube::writegoftcube(const std::string filename, const bool anyrank)
+{
+	if (!sparse)
 	{
-		zipfile(writeoptions, root);
-		// if delete files requested, remove uncompressed files
-		if (writeoptions[3])
-		{
-			// delete files 
-			for (unsigned int i=0; i<writeoptions.size()-2; i++)
-			{
-				std::string tmpfile=root+extensions[i];
-				if (writeoptions[i]) remove(tmpfile.c_str());
-			}
-		}
+		GoftCube::writegoftcube(filename,anyrank);
+		return;
 	}
-	else if (writeoptions[2])
-		std::cerr << "Zipping of output only possible if output set with goftcube.setwriteouttext or goftcube.setwriteoutbinary." << std::endl << std::flush;
+	int commrank;
+#ifdef HAVEMPI
+	MPI_Comm_rank(MPI_COMM_WORLD,&commrank);
+#else
+	commrank = 0;
+#endif
+	if (!anyrank && commrank!=0) return;
+	FoMo::ProfileScope scope("write");
+	std::string root=rootfilename(filename);
+	if (writeoptions[0])
+		writerendercube_sparse(*this,root+extensions[0]);
+	if (writeoptions[1])
+	{
+		FoMo::RenderCube densecube(*this);
+		densecube.densify();
+		writegoftcube_txt(densecube,root+extensions[1]);
+	}
+	zipoutput(writeoptions, root);
 }
 
 /**
@@ -297,42 +476,33 @@ void FoMo::GoftCube::readgoftcube(const std::string emissionsave)
 	// Read GoftCube datacube from file "emissionsave"
 	// Otherwise read in data cube (simulation snapshots) from directory specified in main function
 
-	int commrank;
-#ifdef HAVEMPI
-        MPI_Comm_rank(MPI_COMM_WORLD,&commrank);
-#else
-	commrank = 0;
-#endif
-	if (commrank==0)
+	std::ifstream in(emissionsave,std::ios::binary);
+	if (in.is_open())
 	{
-		std::ifstream in(emissionsave,std::ios::binary);
-		if (in.is_open())
+		in >> dim;
+		in >> ng;
+		in >> nvars;
+		in >> chiantifile;
+		in >> abundfile;
+		
+		grid.resize(dim);
+		vars.resize(nvars);
+		lambda0=readgoftfromchianti(chiantifile);
+		
+		for (unsigned int i=0; i<dim; i++)
 		{
-			in >> dim;
-			in >> ng;
-			in >> nvars;
-			in >> chiantifile;
-			in >> abundfile;
-			
-			grid.resize(dim);
-			vars.resize(nvars);
-			lambda0=readgoftfromchianti(chiantifile);
-			
-			for (unsigned int i=0; i<dim; i++)
-			{
-				grid[i].resize(ng);
-			}
-			for (unsigned int i=0; i<nvars; i++)
-			{
-				vars[i].resize(ng);
-			}
-			for (unsigned int j=0; j<ng; j++)
-			{
-				for (unsigned int i=0; i<dim; i++) in >> grid[i][j];
-				for (unsigned int i=0; i<nvars; i++) in >> vars[i][j];
-			}
+			grid[i].resize(ng);
+		}
+		for (unsigned int i=0; i<nvars; i++)
+		{
+			vars[i].resize(ng);
+		}
+		for (unsigned int j=0; j<ng; j++)
+		{
+			for (unsigned int i=0; i<dim; i++) in >> grid[i][j];
+			for (unsigned int i=0; i<nvars; i++) in >> vars[i][j];
 		}
-		else std::cerr << "Unable to read " << emissionsave << std::endl;
-		in.close();
 	}
+	else std::cerr << "Unable to read " << emissionsave << std::endl;
+	in.close();
 }
\ No newline at end of file
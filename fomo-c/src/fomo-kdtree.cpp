@@ -0,0 +1,172 @@
+#include "../config.h"
+#include "FoMo.h"
+#include "FoMo-internal.h"
+#include <cmath>
+#include <algorithm>
+#include <numeric>
+
+// below this number of points, the subtrees are built in the same task
+const int kdtreetasksize=1<<16;
+
+/**
+ * @brief This constructs an empty KDTree.
+ */
+FoMo::KDTree::KDTree(): depth(0)
+{
+}
+
+/**
+ * @brief This builds the KDTree of a set of points.
+ *
+ * The subtrees are built in parallel (with OpenMP tasks) if FoMo is compiled with OpenMP.
+ * @param x The x-coordinates of the points.
+ * @param y The y-coordinates of the points.
+ * @param z The z-coordinates of the points.
+ */
+FoMo::KDTree::KDTree(const std::vector<float> & x, const std::vector<float> & y, const std::vector<float> & z): depth(0)
+{
+	int n=x.size();
+	// the number of levels is such that the leaves contain at most leafsize points
+	while ((n+(1<<depth)-1)/(1<<depth) > leafsize) depth++;
+	split.resize((1<<depth)-1);
+	splitdim.resize((1<<depth)-1);
+	pointid.resize(n);
+	std::iota(pointid.begin(),pointid.end(),0);
+	// the bounding box of all points, which is split together with the points
+	std::vector<float> bounds={INFINITY,INFINITY,INFINITY,-INFINITY,-INFINITY,-INFINITY};
+	for (int i=0; i<n; i++)
+	{
+		bounds[0]=std::min(bounds[0],x[i]);
+		bounds[1]=std::min(bounds[1],y[i]);
+		bounds[2]=std::min(bounds[2],z[i]);
+		bounds[3]=std::max(bounds[3],x[i]);
+		bounds[4]=std::max(bounds[4],y[i]);
+		bounds[5]=std::max(bounds[5],z[i]);
+	}
+#ifdef _OPENMP
+#pragma omp parallel
+#pragma omp single
+#endif
+	build(x,y,z,bounds.data(),0,0,n,0);
+	// store the coordinates in the order of the leaves
+	px.resize(n);
+	py.resize(n);
+	pz.resize(n);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int i=0; i<n; i++)
+	{
+		px[i]=x[pointid[i]];
+		py[i]=y[pointid[i]];
+		pz[i]=z[pointid[i]];
+	}
+}
+
+// This splits the points lo to hi-1 at the median along the widest dimension of their cell, and continues with both halves.
+// The cell bounds are {xmin, ymin, zmin, xmax, ymax, zmax}.
+void FoMo::KDTree::build(const std::vector<float> & x, const std::vector<float> & y, const std::vector<float> & z, const float * bounds, const int node, const int lo, const int hi, const int level)
+{
+	if (level == depth) return;
+	const std::vector<float> * coord[3]={&x,&y,&z};
+	int dim=0;
+	for (int d=1; d<3; d++) if (bounds[d+3]-bounds[d] > bounds[dim+3]-bounds[dim]) dim=d;
+	const std::vector<float> & c=*coord[dim];
+	// the points left of mid are not larger than the split value, the points from mid onwards are not smaller
+	int mid=lo+(hi-lo)/2;
+	std::nth_element(pointid.begin()+lo,pointid.begin()+mid,pointid.begin()+hi,[&c](const int a, const int b){return c[a] < c[b];});
+	split[node]=(mid < hi) ? c[pointid[mid]] : 0;
+	splitdim[node]=dim;
+	float leftbounds[6], rightbounds[6];
+	std::copy(bounds,bounds+6,leftbounds);
+	std::copy(bounds,bounds+6,rightbounds);
+	leftbounds[dim+3]=split[node];
+	rightbounds[dim]=split[node];
+#ifdef _OPENMP
+#pragma omp task shared(x,y,z,leftbounds) if (hi-lo > kdtreetasksize)
+#endif
+	build(x,y,z,leftbounds,2*node+1,lo,mid,level+1);
+	build(x,y,z,rightbounds,2*node+2,mid,hi,level+1);
+#ifdef _OPENMP
+#pragma omp taskwait
+#endif
+}
+
+/**
+ * @brief This finds the nearest point inside a cube around a position.
+ *
+ * Only the points strictly inside the cube with half-side maxdistance around the position are considered,
+ * as for a query of the nearest point within a box in the Boost R-tree. Of these points, the one at the
+ * smallest Euclidean distance is returned.
+ * @param x The x-coordinate of the position.
+ * @param y The y-coordinate of the position.
+ * @param z The z-coordinate of the position.
+ * @param maxdistance The half-side of the cube.
+ * @return The index of the nearest point in the input of the constructor, or -1 if there is no point in the cube.
+ */
+int FoMo::KDTree::nearest(const float x, const float y, const float z, const float maxdistance) const
+{
+	const float query[3]={x,y,z};
+	int best=-1;
+	float bestdistance=INFINITY;
+	// the subtrees that still need to be searched, with a lower bound of their squared distance
+	// at most one subtree is put aside per level, so that the stack cannot overflow
+	struct subtree
+	{
+		int node, lo, hi, level;
+		float distance;
+	} stack[64];
+	int nstack=0;
+	stack[nstack++]={0,0,int(pointid.size()),0,0.f};
+	while (nstack > 0)
+	{
+		subtree current=stack[--nstack];
+		if (current.distance > bestdistance) continue;
+		// descend to the leaf on the side of the query, and put the other sides aside if they are close enough
+		while (current.level < depth)
+		{
+			int mid=current.lo+(current.hi-current.lo)/2;
+			float diff=query[splitdim[current.node]]-split[current.node];
+			subtree left={2*current.node+1,current.lo,mid,current.level+1,current.distance};
+			subtree right={2*current.node+2,mid,current.hi,current.level+1,current.distance};
+			subtree & far=(diff < 0) ? right : left;
+			if (std::fabs(diff) < maxdistance && diff*diff <= bestdistance)
+			{
+				far.distance=std::max(current.distance,diff*diff);
+				stack[nstack++]=far;
+			}
+			current=(diff < 0) ? left : right;
+		}
+		// compute the distances to all points in the leaf, points outside of the cube get an infinite distance
+		float distance[leafsize];
+		int n=current.hi-current.lo;
+		const float * lx=px.data()+current.lo;
+		const float * ly=py.data()+current.lo;
+		const float * lz=pz.data()+current.lo;
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+		for (int i=0; i<n; i++)
+		{
+			float dx=lx[i]-x, dy=ly[i]-y, dz=lz[i]-z;
+			bool inside=(std::fabs(dx) < maxdistance) & (std::fabs(dy) < maxdistance) & (std::fabs(dz) < maxdistance);
+			distance[i]=inside ? dx*dx+dy*dy+dz*dz : INFINITY;
+		}
+		for (int i=0; i<n; i++)
+			if (distance[i] < bestdistance)
+			{
+				bestdistance=distance[i];
+				best=current.lo+i;
+			}
+	}
+	return (best >= 0) ? pointid[best] : -1;
+}
+
+/**
+ * @brief This returns the number of points in the KDTree.
+ * @return The number of points.
+ */
+size_t FoMo::KDTree::size() const
+{
+	return pointid.size();
+}
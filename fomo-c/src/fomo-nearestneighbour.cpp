@@ -11,6 +11,7 @@
 #include <algorithm>
 #include <cassert>
 #include <set>
+#include <fstream>
 
 
 #include <boost/geometry.hpp>
@@ -24,11 +25,63 @@ namespace bgi = boost::geometry::index;
 typedef bg::model::point<float, 3, bg::cs::cartesian> point;
 typedef bg::model::box<point> box;
 typedef std::pair<point, unsigned> value;
+// take an rtree with the quadratic packing algorithm, it takes (slightly) more time to build, but queries are faster for large renderings
+typedef bgi::rtree< value, bgi::quadratic<16> > rtree;
+
+namespace FoMo
+{
+	/**
+	 * @brief The spatial index of the data points, which does not depend on the view.
+	 * 
+	 * Only one of the indexes is built, depending on RenderOptions::spatialindex.
+	 */
+	struct NearestNeighbourIndex
+	{
+		/** The kind of index: "rtree", "kdtree", "grid" or "voxel". */
+		std::string spatialindex;
+		/** The memory limit of the voxel table. */
+		double maxmemory=0;
+		rtree tree;
+		KDTree kdtree;
+		UniformGrid grid;
+		VoxelTable voxels;
+	};
+	
+	/**
+	 * @brief The mapping of one view: the bounds of the rotated grid and the nearest data points along every ray.
+	 * 
+	 * The samples along a ray are stored as runs of consecutive samples with the same nearest data point. Samples
+	 * without a nearest data point do not contribute, and are left out. Rendering the view is then a sparse 
+	 * matrix-vector product of the runs with the emission of the data points.
+	 */
+	struct NearestNeighbourView
+	{
+		double minx, maxx, miny, maxy, minz, maxz;
+		/** The runs of ray (i,j) of the region of interest are rayoffset[i*nx+j] to rayoffset[i*nx+j+1]-1. */
+		std::vector<int> rayoffset;
+		/** The nearest data point of every run. */
+		std::vector<int> runpoint;
+		/** The number of samples of every run. */
+		std::vector<int> runcount;
+	};
+}
 
 const double speedoflight=GSL_CONST_MKSA_SPEED_OF_LIGHT; // speed of light
 const double pi=M_PI; //pi
 
-FoMo::RenderCube nearestneighbourinterpolation(FoMo::GoftCube goftcube, const double l, const double b, const int x_pixel, const int y_pixel, const int z_pixel, const int lambda_pixel, const double lambda_width)
+// This builds the kd-tree, uniform grid or voxel table (depending on options.spatialindex) of a set of points.
+static std::shared_ptr<FoMo::NearestNeighbourIndex> newnearestneighbourindex(const std::vector<float> & x, const std::vector<float> & y, const std::vector<float> & z, const FoMo::RenderOptions & options)
+{
+	std::shared_ptr<FoMo::NearestNeighbourIndex> index=std::make_shared<FoMo::NearestNeighbourIndex>();
+	index->spatialindex=options.spatialindex;
+	index->maxmemory=options.indexmemory;
+	if (options.spatialindex == "kdtree") index->kdtree=FoMo::KDTree(x,y,z);
+	else if (options.spatialindex == "voxel") index->voxels=FoMo::VoxelTable(x,y,z,options.indexmemory);
+	else index->grid=FoMo::UniformGrid(x,y,z);
+	return index;
+}
+
+FoMo::RenderCube nearestneighbourinterpolation(const FoMo::GoftCube & goftcube, const double l, const double b, const int x_pixel, const int y_pixel, const int z_pixel, const int lambda_pixel, const double lambda_width, const FoMo::RenderOptions & options)
 {
 //
 // results is an array of at least dimension (x2-x1+1)*(y2-y1+1)*lambda_pixel and must be initialized to zero
@@ -41,75 +94,140 @@ FoMo::RenderCube nearestneighbourinterpolation(FoMo::GoftCube goftcube, const do
 #else
 	commrank = 0;
 #endif
-	//FoMo::DataCube goftcube=object.datacube;
-	FoMo::tgrid grid = goftcube.readgrid();
 	int ng=goftcube.readngrid();
 	int dim=goftcube.readdim();
 
 	// We will calculate the maximum image coordinates by projecting the grid onto the image plane
 	// Rotate the grid over an angle -l (around z-axis), and -b (around y-axis)
 	// Take the min and max of the resulting coordinates, those are coordinates in the image plane
+	// The grid and variables are not copied, but read through a ColumnReader (which decompresses a compressed goftcube on the fly)
 	if (commrank==0) std::cout << "Rotating coordinates to POS reference... " << std::flush;
-	std::vector<double> xacc, yacc, zacc, losvel;
-	xacc.resize(ng);
-	yacc.resize(ng);
-	zacc.resize(ng);
-	losvel.resize(ng);
-	// Read the physical variables
-	FoMo::tphysvar peakvec=goftcube.readvar(0);//Peak intensity
-	FoMo::tphysvar fwhmvec=goftcube.readvar(1);// line width, =1 for AIA imaging
-	FoMo::tphysvar vx=goftcube.readvar(2);
-	FoMo::tphysvar vy=goftcube.readvar(3);
-	FoMo::tphysvar vz=goftcube.readvar(4);
+	// Define the unit vector along the line-of-sight
+	std::vector<double> unit = {sin(b)*cos(l), -sin(b)*sin(l), cos(b)};
 
 	// initialisations for boost nearest neighbour
 	point boostpoint, targetpoint;
 	value boostpair;
-	std::vector<value> input_values(ng),returned_values;
+	std::vector<value> input_values,returned_values;
+	// the coordinates of the data points, for the kd-tree, the uniform grid and the voxel table
+	std::vector<float> input_x, input_y, input_z;
+	bool usertree=(options.spatialindex == "rtree");
 	box maxdistancebox;
+	double minx=INFINITY, maxx=-INFINITY, miny=INFINITY, maxy=-INFINITY, minz=INFINITY, maxz=-INFINITY;
+
+	// if the index is kept between renderings, look up the spatial index and the mapping of this view
+	std::shared_ptr<FoMo::NearestNeighbourIndex> index;
+	std::shared_ptr<FoMo::NearestNeighbourView> view, newview;
+	std::string viewkey=FoMo::renderviewkey(l,b,x_pixel,y_pixel,z_pixel,options);
+	// the voxel table only finds the nearest points approximately, so that its mappings are kept separately
+	if (options.spatialindex == "voxel") viewkey+="|voxel:"+std::to_string(options.indexmemory);
+	if (options.index)
+	{
+		std::lock_guard<std::mutex> guard(options.index->lock);
+		index=options.index->nearestneighbour;
+		// an index of the other kind is replaced
+		if (index && (index->spatialindex != options.spatialindex || (options.spatialindex == "voxel" && index->maxmemory != options.indexmemory))) index.reset();
+		std::map<std::string, std::shared_ptr<FoMo::NearestNeighbourView> >::const_iterator it=options.index->nearestneighbourviews.find(viewkey);
+		if (it != options.index->nearestneighbourviews.end()) view=it->second;
+	}
+	// the spatial index is only built if it is not kept, the grid is only rotated if the view is not kept
+	if (!index && !view && usertree) input_values.resize(ng);
+	if (!index && !view && !usertree)
+	{
+		input_x.resize(ng);
+		input_y.resize(ng);
+		input_z.resize(ng);
+	}
 
-// No openmp possible here
-// Because of the insertions at the end of the loop, we get segfaults :(
+	if (view)
+	{
+		minx=view->minx;
+		maxx=view->maxx;
+		miny=view->miny;
+		maxy=view->maxy;
+		minz=view->minz;
+		maxz=view->maxz;
+	}
+	else
 #ifdef _OPENMP
-#pragma omp parallel for schedule(dynamic) private (boostpoint, boostpair)
+#pragma omp parallel private (boostpoint, boostpair) reduction(min:minx,miny,minz) reduction(max:maxx,maxy,maxz)
 #endif
-	for (int i=0; i<ng; i++)
-	{
-		std::vector<double> gridpoint;
-		gridpoint.resize(dim);
-		for (int j=0; j<dim; j++)	gridpoint.at(j)=grid[j][i];
-		// if dim==2, then set all z-coordinates to 0.
-		if (dim==2) gridpoint.push_back(0.);
-		xacc.at(i)=gridpoint.at(0)*cos(b)*cos(l)-gridpoint.at(1)*cos(b)*sin(l)-gridpoint.at(2)*sin(b);// rotated grid
-		yacc.at(i)=gridpoint.at(0)*sin(l)+gridpoint.at(1)*cos(l);
-		zacc.at(i)=gridpoint.at(0)*sin(b)*cos(l)-gridpoint.at(1)*sin(b)*sin(l)+gridpoint.at(2)*cos(b);
-		// Define the unit vector along the line-of-sight
-		std::vector<double> unit = {sin(b)*cos(l), -sin(b)*sin(l), cos(b)};
-		std::vector<double> velvec = {vx[i], vy[i], vz[i]};// velocity vector
-		double losvelval = inner_product(unit.begin(),unit.end(),velvec.begin(),0.0);//velocity along line of sight for position [i]/[ng]
-		losvel.at(i)=losvelval;
-
-		// build r-tree from gridpoints, this part is not parallel
-		boostpoint = point(gridpoint.at(0), gridpoint.at(1), gridpoint.at(2));
-		boostpair=std::make_pair(boostpoint,i);
-		input_values.at(i)=boostpair;
+	{
+		std::vector<FoMo::ColumnReader> coordreader;
+		for (int j=0; j<dim; j++) coordreader.push_back(FoMo::ColumnReader(goftcube,j));
+#ifdef _OPENMP
+#pragma omp for
+#endif
+		for (int i=0; i<ng; i++)
+		{
+			std::vector<double> gridpoint;
+			gridpoint.resize(dim);
+			for (int j=0; j<dim; j++)	gridpoint.at(j)=coordreader[j][i];
+			// if dim==2, then set all z-coordinates to 0.
+			if (dim==2) gridpoint.push_back(0.);
+			double xacc=gridpoint.at(0)*cos(b)*cos(l)-gridpoint.at(1)*cos(b)*sin(l)-gridpoint.at(2)*sin(b);// rotated grid
+			double yacc=gridpoint.at(0)*sin(l)+gridpoint.at(1)*cos(l);
+			double zacc=gridpoint.at(0)*sin(b)*cos(l)-gridpoint.at(1)*sin(b)*sin(l)+gridpoint.at(2)*cos(b);
+			minx=std::min(minx,xacc);
+			maxx=std::max(maxx,xacc);
+			miny=std::min(miny,yacc);
+			maxy=std::max(maxy,yacc);
+			minz=std::min(minz,zacc);
+			maxz=std::max(maxz,zacc);
+
+			// collect the points of the kd-tree, uniform grid or voxel table
+			if (!input_x.empty())
+			{
+				input_x[i]=gridpoint.at(0);
+				input_y[i]=gridpoint.at(1);
+				input_z[i]=gridpoint.at(2);
+			}
+			// build r-tree from gridpoints, this part is not parallel
+			if (input_values.empty()) continue;
+			boostpoint = point(gridpoint.at(0), gridpoint.at(1), gridpoint.at(2));
+			boostpair=std::make_pair(boostpoint,i);
+			input_values.at(i)=boostpair;
+		}
 	}
 	if (commrank==0) std::cout << "Done!" << std::endl;
-	if (commrank==0) std::cout << "Building R-tree..." << std::flush;
-	// take an rtree with the quadratic packing algorithm, it takes (slightly) more time to build, but queries are faster for large renderings
-	bgi::rtree< value, bgi::quadratic<16> > rtree(input_values.begin(),input_values.end());
-
-	// compute the bounds of the input data points, so that we can equidistantly distribute the target pixels
-	double minz=*(min_element(zacc.begin(),zacc.end()));
-	double maxz=*(max_element(zacc.begin(),zacc.end()));
-	double minx=*(min_element(xacc.begin(),xacc.end()));
-	double maxx=*(max_element(xacc.begin(),xacc.end()));
-	double miny=*(min_element(yacc.begin(),yacc.end()));
-	double maxy=*(max_element(yacc.begin(),yacc.end()));
-	xacc.clear(); // release the memory
-	yacc.clear();
-	zacc.clear();
-	if (commrank==0) std::cout << "Done!" << std::endl << std::flush;
+	if (view)
+	{
+		if (commrank==0) std::cout << "Reusing the mapping of this view." << std::endl << std::flush;
+	}
+	else if (index)
+	{
+		if (commrank==0) std::cout << "Reusing the " << options.spatialindex << " index." << std::endl << std::flush;
+	}
+	else if (!usertree)
+	{
+		if (commrank==0) std::cout << "Building " << options.spatialindex << " index..." << std::flush;
+		FoMo::ProfileScope scope("index");
+		index=newnearestneighbourindex(input_x,input_y,input_z,options);
+		std::vector<float>().swap(input_x); // release the memory
+		std::vector<float>().swap(input_y);
+		std::vector<float>().swap(input_z);
+		if (commrank==0) std::cout << "Done!" << std::endl << std::flush;
+		if (options.index)
+		{
+			std::lock_guard<std::mutex> guard(options.index->lock);
+			options.index->nearestneighbour=index;
+		}
+	}
+	else
+	{
+		if (commrank==0) std::cout << "Building R-tree..." << std::flush;
+		FoMo::ProfileScope scope("index");
+		index=std::make_shared<FoMo::NearestNeighbourIndex>();
+		index->spatialindex=options.spatialindex;
+		index->tree=rtree(input_values.begin(),input_values.end());
+		std::vector<value>().swap(input_values); // release the memory
+		if (commrank==0) std::cout << "Done!" << std::endl << std::flush;
+		if (options.index)
+		{
+			std::lock_guard<std::mutex> guard(options.index->lock);
+			options.index->nearestneighbour=index;
+		}
+	}
 
 	std::string chiantifile=goftcube.readchiantifile();
 	double lambda0=goftcube.readlambda0();// lambda0=AIA bandpass for AIA imaging
@@ -119,13 +237,40 @@ FoMo::RenderCube nearestneighbourinterpolation(FoMo::GoftCube goftcube, const do
 	double x,y,z,intpolpeak,intpolfwhm,intpollosvel,lambdaval,tempintens;
 	int ind;
 
-	//initialize grids
-	FoMo::tgrid newgrid;
-	FoMo::tcoord xvec(x_pixel*y_pixel*lambda_pixel),yvec(x_pixel*y_pixel*lambda_pixel),lambdavec(x_pixel*y_pixel*lambda_pixel);
-	newgrid.push_back(xvec);
-	newgrid.push_back(yvec);
-	if (lambda_pixel > 1) newgrid.push_back(lambdavec);
-	FoMo::tphysvar intens(x_pixel*y_pixel*lambda_pixel,0);
+	// a sparse spectrum is only useful for spectroscopic renderings
+	bool sparse=options.sparse && (lambda_pixel > 1);
+	// only the pixels in the region of interest are rendered
+	int x0, nx, y0, ny;
+	FoMo::regionofinterest(options,x_pixel,y_pixel,x0,nx,y0,ny);
+	// the mapping of this view is recorded if the index is kept
+	if (options.index && options.index->keepviews && !view)
+	{
+		newview=std::make_shared<FoMo::NearestNeighbourView>();
+		newview->minx=minx;
+		newview->maxx=maxx;
+		newview->miny=miny;
+		newview->maxy=maxy;
+		newview->minz=minz;
+		newview->maxz=maxz;
+	}
+	// the runs of every ray, which are packed into newview after the rendering
+	std::vector<std::vector<std::pair<int,int> > > rayruns;
+	if (newview) rayruns.resize(nx*ny);
+	// the image is stored on regular axes, so that only the intensity is written per pixel
+	FoMo::tphysvar intens;
+	// for a sparse rendering, only the bins with emission are stored per ray, and packed after the rendering
+	std::vector<int> firstbin, bincount;
+	std::vector<FoMo::tphysvar> rayspectra;
+	if (sparse)
+	{
+		firstbin.resize(nx*ny,0);
+		bincount.resize(nx*ny,0);
+		rayspectra.resize(nx*ny);
+	}
+	else
+	{
+		intens.resize(nx*ny*lambda_pixel,0);
+	}
 
 	// maxdistance is the furthest distance between a grid point and a simulation point at which the emission is interpolated
 	// it is computed as the half diagonal of the rectangle around this ray, with the sides equal to the x and y distance between rays
@@ -138,25 +283,114 @@ FoMo::RenderCube nearestneighbourinterpolation(FoMo::GoftCube goftcube, const do
 	maxdistance = std::max((maxx-minx)/(x_pixel-1),(maxy-miny)/(y_pixel-1))/.3;
 	if ((maxx-minx)/std::pow(ng,1./3.)>maxdistance || (maxy-miny)/std::pow(ng,1./3.)>maxdistance) std::cout << std::endl << "Warning: maximum distance to interpolated point set to " << maxdistance << "Mm. If it is too small, you have too many interpolating rays and you will have dark stripes in the image plane. Reduce x-resolution or y-resolution." << std::endl;
 
-	boost::progress_display show_progress(x_pixel*y_pixel*z_pixel);
+	// the statistics of the rays (see FoMo::RayStatistics): every ray has z_pixel samples
+	bool statistics=options.raystatistics;
+	std::vector<int> rayempty, raydistinct;
+	std::vector<unsigned char> pointhit;
+	if (statistics)
+	{
+		rayempty.resize(nx*ny,0);
+		raydistinct.resize(nx*ny,0);
+		pointhit.resize(ng,0);
+	}
+
+	boost::progress_display show_progress(nx*ny*z_pixel);
+	bool usekdtree=(index && index->spatialindex == "kdtree");
+	bool usegrid=(index && index->spatialindex == "grid");
+	bool usevoxels=(index && index->spatialindex == "voxel");
 	double deltaz=(maxz-minz);
 	if (z_pixel != 1) deltaz/=(z_pixel-1);
 
 #ifdef _OPENMP
-#pragma omp parallel for schedule(dynamic) collapse(2) shared (rtree) private (x,y,z,intpolpeak,intpolfwhm,intpollosvel,lambdaval,tempintens,ind,returned_values,targetpoint,maxdistancebox)
+#pragma omp parallel shared (index,view,newview,rayruns) private (x,y,z,intpolpeak,intpolfwhm,intpollosvel,lambdaval,tempintens,ind,returned_values,targetpoint,maxdistancebox)
 #endif
-	for (int i=0; i<y_pixel; i++)
-		for (int j=0; j<x_pixel; j++)
+	{
+	FoMo::ProfileScope scope("render");
+	// Read the physical variables
+	FoMo::ColumnReader peakvec=FoMo::rendercolumn(goftcube,dim,options);//Peak intensity
+	FoMo::ColumnReader fwhmvec=FoMo::rendercolumn(goftcube,dim+1,options);// line width, =1 for AIA imaging
+	std::vector<FoMo::ColumnReader> velreader=FoMo::velocitycolumns(goftcube,lambda_pixel,options);
+	// the lines that are blended into the spectral window, if any
+	const std::vector<FoMo::BlendedLine> * blend=(options.blend && lambda_pixel>1) ? options.blend.get() : NULL;
+	// the spectrum along the current ray is accumulated here, and only copied to the output when the ray is finished
+	FoMo::tphysvar rayspectrum(lambda_pixel);
+	// the data points sampled by the current ray, and its number of samples with a data point, for the statistics
+	std::vector<int> raypoints;
+	int nfilled;
+	// this adds the emission of the data point nearestindex (nothing if it is -1) to the spectrum of the ray, for repeat 
+	// consecutive samples, in the same order as sample by sample
+	auto addsamples = [&](const int nearestindex, const int repeat)
+	{
+		if (nearestindex >= 0)
+		{
+			intpolpeak=peakvec[nearestindex];
+			intpolfwhm=fwhmvec[nearestindex];
+			//velocity along line of sight for position [i]/[ng]
+			intpollosvel=0;
+			for (unsigned int c=0; c<velreader.size(); c++) intpollosvel+=unit[c]*velreader[c][nearestindex];
+		}
+		else
+		{
+			intpolpeak=0;
+		}
+
+		if (lambda_pixel>1)// spectroscopic study
+		{
+			for (int il=0; il<lambda_pixel; il++) // changed index from global variable l into il [D.Y. 17 Nov 2014]
+			{
+				// lambda the relative wavelength around lambda0, with a width of lambda_width
+				lambdaval=double(il)/(lambda_pixel-1)*lambda_width_in_A-lambda_width_in_A/2.;
+				// here a ternary operator may be used
+				// if intpolpeak is not zero then the correct expression is used. otherwise, the intensity is just 0
+				// it remains to be tested if this is faster than just the direct computation
+				tempintens=intpolpeak ? intpolpeak*exp(-pow(lambdaval-intpollosvel/speedoflight*lambda0,2)/pow(intpolfwhm,2)*4.*log(2.)) : 0; // Uncommented this line by Vaibhav pant on 22 Nov, 2018. tempintens as defined below was giving NAN values for odd wavelength bins.
+
+				//tempintens=intpolpeak*exp(-pow(lambdaval-intpollosvel/speedoflight*lambda0,2)/pow(intpolfwhm,2)*4.*log(2.));
+				// the blended lines are added on the same wavelength axis, in the same traversal of the ray
+				if (blend && nearestindex >= 0) tempintens+=FoMo::blendedintensity(*blend,nearestindex,lambdaval,intpollosvel/speedoflight,lambda0);
+
+				for (int r=0; r<repeat; r++) rayspectrum[il]+=tempintens;// loop over z and lambda [D.Y 17 Nov 2014]
+			}
+		}
+
+		if (lambda_pixel==1) // AIA imaging study
+		{
+			tempintens=intpolpeak;
+			for (int r=0; r<repeat; r++) rayspectrum[0]+=tempintens;// loop over z and lambda [D.Y 17 Nov 2014]
+		}
+	};
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic) collapse(2)
+#endif
+	for (int i=y0; i<y0+ny; i++)
+		for (int j=x0; j<x0+nx; j++)
 		{
 			// now we're on one ray, through point with coordinates in the image plane
 			x = double(j)/(x_pixel-1)*(maxx-minx)+minx;
 			y = double(i)/(y_pixel-1)*(maxy-miny)+miny;
+			int ray=(i-y0)*nx+j-x0;
 
 			std::vector<double> p;
+			std::fill(rayspectrum.begin(),rayspectrum.end(),0);
+			raypoints.clear();
+			nfilled=0;
 
-			#ifdef _OPENMP
-			#pragma omp task
-			#endif
+			if (view)
+			{
+				// the nearest points along this ray are known from a previous rendering
+				for (int r=view->rayoffset[ray]; r<view->rayoffset[ray+1]; r++)
+				{
+					addsamples(view->runpoint[r],view->runcount[r]);
+					if (statistics)
+					{
+						raypoints.push_back(view->runpoint[r]);
+						nfilled+=view->runcount[r];
+					}
+				}
+				// print progress
+				show_progress+=z_pixel;
+			}
+			else
 			for (int k=0; k<z_pixel; k++) // scanning through ccd
 			{
 				z = double(k)*deltaz+minz;
@@ -178,60 +412,104 @@ FoMo::RenderCube nearestneighbourinterpolation(FoMo::GoftCube goftcube, const do
 				// it seems the expression above is the culprit for simulations with very stretched grids producing striped emissions, let's make the box of size maxdistance
 				maxdistancebox=box(point(p.at(0)-maxdistance,p.at(1)-maxdistance,p.at(2)-maxdistance),point(p.at(0)+maxdistance,p.at(1)+maxdistance,p.at(2)+maxdistance));
 				//numberofpoints=
-				rtree.query(bgi::nearest(targetpoint, 1) && bgi::within(maxdistancebox), std::back_inserter(returned_values));
-
-				if (returned_values.size() >= 1)
-				{
-					nearestindex=returned_values.at(0).second;
-					intpolpeak=peakvec.at(nearestindex);
-					intpolfwhm=fwhmvec.at(nearestindex);
-					intpollosvel=losvel.at(nearestindex);
-				}
+				// the kd-tree and the uniform grid search the same box, without allocating the result, 
+				// the voxel table only checks if the point of the voxel of the sample is in that box
+				if (usekdtree)
+					nearestindex=index->kdtree.nearest(p.at(0),p.at(1),p.at(2),maxdistance);
+				else if (usegrid)
+					nearestindex=index->grid.nearest(p.at(0),p.at(1),p.at(2),maxdistance);
+				else if (usevoxels)
+					nearestindex=index->voxels.nearest(p.at(0),p.at(1),p.at(2),maxdistance);
 				else
 				{
-					intpolpeak=0;
+					index->tree.query(bgi::nearest(targetpoint, 1) && bgi::within(maxdistancebox), std::back_inserter(returned_values));
+					if (returned_values.size() >= 1) nearestindex=returned_values.at(0).second;
 				}
-
-				if (lambda_pixel>1)// spectroscopic study
+				addsamples(nearestindex,1);
+				if (statistics && nearestindex >= 0)
 				{
-					for (int il=0; il<lambda_pixel; il++) // changed index from global variable l into il [D.Y. 17 Nov 2014]
-					{
-						// lambda the relative wavelength around lambda0, with a width of lambda_width
-						lambdaval=double(il)/(lambda_pixel-1)*lambda_width_in_A-lambda_width_in_A/2.;
-						// here a ternary operator may be used
-						// if intpolpeak is not zero then the correct expression is used. otherwise, the intensity is just 0
-						// it remains to be tested if this is faster than just the direct computation
-						tempintens=intpolpeak ? intpolpeak*exp(-pow(lambdaval-intpollosvel/speedoflight*lambda0,2)/pow(intpolfwhm,2)*4.*log(2.)) : 0; // Uncommented this line by Vaibhav pant on 22 Nov, 2018. tempintens as defined below was giving NAN values for odd wavelength bins.
-
-						//tempintens=intpolpeak*exp(-pow(lambdaval-intpollosvel/speedoflight*lambda0,2)/pow(intpolfwhm,2)*4.*log(2.));
-
-						ind=(i*(x_pixel)+j)*lambda_pixel+il;//
-						newgrid.at(0).at(ind)=x;
-						newgrid.at(1).at(ind)=y;
-						newgrid.at(2).at(ind)=lambdaval+lambda0; // store the full wavelength
-						// this is critical, but with tasks, the ind is unique for each task, and no collision should occur
-						intens.at(ind)+=tempintens;// loop over z and lambda [D.Y 17 Nov 2014]
-					}
+					if (raypoints.empty() || raypoints.back() != nearestindex) raypoints.push_back(nearestindex);
+					nfilled++;
 				}
-			
-				if (lambda_pixel==1) // AIA imaging study
+
+				// record the mapping of this view: samples without a nearest point do not contribute, 
+				// and consecutive samples with the same nearest point are merged into one run
+				if (newview && nearestindex >= 0)
 				{
-					tempintens=intpolpeak;
-					ind=(i*x_pixel+j);
-					newgrid.at(0).at(ind)=x;
-					newgrid.at(1).at(ind)=y;
-					// this is critical, but with tasks, the ind is unique for each task, and no collision should occur
-					intens.at(ind)+=tempintens;// loop over z and lambda [D.Y 17 Nov 2014]
+					std::vector<std::pair<int,int> > & runs=rayruns[ray];
+					if (!runs.empty() && runs.back().first == nearestindex)
+						runs.back().second++;
+					else
+						runs.push_back(std::make_pair(nearestindex,1));
 				}
 
 			// print progress
 				++show_progress;
 			}
+
+			// the ray is done: store its statistics and its spectrum
+			if (statistics)
+			{
+				rayempty[ray]=z_pixel-nfilled;
+				std::sort(raypoints.begin(),raypoints.end());
+				raypoints.erase(std::unique(raypoints.begin(),raypoints.end()),raypoints.end());
+				raydistinct[ray]=raypoints.size();
+				for (unsigned int k=0; k<raypoints.size(); k++)
+				{
+#ifdef _OPENMP
+#pragma omp atomic write
+#endif
+					pointhit[raypoints[k]]=1;
+				}
+			}
+			// every ray has its own pixel, so that no collision between threads can occur
+			if (sparse)
+			{
+				// keep the bins between the first and last bin above the threshold
+				float threshold=options.sparsethreshold*(*std::max_element(rayspectrum.begin(),rayspectrum.end()));
+				int first=0, last=lambda_pixel-1;
+				while (first<lambda_pixel && !(rayspectrum[first]>threshold)) first++;
+				while (last>=first && !(rayspectrum[last]>threshold)) last--;
+				ind=(i-y0)*nx+j-x0;
+				if (last>=first)
+				{
+					firstbin[ind]=first;
+					bincount[ind]=last-first+1;
+					rayspectra[ind].assign(rayspectrum.begin()+first,rayspectrum.begin()+last+1);
+				}
+			}
+			else
+			{
+				std::copy(rayspectrum.begin(),rayspectrum.end(),intens.begin()+ray*lambda_pixel);
+			}
 		}
+	}
 	if (commrank==0) std::cout << " Done! " << std::endl << std::flush;
+	if (newview)
+	{
+		newview->rayoffset.resize(nx*ny+1);
+		newview->rayoffset[0]=0;
+		for (int r=0; r<nx*ny; r++) newview->rayoffset[r+1]=newview->rayoffset[r]+rayruns[r].size();
+		newview->runpoint.reserve(newview->rayoffset.back());
+		newview->runcount.reserve(newview->rayoffset.back());
+		for (int r=0; r<nx*ny; r++)
+		{
+			for (unsigned int k=0; k<rayruns[r].size(); k++)
+			{
+				newview->runpoint.push_back(rayruns[r][k].first);
+				newview->runcount.push_back(rayruns[r][k].second);
+			}
+			std::vector<std::pair<int,int> >().swap(rayruns[r]);
+		}
+		std::lock_guard<std::mutex> guard(options.index->lock);
+		options.index->nearestneighbourviews[viewkey]=newview;
+	}
 
 	FoMo::RenderCube rendercube(goftcube);
-	FoMo::tvars newdata;
+	// the regular axes of the image, the wavelength axis stores the full wavelength
+	// an imaging rendering has a single wavelength pixel, and no wavelength step
+	std::vector<double> step={(maxx-minx)/(x_pixel-1),(maxy-miny)/(y_pixel-1),(lambda_pixel > 1) ? lambda_width_in_A/(lambda_pixel-1) : 0.};
+	std::vector<double> origin={minx+x0*step[0],miny+y0*step[1],lambda0-lambda_width_in_A/2.};
 	double pathlength=(maxz-minz)/(z_pixel-1);
 	// this does not work if only one z_pixel is given (e.g. for a 2D simulation), or the maxz and minz are equal (face-on on 2D simulation)
 	// assume that the thickness of the slab is 1Mm.
@@ -251,24 +529,79 @@ FoMo::RenderCube nearestneighbourinterpolation(FoMo::GoftCube goftcube, const do
 	unitvec.push_back("erg cm^{-2} s^{-1} \\AA{}^{-1}");
 	// check if the units of emissivity contain DN: then we are dealing with an instrument, and spatial units should be converted to arcsec, 
 	// intensity should be rescaled to pixel size
-	std::size_t found = goftcube.readunit().at(dim).find("DN");
+	std::size_t found = FoMo::emissionunit(goftcube,options).find("DN");
 	if (found!=std::string::npos)
 	{
 		unitvec.at(0)="arcsec";
-		newgrid.at(0)=FoMo::operator*(1./Mmperarcsec,newgrid.at(0));
 		unitvec.at(1)="arcsec";
-		newgrid.at(1)=FoMo::operator*(1./Mmperarcsec,newgrid.at(1));
+		for (int i=0; i<2; i++)
+		{
+			origin.at(i)/=Mmperarcsec;
+			step.at(i)/=Mmperarcsec;
+		}
 		float dx=(maxx-minx)/(x_pixel-1),dy=(maxy-miny)/(y_pixel-1); // are given in Mm
 		apix = (dx/Mmperarcsec)*(dy/Mmperarcsec)*pow(pi/180./3600.,2); 
 		std::cout << "apix" << apix << "dx" << dx << "dy" << dy;
 		unitvec.back()="DN s^{-1} pixel^{-1}"; // this could be improved using Boost::units, making everything automatic, including compiler checks
 	}
 	
-	intens=FoMo::operator*(pathlength*1e8*apix,intens); // assume that the coordinates in goftcube are given in Mm, and convert to cm
-	newdata.push_back(intens);
-	rendercube.setdata(newgrid,newdata,&unitvec);
+	if (sparse)
+	{
+		// pack the spectra of all rays one after the other
+		FoMo::tphysvar values;
+		values.reserve(std::accumulate(bincount.begin(),bincount.end(),size_t(0)));
+		for (int i=0; i<nx*ny; i++)
+		{
+			values.insert(values.end(),rayspectra[i].begin(),rayspectra[i].end());
+			FoMo::tphysvar().swap(rayspectra[i]);
+		}
+		values=FoMo::operator*(pathlength*1e8*apix,values); // assume that the coordinates in goftcube are given in Mm, and convert to cm
+		std::vector<int> count={nx,ny,lambda_pixel};
+		rendercube.setsparsedata(count,origin,step,firstbin,bincount,values,&unitvec);
+	}
+	else
+	{
+		intens=FoMo::operator*(pathlength*1e8*apix,intens); // assume that the coordinates in goftcube are given in Mm, and convert to cm
+		std::vector<int> count={nx,ny};
+		if (lambda_pixel > 1) count.push_back(lambda_pixel);
+		rendercube.setregulardata(count,origin,step,intens,&unitvec);
+	}
 	rendercube.setrendermethod("NearestNeighbour");
-	rendercube.setresolution(x_pixel,y_pixel,z_pixel,lambda_pixel,lambda_width);
+	rendercube.setresolution(nx,ny,z_pixel,lambda_pixel,lambda_width);
+	if (statistics)
+	{
+		// the maps per ray, at the coordinates of the rays in Mm
+		FoMo::RayStatistics raystatistics;
+		FoMo::tgrid grid(2,FoMo::tphysvar(nx*ny));
+		FoMo::tvars vars(4,FoMo::tphysvar(nx*ny));
+		for (int i=0; i<ny; i++)
+			for (int j=0; j<nx; j++)
+			{
+				int ray=i*nx+j;
+				grid[0][ray]=double(x0+j)/(x_pixel-1)*(maxx-minx)+minx;
+				grid[1][ray]=double(y0+i)/(y_pixel-1)*(maxy-miny)+miny;
+				vars[0][ray]=z_pixel;
+				vars[1][ray]=rayempty[ray];
+				vars[2][ray]=raydistinct[ray];
+				vars[3][ray]=double(rayempty[ray])/z_pixel;
+				raystatistics.nempty+=rayempty[ray];
+			}
+		std::vector<std::string> statunits={"Mm","Mm","samples","samples","points",""};
+		raystatistics.maps.setdata(grid,vars,&statunits);
+		raystatistics.maps.setwriteoptions(rendercube.getwriteoptions());
+		raystatistics.nsamples=long(nx)*ny*z_pixel;
+		raystatistics.npoints=ng;
+		raystatistics.nhit=std::count(pointhit.begin(),pointhit.end(),1);
+		raystatistics.maxdistance=maxdistance;
+		rendercube.setraystatistics(raystatistics);
+		if (commrank==0)
+		{
+			std::cout << "Ray statistics: " << raystatistics.nempty << " of " << raystatistics.nsamples << " samples (";
+			std::cout << 100.*raystatistics.nempty/raystatistics.nsamples << "%) have no data point within " << maxdistance << "Mm, ";
+			std::cout << raystatistics.nhit << " of " << ng << " data points (" << 100.*raystatistics.nhit/ng << "%) are sampled, ";
+			std::cout << double(std::accumulate(raydistinct.begin(),raydistinct.end(),0L))/(nx*ny) << " data points per ray." << std::endl << std::flush;
+		}
+	}
 	if (lambda_pixel == 1)
 	{
 		rendercube.setobservationtype(FoMo::Imaging);
@@ -282,26 +615,197 @@ FoMo::RenderCube nearestneighbourinterpolation(FoMo::GoftCube goftcube, const do
 
 namespace FoMo
 {
-	FoMo::RenderCube RenderWithNearestNeighbour(FoMo::GoftCube goftcube, const int x_pixel, const int y_pixel, const int z_pixel, const int lambda_pixel, const double lambda_width,
-	std::vector<double> lvec, std::vector<double> bvec, std::string outfile)
+	FoMo::RenderCube RenderWithNearestNeighbour(const FoMo::GoftCube & goftcube, const int x_pixel, const int y_pixel, const int z_pixel, const int lambda_pixel, const double lambda_width,
+	std::vector<double> lvec, std::vector<double> bvec, std::string outfile, const FoMo::RenderOptions & options)
 	{
 		FoMo::RenderCube rendercube(goftcube);
+		if (options.index) FoMo::checkrenderindex(*options.index,goftcube);
 		for (std::vector<double>::iterator lit=lvec.begin(); lit!=lvec.end(); ++lit)
 			for (std::vector<double>::iterator bit=bvec.begin(); bit!=bvec.end(); ++bit)
 			{
-				rendercube=nearestneighbourinterpolation(goftcube,*lit,*bit, x_pixel, y_pixel, z_pixel, lambda_pixel, lambda_width);
+				rendercube=nearestneighbourinterpolation(goftcube,*lit,*bit, x_pixel, y_pixel, z_pixel, lambda_pixel, lambda_width, options);
 				rendercube.setangles(*lit,*bit);
-				std::stringstream ss;
 				// if outfile is "", then this should not be executed.
-				ss << outfile;
-				ss << "l";
-				ss << std::setfill('0') << std::setw(3) << std::round(*lit/pi*180.);
-				ss << "b";
-				ss << std::setfill('0') << std::setw(3) << std::round(*bit/pi*180.);
-				ss << ".txt";
-				rendercube.writegoftcube(ss.str());
-				ss.str("");
+				std::string filename=FoMo::renderfilename(outfile,"NearestNeighbour",*lit,*bit);
+				if (options.write) rendercube.writegoftcube(filename,true);
+				// the maps of the ray statistics are written next to the rendering
+				if (options.write && rendercube.hasraystatistics())
+				{
+					FoMo::GoftCube maps=rendercube.readraystatistics().maps;
+					maps.writegoftcube(filename.substr(0,filename.size()-4)+"raystatistics.txt",true);
+				}
 			}
 		return rendercube;
 	}
 }
+
+/**
+ * @brief This builds the spatial index of the NearestNeighbour rendermethod in a RenderIndex, if it is not there yet.
+ * 
+ * Only the pointer-free indexes ("kdtree", "grid" and "voxel") can be built in advance, since they are the ones 
+ * that can be placed in shared memory with layoutnearestneighbourindex(). The RenderIndex should have been checked 
+ * against the grid with checkrenderindex() before.
+ * @param index The RenderIndex in which the spatial index is stored.
+ * @param goftcube The goftcube of which the grid is indexed.
+ * @param options The render options, with the kind of spatial index.
+ * @return True if the spatial index has been built, false if the RenderIndex already contained it.
+ */
+bool FoMo::buildnearestneighbourindex(FoMo::RenderIndex & index, const FoMo::GoftCube & goftcube, const FoMo::RenderOptions & options)
+{
+	if (options.spatialindex == "rtree")
+	{
+		std::cerr << "Error: the R-tree cannot be built in advance, use another spatial index." << std::endl << std::flush;
+		exit(EXIT_FAILURE);
+	}
+	{
+		std::lock_guard<std::mutex> guard(index.lock);
+		std::shared_ptr<FoMo::NearestNeighbourIndex> current=index.nearestneighbour;
+		if (current && current->spatialindex == options.spatialindex && (options.spatialindex != "voxel" || current->maxmemory == options.indexmemory)) return false;
+	}
+	FoMo::ProfileScope scope("index");
+	int ng=goftcube.readngrid();
+	int dim=goftcube.readdim();
+	std::vector<float> x(ng), y(ng), z(ng,0.);
+	std::vector<float> * coord[3]={&x,&y,&z};
+	for (int j=0; j<std::min(dim,3); j++)
+	{
+		FoMo::ColumnReader reader(goftcube,j);
+		for (int i=0; i<ng; i++) (*coord[j])[i]=reader[i];
+	}
+	std::shared_ptr<FoMo::NearestNeighbourIndex> built=newnearestneighbourindex(x,y,z,options);
+	std::lock_guard<std::mutex> guard(index.lock);
+	index.nearestneighbour=built;
+	return true;
+}
+
+/**
+ * @brief This passes the spatial index of the NearestNeighbour rendermethod in a RenderIndex to a SharedLayout.
+ * 
+ * If the RenderIndex does not contain a spatial index of the kind of options.spatialindex, one is created for the 
+ * Attach pass, and nothing is done for the other passes. The R-tree is not supported, since it consists of pointers.
+ * @param index The RenderIndex with the spatial index.
+ * @param memory The SharedLayout.
+ * @param options The render options, with the kind of spatial index.
+ */
+void FoMo::layoutnearestneighbourindex(FoMo::RenderIndex & index, FoMo::SharedLayout & memory, const FoMo::RenderOptions & options)
+{
+	std::lock_guard<std::mutex> guard(index.lock);
+	std::shared_ptr<FoMo::NearestNeighbourIndex> current=index.nearestneighbour;
+	if (!current || current->spatialindex != options.spatialindex)
+	{
+		if (memory.readpass() != FoMo::SharedLayout::Attach) return;
+		current=std::make_shared<FoMo::NearestNeighbourIndex>();
+		current->spatialindex=options.spatialindex;
+		current->maxmemory=options.indexmemory;
+		index.nearestneighbour=current;
+	}
+	if (current->spatialindex == "kdtree") current->kdtree.layout(memory);
+	else if (current->spatialindex == "grid") current->grid.layout(memory);
+	else if (current->spatialindex == "voxel") current->voxels.layout(memory);
+	else
+	{
+		std::cerr << "Error: the " << current->spatialindex << " spatial index cannot be placed in shared memory." << std::endl << std::flush;
+		exit(EXIT_FAILURE);
+	}
+}
+
+// the first bytes of a file with view mappings, followed by the version of the format
+const char viewmappingsmagic[8]={'F','o','M','o','N','N','V','1'};
+
+/**
+ * @brief This writes the NearestNeighbour view mappings of a RenderIndex to a binary file.
+ * 
+ * The file contains the hash of the grid, and for every view its key, bounds and runs.
+ * @param index The RenderIndex of which the views are written.
+ * @param filename The file to which the views are written.
+ */
+void FoMo::writenearestneighbourviews(FoMo::RenderIndex & index, const std::string filename)
+{
+	std::ofstream out(filename,std::ios::binary);
+	if (!out)
+	{
+		std::cerr << "Error: could not open " << filename << " for writing." << std::endl;
+		exit(EXIT_FAILURE);
+	}
+	std::lock_guard<std::mutex> guard(index.lock);
+	uint64_t nviews=index.nearestneighbourviews.size();
+	out.write(viewmappingsmagic,sizeof(viewmappingsmagic));
+	out.write(reinterpret_cast<const char *>(&index.gridhash),sizeof(index.gridhash));
+	out.write(reinterpret_cast<const char *>(&nviews),sizeof(nviews));
+	for (auto it=index.nearestneighbourviews.begin(); it!=index.nearestneighbourviews.end(); ++it)
+	{
+		const FoMo::NearestNeighbourView & view=*it->second;
+		uint64_t sizes[3]={it->first.size(),view.rayoffset.size(),view.runpoint.size()};
+		double bounds[6]={view.minx,view.maxx,view.miny,view.maxy,view.minz,view.maxz};
+		out.write(reinterpret_cast<const char *>(sizes),sizeof(sizes));
+		out.write(it->first.data(),sizes[0]);
+		out.write(reinterpret_cast<const char *>(bounds),sizeof(bounds));
+		out.write(reinterpret_cast<const char *>(view.rayoffset.data()),sizes[1]*sizeof(int));
+		out.write(reinterpret_cast<const char *>(view.runpoint.data()),sizes[2]*sizeof(int));
+		out.write(reinterpret_cast<const char *>(view.runcount.data()),sizes[2]*sizeof(int));
+	}
+	if (!out)
+	{
+		std::cerr << "Error: could not write the view mappings to " << filename << "." << std::endl;
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * @brief This reads NearestNeighbour view mappings written with writenearestneighbourviews() into a RenderIndex.
+ * 
+ * If the RenderIndex belongs to another grid, its contents are discarded first. Afterwards, the RenderIndex 
+ * belongs to the grid of the file, which is checked by checkrenderindex() at the next rendering.
+ * @param index The RenderIndex to which the views are added.
+ * @param filename The file with the views.
+ * @return False if the file could not be read, or is not a file with view mappings.
+ */
+bool FoMo::readnearestneighbourviews(FoMo::RenderIndex & index, const std::string filename)
+{
+	std::ifstream in(filename,std::ios::binary);
+	char magic[sizeof(viewmappingsmagic)];
+	uint64_t gridhash, nviews;
+	in.read(magic,sizeof(magic));
+	in.read(reinterpret_cast<char *>(&gridhash),sizeof(gridhash));
+	in.read(reinterpret_cast<char *>(&nviews),sizeof(nviews));
+	if (!in || !std::equal(magic,magic+sizeof(magic),viewmappingsmagic)) return false;
+	std::map<std::string, std::shared_ptr<FoMo::NearestNeighbourView> > views;
+	for (uint64_t v=0; v<nviews; v++)
+	{
+		uint64_t sizes[3];
+		double bounds[6];
+		in.read(reinterpret_cast<char *>(sizes),sizeof(sizes));
+		if (!in) return false;
+		std::string key(sizes[0],' ');
+		std::shared_ptr<FoMo::NearestNeighbourView> view=std::make_shared<FoMo::NearestNeighbourView>();
+		view->rayoffset.resize(sizes[1]);
+		view->runpoint.resize(sizes[2]);
+		view->runcount.resize(sizes[2]);
+		in.read(&key[0],sizes[0]);
+		in.read(reinterpret_cast<char *>(bounds),sizeof(bounds));
+		in.read(reinterpret_cast<char *>(view->rayoffset.data()),sizes[1]*sizeof(int));
+		in.read(reinterpret_cast<char *>(view->runpoint.data()),sizes[2]*sizeof(int));
+		in.read(reinterpret_cast<char *>(view->runcount.data()),sizes[2]*sizeof(int));
+		if (!in || sizes[1] == 0 || uint64_t(view->rayoffset.back()) != sizes[2]) return false;
+		view->minx=bounds[0];
+		view->maxx=bounds[1];
+		view->miny=bounds[2];
+		view->maxy=bounds[3];
+		view->minz=bounds[4];
+		view->maxz=bounds[5];
+		views[key]=view;
+	}
+	
+	std::lock_guard<std::mutex> guard(index.lock);
+	if (!index.gridknown || index.gridhash != gridhash)
+	{
+		index.nearestneighbour.reset();
+		index.nearestneighbourviews.clear();
+		index.projectionviews.clear();
+		index.cgal.reset();
+		index.gridhash=gridhash;
+		index.gridknown=true;
+	}
+	for (auto it=views.begin(); it!=views.end(); ++it) index.nearestneighbourviews[it->first]=it->second;
+	return true;
+}
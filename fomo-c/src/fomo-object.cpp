@@ -3,6 +3,12 @@
 #include "FoMo-internal.h"
 #include <map>
 #include <iostream>
+#include <utility>
+#include <sstream>
+#include <iomanip>
+#include <cmath>
+
+const double pi=M_PI; //pi
 
 /**
  * @brief This member is the constructor of the FoMoObject.
@@ -14,7 +20,7 @@
  * @param indim The integer indim sets the dimension of the datacube. It defaults to 3.
  */
 FoMo::FoMoObject::FoMoObject(const int indim):
-	datacube(indim), goftcube(datacube), rendering(goftcube)
+	datacube(indim), goftcube(datacube), rendering(goftcube), compression(false), sparsespectra(false), sparsethreshold(0), datahash(0), datahashknown(false), slabdepth(1.), spatialindex("rtree"), indexmemory(1e9), lazyemission(false), raystatistics(false), automethod(false), autotolerance(0.01)
 {
 }
 
@@ -31,11 +37,14 @@ FoMo::FoMoObject::~FoMoObject()
  * Use this method to set the rendermethod. At the moment (version 3.3), there 
  * are three rendermethods: "CGAL", "CGAL2D" and "NearestNeighbour".
  * It should be read before the render() is called, because that used the information here.
+ * With "auto", render() chooses the rendermethod and the spatial index itself, see autotune(). The 
+ * rendering then records the rendermethod that was used.
  * @param inrendermethod The function takes a string as an argument, which is 
  * then internally connected to a rendermethod.
  */
 void FoMo::FoMoObject::setrendermethod(const std::string inrendermethod)
 {
+	automethod=(inrendermethod == "auto");
 	rendering.setrendermethod(inrendermethod);
 }
 
@@ -47,6 +56,7 @@ The function returns the string for the rendermethod that is currently set in th
  */
 std::string FoMo::FoMoObject::readrendermethod()
 {
+	if (automethod) return "auto";
 	return rendering.readrendermethod();
 }
 
@@ -66,7 +76,8 @@ FoMo::DataCube FoMo::FoMoObject::readdatacube()
  * 
  * FoMoObject.goftcube is a private member, thus its access can only be done through this function.
  * @return The return value is the goftcube of the FoMoObject and is of type GoftCube. It contains the calculated
- * emission at each datapoint of the original mesh.
+ * emission at each datapoint of the original mesh. If the emission is computed lazily (see setlazyemission()), it 
+ * only contains the grid.
  */
 FoMo::GoftCube FoMo::FoMoObject::readgoftcube()
 {
@@ -138,6 +149,8 @@ std::string FoMo::FoMoObject::readchiantifile()
 void FoMo::FoMoObject::push_back_datapoint(std::vector<double> coordinate, std::vector<double> variables, std::vector<std::string> * unitvec)
 {
 	this->datacube.push_back(coordinate,variables,unitvec);
+	emissionkey.clear();
+	datahashknown=false;
 }
 
 /**
@@ -152,6 +165,457 @@ void FoMo::FoMoObject::push_back_datapoint(std::vector<double> coordinate, std::
 void FoMo::FoMoObject::setdata(tgrid& ingrid, tvars& indata, std::vector<std::string> * unitvec)
 {
 	this->datacube.setdata(ingrid,indata,unitvec);
+	emissionkey.clear();
+	datahashknown=false;
+}
+
+/**
+ * @brief This sets the data of the FoMoObject without copying it, see DataCube::swapdata().
+ * 
+ * The columns of ingrid and indata are taken over, and contain the previous data of the FoMoObject afterwards.
+ * @param ingrid The grid to be imported.
+ * @param indata The data to be imported.
+ * @param unitvec If not NULL, the units of the grid and the variables.
+ */
+void FoMo::FoMoObject::swapdata(tgrid& ingrid, tvars& indata, std::vector<std::string> * unitvec)
+{
+	this->datacube.swapdata(ingrid,indata,unitvec);
+	emissionkey.clear();
+	datahashknown=false;
+}
+
+/**
+ * @brief This lets the FoMoObject read its data from columns in memory of someone else, see DataCube::setshared().
+ * 
+ * The columns are not copied (e.g. the arrays of the Python module), and should stay valid and unchanged as long 
+ * as the FoMoObject uses them. They are copied before the data is modified, e.g. by mortonsort().
+ * @param ingrid The coordinates, each with ngrid values.
+ * @param indata The physical variables, each with ngrid values.
+ * @param ngrid The number of data points.
+ * @param unitvec If not NULL, the units of the grid and the variables.
+ */
+void FoMo::FoMoObject::setshareddata(const std::vector<const float *> & ingrid, const std::vector<const float *> & indata, const int ngrid, std::vector<std::string> * unitvec)
+{
+	if (this->datacube.readdim() != int(ingrid.size())) this->datacube.setdim(ingrid.size());
+	std::vector<const float *> columns=ingrid;
+	columns.insert(columns.end(),indata.begin(),indata.end());
+	this->datacube.setshared(columns,ngrid,unitvec);
+	emissionkey.clear();
+	datahashknown=false;
+}
+
+/**
+ * @brief This reorders the data points of the FoMoObject along a Morton curve.
+ * 
+ * The protected member datacube is sorted with DataCube::mortonsort(). This is worthwhile for data 
+ * loaded in an arbitrary order (e.g. from a custom reader), because the spatial indices used in the rendering 
+ * are built faster and are queried with fewer cache misses if neighbouring points are stored close together.
+ * It should be called after the data has been loaded, and before render().
+ * @param permutation If not NULL, element i of this vector will contain the original index of the data point
+ * that is now stored at position i.
+ */
+void FoMo::FoMoObject::mortonsort(std::vector<unsigned int> * permutation)
+{
+	this->datacube.mortonsort(permutation);
+	emissionkey.clear();
+	datahashknown=false;
+}
+
+/**
+ * @brief This sets whether the goftcube is stored compressed during the rendering.
+ * 
+ * If compression is switched on, render() compresses the goftcube after it has been computed (see DataCube::compress()).
+ * The render routines then decompress the data block by block, which trades a little computation time for about half 
+ * of the memory of the goftcube. The compression is lossy: the coordinates are stored with 16 bits per block, and the 
+ * variables as half precision floats. It works best if the data has been sorted with mortonsort() first. The datacube 
+ * itself is never compressed, so that the data set with setdata() stays exact.
+ * @param compress If true, the goftcube is compressed for rendering. It defaults to true.
+ */
+void FoMo::FoMoObject::setcompression(const bool compress)
+{
+	compression=compress;
+	emissionkey.clear();
+}
+
+/**
+ * @brief This returns whether the data is compressed for the rendering.
+ * @return True if the goftcube will be compressed, as set with setcompression().
+ */
+bool FoMo::FoMoObject::readcompression()
+{
+	return compression;
+}
+
+/**
+ * @brief This sets whether spectroscopic renderings are stored sparsely.
+ * 
+ * With a wide spectral window, most wavelength bins of most pixels contain no emission. If sparse spectra are 
+ * switched on, the render routines only keep, for every pixel, the range of wavelength bins with emission 
+ * (see RenderCube::issparse()). This reduces the memory and the size of the binary output files. The rendering
+ * (FoMoObject.rendering) is then sparse as well, and should be converted with RenderCube::densify() before its 
+ * grid or variables are read. Imaging renderings are not affected.
+ * @param sparse If true, spectroscopic renderings are stored sparsely. It defaults to true.
+ * @param threshold The wavelength bins at the edges of a spectrum with an intensity not larger than threshold times the peak 
+ * intensity of that spectrum are dropped. With the default value 0, only bins without any emission are dropped, and no
+ * information is lost.
+ */
+void FoMo::FoMoObject::setsparsespectra(const bool sparse, const double threshold)
+{
+	sparsespectra=sparse;
+	sparsethreshold=threshold;
+}
+
+/**
+ * @brief This returns whether spectroscopic renderings are stored sparsely.
+ * @return True if the renderings will be sparse, as set with setsparsespectra().
+ */
+bool FoMo::FoMoObject::readsparsespectra()
+{
+	return sparsespectra;
+}
+
+/**
+ * @brief This restricts the rendering to a region of interest in the image.
+ * 
+ * Only the pixels with x index between roi[0] and roi[1] and y index between roi[2] and roi[3] (inclusive, counting 
+ * from 0) of the full image with the resolution set by setresolution() are rendered. The pixels have the same 
+ * coordinates as in the full image, so that the rendering can be used to zoom in on a part of the image without
+ * recomputing the rest. The CGAL rendermethods always render the full image.
+ * @param inroi The region of interest {xmin, xmax, ymin, ymax}. If empty (the default), the full image is rendered.
+ */
+void FoMo::FoMoObject::setregionofinterest(const std::vector<int> inroi)
+{
+	if (inroi.size() != 0 && inroi.size() != 4)
+	{
+		std::cerr << "Error: the region of interest should be given as {xmin, xmax, ymin, ymax}." << std::endl << std::flush;
+		exit(EXIT_FAILURE);
+	}
+	roi=inroi;
+}
+
+/**
+ * @brief This returns the region of interest.
+ * @return The region of interest {xmin, xmax, ymin, ymax} set with setregionofinterest(), or an empty vector for the full image.
+ */
+std::vector<int> FoMo::FoMoObject::readregionofinterest()
+{
+	return roi;
+}
+
+/**
+ * @brief This sets whether the spatial index and the mapping of every view are kept between renderings.
+ * 
+ * Building the spatial index (the R-tree of the NearestNeighbour method), and finding the data point(s) that
+ * contribute to every pixel, only depends on the grid and the view, not on the variables. If the index is kept,
+ * rendering a new snapshot on the same grid (e.g. with setdata()), or the same snapshot with another chiantifile,
+ * only needs to gather the emission of the points that are already known for every view. This is done for the
+ * NearestNeighbour and Projection methods, the CGAL method only keeps its Delaunay triangulation. The grid is hashed before every render() to check that it has not
+ * changed, unless it is declared static. The NearestNeighbour mapping stores the samples along every ray as runs of
+ * samples with the same nearest data point, which uses 8 bytes per run per view (at most x_pixel*y_pixel*z_pixel runs). 
+ * Projection uses 4 bytes per data point per view. This comes on top of the R-tree. Copies of the FoMoObject share 
+ * the index. The NearestNeighbour mappings can be stored with writeviewmappings() for later runs.
+ * @param reuse If true (the default), the index is kept. If false, the index is released.
+ * @param staticgrid If true, the grid is declared not to change between renderings, and it is not hashed. 
+ * Renderings of a different grid are then wrong.
+ */
+void FoMo::FoMoObject::setreuseindex(const bool reuse, const bool staticgrid)
+{
+	if (!reuse)
+	{
+		renderindex.reset();
+		return;
+	}
+	if (!renderindex) renderindex=std::make_shared<FoMo::RenderIndex>();
+	std::lock_guard<std::mutex> guard(renderindex->lock);
+	renderindex->staticgrid=staticgrid;
+}
+
+/**
+ * @brief This returns whether the index is kept between renderings.
+ * @return True if setreuseindex() was switched on.
+ */
+bool FoMo::FoMoObject::readreuseindex()
+{
+	return bool(renderindex);
+}
+
+/**
+ * @brief This makes the FoMoObject use the index of another FoMoObject.
+ * 
+ * The spatial index and the mapping of every view (see setreuseindex()) are then shared with other, and kept between 
+ * renderings. This is useful for the snapshots of a time series on the same grid, that are read into different 
+ * FoMoObjects: the index is only built for the first snapshot. If the grid is not declared static in other, it is 
+ * hashed before every render(), and the index is rebuilt when the grid differs from that of the last rendering.
+ * @param other The FoMoObject of which the index is used. If its index is not kept, it is switched on first.
+ */
+void FoMo::FoMoObject::shareindex(FoMo::FoMoObject & other)
+{
+	if (!other.renderindex) other.setreuseindex();
+	renderindex=other.renderindex;
+}
+
+/**
+ * @brief This makes the datacube of this FoMoObject read the data of another FoMoObject, without copying it.
+ * 
+ * This is useful to render the same data with several chiantifiles or abundfiles, each in its own FoMoObject that 
+ * keeps its own emission between renderings (as in fomo-server), while the data is only stored once. The data of 
+ * other should not be changed, and other should not be destroyed, as long as this FoMoObject is rendered. The 
+ * index is not shared, use shareindex() for that.
+ * @param other The FoMoObject of which the data is used.
+ */
+void FoMo::FoMoObject::sharedata(FoMo::FoMoObject & other)
+{
+	datacube.setshared(other.datacube);
+	emission.reset();
+	emissionkey.clear();
+	datahashknown=false;
+}
+
+/**
+ * @brief This sets the thickness of a 2D DataCube for the Slab rendermethod.
+ * 
+ * The Slab rendermethod treats a 2D DataCube in the (x,y)-plane as invariant along the z-axis, between 
+ * z=-depth/2 and z=depth/2. The intensity is then integrated over the part of every ray that is inside this slab.
+ * @param depth The thickness of the slab, in the units of the grid (normally Mm). It defaults to 1.
+ */
+void FoMo::FoMoObject::setslabdepth(const double depth)
+{
+	slabdepth=depth;
+}
+
+/**
+ * @brief This returns the thickness of a 2D DataCube for the Slab rendermethod.
+ * @return The thickness set with setslabdepth().
+ */
+double FoMo::FoMoObject::readslabdepth()
+{
+	return slabdepth;
+}
+
+/**
+ * @brief This sets the spatial index used by the NearestNeighbour rendermethod.
+ * 
+ * The NearestNeighbour rendermethod looks up the nearest data point of every sample along the rays in a spatial index. 
+ * The default "rtree" is the Boost R-tree. The alternative "kdtree" is an array-based kd-tree (see KDTree), which 
+ * uses less memory and is faster to build and query for large grids. For data points with a near-uniform density (e.g. 
+ * an unstructured grid resampled from a regular one), "grid" is a bucketed uniform grid (see UniformGrid), which is 
+ * built in linear time and queried in constant time. All find the nearest point in the same box around the sample, 
+ * the renderings only differ where two data points are (almost) equally close to a sample.
+ * 
+ * For repeated renderings of the same grid (see setreuseindex()), "voxel" precomputes the nearest data point of 
+ * every voxel of a fine lattice (see VoxelTable), so that every sample is a single look-up. The nearest point is 
+ * then only found up to the size of a voxel, which is set by the memory limit.
+ * @param index The spatial index, "rtree", "kdtree", "grid" or "voxel".
+ * @param maxmemory The maximum memory (in bytes) used to build the "voxel" index. It defaults to 1GB.
+ */
+void FoMo::FoMoObject::setspatialindex(const std::string index, const double maxmemory)
+{
+	if (index != "rtree" && index != "kdtree" && index != "grid" && index != "voxel")
+	{
+		std::cerr << "Error: unknown spatial index " << index << ", use rtree, kdtree, grid or voxel." << std::endl;
+		exit(EXIT_FAILURE);
+	}
+	spatialindex=index;
+	indexmemory=maxmemory;
+}
+
+/**
+ * @brief This returns the spatial index used by the NearestNeighbour rendermethod.
+ * @return The spatial index set with setspatialindex().
+ */
+std::string FoMo::FoMoObject::readspatialindex()
+{
+	return spatialindex;
+}
+
+/**
+ * @brief This sets whether the emission is computed lazily during the rendering.
+ * 
+ * Normally, render() first computes the emission and line width of every data point (see computeemission()), 
+ * including the points that are not seen by any ray (e.g. outside the region of interest). With lazy emission, 
+ * the goftcube only contains the grid, and the emission is computed by the render routine for the blocks of data 
+ * points that are actually sampled, and kept for the next renderings of the same data. This pays off most for data 
+ * sorted with mortonsort(), rendered with a region of interest. The renderings are identical, except with compression 
+ * (see setcompression()): the lazy emission is then not rounded to half precision. This is done for the NearestNeighbour, 
+ * Projection and Slab methods, the CGAL methods always compute the full emission.
+ * @param lazy If true (the default), the emission is computed lazily.
+ */
+void FoMo::FoMoObject::setlazyemission(const bool lazy)
+{
+	lazyemission=lazy;
+	emissionkey.clear();
+}
+
+/**
+ * @brief This returns whether the emission is computed lazily.
+ * @return True if setlazyemission() was switched on.
+ */
+bool FoMo::FoMoObject::readlazyemission()
+{
+	return lazyemission;
+}
+
+/**
+ * @brief This sets the spectral lines that are blended into the spectral window of the chiantifile.
+ * 
+ * Several lines of the CHIANTI tables can fall within one spectral window of an instrument, e.g. the Fe XII lines 
+ * at 193.5 and 195.1 Angstrom, or the C IV doublet at 1548 and 1551 Angstrom. With blended lines, render() adds the 
+ * emission of these lines to the spectrum of the chiantifile (set with setchiantifile()), in the same traversal of 
+ * the rays. The wavelength axis stays the one of the chiantifile: it is centred on its rest wavelength, with the width 
+ * set with setresolution(), which should therefore be wide enough to contain all the lines. Every line is a Gaussian 
+ * with its own rest wavelength, and with its own peak emission and thermal width (from the atomic weight in its 
+ * CHIANTI table), computed with the same abundfile. All lines are Doppler shifted with the same line-of-sight velocity.\n
+ * The emission of the blended lines is computed at the first render(), together with the emission of the chiantifile, 
+ * and is never computed lazily nor compressed. Blended lines are only rendered spectroscopically (lambda_pixel > 1), 
+ * with the NearestNeighbour, Projection or Slab rendermethod, and cannot be combined with setnodesharing().
+ * @param chiantifiles The CHIANTI tables of the blended lines. If empty (the default), only the chiantifile is rendered.
+ */
+void FoMo::FoMoObject::setblendedlines(const std::vector<std::string> chiantifiles)
+{
+	blendedlines.reset();
+	if (!chiantifiles.empty())
+	{
+		blendedlines=std::make_shared<std::vector<FoMo::BlendedLine> >(chiantifiles.size());
+		for (unsigned int k=0; k<chiantifiles.size(); k++)
+		{
+			blendedlines->at(k).chiantifile=chiantifiles[k];
+			blendedlines->at(k).lambda0=FoMo::readgoftfromchianti(chiantifiles[k]);
+		}
+	}
+	emissionkey.clear();
+}
+
+/**
+ * @brief This returns the spectral lines that are blended into the spectral window of the chiantifile.
+ * @return The CHIANTI tables set with setblendedlines(), or an empty vector if only the chiantifile is rendered.
+ */
+std::vector<std::string> FoMo::FoMoObject::readblendedlines()
+{
+	std::vector<std::string> chiantifiles;
+	if (blendedlines) for (unsigned int k=0; k<blendedlines->size(); k++) chiantifiles.push_back(blendedlines->at(k).chiantifile);
+	return chiantifiles;
+}
+
+/**
+ * @brief This sets whether the renderings collect statistics of their rays.
+ * 
+ * The NearestNeighbour rendermethod then counts for every ray the samples, the samples without a data point within 
+ * the maximum distance, and the distinct data points sampled, and for every view the data points that are not sampled 
+ * at all (see RayStatistics). The statistics are printed, stored in the rendering (see RenderCube::readraystatistics()), 
+ * and the maps per ray are written next to every rendering, with "raystatistics" appended to its name. This helps to 
+ * choose the lowest x_pixel, y_pixel and z_pixel that still sample every data point (with a region of interest, only 
+ * the data points in front of it can be sampled). Collecting the statistics costs a 
+ * byte per data point, and slows down the rendering a little. The other rendermethods do not collect statistics.
+ * @param statistics If true (the default), the statistics are collected.
+ */
+void FoMo::FoMoObject::setraystatistics(const bool statistics)
+{
+	raystatistics=statistics;
+}
+
+/**
+ * @brief This returns whether the renderings collect statistics of their rays.
+ * @return True if the statistics are collected, as set with setraystatistics().
+ */
+bool FoMo::FoMoObject::readraystatistics()
+{
+	return raystatistics;
+}
+
+/**
+ * @brief This sets the accuracy that the "auto" rendermethod should reach.
+ * 
+ * The "auto" rendermethod (see setrendermethod()) only chooses a rendermethod or spatial index if its rendering 
+ * of a sample of the rays differs less than this from the rendering with the NearestNeighbour rendermethod and the 
+ * exact "rtree" index. The difference is the sum of the absolute differences of the intensities, relative to the 
+ * sum of the intensities of the reference.
+ * @param tolerance The maximum relative difference (the default is 0.01).
+ */
+void FoMo::FoMoObject::setautotolerance(const double tolerance)
+{
+	if (tolerance < 0)
+	{
+		std::cerr << "Error: the tolerance of the auto rendermethod should not be negative." << std::endl << std::flush;
+		exit(EXIT_FAILURE);
+	}
+	autotolerance=tolerance;
+	autokey.clear();
+}
+
+/**
+ * @brief This returns the accuracy that the "auto" rendermethod should reach.
+ * @return The maximum relative difference, as set with setautotolerance().
+ */
+double FoMo::FoMoObject::readautotolerance()
+{
+	return autotolerance;
+}
+
+/**
+ * @brief This writes the view mappings of the index to a file.
+ * 
+ * The mapping of a view tells which data points contribute to every ray, such that a rendering of that view 
+ * only needs to add the emission of those data points. Only the NearestNeighbour mappings are written, together 
+ * with the hash of the grid. The file can be read back with readviewmappings() in a later run, e.g. to render 
+ * the next snapshots of a simulation on the same grid.
+ * @param filename The binary file to which the mappings are written.
+ */
+void FoMo::FoMoObject::writeviewmappings(const std::string filename)
+{
+	if (!renderindex)
+	{
+		std::cerr << "Error: writeviewmappings needs setreuseindex() to be switched on." << std::endl;
+		exit(EXIT_FAILURE);
+	}
+	FoMo::writenearestneighbourviews(*renderindex,filename);
+}
+
+/**
+ * @brief This reads view mappings that were written with writeviewmappings().
+ * 
+ * The mappings are added to the index, and are used by the next renderings with the same view. If the grid was 
+ * not declared static in setreuseindex(), they are discarded at the next rendering if the grid of the data is 
+ * not the grid the mappings were computed for. setreuseindex() should be switched on first.
+ * @param filename The binary file with the mappings.
+ */
+void FoMo::FoMoObject::readviewmappings(const std::string filename)
+{
+	if (!renderindex)
+	{
+		std::cerr << "Error: readviewmappings needs setreuseindex() to be switched on." << std::endl;
+		exit(EXIT_FAILURE);
+	}
+	if (!FoMo::readnearestneighbourviews(*renderindex,filename))
+	{
+		std::cerr << "Error: could not read view mappings from " << filename << "." << std::endl;
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * @brief This sets the directory of the render cache.
+ * 
+ * If a render cache is set, render() first looks up every view in this directory, and only the views that are 
+ * not found are rendered. The renderings are stored under a key that is a hash of the contents of the datacube, 
+ * the contents of the chiantifile and abundfile, the rendermethod, the resolution, the sparse-spectra and compression 
+ * settings and the viewing angles (see rendercachekey()). A cached rendering is still written out to the outfile, as if it 
+ * were rendered. New renderings are stored atomically, so that several programs can share the same cache directory.
+ * The statistics of the rays (see setraystatistics()) are not cached: with statistics, every view is rendered.
+ * The directory should exist, and is never cleaned up by FoMo.
+ * @param cachedir The directory of the render cache. If empty (the default), no cache is used.
+ */
+void FoMo::FoMoObject::setrendercache(const std::string cachedir)
+{
+	rendercache=cachedir;
+}
+
+/**
+ * @brief This returns the directory of the render cache.
+ * @return The directory set with setrendercache(), or an empty string if no cache is used.
+ */
+std::string FoMo::FoMoObject::readrendercache()
+{
+	return rendercache;
 }
 
 /**
@@ -314,6 +778,8 @@ enum FoMoRenderValue
 #endif
 	NearestNeighbour,
 	Projection,
+	Slab,
+	Abel,
 	// add more methods here
 	LastVirtualRenderMethod
 };
@@ -328,6 +794,8 @@ static const std::map<std::string, FoMoRenderValue>::value_type RenderMapEntries
 #endif
 	std::map<std::string, FoMoRenderValue>::value_type("NearestNeighbour",NearestNeighbour),
 	std::map<std::string, FoMoRenderValue>::value_type("Projection",Projection),
+	std::map<std::string, FoMoRenderValue>::value_type("Slab",Slab),
+	std::map<std::string, FoMoRenderValue>::value_type("Abel",Abel),
 	/// [Rendermethods]
 	std::map<std::string, FoMoRenderValue>::value_type("ThisIsNotARealRenderMethod",LastVirtualRenderMethod)
 };
@@ -337,6 +805,22 @@ static const std::map<std::string, FoMoRenderValue>::value_type RenderMapEntries
 
 static std::map<std::string, FoMoRenderValue> RenderMap{ &RenderMapEntries[0], &RenderMapEntries[LastVirtualRenderMethod-1] };
 
+/**
+ * @brief This returns the rendermethods that are available in this build of FoMo.
+ * 
+ * The CGAL and CGAL2D methods are only available if FoMo was compiled with CGAL. The last one is "auto", 
+ * which lets FoMoObject.render() choose the rendermethod.
+ * @return The names of the rendermethods, as they are passed to FoMoObject.setrendermethod().
+ */
+std::vector<std::string> FoMo::rendermethods()
+{
+	std::vector<std::string> methods;
+	for (std::map<std::string, FoMoRenderValue>::const_iterator it=RenderMap.begin(); it!=RenderMap.end(); ++it)
+		methods.push_back(it->first);
+	methods.push_back("auto");
+	return methods;
+}
+
 /**
  * @brief This is the main render routine for the FoMo::FoMoObject.
  * 
@@ -361,7 +845,6 @@ static std::map<std::string, FoMoRenderValue> RenderMap{ &RenderMapEntries[0], &
  */
 void FoMo::FoMoObject::render(const std::vector<double> lvec, const std::vector<double> bvec)
 {
-	FoMo::GoftCube tmpgoft;
 	FoMo::RenderCube tmprender(this->goftcube);
 	int x_pixel, y_pixel, z_pixel, lambda_pixel;
 	double lambda_width;
@@ -371,10 +854,221 @@ void FoMo::FoMoObject::render(const std::vector<double> lvec, const std::vector<
 	else
 		this->rendering.setobservationtype(Spectroscopic);
 	
+	if (blendedlines)
+	{
+		std::string rendermethod=this->readrendermethod();
+		if (lambda_pixel <= 1)
+		{
+			std::cerr << "Error: blended lines can only be rendered spectroscopically (lambda_pixel > 1)." << std::endl << std::flush;
+			exit(EXIT_FAILURE);
+		}
+		if (rendermethod != "NearestNeighbour" && rendermethod != "Projection" && rendermethod != "Slab" && rendermethod != "auto")
+		{
+			std::cerr << "Error: blended lines are not supported by the " << rendermethod << " rendermethod." << std::endl << std::flush;
+			exit(EXIT_FAILURE);
+		}
+		if (nodesharing)
+		{
+			std::cerr << "Error: blended lines cannot be rendered when the data is shared between the ranks of a node." << std::endl << std::flush;
+			exit(EXIT_FAILURE);
+		}
+	}
+	// with node sharing, the datacube of the other ranks than the first of the node may be empty
+	uint64_t nodedatahash=0;
+	if (nodesharing) nodedatahash=this->sharenode();
+	if (automethod) this->autotune(lvec,bvec);
+	FoMo::RenderOptions options=this->renderoptions();
+	
+	if (rendercache.empty() && checkpointfile.empty())
+	{
+		this->computeemission();
+		tmprender=this->renderviews(lvec,bvec,options);
+	}
+	else
+	{
+		// treat the views one by one: views that are completed according to the checkpoint are skipped, 
+		// views that are found in the render cache are read in, and only the other views are rendered
+		uint64_t cachehash=nodedatahash;
+		if (!rendercache.empty() && !nodesharing) cachehash=this->hashdata();
+		// without setreuseindex(), the spatial index (such as the triangulation of CGAL) is still kept for the views
+		// of this call, which are rendered one by one, but the mappings of the views are not recorded
+		if (!options.index)
+		{
+			options.index=std::make_shared<FoMo::RenderIndex>();
+			options.index->keepviews=false;
+		}
+		std::vector<int> resolution={x_pixel,y_pixel,z_pixel,lambda_pixel};
+		bool emissiondone=false, lastskipped=false;
+		double lambda0=0;
+		// the 2D routine does not use the b-angles
+		std::vector<double> viewbvec=bvec;
+		if (rendering.readrendermethod() == "CGAL2D") viewbvec={pi/2.};
+		for (std::vector<double>::const_iterator lit=lvec.begin(); lit!=lvec.end(); ++lit)
+			for (std::vector<double>::const_iterator bit=viewbvec.begin(); bit!=viewbvec.end(); ++bit)
+			{
+				if (!checkpointfile.empty() && this->iscompleted(*lit,*bit))
+				{
+					std::cout << "Skipping l=" << *lit << ", b=" << *bit << ": it is completed according to checkpoint " << checkpointmanifest() << std::endl << std::flush;
+					// the last view is read back from its binary output, if that was kept
+					std::string filename=renderfilename(*lit,*bit);
+					lastskipped=true;
+					if ((lit+1 == lvec.end()) && (bit+1 == viewbvec.end()) && readrendercube_binary(filename.substr(0,filename.rfind("."))+".dat",tmprender))
+					{
+						tmprender.setresolution(x_pixel,y_pixel,z_pixel,lambda_pixel,lambda_width);
+						tmprender.setangles(*lit,*bit);
+						tmprender.setlambda0(FoMo::readgoftfromchianti(tmprender.readchiantifile()));
+						lastskipped=false;
+					}
+					continue;
+				}
+				lastskipped=false;
+				std::string key;
+				if (!rendercache.empty()) key=FoMo::rendercachekey(cachehash,rendering.readchiantifile(),rendering.readabundfile(),rendering.readrendermethod(),
+					resolution,lambda_width,options,*lit,*bit);
+				// the statistics of the rays are not stored in the cache, so that those views are always rendered
+				if (!rendercache.empty() && !raystatistics && FoMo::readrendercache(rendercache,key,tmprender))
+				{
+					std::cout << "Using cached rendering " << key << " for l=" << *lit << ", b=" << *bit << std::endl << std::flush;
+					if (lambda0 == 0) lambda0=FoMo::readgoftfromchianti(tmprender.readchiantifile());
+					tmprender.setlambda0(lambda0);
+					tmprender.setresolution(x_pixel,y_pixel,z_pixel,lambda_pixel,lambda_width);
+					tmprender.setangles(*lit,*bit);
+					tmprender.setwriteoptions(this->goftcube.getwriteoptions());
+					if (options.write) tmprender.writegoftcube(renderfilename(*lit,*bit),true);
+				}
+				else
+				{
+					if (!emissiondone)
+					{
+						this->computeemission();
+						emissiondone=true;
+					}
+					tmprender=this->renderviews({*lit},{*bit},options);
+					if (!rendercache.empty() && options.write) FoMo::writerendercache(rendercache,key,tmprender);
+				}
+				if (!checkpointfile.empty() && options.write) this->markcompleted(*lit,*bit);
+			}
+		// if the last view was skipped and could not be read back, the previous rendering is kept
+		if (lastskipped) return;
+	}
+
+	tmprender.setrendermethod(rendering.readrendermethod());
+	tmprender.setobservationtype(rendering.readobservationtype());
+	// the render routines set the resolution of the region of interest, but the full resolution is kept for the next render
+	tmprender.setresolution(x_pixel,y_pixel,z_pixel,lambda_pixel,lambda_width);
+	this->rendering=tmprender;
+}
+
+/**
+ * @brief This collects the settings that are passed on to the render routines.
+ * @return The render options of this FoMoObject.
+ */
+FoMo::RenderOptions FoMo::FoMoObject::renderoptions()
+{
+	FoMo::RenderOptions options;
+	options.sparse=sparsespectra;
+	options.sparsethreshold=sparsethreshold;
+	options.roi=roi;
+	options.index=renderindex;
+	options.depth=slabdepth;
+	options.spatialindex=automethod ? autoindex : spatialindex;
+	// the R-tree consists of pointers, and cannot be shared between the MPI ranks (see setnodesharing())
+	if (nodesharing && options.spatialindex == "rtree") options.spatialindex="kdtree";
+	options.indexmemory=indexmemory;
+	options.raystatistics=raystatistics;
+	options.compression=compression;
+	options.blend=blendedlines;
+	// the views are written by the first rank, but with node sharing every rank writes the views that it renders
+	int commrank;
+#ifdef HAVEMPI
+	MPI_Comm_rank(MPI_COMM_WORLD,&commrank);
+#else
+	commrank = 0;
+#endif
+	options.write=(commrank==0) || bool(nodesharing);
+	return options;
+}
+
+/**
+ * @brief This computes the FoMoObject.goftcube from the FoMoObject.datacube.
+ * 
+ * The emission is computed with the chiantifile and abundfile of the rendering. If compression is switched on 
+ * (see setcompression()), the goftcube is compressed after the computation, the datacube is left unchanged. 
+ * The goftcube is kept for subsequent calls to render(), as long as the data, the chiantifile, the abundfile and 
+ * the observationtype do not change.
+ */
+void FoMo::FoMoObject::computeemission()
+{
+	// the emission is only computed lazily by the render routines that support it
+	std::string rendermethod=this->rendering.readrendermethod();
+	// the emission that is shared between the MPI ranks of a node is not computed lazily (see setnodesharing())
+	bool lazy=lazyemission && !nodesharing && (rendermethod == "NearestNeighbour" || rendermethod == "Projection" || rendermethod == "Slab");
+	// the emission only needs to be recomputed if the data or the settings for the emission have changed
+	std::stringstream key;
+	key << this->rendering.readchiantifile() << "\n" << this->rendering.readabundfile() << "\n" << this->rendering.readobservationtype() << "\n" << lazy;
+	std::vector<std::string> blendfiles=this->readblendedlines();
+	for (unsigned int k=0; k<blendfiles.size(); k++) key << "\n" << blendfiles[k];
+	// a copy of the FoMoObject cannot use the lazy emission of the datacube of the original
+	if (key.str() == emissionkey && (!emission || &emission->readdatacube() == &this->datacube)) return;
+	FoMo::GoftCube tmpgoft;
 	std::bitset<FoMo::noptions> woptions=this->goftcube.getwriteoptions();
-	tmpgoft=FoMo::emissionfromdatacube(this->datacube,this->rendering.readchiantifile(),this->rendering.readabundfile(),this->rendering.readobservationtype());
-	this->goftcube=tmpgoft;
+	emission.reset();
+	if (lazy)
+	{
+		emission=std::make_shared<FoMo::LazyEmission>(this->datacube,this->rendering.readchiantifile(),this->rendering.readabundfile(),this->rendering.readobservationtype());
+		std::cout << "The emission is computed lazily, for the data points that are used in the rendering." << std::endl << std::flush;
+		// the goftcube only reads the grid of the datacube, like the LazyEmission
+		tmpgoft=FoMo::GoftCube(this->datacube.readdim());
+		tmpgoft.setshared(this->datacube,true);
+		tmpgoft.setchiantifile(this->rendering.readchiantifile());
+		tmpgoft.setabundfile(this->rendering.readabundfile());
+		tmpgoft.setlambda0(emission->readlambda0());
+	}
+	else
+	{
+		tmpgoft=FoMo::emissionfromdatacube(this->datacube,this->rendering.readchiantifile(),this->rendering.readabundfile(),this->rendering.readobservationtype());
+	}
+	// the blended lines are new vectors, so that the lines of copies of this FoMoObject are not modified
+	// only their peak emission and line width are computed, the grid and velocities are those of the goftcube
+	if (blendedlines)
+	{
+		std::shared_ptr<std::vector<FoMo::BlendedLine> > lines=std::make_shared<std::vector<FoMo::BlendedLine> >(*blendedlines);
+		for (unsigned int k=0; k<lines->size(); k++)
+		{
+			FoMo::LazyEmission line(this->datacube,lines->at(k).chiantifile,this->rendering.readabundfile(),this->rendering.readobservationtype());
+			lines->at(k).lambda0=line.readlambda0();
+			line.computeall(lines->at(k).peak,lines->at(k).fwhm);
+		}
+		blendedlines=lines;
+	}
+	if (compression) tmpgoft.compress();
+	std::swap(this->goftcube,tmpgoft);
+	tmpgoft=FoMo::GoftCube(); // release the memory of the previous goftcube
 	this->goftcube.setwriteoptions(woptions);
+	emissionkey=key.str();
+}
+
+/**
+ * @brief This renders the FoMoObject.goftcube for all combinations of lvec and bvec with the selected rendermethod.
+ * 
+ * The goftcube should have been computed with computeemission() before. The renderings are written out by the 
+ * render routines, and the last one is returned.
+ * @param lvec The l-angles of the views.
+ * @param bvec The b-angles of the views.
+ * @param options The options that are passed on to the render routine.
+ * @return The rendering for lvec.back() and bvec.back().
+ */
+FoMo::RenderCube FoMo::FoMoObject::renderviews(const std::vector<double> lvec, const std::vector<double> bvec, const FoMo::RenderOptions & options)
+{
+	// the emission is passed on if it is computed lazily
+	FoMo::RenderOptions viewoptions=options;
+	viewoptions.emission=emission;
+	// the blended lines are computed by computeemission(), after the options were collected
+	viewoptions.blend=blendedlines;
+	FoMo::RenderCube tmprender(this->goftcube);
+	int x_pixel, y_pixel, z_pixel, lambda_pixel;
+	double lambda_width;
+	this->rendering.readresolution(x_pixel,y_pixel,z_pixel,lambda_pixel,lambda_width);
 	
 	switch (RenderMap[rendering.readrendermethod()])
 	{
@@ -384,21 +1078,29 @@ void FoMo::FoMoObject::render(const std::vector<double> lvec, const std::vector<
 			std::cout << "Using CGAL-2D for rendering." << std::endl << std::flush;
 			if (bvec.size()>0) std::cout << "Warning: the bvec-values are not used in this 2D routine." << std::endl << std::flush;
 			tmprender=FoMo::RenderWithCGAL2D(this->datacube,this->goftcube,this->rendering.readobservationtype(),
-			x_pixel, y_pixel, lambda_pixel, lambda_width, lvec, this->outfile);
+			x_pixel, y_pixel, lambda_pixel, lambda_width, lvec, this->outfile, viewoptions);
 			break;
 		case CGAL:
 			std::cout << "Using CGAL for rendering." << std::endl << std::flush;
 			tmprender=FoMo::RenderWithCGAL(this->datacube,this->goftcube,this->rendering.readobservationtype(),
-			x_pixel, y_pixel, z_pixel, lambda_pixel, lambda_width,lvec,bvec,this->outfile);
+			x_pixel, y_pixel, z_pixel, lambda_pixel, lambda_width,lvec,bvec,this->outfile, viewoptions);
 			break;
 #endif
 		case NearestNeighbour:
 			std::cout << "Using nearest-neighbour rendering." << std::endl << std::flush;
-			tmprender=FoMo::RenderWithNearestNeighbour(this->goftcube,x_pixel, y_pixel, z_pixel, lambda_pixel, lambda_width, lvec, bvec, this->outfile);
+			tmprender=FoMo::RenderWithNearestNeighbour(this->goftcube,x_pixel, y_pixel, z_pixel, lambda_pixel, lambda_width, lvec, bvec, this->outfile, viewoptions);
 			break;
 		case Projection:
 			std::cout << "Using projection for rendering." << std::endl << std::flush;
-			tmprender=FoMo::RenderWithProjection(this->goftcube,x_pixel,y_pixel,z_pixel,lambda_pixel,lambda_width,lvec,bvec, this->outfile);
+			tmprender=FoMo::RenderWithProjection(this->goftcube,x_pixel,y_pixel,z_pixel,lambda_pixel,lambda_width,lvec,bvec, this->outfile, viewoptions);
+			break;
+		case Slab:
+			std::cout << "Using the 2.5D slab for rendering." << std::endl << std::flush;
+			tmprender=FoMo::RenderWithSlab(this->goftcube,x_pixel,y_pixel,z_pixel,lambda_pixel,lambda_width,lvec,bvec, this->outfile, viewoptions);
+			break;
+		case Abel:
+			std::cout << "Using the Abel projection for rendering." << std::endl << std::flush;
+			tmprender=FoMo::RenderWithAbel(this->goftcube,x_pixel,y_pixel,z_pixel,lambda_pixel,lambda_width,lvec,bvec, this->outfile, viewoptions);
 			break;
 		case LastVirtualRenderMethod: // this should not be reached, since it is excluded from the map
 		default:
@@ -406,10 +1108,49 @@ void FoMo::FoMoObject::render(const std::vector<double> lvec, const std::vector<
 			exit(EXIT_FAILURE);
 			break;
 	}
+	if (emission) std::cout << "The emission has been computed for " << emission->readncomputed() << " of " << this->datacube.readngrid() << " data points." << std::endl << std::flush;
+	return tmprender;
+}
 
-	tmprender.setrendermethod(rendering.readrendermethod());
-	tmprender.setobservationtype(rendering.readobservationtype());
-	this->rendering=tmprender;
+/**
+ * @brief This returns the name of the output file of a view, as it is written by the render routines.
+ * 
+ * The name is outfile appended with "l"+l+"b"+b, with the angles in degrees. For the CGAL2D rendermethod, 
+ * which does not use the b-angle, only "l"+l is appended.
+ * @param outfile The start of the filename, see FoMoObject::setoutfile().
+ * @param rendermethod The rendermethod.
+ * @param l The l-angle of the view, in radians.
+ * @param b The b-angle of the view, in radians.
+ * @return The filename, with extension .txt (which is replaced by GoftCube::writegoftcube()).
+ */
+std::string FoMo::renderfilename(const std::string outfile, const std::string rendermethod, const double l, const double b)
+{
+	std::stringstream ss;
+	ss << outfile;
+	ss << "l";
+	ss << std::setfill('0') << std::setw(3) << std::round(l/pi*180.);
+	if (rendermethod != "CGAL2D")
+	{
+		ss << "b";
+		ss << std::setfill('0') << std::setw(3) << std::round(b/pi*180.);
+	}
+	ss << ".txt";
+	return ss.str();
+}
+
+/**
+ * @brief This returns the name of the output file of a view, as it is written by render().
+ * 
+ * The name is outfile (set with setoutfile()) appended with "l"+l+"b"+b, with the angles in degrees. For the 
+ * CGAL2D rendermethod, which does not use the b-angle, only "l"+l is appended.
+ * @param l The l-angle of the view, in radians.
+ * @param b The b-angle of the view, in radians.
+ * @return The filename, with extension .txt (which is replaced by GoftCube::writegoftcube() with the extension 
+ * of the written format).
+ */
+std::string FoMo::FoMoObject::renderfilename(const double l, const double b)
+{
+	return FoMo::renderfilename(outfile,rendering.readrendermethod(),l,b);
 }
 
 /**
@@ -0,0 +1,221 @@
+#include "../config.h"
+#include "FoMo.h"
+#include "FoMo-internal.h"
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <cstring>
+#ifdef HAVE_LINUX_PERF_EVENT_H
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
+// the totals of one stage on one thread
+struct ProfileEntry
+{
+	long calls=0;
+	double seconds=0;
+	// cycles, instructions, cache references and cache misses
+	uint64_t counters[4]={0,0,0,0};
+	bool hascounters=false;
+};
+
+static std::atomic<bool> profiling(false);
+static std::mutex profilelock;
+// the totals, by stage and thread number
+static std::map<std::pair<std::string,int>, ProfileEntry> profile;
+static std::atomic<int> nthreads(0);
+// the bytes transferred from memory per cache miss, for the estimate of the memory bandwidth
+const int cachelinesize=64;
+
+// The hardware counters of the calling thread, opened when the thread first measures a stage with counters.
+class ThreadCounters
+{
+public:
+	int thread;
+	int leader;
+	int fds[4];
+	ThreadCounters(): thread(nthreads++), leader(-1), fds{-1,-1,-1,-1}
+	{
+#ifdef HAVE_LINUX_PERF_EVENT_H
+		const uint64_t configs[4]={PERF_COUNT_HW_CPU_CYCLES,PERF_COUNT_HW_INSTRUCTIONS,PERF_COUNT_HW_CACHE_REFERENCES,PERF_COUNT_HW_CACHE_MISSES};
+		for (int c=0; c<4; c++)
+		{
+			struct perf_event_attr attr;
+			std::memset(&attr,0,sizeof(attr));
+			attr.size=sizeof(attr);
+			attr.type=PERF_TYPE_HARDWARE;
+			attr.config=configs[c];
+			attr.read_format=PERF_FORMAT_GROUP;
+			attr.exclude_kernel=1;
+			attr.exclude_hv=1;
+			// the counters of this thread only, on any cpu, in one group so that they are scheduled together
+			fds[c]=syscall(__NR_perf_event_open,&attr,0,-1,leader,0);
+			if (fds[c] < 0)
+			{
+				close();
+				return;
+			}
+			if (c == 0) leader=fds[0];
+		}
+		ioctl(leader,PERF_EVENT_IOC_RESET,PERF_IOC_FLAG_GROUP);
+		ioctl(leader,PERF_EVENT_IOC_ENABLE,PERF_IOC_FLAG_GROUP);
+#endif
+	}
+	~ThreadCounters()
+	{
+		close();
+	}
+	void close()
+	{
+#ifdef HAVE_LINUX_PERF_EVENT_H
+		for (int c=0; c<4; c++)
+			if (fds[c] >= 0) ::close(fds[c]);
+#endif
+		for (int c=0; c<4; c++) fds[c]=-1;
+		leader=-1;
+	}
+	// this reads the counters, and returns false if they are not available
+	bool read(uint64_t * values)
+	{
+#ifdef HAVE_LINUX_PERF_EVENT_H
+		if (leader < 0) return false;
+		// the number of counters, followed by their values
+		uint64_t buffer[5];
+		if (::read(leader,buffer,sizeof(buffer)) != sizeof(buffer) || buffer[0] != 4) return false;
+		for (int c=0; c<4; c++) values[c]=buffer[c+1];
+		return true;
+#else
+		return false;
+#endif
+	}
+};
+
+static ThreadCounters & threadcounters()
+{
+	static thread_local ThreadCounters counters;
+	return counters;
+}
+
+static double now()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief This starts the measurement of a stage.
+ * @param instage The name of the stage, which should be a string literal.
+ */
+FoMo::ProfileScope::ProfileScope(const char * instage):
+	stage(instage), active(profiling.load(std::memory_order_relaxed)), start(0), startcounters{0,0,0,0}
+{
+	if (!active) return;
+	// the counters are opened before the time is taken, which only matters for the first stage of every thread
+	ThreadCounters & counters=threadcounters();
+	if (!counters.read(startcounters)) std::fill(startcounters,startcounters+4,0);
+	start=now();
+}
+
+/**
+ * @brief This ends the measurement of a stage, and adds it to the totals of the stage and thread.
+ */
+FoMo::ProfileScope::~ProfileScope()
+{
+	if (!active) return;
+	double seconds=now()-start;
+	ThreadCounters & counters=threadcounters();
+	uint64_t endcounters[4];
+	bool hascounters=counters.read(endcounters);
+	std::lock_guard<std::mutex> guard(profilelock);
+	ProfileEntry & entry=profile[std::make_pair(std::string(stage),counters.thread)];
+	entry.calls++;
+	entry.seconds+=seconds;
+	if (hascounters)
+	{
+		entry.hascounters=true;
+		for (int c=0; c<4; c++) entry.counters[c]+=endcounters[c]-startcounters[c];
+	}
+}
+
+/**
+ * @brief This switches the profiling of the stages of the pipeline on or off.
+ * 
+ * The stages are the computation of the emission ("emission", with "goft" for the interpolation of the G(T) tables, 
+ * or "lazyemission" for blocks computed during the rendering), the building of the spatial indexes ("index"), the 
+ * ray casting or projection of the render routines ("render") and the writing of the output ("write"). For every 
+ * stage and thread, the calls and the wall time are added up. On Linux, the cycles, instructions, cache references 
+ * and cache misses of the thread are also counted with perf_event_open(), if the kernel allows it (see 
+ * /proc/sys/kernel/perf_event_paranoid). The totals are reported by profilingreport().
+ * @param on If true (the default), the stages are profiled from now on.
+ */
+void FoMo::setprofiling(const bool on)
+{
+	profiling=on;
+}
+
+/**
+ * @brief This returns whether the stages of the pipeline are profiled.
+ * @return True if profiling was switched on with setprofiling().
+ */
+bool FoMo::readprofiling()
+{
+	return profiling;
+}
+
+/**
+ * @brief This clears the totals of the profiling.
+ */
+void FoMo::resetprofiling()
+{
+	std::lock_guard<std::mutex> guard(profilelock);
+	profile.clear();
+}
+
+/**
+ * @brief This returns the report of the profiling.
+ * 
+ * The report is a table with a line per stage and thread, and a line with the total of every stage over the threads 
+ * (thread "all"). The columns are separated by spaces: stage, thread, calls, seconds, and if the hardware counters 
+ * are available, cycles, instructions, instructions per cycle, cache references, cache misses and the memory 
+ * bandwidth in GB/s, estimated as one cache line of 64 bytes per cache miss. Counters that are not available are "-".
+ * Stages are nested ("goft" is part of "emission"), and the seconds of the threads of a parallel stage add up.
+ * @return The report, with a header line.
+ */
+std::string FoMo::profilingreport()
+{
+	std::lock_guard<std::mutex> guard(profilelock);
+	// the totals over the threads are added to the entries of thread -1, which are reported as "all"
+	std::map<std::pair<std::string,int>, ProfileEntry> report=profile;
+	for (std::map<std::pair<std::string,int>, ProfileEntry>::const_iterator it=profile.begin(); it!=profile.end(); ++it)
+	{
+		ProfileEntry & total=report[std::make_pair(it->first.first,-1)];
+		total.calls+=it->second.calls;
+		total.seconds+=it->second.seconds;
+		total.hascounters=total.hascounters || it->second.hascounters;
+		for (int c=0; c<4; c++) total.counters[c]+=it->second.counters[c];
+	}
+	std::stringstream ss;
+	ss << "stage thread calls seconds cycles instructions IPC cachereferences cachemisses bandwidth(GB/s)" << std::endl;
+	for (std::map<std::pair<std::string,int>, ProfileEntry>::const_iterator it=report.begin(); it!=report.end(); ++it)
+	{
+		const ProfileEntry & entry=it->second;
+		ss << it->first.first << " ";
+		if (it->first.second < 0) ss << "all ";
+		else ss << it->first.second << " ";
+		ss << entry.calls << " " << std::setprecision(6) << entry.seconds;
+		if (entry.hascounters)
+		{
+			ss << " " << entry.counters[0] << " " << entry.counters[1] << " ";
+			ss << (entry.counters[0] ? double(entry.counters[1])/entry.counters[0] : 0.) << " ";
+			ss << entry.counters[2] << " " << entry.counters[3] << " ";
+			ss << (entry.seconds > 0 ? double(entry.counters[3])*cachelinesize/entry.seconds/1e9 : 0.);
+		}
+		else
+			ss << " - - - - - -";
+		ss << std::endl;
+	}
+	return ss.str();
+}
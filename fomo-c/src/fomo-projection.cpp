@@ -14,54 +14,80 @@
 const double speedoflight=GSL_CONST_MKSA_SPEED_OF_LIGHT; // speed of light
 const double pi=M_PI; //pi
 
-FoMo::RenderCube projectioninterpolation(FoMo::GoftCube goftcube, const double l, const double b, const int x_pixel, const int y_pixel, const int z_pixel, const int lambda_pixel, const double lambda_width)
+namespace FoMo
+{
+	/**
+	 * @brief The mapping of one view: the bounds of the rotated grid and the pixel to which every data point contributes.
+	 */
+	struct ProjectionView
+	{
+		double minx, maxx, miny, maxy, minz, maxz;
+		/** The pixel (i*nx+j) in the region of interest of every data point, or -1 if it is outside. */
+		std::vector<int> pixel;
+	};
+}
+
+FoMo::RenderCube projectioninterpolation(const FoMo::GoftCube & goftcube, const double l, const double b, const int x_pixel, const int y_pixel, const int z_pixel, const int lambda_pixel, const double lambda_width, const FoMo::RenderOptions & options)
 {
-	//FoMo::DataCube goftcube=object.datacube;
-	FoMo::tgrid grid = goftcube.readgrid();
 	int ng=goftcube.readngrid();
 	int dim=goftcube.readdim();
 
 	// We will calculate the maximum image coordinates by projecting the grid onto the image plane
 	// Rotate the grid over an angle -l (around z-axis), and -b (around y-axis)
 	// Take the min and max of the resulting coordinates, those are coordinates in the image plane
+	// The grid and variables are not copied, but read through a ColumnReader (which decompresses a compressed goftcube on the fly)
 	std::cout << "Rotating coordinates to POS reference... " << std::flush;
-	std::vector<double> xacc, yacc, zacc, losvel;
-	xacc.resize(ng);
-	yacc.resize(ng);
-	zacc.resize(ng);
-	losvel.resize(ng);
 	// Define the unit vector along the line-of-sight
 	std::vector<double> unit = {sin(b)*cos(l), -sin(b)*sin(l), cos(b)};
-	// Read the physical variables
-	FoMo::tphysvar peakvec=goftcube.readvar(0);//Peak intensity 
-	FoMo::tphysvar fwhmvec=goftcube.readvar(1);// line width, =1 for AIA imaging
-	FoMo::tphysvar vx=goftcube.readvar(2);  
-	FoMo::tphysvar vy=goftcube.readvar(3);
-	FoMo::tphysvar vz=goftcube.readvar(4);
+	double minx=INFINITY, maxx=-INFINITY, miny=INFINITY, maxy=-INFINITY, minz=INFINITY, maxz=-INFINITY;
 	
+	// if the index is kept between renderings, look up the mapping of this view
+	std::shared_ptr<FoMo::ProjectionView> view, newview;
+	std::string viewkey=FoMo::renderviewkey(l,b,x_pixel,y_pixel,z_pixel,options);
+	if (options.index)
+	{
+		std::lock_guard<std::mutex> guard(options.index->lock);
+		std::map<std::string, std::shared_ptr<FoMo::ProjectionView> >::const_iterator it=options.index->projectionviews.find(viewkey);
+		if (it != options.index->projectionviews.end()) view=it->second;
+	}
+	
+	if (view)
+	{
+		minx=view->minx;
+		maxx=view->maxx;
+		miny=view->miny;
+		maxy=view->maxy;
+		minz=view->minz;
+		maxz=view->maxz;
+	}
+	else
 #ifdef _OPENMP
-#pragma omp parallel for 
+#pragma omp parallel reduction(min:minx,miny,minz) reduction(max:maxx,maxy,maxz)
 #endif
-	for (int i=0; i<ng; i++)
 	{
-		std::vector<double> gridpoint; // declare gridpoint here so that it is private to the thread
-		gridpoint.resize(dim);
-		for (int j=0; j<dim; j++)	gridpoint[j]=grid[j][i];
-		xacc[i]=gridpoint[0]*cos(b)*cos(l)-gridpoint[1]*cos(b)*sin(l)-gridpoint[2]*sin(b);// rotated grid
-		yacc[i]=gridpoint[0]*sin(l)+gridpoint[1]*cos(l);
-		zacc[i]=gridpoint[0]*sin(b)*cos(l)-gridpoint[1]*sin(b)*sin(l)+gridpoint[2]*cos(b);
-		std::vector<double> velvec = {vx[i], vy[i], vz[i]};// velocity vector
-		double losvelval = inner_product(unit.begin(),unit.end(),velvec.begin(),0.0);//velocity along line of sight for position [i]/[ng]
-		losvel.at(i)=losvelval;
+		std::vector<FoMo::ColumnReader> coordreader;
+		for (int j=0; j<dim; j++) coordreader.push_back(FoMo::ColumnReader(goftcube,j));
+#ifdef _OPENMP
+#pragma omp for
+#endif
+		for (int i=0; i<ng; i++)
+		{
+			std::vector<double> gridpoint; // declare gridpoint here so that it is private to the thread
+			gridpoint.resize(dim);
+			for (int j=0; j<dim; j++)	gridpoint[j]=coordreader[j][i];
+			double xacc=gridpoint[0]*cos(b)*cos(l)-gridpoint[1]*cos(b)*sin(l)-gridpoint[2]*sin(b);// rotated grid
+			double yacc=gridpoint[0]*sin(l)+gridpoint[1]*cos(l);
+			double zacc=gridpoint[0]*sin(b)*cos(l)-gridpoint[1]*sin(b)*sin(l)+gridpoint[2]*cos(b);
+			minx=std::min(minx,xacc);
+			maxx=std::max(maxx,xacc);
+			miny=std::min(miny,yacc);
+			maxy=std::max(maxy,yacc);
+			minz=std::min(minz,zacc);
+			maxz=std::max(maxz,zacc);
+		}
 	}
 	
 	// compute the bounds of the input data points, so that we can equidistantly distribute the target pixels
-	double minx=*(min_element(xacc.begin(),xacc.end()));
-	double maxx=*(max_element(xacc.begin(),xacc.end()));
-	double miny=*(min_element(yacc.begin(),yacc.end()));
-	double maxy=*(max_element(yacc.begin(),yacc.end()));
-	double minz=*(min_element(zacc.begin(),zacc.end()));
-	double maxz=*(max_element(zacc.begin(),zacc.end()));
 	std::cout << "Done!" << std::endl;
 
 	std::string chiantifile=goftcube.readchiantifile();
@@ -69,75 +95,95 @@ FoMo::RenderCube projectioninterpolation(FoMo::GoftCube goftcube, const double l
 	double lambda_width_in_A=lambda_width*lambda0/speedoflight;
        	
 	std::cout << "Building frame: " << std::flush;
-	double x,y,lambdaval;
+	double lambdaval;
 	int ind;
 	boost::progress_display show_progress(ng);
 	
-	//initialize grids
-	FoMo::tgrid newgrid;
-	FoMo::tcoord xvec(x_pixel*y_pixel*lambda_pixel),yvec(x_pixel*y_pixel*lambda_pixel),lambdavec(x_pixel*y_pixel*lambda_pixel);
-	newgrid.push_back(xvec);
-	newgrid.push_back(yvec);
-	if (lambda_pixel > 1) newgrid.push_back(lambdavec);
-	FoMo::tphysvar intens(x_pixel*y_pixel*lambda_pixel,0);
-	
-	// initialise the rendering
-#ifdef _OPENMP
-#pragma omp parallel for private (x,y,lambdaval,ind)
-#endif
-	for (int i=0; i<y_pixel; i++)
-		for (int j=0; j<x_pixel; j++)
-		{
-			// now we're on one ray, through point with coordinates in the image plane
-			x = double(j)/(x_pixel-1)*(maxx-minx)+minx;
-			y = double(i)/(y_pixel-1)*(maxy-miny)+miny;
-						
-			if (lambda_pixel>1)// spectroscopic study
-			{
-				for (int il=0; il<lambda_pixel; il++) // changed index from global variable l into il [D.Y. 17 Nov 2014]
-				{
-					// lambda the relative wavelength around lambda0, with a width of lambda_width
-					lambdaval=double(il)/(lambda_pixel-1)*lambda_width_in_A-lambda_width_in_A/2.;
-					// here a ternary operator may be used
-					// if intpolpeak is not zero then the correct expression is used. otherwise, the intensity is just 0
-					// it remains to be tested if this is faster than just the direct computation
-					//tempintens=intpolpeak ? intpolpeak*exp(-pow(lambdaval-intpollosvel/speedoflight*lambda0,2)/pow(intpolfwhm,2)*4.*log(2.)) : 0;
-					ind=(i*(x_pixel)+j)*lambda_pixel+il;// 
-					newgrid.at(0).at(ind)=x;
-					newgrid.at(1).at(ind)=y;
-					newgrid.at(2).at(ind)=lambdaval+lambda0; // store the full wavelength
-				}
-			}
-			
-			if (lambda_pixel==1) // AIA imaging study. Algorithm not verified [DY 14 Nov 2014]
-			{
-				ind=(i*x_pixel+j); 
-				newgrid.at(0).at(ind)=x;
-				newgrid.at(1).at(ind)=y;
-			}
-		}
+	// only the pixels in the region of interest are rendered
+	int x0, nx, y0, ny;
+	FoMo::regionofinterest(options,x_pixel,y_pixel,x0,nx,y0,ny);
+	// the mapping of this view is recorded if the index is kept
+	if (options.index && options.index->keepviews && !view)
+	{
+		newview=std::make_shared<FoMo::ProjectionView>();
+		newview->minx=minx;
+		newview->maxx=maxx;
+		newview->miny=miny;
+		newview->maxy=maxy;
+		newview->minz=minz;
+		newview->maxz=maxz;
+		newview->pixel.resize(ng);
+	}
+	// the image is stored on regular axes, so that only the intensity is written per pixel
+	FoMo::tphysvar intens(nx*ny*lambda_pixel,0);
 
 	int i,j;
 	double tempintens;
 	// we step through the data points, and add their emissivity to the correct pixel
 #ifdef _OPENMP
-#pragma omp parallel for private(lambdaval,ind,i,j,tempintens) shared(xacc,yacc,peakvec,losvel,fwhmvec,intens)
+#pragma omp parallel private(lambdaval,ind,i,j,tempintens) shared(intens,view,newview)
+#endif
+	{
+	FoMo::ProfileScope scope("render");
+	std::vector<FoMo::ColumnReader> coordreader;
+	for (int c=0; c<dim; c++) coordreader.push_back(FoMo::ColumnReader(goftcube,c));
+	// Read the physical variables
+	FoMo::ColumnReader peakvec=FoMo::rendercolumn(goftcube,dim,options);//Peak intensity 
+	FoMo::ColumnReader fwhmvec=FoMo::rendercolumn(goftcube,dim+1,options);// line width, =1 for AIA imaging
+	std::vector<FoMo::ColumnReader> velreader=FoMo::velocitycolumns(goftcube,lambda_pixel,options);
+	// the lines that are blended into the spectral window, if any
+	const std::vector<FoMo::BlendedLine> * blend=(options.blend && lambda_pixel>1) ? options.blend.get() : NULL;
+#ifdef _OPENMP
+#pragma omp for
 #endif
 	for (int k=0; k<ng; k++)
 	{
-		// xacc.at(k) contains x coordinate of pixel to be added
-		j=std::round((xacc.at(k)-minx)*(x_pixel-1)/(maxx-minx));
-		// yacc.at(k) contains y coordinate of pixel to be added
-		i=std::round((yacc.at(k)-miny)*(y_pixel-1)/(maxy-miny));
+		if (view)
+		{
+			// the pixel of this point is known from a previous rendering
+			if (view->pixel[k] < 0)
+			{
+				++show_progress;
+				continue;
+			}
+			i=view->pixel[k]/nx;
+			j=view->pixel[k]%nx;
+		}
+		else
+		{
+			std::vector<double> gridpoint(dim);
+			for (int c=0; c<dim; c++) gridpoint[c]=coordreader[c][k];
+			double xacc=gridpoint[0]*cos(b)*cos(l)-gridpoint[1]*cos(b)*sin(l)-gridpoint[2]*sin(b);// rotated grid
+			double yacc=gridpoint[0]*sin(l)+gridpoint[1]*cos(l);
+			// xacc contains x coordinate of pixel to be added
+			j=std::round((xacc-minx)*(x_pixel-1)/(maxx-minx));
+			// yacc contains y coordinate of pixel to be added
+			i=std::round((yacc-miny)*(y_pixel-1)/(maxy-miny));
+			// points outside the region of interest are skipped
+			if (j<x0 || j>=x0+nx || i<y0 || i>=y0+ny)
+			{
+				if (newview) newview->pixel[k]=-1;
+				++show_progress;
+				continue;
+			}
+			// from now on, i and j are relative to the region of interest
+			i-=y0;
+			j-=x0;
+			if (newview) newview->pixel[k]=i*nx+j;
+		}
 		
 		if (lambda_pixel>1)// spectroscopic study
 		{
+			double losvel=0;//velocity along line of sight for position [i]/[ng]
+			for (unsigned int c=0; c<velreader.size(); c++) losvel+=unit[c]*velreader[c][k];
 			for (int il=0; il<lambda_pixel; il++) // changed index from global variable l into il [D.Y. 17 Nov 2014]
 			{
 				// lambda the relative wavelength around lambda0, with a width of lambda_width
 				lambdaval=static_cast<double>(il)/(lambda_pixel-1)*lambda_width_in_A-lambda_width_in_A/2.;
-				tempintens=peakvec.at(k)*exp(-pow(lambdaval-losvel.at(k)/speedoflight*lambda0,2)/pow(fwhmvec.at(k),2)*4.*log(2.));
-				ind=(i*(x_pixel)+j)*lambda_pixel+il;// 
+				tempintens=peakvec[k]*exp(-pow(lambdaval-losvel/speedoflight*lambda0,2)/pow(fwhmvec[k],2)*4.*log(2.));
+				// the blended lines are added on the same wavelength axis
+				if (blend) tempintens+=FoMo::blendedintensity(*blend,k,lambdaval,losvel/speedoflight,lambda0);
+				ind=(i*nx+j)*lambda_pixel+il;// 
 #ifdef _OPENMP
 #pragma omp atomic
 #endif
@@ -147,19 +193,24 @@ FoMo::RenderCube projectioninterpolation(FoMo::GoftCube goftcube, const double l
 		
 		if (lambda_pixel==1) // AIA imaging study. Algorithm not verified [DY 14 Nov 2014]
 		{
-			ind=(i*x_pixel+j); 
+			ind=(i*nx+j); 
 #ifdef _OPENMP
 #pragma omp atomic
 #endif
-			intens.at(ind)+=peakvec.at(k);
+			intens.at(ind)+=peakvec[k];
 		}
 		// print progress
 		++show_progress;
 	}
+	}
 	std::cout << " Done! " << std::endl << std::flush;
+	if (newview)
+	{
+		std::lock_guard<std::mutex> guard(options.index->lock);
+		options.index->projectionviews[viewkey]=newview;
+	}
 	
 	FoMo::RenderCube rendercube(goftcube);
-	FoMo::tvars newdata;
 	double pathlength=(maxz-minz)/(z_pixel-1);
 	// this does not work if only one z_pixel is given (e.g. for a 2D simulation), or the maxz and minz are equal (face-on on 2D simulation)
 	// assume that the thickness of the slab is 1Mm. 
@@ -175,33 +226,9 @@ FoMo::RenderCube projectioninterpolation(FoMo::GoftCube goftcube, const double l
 		std::cout << "******Take care to correct this value if you need absolute intensities!" << std::endl << std::flush;
 	}
 	
-	// the intensity does not need to be rescaled for spectroscopic data
-	double apix = 1.;
-	// these are the default units if spectroscopic data
-	std::vector<std::string> unitvec;
-	unitvec.push_back("Mm");
-	unitvec.push_back("Mm");
-	if (lambda_pixel > 1) unitvec.push_back("\\AA{}");
-	unitvec.push_back("erg cm^{-2} s^{-1} \\AA{}^{-1}");
-	// check if the units of emissivity contain DN: then we are dealing with an instrument, and spatial units should be converted to arcsec, 
-	// intensity should be rescaled to pixel size
-	std::size_t found = goftcube.readunit().at(dim).find("DN");
-	if (found!=std::string::npos)
-	{
-		unitvec.at(0)="arcsec";
-		newgrid.at(0)=FoMo::operator*(1./Mmperarcsec,newgrid.at(0));
-		unitvec.at(1)="arcsec";
-		newgrid.at(1)=FoMo::operator*(1./Mmperarcsec,newgrid.at(1));
-		float dx=(maxx-minx)/(x_pixel-1),dy=(maxy-miny)/(y_pixel-1); // are given in Mm
-		apix = (dx/Mmperarcsec)*(dy/Mmperarcsec)*pow(pi/180./3600.,2); 
-		unitvec.back()="DN s^{-1} pixel^{-1}"; // this could be improved using Boost::units, making everything automatic, including compiler checks
-	}
-	
-	intens=FoMo::operator*(pathlength*1e8*apix,intens); // assume that the coordinates in goftcube are given in Mm, and convert to cm
-	newdata.push_back(intens);
-	rendercube.setdata(newgrid,newdata,&unitvec);
+	FoMo::setimage(rendercube,goftcube,options,minx,maxx,miny,maxy,x_pixel,y_pixel,x0,nx,y0,ny,lambda_pixel,lambda_width_in_A,lambda0,pathlength,intens);
 	rendercube.setrendermethod("NearestNeighbour");
-	rendercube.setresolution(x_pixel,y_pixel,z_pixel,lambda_pixel,lambda_width);
+	rendercube.setresolution(nx,ny,z_pixel,lambda_pixel,lambda_width);
 	if (lambda_pixel == 1)
 	{
 		rendercube.setobservationtype(FoMo::Imaging);
@@ -215,25 +242,20 @@ FoMo::RenderCube projectioninterpolation(FoMo::GoftCube goftcube, const double l
 
 namespace FoMo
 {
-	FoMo::RenderCube RenderWithProjection(FoMo::GoftCube goftcube, const int x_pixel, const int y_pixel, const int z_pixel, const int lambda_pixel, const double lambda_width,
-	std::vector<double> lvec, std::vector<double> bvec, std::string outfile)
+	FoMo::RenderCube RenderWithProjection(const FoMo::GoftCube & goftcube, const int x_pixel, const int y_pixel, const int z_pixel, const int lambda_pixel, const double lambda_width,
+	std::vector<double> lvec, std::vector<double> bvec, std::string outfile, const FoMo::RenderOptions & options)
 	{
 		FoMo::RenderCube rendercube(goftcube);
+		if (options.index) FoMo::checkrenderindex(*options.index,goftcube);
 		for (std::vector<double>::iterator lit=lvec.begin(); lit!=lvec.end(); ++lit)
 			for (std::vector<double>::iterator bit=bvec.begin(); bit!=bvec.end(); ++bit)
 			{
-				rendercube=projectioninterpolation(goftcube,*lit,*bit, x_pixel, y_pixel, z_pixel, lambda_pixel, lambda_width);
+				rendercube=projectioninterpolation(goftcube,*lit,*bit, x_pixel, y_pixel, z_pixel, lambda_pixel, lambda_width, options);
+				if (options.sparse) rendercube.sparsify(options.sparsethreshold);
 				rendercube.setangles(*lit,*bit);
-				std::stringstream ss;
 				// if outfile is "", then this should not be executed.
-				ss << outfile;
-				ss << "l";
-				ss << std::setfill('0') << std::setw(3) << std::round(*lit/pi*180.);
-				ss << "b";
-				ss << std::setfill('0') << std::setw(3) << std::round(*bit/pi*180.);
-				ss << ".txt";
-				rendercube.writegoftcube(ss.str());
-				ss.str("");
+				std::string filename=FoMo::renderfilename(outfile,"Projection",*lit,*bit);
+				if (options.write) rendercube.writegoftcube(filename,true);
 			}
 		return rendercube;
 	}
@@ -2,6 +2,9 @@
 #include "FoMo.h"
 #include "FoMo-internal.h"
 #include <iostream>
+#include <cstdlib>
+#include <algorithm>
+#include <cassert>
 #include <gsl/gsl_const_mksa.h>
 
 const double speedoflight=GSL_CONST_MKSA_SPEED_OF_LIGHT; // speed of light
@@ -10,20 +13,19 @@ const double speedoflight=GSL_CONST_MKSA_SPEED_OF_LIGHT; // speed of light
  * @brief The default constructor for a RenderCube.
  * 
  * As part of the initialisation, the information in the GoftCube is copied (such as chiantifile, 
- * abundfile, lambda0, grid). The rendermethod defaults to "NearestNeighbour", and the observationtype to 
- * Spectroscopic.\n
+ * abundfile, lambda0), but not its grid and variables, which are replaced by the rendering. The rendermethod 
+ * defaults to "NearestNeighbour", and the observationtype to Spectroscopic.\n
  * The resolution is also set to initial values of 101 (x resolution), 102 (y resolution), 300
  * (resolution along LOS). The number of pixels in the wavelength direction is set to 30, and the width
  * of the spectral window to \f$200000m/s=200km/s\f$.
  * @param goftcube The GoftCube from which the RenderCube must be constructed.
  */
-FoMo::RenderCube::RenderCube(FoMo::GoftCube goftcube)
+FoMo::RenderCube::RenderCube(const FoMo::GoftCube & goftcube)
 {
 	chiantifile=goftcube.readchiantifile();
 	abundfile=goftcube.readabundfile();
 //	ion=goftcube.readion();
 	lambda0=goftcube.readlambda0();
-	grid=goftcube.readgrid();
 	writeoptions=goftcube.getwriteoptions();
 	x_pixel=101;
 	y_pixel=102;
@@ -32,6 +34,8 @@ FoMo::RenderCube::RenderCube(FoMo::GoftCube goftcube)
 	lambda_width=200000; // spectral window width in m/s
 	rendermethod="NearestNeighbour";
 	observationtype=Spectroscopic;
+	sparse=false;
+	regular=false;
 }
 
 /**
@@ -126,6 +130,40 @@ FoMo::FoMoObservationType FoMo::RenderCube::readobservationtype()
 	return observationtype;
 }
 
+/**
+ * @brief This stores the statistics of the rays of the rendering.
+ * @param statistics The statistics, as collected by the render routine.
+ */
+void FoMo::RenderCube::setraystatistics(const FoMo::RayStatistics & statistics)
+{
+	raystatistics=std::make_shared<const FoMo::RayStatistics>(statistics);
+}
+
+/**
+ * @brief This returns whether the RenderCube has statistics of its rays.
+ * @return True if the statistics were collected, see FoMoObject::setraystatistics().
+ */
+bool FoMo::RenderCube::hasraystatistics() const
+{
+	return bool(raystatistics);
+}
+
+/**
+ * @brief This returns the statistics of the rays of the rendering.
+ * 
+ * It is an error to call this if hasraystatistics() is false.
+ * @return The statistics. The reference is valid as long as the RenderCube exists.
+ */
+const FoMo::RayStatistics & FoMo::RenderCube::readraystatistics() const
+{
+	if (!raystatistics)
+	{
+		std::cerr << "Error: the rendering has no ray statistics, use FoMoObject::setraystatistics() before rendering." << std::endl;
+		exit(EXIT_FAILURE);
+	}
+	return *raystatistics;
+}
+
 /**
  * @brief This sets the angles of the RenderCube.
  * @param lin The l-angle.
@@ -146,4 +184,344 @@ void FoMo::RenderCube::readangles(double & lout, double & bout)
 {
 	lout=l;
 	bout=b;
-}
\ No newline at end of file
+}
+/**
+ * @brief This sets the grid and variables of the RenderCube.
+ * 
+ * This is the same as DataCube::setdata(), but a sparse or regular RenderCube is turned into an ordinary RenderCube first.
+ * @param ingrid The grid of the rendering.
+ * @param indata The variables of the rendering.
+ * @param unitvec The units of the grid and the variables.
+ */
+void FoMo::RenderCube::setdata(tgrid& ingrid, tvars& indata, std::vector<std::string> * unitvec)
+{
+	if (sparse)
+	{
+		std::vector<int>().swap(sparsefirstbin);
+		std::vector<int>().swap(sparsecount);
+		tphysvar().swap(sparsevalues);
+		sparse=false;
+	}
+	regular=false;
+	DataCube::setdata(ingrid,indata,unitvec);
+}
+
+/**
+ * @brief This stores a rendering on regular axes in the RenderCube.
+ * 
+ * The image has count[0] pixels in the x direction, count[1] pixels in the y direction and, for a spectroscopic 
+ * rendering, count[2] wavelength bins. The coordinates along each axis are given by origin[i]+k*step[i]. The intensity 
+ * of pixel (ix,iy) and wavelength bin il is intensity[(iy*count[0]+ix)*count[2]+il], as in the ordinary grid written by 
+ * the render routines. The contents of intensity are moved into the RenderCube.
+ * @param count The number of pixels along x, y (and \f$\lambda\f$).
+ * @param origin The first coordinate along x, y (and \f$\lambda\f$).
+ * @param step The distance between consecutive pixels along x, y (and \f$\lambda\f$).
+ * @param intensity The intensity of every entry.
+ * @param unitvec The units of x, y, (\f$\lambda\f$) and the intensity. If NULL, the units are left unchanged.
+ */
+void FoMo::RenderCube::setregulardata(const std::vector<int> & count, const std::vector<double> & origin, const std::vector<double> & step, 
+	FoMo::tphysvar & intensity, std::vector<std::string> * unitvec)
+{
+	assert((count.size() == 2 || count.size() == 3) && origin.size() >= count.size() && step.size() >= count.size());
+	size_t nentries=1;
+	for (unsigned int i=0; i<count.size(); i++) nentries*=count[i];
+	if (nentries != intensity.size())
+	{
+		std::cerr << "Error: the number of intensities does not match the axes of the rendering." << std::endl << std::flush;
+		exit(EXIT_FAILURE);
+	}
+	// free the previous representation
+	compressed=false;
+	sharedcolumns.clear();
+	std::vector<CompressedVar>().swap(cgrid);
+	std::vector<CompressedVar>().swap(cvars);
+	std::vector<int>().swap(sparsefirstbin);
+	std::vector<int>().swap(sparsecount);
+	tphysvar().swap(sparsevalues);
+	sparse=false;
+	dim=count.size();
+	nvars=1;
+	ng=nentries;
+	tgrid(dim).swap(grid);
+	vars.resize(1);
+	std::swap(vars[0],intensity);
+	tphysvar().swap(intensity);
+	if (unitvec) unit=*unitvec;
+	axiscount=count;
+	axisorigin.assign(origin.begin(),origin.begin()+dim);
+	axisstep.assign(step.begin(),step.begin()+dim);
+	regular=true;
+}
+
+/**
+ * @brief This function allows reading of the grid.
+ * 
+ * For a regular or sparse RenderCube, the coordinates of every entry are computed from the axes. For a sparse 
+ * RenderCube, these are the coordinates of all wavelength bins, as after densify().
+ * @return The grid is returned as a tgrid.
+ */
+FoMo::tgrid FoMo::RenderCube::readgrid() const
+{
+	if (!regular && !sparse) return DataCube::readgrid();
+	int nx=axiscount[0], ny=axiscount[1], nl=(dim == 3) ? axiscount[2] : 1;
+	tgrid outgrid(dim,tcoord(ng));
+	for (int iy=0; iy<ny; iy++)
+		for (int ix=0; ix<nx; ix++)
+			for (int il=0; il<nl; il++)
+			{
+				unsigned int ind=(iy*nx+ix)*nl+il;
+				outgrid[0][ind]=axisorigin[0]+ix*axisstep[0];
+				outgrid[1][ind]=axisorigin[1]+iy*axisstep[1];
+				if (dim == 3) outgrid[2][ind]=axisorigin[2]+il*axisstep[2];
+			}
+	return outgrid;
+}
+
+/**
+ * @brief This function allows reading of a variable.
+ * 
+ * For a sparse RenderCube, the intensity of all wavelength bins is returned, with the bins that were not stored 
+ * set to 0, as after densify(). The RenderCube itself stays sparse.
+ * @param nvar The variable to be read, 0 for the intensity.
+ * @return A copy of the variable.
+ */
+FoMo::tphysvar FoMo::RenderCube::readvar(const unsigned int nvar) const
+{
+	if (!sparse) return DataCube::readvar(nvar);
+	assert(nvar < nvars);
+	int nx=axiscount[0], ny=axiscount[1], nl=axiscount[2];
+	tphysvar intens(ng,0);
+	size_t pos=0;
+	for (int p=0; p<nx*ny; p++)
+	{
+		std::copy(sparsevalues.begin()+pos,sparsevalues.begin()+pos+sparsecount[p],intens.begin()+p*nl+sparsefirstbin[p]);
+		pos+=sparsecount[p];
+	}
+	return intens;
+}
+
+/**
+ * @brief This restores the uncompressed grid and variables of the RenderCube.
+ * 
+ * Apart from DataCube::decompress(), the grid of a regular RenderCube is computed from its axes and stored, so that 
+ * the functions of DataCube that change the grid or variables can be used.
+ */
+void FoMo::RenderCube::decompress()
+{
+	DataCube::decompress();
+	if (!regular) return;
+	tgrid newgrid=readgrid();
+	grid.swap(newgrid);
+	regular=false;
+}
+
+/**
+ * @brief This returns whether the RenderCube is stored on regular axes.
+ * @return True if the coordinates are given by readaxes(), and the intensity is stored for every entry.
+ */
+bool FoMo::RenderCube::isregular() const
+{
+	return regular;
+}
+
+/**
+ * @brief This returns the intensity of the RenderCube, without copying it.
+ * 
+ * For a regular RenderCube, the intensity of pixel (ix,iy) and wavelength bin il is element (iy*nx+ix)*nl+il (see 
+ * readaxes()). The reference is valid as long as the RenderCube is not changed. This cannot be used for a sparse or 
+ * compressed RenderCube: use densify() or decompress() first.
+ * @return The intensity, i.e. the only variable of the RenderCube.
+ */
+const FoMo::tphysvar & FoMo::RenderCube::readintensity() const
+{
+	if (sparse || compressed || (nvars < 1))
+	{
+		std::cerr << "Error: the intensity of a sparse or compressed RenderCube cannot be read without copying." << std::endl << std::flush;
+		exit(EXIT_FAILURE);
+	}
+	return vars[0];
+}
+
+/**
+ * @brief This reads the axes of a regular or sparse RenderCube.
+ * @param count The number of pixels along x, y (and \f$\lambda\f$).
+ * @param origin The first coordinate along x, y (and \f$\lambda\f$).
+ * @param step The distance between consecutive pixels along x, y (and \f$\lambda\f$).
+ */
+void FoMo::RenderCube::readaxes(std::vector<int> & count, std::vector<double> & origin, std::vector<double> & step) const
+{
+	count=axiscount;
+	origin=axisorigin;
+	step=axisstep;
+}
+
+/**
+ * @brief This stores a sparse spectroscopic rendering in the RenderCube.
+ * 
+ * The image has count[0] pixels in the x direction, count[1] pixels in the y direction and count[2] wavelength bins.
+ * The coordinates along each axis are given by origin[i]+k*step[i]. For pixel p=iy*count[0]+ix, the wavelength
+ * bins firstbin[p] up to firstbin[p]+bincount[p]-1 are stored in values, after the bins of all previous pixels.
+ * The other bins are zero. The contents of firstbin, bincount and values are moved into the RenderCube.
+ * @param count The number of pixels along x, y and \f$\lambda\f$.
+ * @param origin The first coordinate along x, y and \f$\lambda\f$.
+ * @param step The distance between consecutive pixels along x, y and \f$\lambda\f$.
+ * @param firstbin The first stored wavelength bin of each pixel.
+ * @param bincount The number of stored wavelength bins of each pixel.
+ * @param values The packed intensities.
+ * @param unitvec The units of x, y, \f$\lambda\f$ and the intensity. If NULL, the units are left unchanged.
+ */
+void FoMo::RenderCube::setsparsedata(const std::vector<int> & count, const std::vector<double> & origin, const std::vector<double> & step, 
+	std::vector<int> & firstbin, std::vector<int> & bincount, tphysvar & values, std::vector<std::string> * unitvec)
+{
+	assert(count.size() == 3 && origin.size() == 3 && step.size() == 3);
+	unsigned int npixels=count[0]*count[1];
+	if ((firstbin.size() != npixels) || (bincount.size() != npixels))
+	{
+		std::cerr << "Error: the number of pixels in the sparse data does not match the number of pixels in the image." << std::endl << std::flush;
+		exit(EXIT_FAILURE);
+	}
+	size_t nvalues=0;
+	for (unsigned int i=0; i<npixels; i++) nvalues+=bincount[i];
+	if (nvalues != values.size())
+	{
+		std::cerr << "Error: the number of sparse values does not match the bin counts." << std::endl << std::flush;
+		exit(EXIT_FAILURE);
+	}
+	// free the dense representation
+	compressed=false;
+	sharedcolumns.clear();
+	tgrid().swap(grid);
+	tvars().swap(vars);
+	std::vector<CompressedVar>().swap(cgrid);
+	std::vector<CompressedVar>().swap(cvars);
+	dim=3;
+	nvars=1;
+	ng=npixels*count[2];
+	if (unitvec) unit=*unitvec;
+	axiscount=count;
+	axisorigin=origin;
+	axisstep=step;
+	std::swap(sparsefirstbin,firstbin);
+	std::swap(sparsecount,bincount);
+	std::swap(sparsevalues,values);
+	regular=false;
+	sparse=true;
+}
+
+/**
+ * @brief This converts a spectroscopic rendering to the sparse representation.
+ * 
+ * The RenderCube should contain a rendering with the ordering of the render routines, i.e. the wavelength 
+ * varies fastest, then x, then y, and the resolution should be set with setresolution(). For each pixel, the bins
+ * at the edges of the spectrum with an intensity not larger than threshold times the peak intensity of that 
+ * spectrum are dropped. With the default threshold of 0, only bins without emission are dropped, and densify() 
+ * restores the intensities exactly. Imaging renderings and RenderCubes that are already sparse are left unchanged.
+ * @param threshold The relative intensity below which the wings of the spectrum are dropped.
+ */
+void FoMo::RenderCube::sparsify(const double threshold)
+{
+	if (sparse || (dim != 3) || (nvars != 1) || (lambda_pixel <= 1)) return;
+	if (ng != (unsigned int)(x_pixel*y_pixel*lambda_pixel))
+	{
+		std::cerr << "Error: the RenderCube does not have the resolution set with setresolution(), it cannot be made sparse." << std::endl << std::flush;
+		exit(EXIT_FAILURE);
+	}
+	DataCube::decompress();
+	std::vector<int> count={x_pixel,y_pixel,lambda_pixel};
+	std::vector<double> origin(3), step(3);
+	if (regular)
+	{
+		origin=axisorigin;
+		step=axisstep;
+	}
+	else
+	{
+		// the pixels are regularly spaced, so that the axes follow from the first elements along each direction
+		std::vector<unsigned int> stride={(unsigned int)lambda_pixel,(unsigned int)(x_pixel*lambda_pixel),1};
+		for (int i=0; i<3; i++)
+		{
+			origin[i]=grid[i][0];
+			step[i]= count[i] > 1 ? grid[i][stride[i]]-grid[i][0] : 0;
+		}
+	}
+	std::vector<int> firstbin(x_pixel*y_pixel,0), bincount(x_pixel*y_pixel,0);
+	tphysvar values;
+	for (int p=0; p<x_pixel*y_pixel; p++)
+	{
+		tphysvar::const_iterator spectrum=vars[0].begin()+p*lambda_pixel;
+		float minintens=threshold*(*std::max_element(spectrum,spectrum+lambda_pixel));
+		int first=0, last=lambda_pixel-1;
+		while (first<lambda_pixel && !(spectrum[first]>minintens)) first++;
+		while (last>=first && !(spectrum[last]>minintens)) last--;
+		if (last>=first)
+		{
+			firstbin[p]=first;
+			bincount[p]=last-first+1;
+			values.insert(values.end(),spectrum+first,spectrum+last+1);
+		}
+	}
+	setsparsedata(count,origin,step,firstbin,bincount,values);
+}
+
+/**
+ * @brief This converts a sparse RenderCube back to a regular RenderCube.
+ * 
+ * The bins that were not stored are set to 0, the axes are kept. If the RenderCube is not sparse, nothing happens.
+ */
+void FoMo::RenderCube::densify()
+{
+	if (!sparse) return;
+	tphysvar intens=readvar(0);
+	std::vector<int> count=axiscount;
+	std::vector<double> origin=axisorigin, step=axisstep;
+	setregulardata(count,origin,step,intens);
+}
+
+/**
+ * @brief This returns whether the RenderCube is stored sparsely.
+ * @return True if the intensity is stored per pixel as a range of wavelength bins.
+ */
+bool FoMo::RenderCube::issparse() const
+{
+	return sparse;
+}
+
+/**
+ * @brief This reads the axes of a sparse RenderCube.
+ * 
+ * This is the same as readaxes().
+ * @param count The number of pixels along x, y and \f$\lambda\f$.
+ * @param origin The first coordinate along x, y and \f$\lambda\f$.
+ * @param step The distance between consecutive pixels along x, y and \f$\lambda\f$.
+ */
+void FoMo::RenderCube::readsparseaxes(std::vector<int> & count, std::vector<double> & origin, std::vector<double> & step) const
+{
+	readaxes(count,origin,step);
+}
+
+/**
+ * @brief This returns the first stored wavelength bin of each pixel of a sparse RenderCube.
+ * @return A vector of length x_pixel*y_pixel.
+ */
+const std::vector<int> & FoMo::RenderCube::readsparsefirstbin() const
+{
+	return sparsefirstbin;
+}
+
+/**
+ * @brief This returns the number of stored wavelength bins of each pixel of a sparse RenderCube.
+ * @return A vector of length x_pixel*y_pixel.
+ */
+const std::vector<int> & FoMo::RenderCube::readsparsecount() const
+{
+	return sparsecount;
+}
+
+/**
+ * @brief This returns the packed intensities of a sparse RenderCube.
+ * @return The stored wavelength bins of all pixels, one pixel after the other.
+ */
+const FoMo::tphysvar & FoMo::RenderCube::readsparsevalues() const
+{
+	return sparsevalues;
+}
@@ -0,0 +1,244 @@
+#include "../config.h"
+#include "FoMo.h"
+#include "FoMo-internal.h"
+#include <iostream>
+#include <cstdlib>
+
+namespace FoMo
+{
+	/**
+	 * @brief The MPI ranks on a node that share the goftcube and the spatial index, see FoMoObject::setnodesharing().
+	 */
+	struct NodeSharing
+	{
+#ifdef HAVEMPI
+		/** The ranks of MPI_COMM_WORLD on this node. */
+		MPI_Comm node=MPI_COMM_NULL;
+		/** The window with the shared goftcube and spatial index, allocated by the first rank of the node. */
+		MPI_Win window=MPI_WIN_NULL;
+#endif
+		/** True if the window contains the spatial index, besides the goftcube. */
+		bool indexshared=false;
+		/** The rank on the node, rank 0 computes the emission and the spatial index. */
+		int noderank=0;
+		/** The number of ranks on the node. */
+		int nodesize=1;
+	};
+}
+
+#ifdef HAVEMPI
+// This sends a string from the first rank of the node to the other ranks.
+static void broadcaststring(std::string & text, MPI_Comm node)
+{
+	unsigned long length=text.size();
+	MPI_Bcast(&length,1,MPI_UNSIGNED_LONG,0,node);
+	text.resize(length);
+	MPI_Bcast(&text[0],length,MPI_CHAR,0,node);
+}
+#endif
+
+/**
+ * @brief This sets whether the MPI ranks on a node share the goftcube and the spatial index.
+ *
+ * When every core runs its own MPI rank, every rank would otherwise compute its own goftcube and build its own
+ * spatial index, which multiplies the memory by the number of ranks per node. With node sharing, render() is
+ * collective over the ranks of a node: the first rank of the node computes the goftcube from its datacube and
+ * builds the spatial index of the NearestNeighbour rendermethod, and copies both into an MPI-3 shared memory
+ * window. All ranks of the node then render their own views (passed to render()) from the window, read-only, and
+ * every rank writes the views that it renders, rather than only the first rank of MPI_COMM_WORLD. The ranks should
+ * thus render different views, or set a different outfile (see setoutfile()). The datacube of the other ranks is
+ * not used, and can be left empty. The window is only rebuilt if the data, the
+ * emission settings or the spatial index change, so that further render() calls only exchange the settings.\n
+ * Only the pointer-free spatial indexes can be shared: the "rtree" spatial index is replaced by the "kdtree",
+ * which finds the same nearest points. The emission is not computed lazily (see setlazyemission()). The other
+ * rendermethods render from the shared goftcube, but the CGAL rendermethods still build their own triangulation
+ * on every rank. The "auto" rendermethod is not supported. The render cache (see setrendercache()) is keyed on the
+ * datacube of the first rank, and should be set on all ranks: every rank stores the views that it renders. Every rank
+ * records its views in its own checkpoint manifest (see setcheckpointfile()). The index is kept between renderings (see
+ * setreuseindex()), and copies of the FoMoObject should not be rendered while the node sharing is on.\n
+ * This call is collective over MPI_COMM_WORLD. Switching the node sharing off is collective as well: every rank
+ * then takes a private copy of the goftcube and the spatial index, and the window is released. It needs FoMo
+ * to be compiled with MPI (configure --with-mpi).
+ * @param share If true (the default), the goftcube and spatial index are shared between the ranks on a node.
+ */
+void FoMo::FoMoObject::setnodesharing(const bool share)
+{
+#ifdef HAVEMPI
+	if (share && !nodesharing)
+	{
+		nodesharing=std::make_shared<FoMo::NodeSharing>();
+		MPI_Comm_split_type(MPI_COMM_WORLD,MPI_COMM_TYPE_SHARED,0,MPI_INFO_NULL,&nodesharing->node);
+		MPI_Comm_rank(nodesharing->node,&nodesharing->noderank);
+		MPI_Comm_size(nodesharing->node,&nodesharing->nodesize);
+		if (!renderindex) this->setreuseindex();
+		// the goftcube and index of the other ranks are replaced by those of the first rank at the next render()
+		emissionkey.clear();
+	}
+	if (!share && nodesharing)
+	{
+		if (nodesharing->window != MPI_WIN_NULL)
+		{
+			this->goftcube.decompress();
+			FoMo::SharedLayout detach(FoMo::SharedLayout::Detach);
+			FoMo::layoutnearestneighbourindex(*renderindex,detach,this->renderoptions());
+			MPI_Win_free(&nodesharing->window);
+		}
+		MPI_Comm_free(&nodesharing->node);
+		nodesharing.reset();
+	}
+#else
+	if (share)
+	{
+		std::cerr << "Error: sharing the data between the ranks of a node needs FoMo to be compiled with MPI." << std::endl << std::flush;
+		exit(EXIT_FAILURE);
+	}
+#endif
+}
+
+/**
+ * @brief This returns whether the goftcube and the spatial index are shared between the MPI ranks of a node.
+ * @return True if setnodesharing() was switched on.
+ */
+bool FoMo::FoMoObject::readnodesharing()
+{
+	return bool(nodesharing);
+}
+
+/**
+ * @brief This shares the goftcube and the spatial index of the first rank of the node with the other ranks.
+ *
+ * It is called by render() on all ranks of the node, see setnodesharing(). The first rank computes the emission,
+ * and for the NearestNeighbour rendermethod builds the spatial index. If either is new, the previous window is
+ * released, and a new window holds the columns of the goftcube followed by the spatial index (see SharedLayout).
+ * All ranks then read the goftcube and the spatial index from the window. The other ranks take over the settings
+ * of the goftcube, so that computeemission() does not compute it again.
+ * @return The hash of the datacube of the first rank (see hashdatacube()) if a render cache is set there (see
+ * setrendercache()), or 0. The datacube of the other ranks may be empty, so that the render cache uses this hash.
+ */
+uint64_t FoMo::FoMoObject::sharenode()
+{
+#ifdef HAVEMPI
+	if (automethod)
+	{
+		std::cerr << "Error: the auto rendermethod cannot be used when the data is shared between the ranks of a node." << std::endl << std::flush;
+		exit(EXIT_FAILURE);
+	}
+	MPI_Comm node=nodesharing->node;
+	bool leader=(nodesharing->noderank == 0);
+	FoMo::RenderOptions options=this->renderoptions();
+	bool nearestneighbour=(rendering.readrendermethod() == "NearestNeighbour");
+
+	// the first rank computes the goftcube and the spatial index, which are new if they are not in the window yet
+	int changed=(nodesharing->window == MPI_WIN_NULL);
+	if (leader)
+	{
+		this->computeemission();
+		if (!goftcube.isshared()) changed=1;
+		if (nearestneighbour)
+		{
+			FoMo::checkrenderindex(*renderindex,goftcube);
+			if (FoMo::buildnearestneighbourindex(*renderindex,goftcube,options) || !nodesharing->indexshared) changed=1;
+		}
+	}
+	MPI_Bcast(&changed,1,MPI_INT,0,node);
+	int shareindex=nearestneighbour;
+	MPI_Bcast(&shareindex,1,MPI_INT,0,node);
+	std::string key=emissionkey;
+	broadcaststring(key,node);
+	uint64_t nodedatahash=(leader && !rendercache.empty()) ? this->hashdata() : 0;
+	MPI_Bcast(&nodedatahash,1,MPI_UINT64_T,0,node);
+	if (!changed)
+	{
+		emissionkey=key;
+		return nodedatahash;
+	}
+
+	// the goftcube and index that are still in the previous window are copied out by the first rank, and dropped by the others
+	std::bitset<FoMo::noptions> woptions=goftcube.getwriteoptions();
+	if (nodesharing->window != MPI_WIN_NULL)
+	{
+		if (leader)
+		{
+			goftcube.decompress();
+			FoMo::SharedLayout detach(FoMo::SharedLayout::Detach);
+			FoMo::layoutnearestneighbourindex(*renderindex,detach,options);
+		}
+		else
+		{
+			goftcube=FoMo::GoftCube(goftcube.readdim());
+			std::lock_guard<std::mutex> guard(renderindex->lock);
+			renderindex->nearestneighbour.reset();
+		}
+		MPI_Win_free(&nodesharing->window);
+	}
+
+	// the shape and settings of the goftcube
+	int shape[3]={goftcube.readdim(),goftcube.readnvars(),goftcube.readngrid()};
+	MPI_Bcast(shape,3,MPI_INT,0,node);
+	int ncolumns=shape[0]+shape[1];
+	size_t columnbytes=(size_t(shape[2])*sizeof(float)+7)/8*8;
+	double lambda0=goftcube.readlambda0();
+	MPI_Bcast(&lambda0,1,MPI_DOUBLE,0,node);
+	std::string chiantifile=goftcube.readchiantifile(), abundfile=goftcube.readabundfile();
+	broadcaststring(chiantifile,node);
+	broadcaststring(abundfile,node);
+	std::vector<std::string> unit=goftcube.readunit();
+	unit.resize(ncolumns);
+	for (int c=0; c<ncolumns; c++) broadcaststring(unit[c],node);
+
+	// the first rank allocates the window and copies the goftcube and the spatial index into it
+	size_t bytes=0;
+	if (leader)
+	{
+		FoMo::SharedLayout size(FoMo::SharedLayout::Size);
+		if (shareindex) FoMo::layoutnearestneighbourindex(*renderindex,size,options);
+		bytes=ncolumns*columnbytes+size.size();
+	}
+	char * memory;
+	MPI_Win_allocate_shared(bytes,1,MPI_INFO_NULL,node,&memory,&nodesharing->window);
+	if (leader)
+	{
+		FoMo::ProfileScope scope("share");
+		for (int c=0; c<ncolumns; c++)
+		{
+			FoMo::ColumnReader reader(goftcube,c);
+			float * column=reinterpret_cast<float *>(memory+c*columnbytes);
+			for (int i=0; i<shape[2]; i++) column[i]=reader[i];
+		}
+		FoMo::SharedLayout write(FoMo::SharedLayout::Write,memory+ncolumns*columnbytes);
+		if (shareindex) FoMo::layoutnearestneighbourindex(*renderindex,write,options);
+		std::cout << "Sharing " << bytes/1e6 << "MB of goftcube" << (shareindex ? " and " + options.spatialindex + " index" : "");
+		std::cout << " with " << nodesharing->nodesize-1 << " other ranks on the node." << std::endl << std::flush;
+	}
+	// the fence makes the copy of the first rank visible to the other ranks
+	MPI_Win_fence(0,nodesharing->window);
+
+	// all ranks read the goftcube and the spatial index from the window
+	MPI_Aint windowsize;
+	int displacement;
+	MPI_Win_shared_query(nodesharing->window,0,&windowsize,&displacement,&memory);
+	std::vector<const float *> columns(ncolumns);
+	for (int c=0; c<ncolumns; c++) columns[c]=reinterpret_cast<const float *>(memory+c*columnbytes);
+	if (!leader)
+	{
+		goftcube=FoMo::GoftCube(shape[0]);
+		goftcube.setchiantifile(chiantifile);
+		goftcube.setabundfile(abundfile);
+		goftcube.setlambda0(lambda0);
+		goftcube.setwriteoptions(woptions);
+		emission.reset();
+	}
+	goftcube.setshared(columns,shape[2],&unit);
+	emissionkey=key;
+	if (shareindex)
+	{
+		if (!leader) FoMo::checkrenderindex(*renderindex,goftcube);
+		FoMo::SharedLayout attach(FoMo::SharedLayout::Attach,memory+ncolumns*columnbytes);
+		FoMo::layoutnearestneighbourindex(*renderindex,attach,options);
+	}
+	nodesharing->indexshared=shareindex;
+	return nodedatahash;
+#else
+	return 0;
+#endif
+}
@@ -0,0 +1,308 @@
+#include "../config.h"
+#include "FoMo.h"
+#include "FoMo-internal.h"
+#include <sstream>
+#include <iomanip>
+#include <cstdlib>
+#include <gsl/gsl_const_mksa.h>
+#include <boost/progress.hpp>
+#include <cmath>
+#include <numeric>
+#include <algorithm>
+
+#include <boost/geometry.hpp>
+#include <boost/geometry/geometries/point.hpp>
+#include <boost/geometry/geometries/box.hpp>
+#include <boost/geometry/index/rtree.hpp>
+namespace bg = boost::geometry;
+namespace bgi = boost::geometry::index;
+
+typedef bg::model::point<float, 2, bg::cs::cartesian> point2d;
+typedef bg::model::box<point2d> box2d;
+typedef std::pair<point2d, unsigned> value2d;
+typedef bgi::rtree< value2d, bgi::quadratic<16> > rtree2d;
+
+const double speedoflight=GSL_CONST_MKSA_SPEED_OF_LIGHT; // speed of light
+const double pi=M_PI; //pi
+
+/**
+ * @brief This finds the nearest data point of a 2D DataCube to a point in its plane.
+ *
+ * If the data points form a regular lattice (in any order), the nearest point is found by rounding the coordinates.
+ * Otherwise, a 2D R-tree is used, and only points within two typical grid spacings are taken into account.
+ */
+class PlaneLocator
+{
+protected:
+	bool regular;
+	int nux, nuy;
+	std::vector<int> lattice;
+	rtree2d tree;
+public:
+	/** The bounding box of the data points. */
+	double minx, maxx, miny, maxy;
+	/** The typical distance between data points. */
+	double spacing;
+	PlaneLocator(const FoMo::GoftCube & goftcube);
+	int nearest(const double x, const double y) const;
+};
+
+/**
+ * @brief This sets up the nearest neighbour look-up for the grid of a 2D goftcube.
+ * @param goftcube The goftcube, of dimension 2.
+ */
+PlaneLocator::PlaneLocator(const FoMo::GoftCube & goftcube):
+	regular(false), nux(0), nuy(0)
+{
+	int ng=goftcube.readngrid();
+	FoMo::ColumnReader xreader(goftcube,0), yreader(goftcube,1);
+	FoMo::tcoord xvec(ng), yvec(ng);
+	for (int i=0; i<ng; i++)
+	{
+		xvec[i]=xreader[i];
+		yvec[i]=yreader[i];
+	}
+	minx=*std::min_element(xvec.begin(),xvec.end());
+	maxx=*std::max_element(xvec.begin(),xvec.end());
+	miny=*std::min_element(yvec.begin(),yvec.end());
+	maxy=*std::max_element(yvec.begin(),yvec.end());
+
+	// check for a regular lattice: the unique coordinates should be equidistant, and every lattice point should occur once
+	FoMo::tcoord ux(xvec), uy(yvec);
+	std::sort(ux.begin(),ux.end());
+	ux.erase(std::unique(ux.begin(),ux.end()),ux.end());
+	std::sort(uy.begin(),uy.end());
+	uy.erase(std::unique(uy.begin(),uy.end()),uy.end());
+	nux=ux.size();
+	nuy=uy.size();
+	if (nux > 1 && nuy > 1 && size_t(nux)*nuy == size_t(ng))
+	{
+		double dx=(maxx-minx)/(nux-1), dy=(maxy-miny)/(nuy-1);
+		regular=true;
+		for (int i=0; i<nux && regular; i++) regular=std::abs(ux[i]-minx-i*dx) < 1e-3*dx;
+		for (int i=0; i<nuy && regular; i++) regular=std::abs(uy[i]-miny-i*dy) < 1e-3*dy;
+		if (regular) lattice.assign(ng,-1);
+		for (int i=0; i<ng && regular; i++)
+		{
+			int ix=std::round((xvec[i]-minx)/dx), iy=std::round((yvec[i]-miny)/dy);
+			int & entry=lattice[iy*nux+ix];
+			regular=(entry == -1);
+			entry=i;
+		}
+		if (!regular) std::vector<int>().swap(lattice);
+	}
+	spacing=std::sqrt((maxx-minx)*(maxy-miny)/ng);
+	if (regular)
+	{
+		spacing=std::min((maxx-minx)/(nux-1),(maxy-miny)/(nuy-1));
+		std::cout << "The 2D grid is a regular lattice of " << nux << "x" << nuy << " points." << std::endl << std::flush;
+	}
+	else
+	{
+		std::cout << "Building 2D R-tree..." << std::flush;
+		std::vector<value2d> input_values(ng);
+		for (int i=0; i<ng; i++) input_values[i]=std::make_pair(point2d(xvec[i],yvec[i]),i);
+		tree=rtree2d(input_values.begin(),input_values.end());
+		std::cout << "Done!" << std::endl << std::flush;
+	}
+}
+
+/**
+ * @brief This returns the nearest data point.
+ * @param x The x-coordinate in the plane of the data.
+ * @param y The y-coordinate in the plane of the data.
+ * @return The index of the nearest data point, or -1 if there is no data point close enough.
+ */
+int PlaneLocator::nearest(const double x, const double y) const
+{
+	if (regular)
+	{
+		int ix=std::round((x-minx)/(maxx-minx)*(nux-1)), iy=std::round((y-miny)/(maxy-miny)*(nuy-1));
+		if (ix<0 || ix>=nux || iy<0 || iy>=nuy) return -1;
+		return lattice[iy*nux+ix];
+	}
+	std::vector<value2d> returned_values;
+	box2d maxdistancebox(point2d(x-2*spacing,y-2*spacing),point2d(x+2*spacing,y+2*spacing));
+	tree.query(bgi::nearest(point2d(x,y),1) && bgi::within(maxdistancebox), std::back_inserter(returned_values));
+	if (returned_values.empty()) return -1;
+	return returned_values[0].second;
+}
+
+/**
+ * @brief This clips the interval [t1,t2] of a ray a+t*u to the part where lower <= a+t*u <= upper.
+ * @return False if the clipped interval is empty.
+ */
+inline bool clipray(const double a, const double u, const double lower, const double upper, double & t1, double & t2)
+{
+	if (u == 0) return (a >= lower) && (a <= upper) && (t1 < t2);
+	double ta=(lower-a)/u, tb=(upper-a)/u;
+	t1=std::max(t1,std::min(ta,tb));
+	t2=std::min(t2,std::max(ta,tb));
+	return t1 < t2;
+}
+
+FoMo::RenderCube slabinterpolation(const FoMo::GoftCube & goftcube, const PlaneLocator & locator, const double l, const double b, const int x_pixel, const int y_pixel, const int z_pixel, const int lambda_pixel, const double lambda_width, const FoMo::RenderOptions & options)
+{
+	int commrank;
+#ifdef HAVEMPI
+	MPI_Comm_rank(MPI_COMM_WORLD,&commrank);
+#else
+	commrank = 0;
+#endif
+	int dim=goftcube.readdim();
+	double depth=options.depth;
+
+	// The data is invariant along the z-axis, for -depth/2 <= z <= depth/2
+	// The image plane is found by rotating the corners of this slab over an angle -l (around z-axis), and -b (around y-axis)
+	double minx=INFINITY, maxx=-INFINITY, miny=INFINITY, maxy=-INFINITY;
+	for (int c=0; c<8; c++)
+	{
+		double gx= c&1 ? locator.maxx : locator.minx;
+		double gy= c&2 ? locator.maxy : locator.miny;
+		double gz= c&4 ? depth/2. : -depth/2.;
+		double xacc=gx*cos(b)*cos(l)-gy*cos(b)*sin(l)-gz*sin(b);
+		double yacc=gx*sin(l)+gy*cos(l);
+		minx=std::min(minx,xacc);
+		maxx=std::max(maxx,xacc);
+		miny=std::min(miny,yacc);
+		maxy=std::max(maxy,yacc);
+	}
+	// Define the unit vector along the line-of-sight
+	std::vector<double> unit = {sin(b)*cos(l), -sin(b)*sin(l), cos(b)};
+	// the length of the projection of a piece of the ray onto the plane of the data
+	double planefraction=std::sqrt(unit[0]*unit[0]+unit[1]*unit[1]);
+
+	std::string chiantifile=goftcube.readchiantifile();
+	double lambda0=goftcube.readlambda0();// lambda0=AIA bandpass for AIA imaging
+	double lambda_width_in_A=lambda_width*lambda0/speedoflight;
+
+	// only the pixels in the region of interest are rendered
+	int x0, nx, y0, ny;
+	FoMo::regionofinterest(options,x_pixel,y_pixel,x0,nx,y0,ny);
+	// the image is stored on regular axes, so that only the intensity is written per pixel
+	FoMo::tphysvar intens(nx*ny*lambda_pixel,0);
+
+	if (commrank==0) std::cout << "Building frame: " << std::flush;
+	boost::progress_display show_progress(nx*ny);
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+	{
+	FoMo::ProfileScope scope("render");
+	FoMo::ColumnReader peakvec=FoMo::rendercolumn(goftcube,dim,options);//Peak intensity
+	FoMo::ColumnReader fwhmvec=FoMo::rendercolumn(goftcube,dim+1,options);// line width, =1 for AIA imaging
+	std::vector<FoMo::ColumnReader> velreader=FoMo::velocitycolumns(goftcube,lambda_pixel,options);
+	// the lines that are blended into the spectral window, if any
+	const std::vector<FoMo::BlendedLine> * blend=(options.blend && lambda_pixel>1) ? options.blend.get() : NULL;
+	// the nearest points along the ray, with the length of the ray (in Mm) that they cover
+	std::vector<std::pair<int,double> > runs;
+	FoMo::tphysvar rayspectrum(lambda_pixel);
+#ifdef _OPENMP
+#pragma omp for collapse(2) schedule(dynamic)
+#endif
+	for (int i=y0; i<y0+ny; i++)
+		for (int j=x0; j<x0+nx; j++)
+		{
+			double x = double(j)/(x_pixel-1)*(maxx-minx)+minx;
+			double y = double(i)/(y_pixel-1)*(maxy-miny)+miny;
+			// the ray is a+t*unit, with a the derotated point in the image plane
+			std::vector<double> a={x*cos(b)*cos(l)+y*sin(l),-x*cos(b)*sin(l)+y*cos(l),-x*sin(b)};
+			std::fill(rayspectrum.begin(),rayspectrum.end(),0);
+			runs.clear();
+
+			// the part of the ray inside the slab and above the data
+			double t1=-INFINITY, t2=INFINITY;
+			if (clipray(a[2],unit[2],-depth/2.,depth/2.,t1,t2) && clipray(a[0],unit[0],locator.minx,locator.maxx,t1,t2) && clipray(a[1],unit[1],locator.miny,locator.maxy,t1,t2))
+			{
+				// the emission does not change along the invariant direction: a ray along it only needs one sample,
+				// otherwise the projection of the ray onto the data is sampled at about the grid spacing, with at most z_pixel samples
+				int nsamples=std::ceil((t2-t1)*planefraction/locator.spacing);
+				nsamples=std::max(1,std::min(nsamples,z_pixel));
+				double dt=(t2-t1)/nsamples;
+				for (int k=0; k<nsamples; k++)
+				{
+					double t=t1+(k+0.5)*dt;
+					int nearestindex=locator.nearest(a[0]+t*unit[0],a[1]+t*unit[1]);
+					if (nearestindex < 0) continue;
+					if (!runs.empty() && runs.back().first == nearestindex) runs.back().second+=dt;
+					else runs.push_back(std::make_pair(nearestindex,dt));
+				}
+			}
+
+			for (unsigned int r=0; r<runs.size(); r++)
+			{
+				int nearestindex=runs[r].first;
+				double intpolpeak=peakvec[nearestindex]*runs[r].second;
+				if (lambda_pixel>1)// spectroscopic study
+				{
+					double intpolfwhm=fwhmvec[nearestindex];
+					double intpollosvel=0;
+					for (unsigned int c=0; c<velreader.size(); c++) intpollosvel+=unit[c]*velreader[c][nearestindex];
+					for (int il=0; il<lambda_pixel; il++)
+					{
+						// lambda the relative wavelength around lambda0, with a width of lambda_width
+						double lambdaval=double(il)/(lambda_pixel-1)*lambda_width_in_A-lambda_width_in_A/2.;
+						rayspectrum[il]+=intpolpeak ? intpolpeak*exp(-pow(lambdaval-intpollosvel/speedoflight*lambda0,2)/pow(intpolfwhm,2)*4.*log(2.)) : 0;
+						// the blended lines are added on the same wavelength axis, weighted with the same length of the ray
+						if (blend) rayspectrum[il]+=runs[r].second*FoMo::blendedintensity(*blend,nearestindex,lambdaval,intpollosvel/speedoflight,lambda0);
+					}
+				}
+				if (lambda_pixel==1) // AIA imaging study
+				{
+					rayspectrum[0]+=intpolpeak;
+				}
+			}
+
+			// every ray has its own pixel, so that no collision between threads can occur
+			std::copy(rayspectrum.begin(),rayspectrum.end(),intens.begin()+((i-y0)*nx+j-x0)*lambda_pixel);
+			++show_progress;
+		}
+	}
+	if (commrank==0) std::cout << " Done! " << std::endl << std::flush;
+
+	FoMo::RenderCube rendercube(goftcube);
+	// the path lengths of the rays are already in the intensity, in Mm
+	FoMo::setimage(rendercube,goftcube,options,minx,maxx,miny,maxy,x_pixel,y_pixel,x0,nx,y0,ny,lambda_pixel,lambda_width_in_A,lambda0,1.,intens);
+	if (options.sparse && (lambda_pixel > 1)) rendercube.sparsify(options.sparsethreshold);
+	rendercube.setrendermethod("Slab");
+	rendercube.setresolution(nx,ny,z_pixel,lambda_pixel,lambda_width);
+	if (lambda_pixel == 1)
+	{
+		rendercube.setobservationtype(FoMo::Imaging);
+	}
+	else
+	{
+		rendercube.setobservationtype(FoMo::Spectroscopic);
+	}
+	return rendercube;
+}
+
+namespace FoMo
+{
+	FoMo::RenderCube RenderWithSlab(const FoMo::GoftCube & goftcube, const int x_pixel, const int y_pixel, const int z_pixel, const int lambda_pixel, const double lambda_width,
+	std::vector<double> lvec, std::vector<double> bvec, std::string outfile, const FoMo::RenderOptions & options)
+	{
+		if (goftcube.readdim() != 2)
+		{
+			std::cerr << "Error: the Slab rendermethod needs a 2D DataCube." << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		if (options.depth <= 0)
+		{
+			std::cerr << "Error: the depth of the slab should be positive." << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		FoMo::RenderCube rendercube(goftcube);
+		PlaneLocator locator(goftcube);
+		for (std::vector<double>::iterator lit=lvec.begin(); lit!=lvec.end(); ++lit)
+			for (std::vector<double>::iterator bit=bvec.begin(); bit!=bvec.end(); ++bit)
+			{
+				rendercube=slabinterpolation(goftcube,locator,*lit,*bit, x_pixel, y_pixel, z_pixel, lambda_pixel, lambda_width, options);
+				rendercube.setangles(*lit,*bit);
+				// if outfile is "", then this should not be executed.
+				std::string filename=FoMo::renderfilename(outfile,"Slab",*lit,*bit);
+				if (options.write) rendercube.writegoftcube(filename,true);
+			}
+		return rendercube;
+	}
+}
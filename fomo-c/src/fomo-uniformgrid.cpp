@@ -0,0 +1,199 @@
+#include "../config.h"
+#include "FoMo.h"
+#include "FoMo-internal.h"
+#include <cmath>
+#include <algorithm>
+
+/**
+ * @brief This constructs an empty UniformGrid.
+ */
+FoMo::UniformGrid::UniformGrid(): origin{0,0,0}, cellsize(1), ncells{1,1,1}, cellstart(2,0)
+{
+}
+
+/**
+ * @brief This builds the UniformGrid of a set of points.
+ *
+ * Dimensions in which the points are (almost) not spread out, such as the z-coordinate of a 2D DataCube, get 
+ * only one cell.
+ * @param x The x-coordinates of the points.
+ * @param y The y-coordinates of the points.
+ * @param z The z-coordinates of the points.
+ */
+FoMo::UniformGrid::UniformGrid(const std::vector<float> & x, const std::vector<float> & y, const std::vector<float> & z)
+{
+	int n=x.size();
+	const std::vector<float> * coord[3]={&x,&y,&z};
+	float minc[3]={0,0,0}, maxc[3]={0,0,0};
+	for (int d=0; d<3; d++)
+		if (n > 0)
+		{
+			minc[d]=*std::min_element(coord[d]->begin(),coord[d]->end());
+			maxc[d]=*std::max_element(coord[d]->begin(),coord[d]->end());
+		}
+	// the mean distance between the points, over the dimensions in which they are spread out
+	double largest=std::max(maxc[0]-minc[0],std::max(maxc[1]-minc[1],maxc[2]-minc[2]));
+	double volume=1.;
+	int nspread=0;
+	for (int d=0; d<3; d++)
+		if (maxc[d]-minc[d] > 1e-6*largest)
+		{
+			volume*=maxc[d]-minc[d];
+			nspread++;
+		}
+	cellsize=(nspread > 0 && n > 0) ? std::pow(volume/n,1./nspread) : 1.;
+	// the number of cells should not be much larger than the number of points (e.g. if the points are on a line)
+	long totalcells;
+	do
+	{
+		totalcells=1;
+		for (int d=0; d<3; d++)
+		{
+			origin[d]=minc[d];
+			ncells[d]=(maxc[d]-minc[d] > 1e-6*largest) ? int(std::floor((maxc[d]-minc[d])/cellsize))+1 : 1;
+			totalcells*=ncells[d];
+		}
+		if (totalcells > 2*long(n)+1) cellsize*=1.26;
+	}
+	while (totalcells > 2*long(n)+1);
+
+	// sort the points by cell (a counting sort, which keeps the order of the points within a cell)
+	std::vector<int> cellofpoint(n);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int i=0; i<n; i++)
+	{
+		int c[3];
+		for (int d=0; d<3; d++) c[d]=std::min(std::max(int(((*coord[d])[i]-origin[d])/cellsize),0),ncells[d]-1);
+		cellofpoint[i]=(c[2]*ncells[1]+c[1])*ncells[0]+c[0];
+	}
+	cellstart.assign(totalcells+1,0);
+	for (int i=0; i<n; i++) cellstart[cellofpoint[i]+1]++;
+	for (long c=0; c<totalcells; c++) cellstart[c+1]+=cellstart[c];
+	std::vector<int> next(cellstart.begin(),cellstart.end()-1);
+	pointid.resize(n);
+	for (int i=0; i<n; i++) pointid[next[cellofpoint[i]]++]=i;
+	px.resize(n);
+	py.resize(n);
+	pz.resize(n);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int i=0; i<n; i++)
+	{
+		px[i]=x[pointid[i]];
+		py[i]=y[pointid[i]];
+		pz[i]=z[pointid[i]];
+	}
+}
+
+// This updates best and bestdistance (squared) with the nearest point inside the cube around the position, of the 
+// consecutive cells firstcell to lastcell (which are next to each other along x).
+void FoMo::UniformGrid::searchcells(const int firstcell, const int lastcell, const float x, const float y, const float z, const float maxdistance, int & best, float & bestdistance) const
+{
+	// the distances are computed in one vectorised loop per chunk of points, points outside of the cube get an infinite distance
+	const int chunksize=16;
+	float distance[chunksize];
+	int end=cellstart[lastcell+1];
+	for (int lo=cellstart[firstcell]; lo<end; lo+=chunksize)
+	{
+		int n=std::min(chunksize,end-lo);
+		const float * lx=px.data()+lo;
+		const float * ly=py.data()+lo;
+		const float * lz=pz.data()+lo;
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+		for (int i=0; i<n; i++)
+		{
+			float dx=lx[i]-x, dy=ly[i]-y, dz=lz[i]-z;
+			bool inside=(std::fabs(dx) < maxdistance) & (std::fabs(dy) < maxdistance) & (std::fabs(dz) < maxdistance);
+			distance[i]=inside ? dx*dx+dy*dy+dz*dz : INFINITY;
+		}
+		for (int i=0; i<n; i++)
+			if (distance[i] < bestdistance)
+			{
+				bestdistance=distance[i];
+				best=lo+i;
+			}
+	}
+}
+
+/**
+ * @brief This finds the nearest point inside a cube around a position.
+ *
+ * Only the points strictly inside the cube with half-side maxdistance around the position are considered,
+ * as for a query of the nearest point within a box in the Boost R-tree. Of these points, the one at the
+ * smallest Euclidean distance is returned.
+ * @param x The x-coordinate of the position.
+ * @param y The y-coordinate of the position.
+ * @param z The z-coordinate of the position.
+ * @param maxdistance The half-side of the cube.
+ * @return The index of the nearest point in the input of the constructor, or -1 if there is no point in the cube.
+ */
+int FoMo::UniformGrid::nearest(const float x, const float y, const float z, const float maxdistance) const
+{
+	const float query[3]={x,y,z};
+	// the cell of the position, and the range of cells that overlap with the cube
+	int center[3], first[3], last[3];
+	for (int d=0; d<3; d++)
+	{
+		center[d]=std::min(std::max(int(std::floor((query[d]-origin[d])/cellsize)),0),ncells[d]-1);
+		first[d]=std::max(int(std::floor((query[d]-maxdistance-origin[d])/cellsize)),0);
+		last[d]=std::min(int(std::floor((query[d]+maxdistance-origin[d])/cellsize)),ncells[d]-1);
+		if (first[d] > last[d]) return -1;
+	}
+	int best=-1;
+	float bestdistance=INFINITY;
+	for (int r=0; ; r++)
+	{
+		// search the cells at distance r (in cells) of the center, per row along x: the points of a row are consecutive
+		int ifirst=std::max(center[0]-r,first[0]), ilast=std::min(center[0]+r,last[0]);
+		for (int k=std::max(center[2]-r,first[2]); k<=std::min(center[2]+r,last[2]); k++)
+			for (int j=std::max(center[1]-r,first[1]); j<=std::min(center[1]+r,last[1]); j++)
+			{
+				int row=(k*ncells[1]+j)*ncells[0];
+				if (std::abs(j-center[1]) == r || std::abs(k-center[2]) == r)
+				{
+					// the whole row is on the shell
+					if (ifirst <= ilast) searchcells(row+ifirst,row+ilast,x,y,z,maxdistance,best,bestdistance);
+				}
+				else
+				{
+					// only the ends of the row are on the shell
+					if (center[0]-r >= first[0]) searchcells(row+center[0]-r,row+center[0]-r,x,y,z,maxdistance,best,bestdistance);
+					if (r > 0 && center[0]+r <= last[0]) searchcells(row+center[0]+r,row+center[0]+r,x,y,z,maxdistance,best,bestdistance);
+				}
+			}
+		// stop if all cells overlapping with the cube have been searched, 
+		// or if the remaining cells are further away than the nearest point
+		bool covered=true;
+		float remaining=INFINITY;
+		for (int d=0; d<3; d++)
+		{
+			if (center[d]-r > first[d])
+			{
+				covered=false;
+				remaining=std::min(remaining,query[d]-(origin[d]+(center[d]-r)*cellsize));
+			}
+			if (center[d]+r < last[d])
+			{
+				covered=false;
+				remaining=std::min(remaining,origin[d]+(center[d]+r+1)*cellsize-query[d]);
+			}
+		}
+		if (covered) break;
+		if (best >= 0 && remaining > 0 && remaining*remaining >= bestdistance) break;
+	}
+	return (best >= 0) ? pointid[best] : -1;
+}
+
+/**
+ * @brief This returns the number of points in the UniformGrid.
+ * @return The number of points.
+ */
+size_t FoMo::UniformGrid::size() const
+{
+	return pointid.size();
+}
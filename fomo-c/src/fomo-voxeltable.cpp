@@ -0,0 +1,205 @@
+#include "../config.h"
+#include "FoMo.h"
+#include "FoMo-internal.h"
+#include <cmath>
+#include <algorithm>
+
+/**
+ * @brief This constructs an empty VoxelTable.
+ */
+FoMo::VoxelTable::VoxelTable(): origin{0,0,0}, voxelsize(1), nvoxels{1,1,1}, ncorners{1,1,1}, owner(1,-1)
+{
+}
+
+/**
+ * @brief This computes the VoxelTable of a set of points.
+ *
+ * Dimensions in which the points are (almost) not spread out, such as the z-coordinate of a 2D DataCube, get
+ * only one layer of corners. The jump flooding is done with steps of half the lattice size down to 1, followed by
+ * one extra pass with step 1 to correct most of its errors. The passes are parallel over the corners.
+ * @param x The x-coordinates of the points.
+ * @param y The y-coordinates of the points.
+ * @param z The z-coordinates of the points.
+ * @param maxmemory The maximum memory (in bytes) for the voxel tables.
+ */
+FoMo::VoxelTable::VoxelTable(const std::vector<float> & x, const std::vector<float> & y, const std::vector<float> & z, const double maxmemory):
+	px(x), py(y), pz(z)
+{
+	int n=x.size();
+	const std::vector<float> * coord[3]={&x,&y,&z};
+	float minc[3]={0,0,0}, maxc[3]={0,0,0};
+	for (int d=0; d<3; d++)
+		if (n > 0)
+		{
+			minc[d]=*std::min_element(coord[d]->begin(),coord[d]->end());
+			maxc[d]=*std::max_element(coord[d]->begin(),coord[d]->end());
+		}
+	// half the mean distance between the points, over the dimensions in which they are spread out
+	double largest=std::max(maxc[0]-minc[0],std::max(maxc[1]-minc[1],maxc[2]-minc[2]));
+	double volume=1.;
+	int nspread=0;
+	for (int d=0; d<3; d++)
+		if (maxc[d]-minc[d] > 1e-6*largest)
+		{
+			volume*=maxc[d]-minc[d];
+			nspread++;
+		}
+	voxelsize=(nspread > 0 && n > 0) ? std::pow(volume/n,1./nspread)/2. : 1.;
+	// the table has the corners of the voxels, and two tables of ints are needed during the jump flooding
+	double totalcorners;
+	do
+	{
+		totalcorners=1;
+		for (int d=0; d<3; d++)
+		{
+			origin[d]=minc[d];
+			nvoxels[d]=(maxc[d]-minc[d] > 1e-6*largest) ? int(std::floor((maxc[d]-minc[d])/voxelsize))+1 : 1;
+			ncorners[d]=(maxc[d]-minc[d] > 1e-6*largest) ? nvoxels[d]+1 : 1;
+			totalcorners*=ncorners[d];
+		}
+		if (totalcorners*2*sizeof(int) > maxmemory || totalcorners > INT32_MAX) voxelsize*=1.26;
+	}
+	while ((totalcorners*2*sizeof(int) > maxmemory || totalcorners > INT32_MAX) && totalcorners > 1);
+
+	// the seeds: every corner gets the nearest of the points in the voxels around it, 
+	// so that every point is seeded unless it is in a voxel with many points
+	owner.assign(int(totalcorners),-1);
+	std::vector<float> seeddistance(owner.size(),INFINITY);
+	for (int i=0; i<n; i++)
+	{
+		int first[3], last[3];
+		for (int d=0; d<3; d++)
+		{
+			first[d]=std::min(std::max(int(std::floor(((*coord[d])[i]-origin[d])/voxelsize)),0),ncorners[d]-1);
+			last[d]=std::min(first[d]+1,ncorners[d]-1);
+		}
+		for (int ck=first[2]; ck<=last[2]; ck++)
+			for (int cj=first[1]; cj<=last[1]; cj++)
+				for (int ci=first[0]; ci<=last[0]; ci++)
+				{
+					float dx=x[i]-(origin[0]+ci*voxelsize), dy=y[i]-(origin[1]+cj*voxelsize), dz=z[i]-(origin[2]+ck*voxelsize);
+					float distance=dx*dx+dy*dy+dz*dz;
+					int v=(ck*ncorners[1]+cj)*ncorners[0]+ci;
+					if (distance < seeddistance[v])
+					{
+						seeddistance[v]=distance;
+						owner[v]=i;
+					}
+				}
+	}
+	std::vector<float>().swap(seeddistance);
+
+	// the jump flooding passes
+	int largeststep=1;
+	while (2*largeststep < std::max(ncorners[0],std::max(ncorners[1],ncorners[2]))) largeststep*=2;
+	std::vector<int> flooded(owner.size());
+	for (int step=largeststep; step>=1; step/=2)
+	{
+		jumpflood(owner,flooded,step);
+		owner.swap(flooded);
+	}
+	jumpflood(owner,flooded,1);
+	owner.swap(flooded);
+}
+
+// This does one pass of the jump flooding: every corner takes the nearest of the points of the corners at distance step.
+void FoMo::VoxelTable::jumpflood(const std::vector<int> & in, std::vector<int> & out, const int step) const
+{
+#ifdef _OPENMP
+#pragma omp parallel for collapse(2) schedule(static)
+#endif
+	for (int k=0; k<ncorners[2]; k++)
+		for (int j=0; j<ncorners[1]; j++)
+		{
+			float cz=origin[2]+k*voxelsize, cy=origin[1]+j*voxelsize;
+			for (int i=0; i<ncorners[0]; i++)
+			{
+				float cx=origin[0]+i*voxelsize;
+				int best=-1;
+				float bestdistance=INFINITY;
+				for (int dk=-step; dk<=step; dk+=step)
+				{
+					if (k+dk < 0 || k+dk >= ncorners[2]) continue;
+					for (int dj=-step; dj<=step; dj+=step)
+					{
+						if (j+dj < 0 || j+dj >= ncorners[1]) continue;
+						for (int di=-step; di<=step; di+=step)
+						{
+							if (i+di < 0 || i+di >= ncorners[0]) continue;
+							int candidate=in[((k+dk)*ncorners[1]+j+dj)*ncorners[0]+i+di];
+							if (candidate < 0 || candidate == best) continue;
+							float dx=px[candidate]-cx, dy=py[candidate]-cy, dz=pz[candidate]-cz;
+							float distance=dx*dx+dy*dy+dz*dz;
+							// the lowest index wins a tie, so that the result does not depend on the order of the candidates
+							if (distance < bestdistance || (distance == bestdistance && candidate < best))
+							{
+								bestdistance=distance;
+								best=candidate;
+							}
+						}
+					}
+				}
+				out[(k*ncorners[1]+j)*ncorners[0]+i]=best;
+			}
+		}
+}
+
+/**
+ * @brief This looks up the nearest point of a position, if it is inside a cube around the position.
+ *
+ * The candidates are the nearest points of the corners of the voxel of the position. Positions outside of the 
+ * lattice take the nearest voxel at the edge of the lattice.
+ * @param x The x-coordinate of the position.
+ * @param y The y-coordinate of the position.
+ * @param z The z-coordinate of the position.
+ * @param maxdistance The half-side of the cube.
+ * @return The index of the nearest point in the input of the constructor, or -1 if it is not strictly inside the cube.
+ */
+int FoMo::VoxelTable::nearest(const float x, const float y, const float z, const float maxdistance) const
+{
+	const float query[3]={x,y,z};
+	// the first corner of the voxel, and the offsets to the other corners (0 in a dimension with one layer of corners)
+	int v=0, offset[3];
+	for (int d=2; d>=0; d--)
+	{
+		float c=std::floor((query[d]-origin[d])/voxelsize);
+		v=v*ncorners[d]+int(std::min(std::max(c,0.f),float(std::max(ncorners[d]-2,0))));
+	}
+	offset[0]=(ncorners[0] > 1) ? 1 : 0;
+	offset[1]=(ncorners[1] > 1) ? ncorners[0] : 0;
+	offset[2]=(ncorners[2] > 1) ? ncorners[0]*ncorners[1] : 0;
+	int best=-1;
+	float bestdistance=INFINITY;
+	for (int c=0; c<8; c++)
+	{
+		int point=owner[v+((c & 1) ? offset[0] : 0)+((c & 2) ? offset[1] : 0)+((c & 4) ? offset[2] : 0)];
+		if (point < 0 || point == best) continue;
+		float dx=px[point]-x, dy=py[point]-y, dz=pz[point]-z;
+		if (!(std::fabs(dx) < maxdistance && std::fabs(dy) < maxdistance && std::fabs(dz) < maxdistance)) continue;
+		float distance=dx*dx+dy*dy+dz*dz;
+		if (distance < bestdistance)
+		{
+			bestdistance=distance;
+			best=point;
+		}
+	}
+	return best;
+}
+
+/**
+ * @brief This returns the number of points in the VoxelTable.
+ * @return The number of points.
+ */
+size_t FoMo::VoxelTable::size() const
+{
+	return px.size();
+}
+
+/**
+ * @brief This returns the number of voxels of the VoxelTable.
+ * @return The number of voxels.
+ */
+size_t FoMo::VoxelTable::readnvoxels() const
+{
+	return size_t(nvoxels[0])*nvoxels[1]*nvoxels[2];
+}
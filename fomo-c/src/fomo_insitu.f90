@@ -0,0 +1,107 @@
+! This module contains the Fortran interface of the in-situ renderer of FoMo, see FoMo-insitu.h for the description
+! of the routines. Compile it together with the simulation, and link with -lFoMo (and the C++ library, e.g. -lstdc++).
+!
+! The strings should end with c_null_char, e.g. trim(chiantifile)//c_null_char. The arrays of a block are passed
+! as they are stored by the simulation (the first index runs fastest), and lo and hi count the cells from 0:
+! for an AMRVAC block w(ixG^T,1:nw) with interior ixM^LL, lo=ixMlo^D-ixGlo^D and hi=ixMhi^D-ixGlo^D. Velocities
+! that are not passed are given as c_null_ptr, the others as c_loc() of a contiguous array.
+module fomo_insitu
+  use iso_c_binding
+  implicit none
+
+  interface
+    function fomo_insitu_create(dim) bind(c)
+      import :: c_int, c_ptr
+      integer(c_int), value :: dim
+      type(c_ptr) :: fomo_insitu_create
+    end function
+
+    subroutine fomo_insitu_setemission(insitu, chiantifile, abundfile) bind(c)
+      import :: c_ptr, c_char
+      type(c_ptr), value :: insitu
+      character(kind=c_char), dimension(*) :: chiantifile, abundfile
+    end subroutine
+
+    subroutine fomo_insitu_setrendermethod(insitu, rendermethod) bind(c)
+      import :: c_ptr, c_char
+      type(c_ptr), value :: insitu
+      character(kind=c_char), dimension(*) :: rendermethod
+    end subroutine
+
+    subroutine fomo_insitu_setresolution(insitu, x_pixel, y_pixel, z_pixel, lambda_pixel, lambda_width) bind(c)
+      import :: c_ptr, c_int, c_double
+      type(c_ptr), value :: insitu
+      integer(c_int), value :: x_pixel, y_pixel, z_pixel, lambda_pixel
+      real(c_double), value :: lambda_width
+    end subroutine
+
+    subroutine fomo_insitu_addview(insitu, l, b) bind(c)
+      import :: c_ptr, c_double
+      type(c_ptr), value :: insitu
+      real(c_double), value :: l, b
+    end subroutine
+
+    subroutine fomo_insitu_setoutfile(insitu, outfile) bind(c)
+      import :: c_ptr, c_char
+      type(c_ptr), value :: insitu
+      character(kind=c_char), dimension(*) :: outfile
+    end subroutine
+
+    subroutine fomo_insitu_setunits(insitu, lengthunit, densityunit, temperatureunit, velocityunit) bind(c)
+      import :: c_ptr, c_double
+      type(c_ptr), value :: insitu
+      real(c_double), value :: lengthunit, densityunit, temperatureunit, velocityunit
+    end subroutine
+
+    subroutine fomo_insitu_setcadence(insitu, steps, time) bind(c)
+      import :: c_ptr, c_int, c_double
+      type(c_ptr), value :: insitu
+      integer(c_int), value :: steps
+      real(c_double), value :: time
+    end subroutine
+
+    subroutine fomo_insitu_setthreads(insitu, nthreads) bind(c)
+      import :: c_ptr, c_int
+      type(c_ptr), value :: insitu
+      integer(c_int), value :: nthreads
+    end subroutine
+
+    function fomo_insitu_due(insitu, step, time) bind(c)
+      import :: c_ptr, c_int, c_double
+      type(c_ptr), value :: insitu
+      integer(c_int), value :: step
+      real(c_double), value :: time
+      integer(c_int) :: fomo_insitu_due
+    end function
+
+    subroutine fomo_insitu_beginstep(insitu, step, time) bind(c)
+      import :: c_ptr, c_int, c_double
+      type(c_ptr), value :: insitu
+      integer(c_int), value :: step
+      real(c_double), value :: time
+    end subroutine
+
+    subroutine fomo_insitu_addblock(insitu, shape, lo, hi, x0, dx, n, t, vx, vy, vz) bind(c)
+      import :: c_ptr, c_int, c_double
+      type(c_ptr), value :: insitu
+      integer(c_int), dimension(*), intent(in) :: shape, lo, hi
+      real(c_double), dimension(*), intent(in) :: x0, dx, n, t
+      type(c_ptr), value :: vx, vy, vz
+    end subroutine
+
+    subroutine fomo_insitu_endstep(insitu) bind(c)
+      import :: c_ptr
+      type(c_ptr), value :: insitu
+    end subroutine
+
+    subroutine fomo_insitu_wait(insitu) bind(c)
+      import :: c_ptr
+      type(c_ptr), value :: insitu
+    end subroutine
+
+    subroutine fomo_insitu_finish(insitu) bind(c)
+      import :: c_ptr
+      type(c_ptr), value :: insitu
+    end subroutine
+  end interface
+end module fomo_insitu